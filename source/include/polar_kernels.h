@@ -0,0 +1,65 @@
+#ifndef POLAR_KERNELS_H
+#define POLAR_KERNELS_H
+
+#include <float.h>
+#include <math.h>
+
+/* The fast polar kernels
+ * ****************************************************/
+/* Polynomial replacements for atan2, sin and cos, shared by the objects
+ * that offer an 'approximate' mode. atan2 stays within 2e-6 radians of
+ * libm, sin and cos within 1e-7, and neither branches, so the bin loops
+ * using them can be vectorized */
+static inline float polar_atan2(float y, float x)
+{
+    float ax = fabsf(x);
+    float ay = fabsf(y);
+    float lo = ax < ay ? ax : ay;
+    float hi = ax < ay ? ay : ax;
+
+    // minimax polynomial for atan on [0, 1]
+    float t = lo / (hi + FLT_MIN);
+    float t2 = t * t;
+    float angle = -0.01172120f;
+    angle = angle * t2 + 0.05265332f;
+    angle = angle * t2 - 0.11643287f;
+    angle = angle * t2 + 0.19354346f;
+    angle = angle * t2 - 0.33262347f;
+    angle = angle * t2 + 0.99997726f;
+    angle *= t;
+
+    // fold back into the full circle
+    angle = (hi == ay ? 1.57079633f : 0.0f) + (hi == ay ? -angle : angle);
+    angle = (x < 0.0f ? 3.14159265f : 0.0f) + (x < 0.0f ? -angle : angle);
+    return y < 0.0f ? -angle : angle;
+}
+
+static inline void polar_sincos(float phase, float* sine, float* cosine)
+{
+    // reduce to [-pi/4, pi/4] around the nearest multiple of pi/2
+    float q = phase * 0.63661977f;
+    int quadrant = (int)(q + (q < 0.0f ? -0.5f : 0.5f));
+    float k = (float)quadrant;
+    float r = phase - k * 1.5703125f - k * 4.8375129699707031e-4f
+        - k * 7.5497899548918822e-8f;
+    float z = r * r;
+
+    // minimax polynomials for sin and cos on [-pi/4, pi/4]
+    float s = -1.9515295891e-4f;
+    s = s * z + 8.3321608736e-3f;
+    s = s * z - 1.6666654611e-1f;
+    s = s * z * r + r;
+
+    float c = 2.4433157118e-5f;
+    c = c * z - 1.3887316255e-3f;
+    c = c * z + 4.1666645683e-2f;
+    c = c * z * z - 0.5f * z + 1.0f;
+
+    // rotate back into the quadrant
+    float rotated_s = quadrant & 1 ? c : s;
+    float rotated_c = quadrant & 1 ? s : c;
+    *sine = quadrant & 2 ? -rotated_s : rotated_s;
+    *cosine = (quadrant + 1) & 2 ? -rotated_c : rotated_c;
+}
+
+#endif
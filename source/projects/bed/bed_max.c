@@ -4,10 +4,174 @@
 #include "ext.h"
 #include "ext_obex.h"
 
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/* The global variables
+ * *******************************************************/
+#define MAXIMUM_UNDO_STEPS 64
+#define DEFAULT_UNDO_MEMORY 64.0
+
+#define MINIMUM_WORKERS 1
+#define DEFAULT_WORKERS 4
+#define MAXIMUM_WORKERS 16
+
+#define CHUNK_FRAMES 65536
+#define RING_BLOCK 256
+#define MAXIMUM_STEPS 16
+#define ASYNC_POLL_INTERVAL 10.0
+
 /* The class pointer
  * **********************************************************/
 static t_class* bed_class;
 
+/* The kinds of edits kept in the undo history
+ * ********************************/
+enum EDITS { E_SAMPLES, E_REVERSE, E_SHUFFLE, E_CUT };
+
+/* One step of the undo history
+ * ***********************************************/
+typedef struct _bed_edit {
+    long type;
+    long start;
+    long frames;
+    long channels;
+    long bytes;
+
+    float* samples;
+
+    long* order;
+    long segments;
+    long segment_frames;
+} t_bed_edit;
+
+/* The per-frame operations that can be split among workers
+ * ******************/
+enum JOBS {
+    J_PEAK,
+    J_SCALE,
+    J_FADEIN,
+    J_FADEOUT,
+    J_REVERSE,
+    J_RING,
+    J_BATCH_PEAK,
+    J_BATCH,
+    J_TARGETS
+};
+
+/* What became of each buffer an operation was applied to
+ * *********************/
+enum TARGETS { T_DONE, T_SKIPPED, T_FAILED };
+
+/* One worker of a job and the range of iterations it processes
+ * ***************/
+typedef struct _bed_worker {
+    struct _bed_job* job;
+    long first;
+    long last;
+    volatile long done;
+    float peak;
+
+    t_systhread thread;
+    int running;
+} t_bed_worker;
+
+/* A pointwise operation, one step of a batch
+ * *********************************/
+typedef struct _bed_step {
+    long type;
+    long start;
+    long length;
+    float gain;
+    float newmax;
+
+    double increment;
+    double rotation_cos[RING_BLOCK];
+    double rotation_sin[RING_BLOCK];
+    float* table;
+    long table_size;
+} t_bed_step;
+
+/* One of the buffers an operation is applied to, besides the buffer
+ * **********/
+typedef struct _bed_target {
+    t_symbol* name;
+    t_buffer* buffer;
+    float* samples;
+    long nchans;
+    long frames;
+    long status;
+} t_bed_target;
+
+/* A sound file processed from disk to disk, both files mapped in memory.
+ * The frames may be read in another order than they are written
+ * *************/
+typedef struct _bed_stream {
+    unsigned char* source;
+    size_t source_size;
+    unsigned char* dest;
+    size_t dest_size;
+    char dest_path[MAX_PATH_CHARS];
+
+    size_t data_offset;
+    long frames;
+    long nchans;
+    long bytes;
+    long is_float;
+    long big_endian;
+    double scale;
+    double sr;
+
+    long reverse;
+    long* order;
+    long segments;
+    long segment_frames;
+    long short_segment;
+} t_bed_stream;
+
+/* A per-frame operation on the buffer
+ * ****************************************/
+typedef struct _bed_job {
+    long type;
+    float* samples;
+    long nchans;
+    long offset;
+    long length;
+    long count;
+
+    float gain;
+    float newmax;
+    float peak;
+
+    t_bed_step steps[MAXIMUM_STEPS];
+    long num_steps;
+    long peak_steps;
+
+    t_bed_target* targets;
+    long target_type;
+
+    t_bed_stream* stream;
+
+    long pass;
+    long num_passes;
+
+    float progress_from;
+    float progress_to;
+    float progress_sent;
+
+    long num_workers;
+    t_bed_worker workers[MAXIMUM_WORKERS];
+} t_bed_job;
+
 /* The object structure
  * *******************************************************/
 typedef struct _bed {
@@ -16,12 +180,33 @@ typedef struct _bed {
     t_symbol* b_name;
     t_buffer* buffer;
 
-    float* undo_samples;
-    long undo_start;
-    long undo_frames;
-    long can_undo;
-    long undo_resize;
-    long undo_cut;
+    t_bed_edit history[MAXIMUM_UNDO_STEPS];
+    long num_edits;
+    long next_edit;
+    long history_bytes;
+    long history_budget;
+
+    t_bed_job job;
+    long num_workers;
+
+    long async;
+    t_symbol* async_op;
+    long async_edit;
+    long async_start;
+    long async_frames;
+    long async_total;
+    long async_nchans;
+    float* async_samples;
+    void* async_clock;
+
+    t_symbol** targets;
+    long num_targets;
+
+    uint64_t seed;
+
+    t_bed_stream stream;
+
+    void* status_outlet;
 } t_bed;
 
 /* Function prototypes
@@ -38,9 +223,24 @@ void bed_fadeout(t_bed* x, double fadetime);
 void bed_cut(t_bed* x, double start, double end);
 void bed_paste(t_bed* x, t_symbol* destname);
 void bed_reverse(t_bed* x);
-void bed_ring_modulation(t_bed* x, double frequency);
+void bed_ring_modulation(t_bed* x, double frequency, t_symbol* waveform);
 void bed_shuffle_n_segments(t_bed* x, long segments);
 void bed_undo(t_bed* x);
+void bed_redo(t_bed* x);
+void bed_undo_memory(t_bed* x, double megabytes);
+void bed_workers(t_bed* x, long workers);
+void bed_async(t_bed* x, long async);
+void bed_batch(t_bed* x, t_symbol* msg, short argc, t_atom* argv);
+void bed_targets(t_bed* x, t_symbol* msg, short argc, t_atom* argv);
+void bed_each(t_bed* x, t_symbol* msg, short argc, t_atom* argv);
+void bed_stream(t_bed* x, t_symbol* msg, short argc, t_atom* argv);
+void bed_dostream(t_bed* x, t_symbol* msg, short argc, t_atom* argv);
+
+void bed_clear_history(t_bed* x, long first);
+void bed_join_job(t_bed_job* j);
+void bed_free_job(t_bed_job* j);
+void bed_async_tick(t_bed* x);
+void bed_close_stream(t_bed_stream* s, int keep);
 
 /* The initialization routine
  * *************************************************/
@@ -61,10 +261,19 @@ int C74_EXPORT main()
     class_addmethod(bed_class, (method)bed_paste, "paste", A_SYM, 0);
     class_addmethod(bed_class, (method)bed_reverse, "reverse", 0);
     class_addmethod(bed_class, (method)bed_ring_modulation, "ring", A_FLOAT,
-                    0);
+                    A_DEFSYM, 0);
     class_addmethod(bed_class, (method)bed_shuffle_n_segments, "shuffle_n",
                     A_LONG, 0);
     class_addmethod(bed_class, (method)bed_undo, "undo", 0);
+    class_addmethod(bed_class, (method)bed_redo, "redo", 0);
+    class_addmethod(bed_class, (method)bed_undo_memory, "undo_memory",
+                    A_FLOAT, 0);
+    class_addmethod(bed_class, (method)bed_workers, "workers", A_LONG, 0);
+    class_addmethod(bed_class, (method)bed_async, "async", A_LONG, 0);
+    class_addmethod(bed_class, (method)bed_batch, "batch", A_GIMME, 0);
+    class_addmethod(bed_class, (method)bed_targets, "targets", A_GIMME, 0);
+    class_addmethod(bed_class, (method)bed_each, "each", A_GIMME, 0);
+    class_addmethod(bed_class, (method)bed_stream, "stream", A_GIMME, 0);
 
     /* Register the class with Max */
     class_register(CLASS_BOX, bed_class);
@@ -86,8 +295,27 @@ void* bed_new(t_symbol* s, short argc, t_atom* argv)
     /* Parse passed argument */
     atom_arg_getsym(&x->b_name, 0, argc, argv);
 
+    /* Create the status outlet */
+    x->status_outlet = outlet_new((t_object*)x, NULL);
+
     /* Initialize some state variables */
-    x->undo_cut = 0;
+    x->num_edits = 0;
+    x->next_edit = 0;
+    x->history_bytes = 0;
+    x->history_budget = DEFAULT_UNDO_MEMORY * 1024 * 1024;
+    x->num_workers = DEFAULT_WORKERS;
+
+    x->async = 0;
+    x->async_op = NULL;
+    x->async_samples = NULL;
+    x->async_clock = clock_new(x, (method)bed_async_tick);
+    x->job.num_steps = 0;
+    x->targets = NULL;
+    x->num_targets = 0;
+    x->seed = ((uint64_t)rand() << 32) ^ rand() ^ (uintptr_t)x;
+    x->stream.source = NULL;
+    x->stream.dest = NULL;
+    x->stream.order = NULL;
 
     /* Print message to Max window */
     post("bed • Object was created");
@@ -98,8 +326,22 @@ void* bed_new(t_symbol* s, short argc, t_atom* argv)
 
 void bed_free(t_bed* x)
 {
+    /* Wait for a pending asynchronous edit and discard it */
+    if (x->async_op != NULL) {
+        bed_join_job(&x->job);
+        bed_free_job(&x->job);
+        if (x->async_samples != NULL) {
+            sysmem_freeptr(x->async_samples);
+        }
+        bed_close_stream(&x->stream, 0);
+    }
+    clock_free(x->async_clock);
+
     /* Free allocated dynamic memory */
-    sysmem_freeptr(x->undo_samples);
+    bed_clear_history(x, 0);
+    if (x->targets != NULL) {
+        sysmem_freeptr(x->targets);
+    }
 
     /* Print message to Max window */
     post("bed • Object was deleted");
@@ -147,340 +389,1732 @@ int bed_attach_any_buffer(t_buffer** b, t_symbol* b_name)
     }
 }
 
-/******************************************************************************/
-void bed_info(t_bed* x)
+/* The undo history
+ * ***********************************************************/
+void bed_free_edit(t_bed_edit* e)
 {
-    if (!bed_attach_buffer(x)) {
-        return;
+    if (e->samples != NULL) {
+        sysmem_freeptr(e->samples);
+        e->samples = NULL;
+    }
+    if (e->order != NULL) {
+        sysmem_freeptr(e->order);
+        e->order = NULL;
     }
-
-    t_buffer* b;
-    b = x->buffer;
-
-    post("bed • Information:");
-    post("    buffer name: %s", b->b_name->s_name);
-    post("    frame count: %d", b->b_frames);
-    post("    channel count: %d", b->b_nchans);
-    post("    validity: %d", b->b_valid);
-    post("    in-use status: %d", b->b_inuse);
 }
 
-void bed_dblclick(t_bed* x)
+/* Forget every edit from 'first' onwards */
+void bed_clear_history(t_bed* x, long first)
 {
-    if (!bed_attach_buffer(x)) {
-        return;
+    for (long ii = first; ii < x->num_edits; ii++) {
+        x->history_bytes -= x->history[ii].bytes;
+        bed_free_edit(&x->history[ii]);
     }
 
-    t_buffer* b;
-    b = x->buffer;
-
-    object_method(&b->b_obj, gensym("dblclick"));
+    x->num_edits = first;
+    if (x->next_edit > first) {
+        x->next_edit = first;
+    }
 }
 
-void bed_bufname(t_bed* x, t_symbol* name) { x->b_name = name; }
+void bed_drop_oldest_edit(t_bed* x)
+{
+    x->history_bytes -= x->history[0].bytes;
+    bed_free_edit(&x->history[0]);
 
-/******************************************************************************/
-void bed_normalize(t_bed* x, t_symbol* msg, short argc, t_atom* argv)
+    memmove(x->history, x->history + 1,
+            (x->num_edits - 1) * sizeof(t_bed_edit));
+    x->num_edits--;
+    x->next_edit--;
+}
+
+/* Drop the oldest edits, then the furthest edits to redo, while the
+ * history is over budget. The last edit is always kept. */
+void bed_trim_history(t_bed* x)
 {
-    if (argc > 1) {
-        error("bed • The message must have at most two members");
-        return;
+    while (x->num_edits > 1 && x->history_bytes > x->history_budget) {
+        if (x->next_edit > 0) {
+            bed_drop_oldest_edit(x);
+        } else {
+            bed_clear_history(x, x->num_edits - 1);
+        }
     }
+}
 
-    float newmax = 1.0;
-    if (argc == 1) {
-        newmax = atom_getfloat(argv);
+/* Record a new edit, saving the frames it is about to change if asked to */
+t_bed_edit* bed_push_edit(t_bed* x, t_buffer* b, long type, long start,
+                          long frames, int save_samples)
+{
+    float* samples = NULL;
+    long chunksize = frames * b->b_nchans * sizeof(float);
+
+    if (save_samples) {
+        samples = (float*)sysmem_newptr(chunksize);
+        if (samples == NULL) {
+            error("bed • Cannot allocate memory for undo");
+            return NULL;
+        }
+        sysmem_copyptr(b->b_samples + (start * b->b_nchans), samples,
+                       chunksize);
     }
 
-    if (!bed_attach_buffer(x)) {
-        return;
+    /* A new edit discards the edits that could have been redone */
+    bed_clear_history(x, x->next_edit);
+
+    if (x->num_edits == MAXIMUM_UNDO_STEPS) {
+        bed_drop_oldest_edit(x);
     }
 
-    t_buffer* b;
-    b = x->buffer;
+    t_bed_edit* e = &x->history[x->num_edits];
+    e->type = type;
+    e->start = start;
+    e->frames = frames;
+    e->channels = b->b_nchans;
+    e->bytes = save_samples ? chunksize : 0;
+    e->samples = samples;
+    e->order = NULL;
+    e->segments = 0;
+    e->segment_frames = 0;
 
-    ATOMIC_INCREMENT(&b->b_inuse);
+    x->num_edits++;
+    x->next_edit = x->num_edits;
+    x->history_bytes += e->bytes;
 
-    if (!b->b_valid) {
-        ATOMIC_DECREMENT(&b->b_inuse);
-        post("bed • Not a valid buffer!");
+    bed_trim_history(x);
+
+    return &x->history[x->next_edit - 1];
+}
+
+/* Give up an edit whose operation could not be carried out */
+void bed_pop_edit(t_bed* x) { bed_clear_history(x, x->next_edit - 1); }
+
+void bed_undo_memory(t_bed* x, double megabytes)
+{
+    if (megabytes < 0) {
+        post("bed • %.2f MB is not a valid undo memory size", megabytes);
         return;
     }
 
-    long chunksize = b->b_frames * b->b_nchans * sizeof(float);
-    if (x->undo_samples == NULL) {
-        x->undo_samples = (float*)sysmem_newptr(chunksize);
-    } else {
-        x->undo_samples = (float*)sysmem_resizeptr(x->undo_samples, chunksize);
+    x->history_budget = megabytes * 1024 * 1024;
+    bed_trim_history(x);
+}
+
+/* The workers
+ * ****************************************************************/
+void bed_workers(t_bed* x, long workers)
+{
+    if (workers < MINIMUM_WORKERS) {
+        workers = MINIMUM_WORKERS;
+        post("bed • Invalid argument: Minimum number of workers set to %d",
+             workers);
+    } else if (workers > MAXIMUM_WORKERS) {
+        workers = MAXIMUM_WORKERS;
+        post("bed • Invalid argument: Maximum number of workers set to %d",
+             workers);
     }
 
-    if (x->undo_samples == NULL) {
-        error("bed • Cannot allocate memory for undo");
-        x->can_undo = 0;
-        ATOMIC_DECREMENT(&b->b_inuse);
-        return;
+    x->num_workers = workers;
+}
+
+/* The end of the block that holds frame ii. Blocks are aligned on the frames
+ * of the buffer, so they do not depend on how a job is split */
+long bed_block_end(t_bed_job* j, long ii, long last)
+{
+    long end = ii + RING_BLOCK - ((j->offset + ii) % RING_BLOCK);
+    return end < last ? end : last;
+}
+
+/* The modulator of the frames [first, first + frames) of one block. Each
+ * block starts from the exact phase of its first frame and rotates it by a
+ * table of angles, so the phase does not drift on long buffers and the frames
+ * of a block do not depend on each other */
+void bed_ring_block(t_bed_step* s, long first, long frames, float* modulator)
+{
+    long offset = first % RING_BLOCK;
+    double twopi = 8.0 * atan(1.0);
+    double phase = s->increment * (first - offset);
+    phase -= floor(phase);
+
+    if (s->table == NULL) {
+        double re = cos(twopi * phase);
+        double im = sin(twopi * phase);
+        for (long ii = 0; ii < frames; ii++) {
+            modulator[ii] = im * s->rotation_cos[offset + ii]
+                + re * s->rotation_sin[offset + ii];
+        }
     } else {
-        x->can_undo = 1;
-        x->undo_start = 0;
-        x->undo_frames = b->b_frames;
-        x->undo_resize = 0;
-        x->undo_cut = 0;
-        sysmem_copyptr(b->b_samples, x->undo_samples, chunksize);
-    }
+        /* One cycle of the waveform, read with linear interpolation */
+        for (long ii = 0; ii < frames; ii++) {
+            double position = phase + s->increment * (offset + ii);
+            position = (position - floor(position)) * s->table_size;
+
+            long index = (long)position;
+            if (index >= s->table_size) {
+                index = s->table_size - 1;
+            }
+            long next = index + 1 < s->table_size ? index + 1 : 0;
+            double fraction = position - index;
 
-    float maxamp = 0.0;
-    for (int ii = 0; ii < b->b_frames * b->b_nchans; ii++) {
-        if (maxamp < fabs(b->b_samples[ii])) {
-            maxamp = fabs(b->b_samples[ii]);
+            modulator[ii] = s->table[index]
+                + fraction * (s->table[next] - s->table[index]);
         }
     }
+}
 
-    float rescale;
-    if (maxamp > 1e-6) {
-        rescale = newmax / maxamp;
-    } else {
-        post("bed • Amplitude is too low to rescale: %.2f", maxamp);
-        ATOMIC_DECREMENT(&b->b_inuse);
-        return;
-    }
+/* The factor of one step for the frames [first, first + frames) of one
+ * block, computed as the operation on its own would compute it */
+void bed_step_factors(t_bed_step* s, long first, long frames, float* factors)
+{
+    switch (s->type) {
+    case J_PEAK:
+    case J_SCALE:
+        for (long ii = 0; ii < frames; ii++) {
+            factors[ii] = s->gain;
+        }
+        break;
 
-    for (int ii = 0; ii < b->b_frames * b->b_nchans; ii++) {
-        b->b_samples[ii] *= rescale;
-    }
+    case J_FADEIN:
+        for (long ii = 0; ii < frames; ii++) {
+            long kk = first + ii - s->start;
+            factors[ii] = kk < s->length ? (float)kk / (float)s->length : 1.0;
+        }
+        break;
 
-    object_method(&b->b_obj, gensym("dirty"));
-    ATOMIC_DECREMENT(&b->b_inuse);
+    case J_FADEOUT:
+        for (long ii = 0; ii < frames; ii++) {
+            long kk = first + ii - s->start;
+            factors[ii] = kk >= 0 ? 1 - (float)kk / (float)s->length : 1.0;
+        }
+        break;
+
+    case J_RING:
+        bed_ring_block(s, first, frames, factors);
+        break;
+    }
 }
 
-void bed_fadein(t_bed* x, double fadetime)
+void bed_process_target(t_bed_job* j, t_bed_target* t);
+void bed_stream_read(t_bed_stream* s, long channel, long first, long frames,
+                     float* block);
+void bed_stream_write(t_bed_stream* s, long channel, long first, long frames,
+                      float* block);
+
+/* Run iterations [first, last) of a job, one sample, frame, pair or target
+ * each */
+void bed_process_frames(t_bed_job* j, long first, long last, float* peak)
 {
-    if (!bed_attach_buffer(x)) {
-        return;
-    }
+    float* samples = j->samples;
+    long nchans = j->nchans;
+    float factors[MAXIMUM_STEPS][RING_BLOCK];
+    float block[RING_BLOCK];
+
+    switch (j->type) {
+    case J_PEAK:
+        for (long ii = first; ii < last; ii++) {
+            if (*peak < fabs(samples[ii])) {
+                *peak = fabs(samples[ii]);
+            }
+        }
+        break;
 
-    t_buffer* b;
-    b = x->buffer;
+    case J_SCALE:
+        for (long ii = first; ii < last; ii++) {
+            samples[ii] *= j->gain;
+        }
+        break;
 
-    ATOMIC_INCREMENT(&b->b_inuse);
+    case J_FADEIN:
+        for (long ii = first; ii < last; ii++) {
+            for (long jj = 0; jj < nchans; jj++) {
+                samples[(ii * nchans) + jj] *= (float)ii / (float)j->length;
+            }
+        }
+        break;
 
-    if (!b->b_valid) {
-        ATOMIC_DECREMENT(&b->b_inuse);
-        post("bed • Not a valid buffer!");
-        return;
+    case J_FADEOUT:
+        for (long ii = first; ii < last; ii++) {
+            for (long jj = 0; jj < nchans; jj++) {
+                samples[(ii * nchans) + jj] *= 1 - (float)ii / (float)j->length;
+            }
+        }
+        break;
+
+    case J_REVERSE:
+        for (long ii = first; ii < last; ii++) {
+            for (long jj = 0; jj < nchans; jj++) {
+                long kk = ((j->length - 1 - ii) * nchans) + jj;
+                float temp = samples[(ii * nchans) + jj];
+                samples[(ii * nchans) + jj] = samples[kk];
+                samples[kk] = temp;
+            }
+        }
+        break;
+
+    case J_RING:
+        for (long ii = first; ii < last; ii = bed_block_end(j, ii, last)) {
+            long frames = bed_block_end(j, ii, last) - ii;
+            bed_ring_block(&j->steps[0], j->offset + ii, frames, factors[0]);
+            for (long kk = 0; kk < frames; kk++) {
+                for (long jj = 0; jj < nchans; jj++) {
+                    samples[((ii + kk) * nchans) + jj] *= factors[0][kk];
+                }
+            }
+        }
+        break;
+
+    /* Apply the steps one after the other to each block while it is in the
+     * cache, in the order and with the rounding of separate operations. The
+     * factors of a block are shared by its channels. A measuring pass applies
+     * the steps before a normalize to a copy of the block and keeps its
+     * peak */
+    case J_BATCH_PEAK:
+    case J_BATCH:
+        for (long ii = first; ii < last; ii = bed_block_end(j, ii, last)) {
+            long frames = bed_block_end(j, ii, last) - ii;
+            long num_steps = j->num_steps;
+            if (j->type == J_BATCH_PEAK) {
+                num_steps = j->peak_steps;
+            }
+
+            int active[MAXIMUM_STEPS];
+            for (long jj = 0; jj < num_steps; jj++) {
+                t_bed_step* s = &j->steps[jj];
+                active[jj] = j->offset + ii < s->start + s->length
+                    && j->offset + ii + frames > s->start;
+                if (active[jj]) {
+                    bed_step_factors(s, j->offset + ii, frames, factors[jj]);
+                }
+            }
+
+            for (long cc = 0; cc < nchans; cc++) {
+                float* frame = samples + (ii * nchans) + cc;
+                if (j->stream != NULL) {
+                    bed_stream_read(j->stream, cc, j->offset + ii, frames,
+                                    block);
+                } else {
+                    for (long kk = 0; kk < frames; kk++) {
+                        block[kk] = frame[kk * nchans];
+                    }
+                }
+
+                for (long jj = 0; jj < num_steps; jj++) {
+                    if (!active[jj]) {
+                        continue;
+                    }
+                    for (long kk = 0; kk < frames; kk++) {
+                        block[kk] *= factors[jj][kk];
+                    }
+                }
+
+                if (j->type == J_BATCH_PEAK) {
+                    for (long kk = 0; kk < frames; kk++) {
+                        if (*peak < fabs(block[kk])) {
+                            *peak = fabs(block[kk]);
+                        }
+                    }
+                } else if (j->stream != NULL) {
+                    bed_stream_write(j->stream, cc, j->offset + ii, frames,
+                                     block);
+                } else {
+                    for (long kk = 0; kk < frames; kk++) {
+                        frame[kk * nchans] = block[kk];
+                    }
+                }
+            }
+        }
+        break;
+
+    case J_TARGETS:
+        for (long ii = first; ii < last; ii++) {
+            bed_process_target(j, &j->targets[ii]);
+        }
+        break;
     }
+}
 
-    long fadeframes = fadetime * 0.001 * b->b_sr;
-    if (fadetime <= 0 || fadeframes > b->b_frames) {
-        post("bed • %.0fms is not a valid fade-in time", fadetime);
-        ATOMIC_DECREMENT(&b->b_inuse);
-        return;
+/* The iterations processed between two progress reports, frames or whole
+ * buffers */
+long bed_chunk_size(t_bed_job* j)
+{
+    return j->type == J_TARGETS ? 1 : CHUNK_FRAMES;
+}
+
+void bed_report_progress(t_bed* x, t_bed_job* j, int finished)
+{
+    long done = 0;
+    for (long ii = 0; ii < j->num_workers; ii++) {
+        done += j->workers[ii].done;
     }
 
-    long chunksize = fadeframes * b->b_nchans * sizeof(float);
-    if (x->undo_samples == NULL) {
-        x->undo_samples = (float*)sysmem_newptr(chunksize);
-    } else {
-        x->undo_samples = (float*)sysmem_resizeptr(x->undo_samples, chunksize);
+    float progress = j->progress_to;
+    if (!finished && j->count > 0) {
+        progress = j->progress_from
+            + (j->progress_to - j->progress_from) * done / j->count;
     }
 
-    if (x->undo_samples == NULL) {
-        error("bed • Cannot allocate memory for undo");
-        x->can_undo = 0;
-        ATOMIC_DECREMENT(&b->b_inuse);
-        return;
-    } else {
-        x->can_undo = 1;
-        x->undo_start = 0;
-        x->undo_frames = fadeframes;
-        x->undo_resize = 0;
-        x->undo_cut = 0;
-        sysmem_copyptr(b->b_samples, x->undo_samples, chunksize);
+    /* Report every percent, and always the end of the job */
+    if (finished || progress - j->progress_sent >= 0.01) {
+        t_atom value;
+        atom_setfloat(&value, progress);
+        outlet_anything(x->status_outlet, gensym("progress"), 1, &value);
+        j->progress_sent = progress;
     }
+}
+
+/* Process the range of a worker chunk by chunk, reporting progress when
+ * running on the main thread */
+void bed_work(t_bed_worker* w, t_bed* x)
+{
+    long chunk = bed_chunk_size(w->job);
+    for (long ii = w->first; ii < w->last; ii += chunk) {
+        long last = ii + chunk < w->last ? ii + chunk : w->last;
 
-    for (int ii = 0; ii < fadeframes; ii++) {
-        for (int jj = 0; jj < b->b_nchans; jj++) {
-            b->b_samples[(ii * b->b_nchans) + jj] *= (float)ii
-                / (float)fadeframes;
+        bed_process_frames(w->job, ii, last, &w->peak);
+        w->done = last - w->first;
+
+        if (x != NULL) {
+            bed_report_progress(x, w->job, 0);
         }
     }
-
-    object_method(&b->b_obj, gensym("dirty"));
-    ATOMIC_DECREMENT(&b->b_inuse);
 }
 
-void bed_fadeout(t_bed* x, double fadetime)
+void* bed_thread_main(t_bed_worker* w)
 {
-    if (!bed_attach_buffer(x)) {
-        return;
-    }
+    bed_work(w, NULL);
+    systhread_exit(0);
+    return NULL;
+}
 
-    t_buffer* b;
-    b = x->buffer;
+/* Prepare the job of an operation that takes a number of passes over the
+ * frames */
+t_bed_job* bed_prepare_job(t_bed* x, long type, long nchans, long count,
+                           long num_passes)
+{
+    t_bed_job* j = &x->job;
+    j->type = type;
+    j->nchans = nchans;
+    j->offset = 0;
+    j->count = count;
+    j->num_steps = 0;
+    j->stream = NULL;
+    j->pass = 0;
+    j->num_passes = num_passes;
+    return j;
+}
 
-    ATOMIC_INCREMENT(&b->b_inuse);
+/* Split the current pass of a job among the workers and start the threads of
+ * all workers from the first one on */
+void bed_start_job(t_bed* x, t_bed_job* j, long first_thread)
+{
+    /* Give every worker at least one chunk */
+    long chunk = bed_chunk_size(j);
+    long num_workers = (j->count + chunk - 1) / chunk;
+    if (num_workers > x->num_workers) {
+        num_workers = x->num_workers;
+    }
+    if (num_workers < 1) {
+        num_workers = 1;
+    }
 
-    if (!b->b_valid) {
-        ATOMIC_DECREMENT(&b->b_inuse);
-        post("bed • Not a valid buffer!");
-        return;
+    j->num_workers = num_workers;
+    j->peak = 0.0;
+    j->progress_from = (float)j->pass / j->num_passes;
+    j->progress_to = (float)(j->pass + 1) / j->num_passes;
+    j->progress_sent = j->progress_from;
+
+    long share = (j->count + num_workers - 1) / num_workers;
+    for (long ii = 0; ii < num_workers; ii++) {
+        t_bed_worker* w = &j->workers[ii];
+        w->job = j;
+        w->first = ii * share < j->count ? ii * share : j->count;
+        w->last = w->first + share < j->count ? w->first + share : j->count;
+        w->done = 0;
+        w->peak = 0.0;
+        w->running = 0;
     }
 
-    long fadeframes = fadetime * 0.001 * b->b_sr;
-    if (fadetime <= 0 || fadeframes > b->b_frames) {
-        post("bed • %.0fms is not a valid fade-out time", fadetime);
-        ATOMIC_DECREMENT(&b->b_inuse);
-        return;
+    for (long ii = first_thread; ii < num_workers; ii++) {
+        t_bed_worker* w = &j->workers[ii];
+        w->running = !systhread_create((method)bed_thread_main, w, 0, 0, 0,
+                                       &w->thread);
     }
+}
 
-    long chunksize = fadeframes * b->b_nchans * sizeof(float);
-    if (x->undo_samples == NULL) {
-        x->undo_samples = (float*)sysmem_newptr(chunksize);
-    } else {
-        x->undo_samples = (float*)sysmem_resizeptr(x->undo_samples, chunksize);
+int bed_job_finished(t_bed_job* j)
+{
+    for (long ii = 0; ii < j->num_workers; ii++) {
+        t_bed_worker* w = &j->workers[ii];
+        if (w->done < w->last - w->first) {
+            return 0;
+        }
     }
+    return 1;
+}
 
-    if (x->undo_samples == NULL) {
-        error("bed • Cannot allocate memory for undo");
-        x->can_undo = 0;
-        ATOMIC_DECREMENT(&b->b_inuse);
-        return;
-    } else {
-        x->can_undo = 1;
-        x->undo_start = b->b_frames - fadeframes;
-        x->undo_frames = fadeframes;
-        x->undo_resize = 0;
-        x->undo_cut = 0;
-        sysmem_copyptr(b->b_samples + x->undo_start, x->undo_samples,
-                       chunksize);
+/* Wait for the threads and combine the results of the workers */
+void bed_join_job(t_bed_job* j)
+{
+    for (long ii = 0; ii < j->num_workers; ii++) {
+        t_bed_worker* w = &j->workers[ii];
+        if (w->running) {
+            unsigned int status;
+            systhread_join(w->thread, &status);
+            w->running = 0;
+        }
+        if (j->peak < w->peak) {
+            j->peak = w->peak;
+        }
     }
+}
+
+/* Process the first share on the main thread and wait for the others */
+void bed_run_job(t_bed* x, t_bed_job* j)
+{
+    bed_start_job(x, j, 1);
 
-    for (int ii = (int)x->undo_start; ii < x->undo_start + fadeframes; ii++) {
-        for (int jj = 0; jj < b->b_nchans; jj++) {
-            b->b_samples[(ii * b->b_nchans) + jj] *= 1
-                - (float)(ii - x->undo_start) / (float)fadeframes;
+    /* The main thread also takes over any worker that failed to start */
+    for (long ii = 0; ii < j->num_workers; ii++) {
+        if (!j->workers[ii].running) {
+            bed_work(&j->workers[ii], x);
         }
     }
 
-    object_method(&b->b_obj, gensym("dirty"));
-    ATOMIC_DECREMENT(&b->b_inuse);
+    bed_join_job(j);
+    bed_report_progress(x, j, 1);
 }
 
-void bed_cut(t_bed* x, double start, double end)
+/* Release what a job holds beyond the frames it processes */
+void bed_free_job(t_bed_job* j)
 {
-    if (!bed_attach_buffer(x)) {
-        return;
+    for (long ii = 0; ii < j->num_steps; ii++) {
+        t_bed_step* s = &j->steps[ii];
+        if (s->type == J_RING && s->table != NULL) {
+            sysmem_freeptr(s->table);
+            s->table = NULL;
+        }
     }
+    j->num_steps = 0;
+}
 
-    t_buffer* b;
-    b = x->buffer;
+/* The gain that brings the peak found by a job to the new maximum */
+int bed_normalize_gain(t_bed_job* j, float newmax)
+{
+    if (j->peak > 1e-6) {
+        j->gain = newmax / j->peak;
+        return 1;
+    } else {
+        post("bed • Amplitude is too low to rescale: %.2f", j->peak);
+        return 0;
+    }
+}
 
-    ATOMIC_INCREMENT(&b->b_inuse);
+int bed_measuring(t_bed_job* j)
+{
+    return j->type == J_PEAK || j->type == J_BATCH_PEAK;
+}
 
-    if (!b->b_valid) {
-        ATOMIC_DECREMENT(&b->b_inuse);
-        post("bed • Not a valid buffer!");
-        return;
+/* Set up the pass that follows a measuring pass, once its peak is known */
+int bed_next_pass(t_bed_job* j)
+{
+    if (j->type == J_PEAK) {
+        if (!bed_normalize_gain(j, j->newmax)) {
+            return 0;
+        }
+        j->type = J_SCALE;
+    } else {
+        t_bed_step* s = &j->steps[j->peak_steps];
+        if (!bed_normalize_gain(j, s->newmax)) {
+            return 0;
+        }
+        s->gain = j->gain;
+
+        /* Measure again before the next normalize, if there is one */
+        j->type = J_BATCH;
+        for (long ii = j->peak_steps + 1; ii < j->num_steps; ii++) {
+            if (j->steps[ii].type == J_PEAK) {
+                j->type = J_BATCH_PEAK;
+                j->peak_steps = ii;
+                break;
+            }
+        }
     }
 
-    long startframe = start * 0.001 * b->b_sr;
-    long endframe = end * 0.001 * b->b_sr;
-    long cutframes = endframe - startframe;
+    j->pass++;
+    return 1;
+}
 
-    if (startframe < 0 || endframe > b->b_frames || startframe > endframe) {
-        post("bed • %.0fms and %.0fms are not valid cut times", start, end);
-        ATOMIC_DECREMENT(&b->b_inuse);
+/* Fit the steps of a job to a buffer of the given length. Fades keep their
+ * length and the other steps cover the whole buffer */
+int bed_fit_steps(t_bed_job* j, long frames)
+{
+    for (long ii = 0; ii < j->num_steps; ii++) {
+        t_bed_step* s = &j->steps[ii];
+        switch (s->type) {
+        case J_FADEIN:
+            s->start = 0;
+            break;
+        case J_FADEOUT:
+            s->start = frames - s->length;
+            break;
+        default:
+            s->start = 0;
+            s->length = frames;
+            break;
+        }
+        if (s->start < 0 || s->length > frames) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Run the operation of a job over the whole of one target, on its own copy
+ * of the steps. The peak is checked before each pass that needs it, so that
+ * no message is posted from a worker */
+void bed_process_target(t_bed_job* j, t_bed_target* t)
+{
+    t_bed_job k;
+    k.type = j->target_type;
+    k.samples = t->samples;
+    k.nchans = t->nchans;
+    k.offset = 0;
+    k.length = t->frames;
+    k.count = k.type == J_REVERSE ? t->frames / 2 : t->frames;
+    k.num_steps = j->num_steps;
+    k.peak_steps = j->peak_steps;
+    k.stream = NULL;
+    k.pass = 0;
+    memcpy(k.steps, j->steps, j->num_steps * sizeof(t_bed_step));
+
+    if (t->status != T_DONE) {
+        return;
+    }
+    if (!bed_fit_steps(&k, t->frames)) {
+        t->status = T_SKIPPED;
         return;
     }
 
-    long chunksize = cutframes * b->b_nchans * sizeof(float);
-    if (x->undo_samples == NULL) {
-        x->undo_samples = (float*)sysmem_newptr(chunksize);
-    } else {
-        x->undo_samples = (float*)sysmem_resizeptr(x->undo_samples, chunksize);
+    while (bed_measuring(&k)) {
+        k.peak = 0.0;
+        bed_process_frames(&k, 0, k.count, &k.peak);
+        if (k.peak <= 1e-6) {
+            t->status = T_FAILED;
+            return;
+        }
+        bed_next_pass(&k);
     }
 
-    if (x->undo_samples == NULL) {
-        error("bed • Cannot allocate memory for undo");
-        x->can_undo = 0;
-        ATOMIC_DECREMENT(&b->b_inuse);
-        return;
-    } else {
-        x->can_undo = 1;
-        x->undo_start = startframe;
-        x->undo_frames = cutframes;
-        x->undo_resize = 1;
-        x->undo_cut = 1;
-        sysmem_copyptr(b->b_samples + (startframe * b->b_nchans),
-                       x->undo_samples, chunksize);
+    bed_process_frames(&k, 0, k.count, &k.peak);
+}
+
+/* Set up a ring modulator step, copying the first channel of the waveform
+ * so it may change while the job runs */
+int bed_setup_ring(double sr, t_bed_step* s, double frequency,
+                   t_symbol* waveform)
+{
+    s->type = J_RING;
+    s->increment = frequency / sr;
+    s->table = NULL;
+
+    double twopi = 8.0 * atan(1.0);
+    for (long ii = 0; ii < RING_BLOCK; ii++) {
+        s->rotation_cos[ii] = cos(twopi * s->increment * ii);
+        s->rotation_sin[ii] = sin(twopi * s->increment * ii);
     }
 
+    if (waveform->s_name[0] != '\0') {
+        t_buffer* wavebuf = NULL;
+        if (!bed_attach_any_buffer(&wavebuf, waveform)) {
+            return 0;
+        }
+
+        ATOMIC_INCREMENT(&wavebuf->b_inuse);
+        if (!wavebuf->b_valid || wavebuf->b_frames < 1) {
+            ATOMIC_DECREMENT(&wavebuf->b_inuse);
+            post("bed • \"%s\" is not a valid buffer", waveform->s_name);
+            return 0;
+        }
+
+        s->table = (float*)sysmem_newptr(wavebuf->b_frames * sizeof(float));
+        if (s->table == NULL) {
+            ATOMIC_DECREMENT(&wavebuf->b_inuse);
+            error("bed • Cannot allocate memory for the waveform");
+            return 0;
+        }
+        s->table_size = wavebuf->b_frames;
+        for (long ii = 0; ii < s->table_size; ii++) {
+            s->table[ii] = wavebuf->b_samples[ii * wavebuf->b_nchans];
+        }
+        ATOMIC_DECREMENT(&wavebuf->b_inuse);
+    }
+    return 1;
+}
+
+/* The asynchronous mode
+ * ******************************************************/
+void bed_async(t_bed* x, long async) { x->async = async != 0; }
+
+/* Refuse to touch the buffer while an asynchronous edit is pending */
+int bed_busy(t_bed* x)
+{
+    if (x->async_op != NULL) {
+        error("bed • Busy with %s, wait until it is done",
+              x->async_op->s_name);
+        return 1;
+    }
+    return 0;
+}
+
+/* Start the current pass of the job on the workers and poll them */
+void bed_continue_async(t_bed* x)
+{
+    t_bed_job* j = &x->job;
+    bed_start_job(x, j, 0);
+
+    /* Without threads the work is done right away */
+    for (long ii = 0; ii < j->num_workers; ii++) {
+        if (!j->workers[ii].running) {
+            bed_work(&j->workers[ii], NULL);
+        }
+    }
+
+    clock_fdelay(x->async_clock, ASYNC_POLL_INTERVAL);
+}
+
+/* Run the job on a copy of the frames it changes, off the main thread */
+void bed_start_async(t_bed* x, t_buffer* b, t_symbol* op, long edit,
+                     long start, long frames)
+{
+    long chunksize = frames * b->b_nchans * sizeof(float);
+    float* samples = (float*)sysmem_newptr(chunksize);
+    if (samples == NULL) {
+        error("bed • Cannot allocate memory for %s", op->s_name);
+        bed_free_job(&x->job);
+        return;
+    }
+    sysmem_copyptr(b->b_samples + (start * b->b_nchans), samples, chunksize);
+
+    x->async_op = op;
+    x->async_edit = edit;
+    x->async_start = start;
+    x->async_frames = frames;
+    x->async_total = b->b_frames;
+    x->async_nchans = b->b_nchans;
+    x->async_samples = samples;
+
+    x->job.samples = samples;
+    bed_continue_async(x);
+}
+
+void bed_end_stream(t_bed* x, int done);
+
+void bed_end_async(t_bed* x, t_symbol* status)
+{
+    t_atom op;
+    atom_setsym(&op, x->async_op);
+
+    bed_free_job(&x->job);
+    if (x->async_samples != NULL) {
+        sysmem_freeptr(x->async_samples);
+        x->async_samples = NULL;
+    }
+    if (x->stream.source != NULL) {
+        bed_end_stream(x, status == gensym("done"));
+    }
+    x->async_op = NULL;
+
+    outlet_anything(x->status_outlet, status, 1, &op);
+}
+
+/* Poll the workers and, once they are done, swap the result into the
+ * buffer */
+void bed_async_tick(t_bed* x)
+{
+    t_bed_job* j = &x->job;
+    if (!bed_job_finished(j)) {
+        bed_report_progress(x, j, 0);
+        clock_fdelay(x->async_clock, ASYNC_POLL_INTERVAL);
+        return;
+    }
+
+    bed_join_job(j);
+    bed_report_progress(x, j, 1);
+
+    /* Normalizing needs another pass once the peak is known */
+    if (bed_measuring(j)) {
+        if (!bed_next_pass(j)) {
+            bed_end_async(x, gensym("failed"));
+            return;
+        }
+        bed_continue_async(x);
+        return;
+    }
+
+    /* A file is written in place by the workers */
+    if (x->stream.source != NULL) {
+        bed_end_async(x, gensym("done"));
+        return;
+    }
+
+    if (!bed_attach_buffer(x)) {
+        bed_end_async(x, gensym("failed"));
+        return;
+    }
+
+    t_buffer* b;
+    b = x->buffer;
+
+    ATOMIC_INCREMENT(&b->b_inuse);
+
+    if (!b->b_valid || b->b_frames != x->async_total
+        || b->b_nchans != x->async_nchans) {
+        ATOMIC_DECREMENT(&b->b_inuse);
+        post("bed • \"%s\" has changed size, %s was discarded",
+             x->b_name->s_name, x->async_op->s_name);
+        bed_end_async(x, gensym("failed"));
+        return;
+    }
+
+    /* Only sample edits need the frames they replace for undo */
+    if (!bed_push_edit(x, b, x->async_edit, x->async_start, x->async_frames,
+                       x->async_edit == E_SAMPLES)) {
+        ATOMIC_DECREMENT(&b->b_inuse);
+        bed_end_async(x, gensym("failed"));
+        return;
+    }
+
+    sysmem_copyptr(x->async_samples,
+                   b->b_samples + (x->async_start * b->b_nchans),
+                   x->async_frames * b->b_nchans * sizeof(float));
+
+    object_method(&b->b_obj, gensym("dirty"));
+    ATOMIC_DECREMENT(&b->b_inuse);
+    bed_end_async(x, gensym("done"));
+}
+
+/******************************************************************************/
+void bed_info(t_bed* x)
+{
+    if (!bed_attach_buffer(x)) {
+        return;
+    }
+
+    t_buffer* b;
+    b = x->buffer;
+
+    post("bed • Information:");
+    post("    buffer name: %s", b->b_name->s_name);
+    post("    frame count: %d", b->b_frames);
+    post("    channel count: %d", b->b_nchans);
+    post("    validity: %d", b->b_valid);
+    post("    in-use status: %d", b->b_inuse);
+    post("    undo steps: %d", x->next_edit);
+    post("    redo steps: %d", x->num_edits - x->next_edit);
+    post("    undo memory: %.2f MB", x->history_bytes / (1024.0 * 1024.0));
+    post("    workers: %d", x->num_workers);
+    post("    asynchronous: %d", x->async);
+    post("    targets: %d", x->num_targets);
+}
+
+void bed_dblclick(t_bed* x)
+{
+    if (!bed_attach_buffer(x)) {
+        return;
+    }
+
+    t_buffer* b;
+    b = x->buffer;
+
+    object_method(&b->b_obj, gensym("dblclick"));
+}
+
+void bed_bufname(t_bed* x, t_symbol* name)
+{
+    if (bed_busy(x)) {
+        return;
+    }
+
+    /* The history refers to the frames of the previous buffer */
+    if (name != x->b_name) {
+        bed_clear_history(x, 0);
+    }
+
+    x->b_name = name;
+}
+
+/******************************************************************************/
+void bed_reverse_frames(t_bed* x, float* samples, long frames, long nchans)
+{
+    t_bed_job* j = bed_prepare_job(x, J_REVERSE, nchans, frames / 2, 1);
+    j->samples = samples;
+    j->length = frames;
+    bed_run_job(x, j);
+}
+
+/* Gather the segments in their shuffled order, or scatter them back */
+int bed_shuffle_frames(t_bed* x, t_buffer* b, t_bed_edit* e, int inverse)
+{
+    long buffersize = e->frames * b->b_nchans * sizeof(float);
+    float* local_buffer = (float*)sysmem_newptr(buffersize);
+    if (local_buffer == NULL) {
+        error("bed • Cannot allocate memory for shuffle");
+        return 0;
+    } else {
+        sysmem_copyptr(b->b_samples, local_buffer, buffersize);
+    }
+
+    long position = 0;
+    for (long ii = 0; ii < e->segments; ii++) {
+        long start = e->order[ii] * e->segment_frames;
+        long length = e->segment_frames;
+
+        if (start + length > e->frames) {
+            length = e->frames - start;
+        }
+
+        if (inverse) {
+            sysmem_copyptr(local_buffer + (position * b->b_nchans),
+                           b->b_samples + (start * b->b_nchans),
+                           length * b->b_nchans * sizeof(float));
+        } else {
+            sysmem_copyptr(local_buffer + (start * b->b_nchans),
+                           b->b_samples + (position * b->b_nchans),
+                           length * b->b_nchans * sizeof(float));
+        }
+        position += length;
+    }
+
+    sysmem_freeptr(local_buffer);
+
+    return 1;
+}
+
+int bed_remove_frames(t_buffer* b, long start, long frames)
+{
     long bufferframes = b->b_frames;
     long buffersize = bufferframes * b->b_nchans * sizeof(float);
     float* local_buffer = (float*)sysmem_newptr(buffersize);
     if (local_buffer == NULL) {
         error("bed • Cannot allocate memory for undo");
-        x->can_undo = 0;
-        ATOMIC_DECREMENT(&b->b_inuse);
-        return;
+        return 0;
+    } else {
+        sysmem_copyptr(b->b_samples, local_buffer, buffersize);
+    }
+
+    ATOMIC_DECREMENT(&b->b_inuse);
+    t_atom rv;
+    object_method_long(&b->b_obj, gensym("sizeinsamps"),
+                       (bufferframes - frames), &rv);
+    ATOMIC_INCREMENT(&b->b_inuse);
+
+    long chunksize = start * b->b_nchans * sizeof(float);
+    sysmem_copyptr(local_buffer, b->b_samples, chunksize);
+    chunksize = (bufferframes - start - frames) * b->b_nchans * sizeof(float);
+    sysmem_copyptr(local_buffer + ((start + frames) * b->b_nchans),
+                   b->b_samples + (start * b->b_nchans), chunksize);
+
+    sysmem_freeptr(local_buffer);
+
+    return 1;
+}
+
+int bed_insert_frames(t_buffer* b, long start, float* samples, long frames)
+{
+    long bufferframes = b->b_frames;
+    long buffersize = bufferframes * b->b_nchans * sizeof(float);
+    float* local_buffer = (float*)sysmem_newptr(buffersize);
+    if (local_buffer == NULL) {
+        error("bed • Cannot allocate memory for undo");
+        return 0;
     } else {
         sysmem_copyptr(b->b_samples, local_buffer, buffersize);
     }
 
-    ATOMIC_DECREMENT(&b->b_inuse);
-    t_atom rv;
-    object_method_long(&b->b_obj, gensym("sizeinsamps"),
-                       (b->b_frames - cutframes), &rv);
-    ATOMIC_INCREMENT(&b->b_inuse);
+    ATOMIC_DECREMENT(&b->b_inuse);
+    t_atom rv;
+    object_method_long(&b->b_obj, gensym("sizeinsamps"),
+                       (bufferframes + frames), &rv);
+    ATOMIC_INCREMENT(&b->b_inuse);
+
+    long chunksize = start * b->b_nchans * sizeof(float);
+    sysmem_copyptr(local_buffer, b->b_samples, chunksize);
+    chunksize = frames * b->b_nchans * sizeof(float);
+    sysmem_copyptr(samples, b->b_samples + (start * b->b_nchans), chunksize);
+    chunksize = (bufferframes - start) * b->b_nchans * sizeof(float);
+    sysmem_copyptr(local_buffer + (start * b->b_nchans),
+                   b->b_samples + ((start + frames) * b->b_nchans),
+                   chunksize);
+
+    sysmem_freeptr(local_buffer);
+
+    return 1;
+}
+
+/* Undo or redo an edit on the attached buffer */
+int bed_apply_edit(t_bed* x, t_buffer* b, t_bed_edit* e, int undo)
+{
+    switch (e->type) {
+    case E_SAMPLES: {
+        /* Swapping toggles between the edited and the saved frames */
+        float* samples = b->b_samples + (e->start * b->b_nchans);
+        for (long ii = 0; ii < e->frames * b->b_nchans; ii++) {
+            float temp = samples[ii];
+            samples[ii] = e->samples[ii];
+            e->samples[ii] = temp;
+        }
+        return 1;
+    }
+
+    case E_REVERSE:
+        bed_reverse_frames(x, b->b_samples, e->frames, b->b_nchans);
+        return 1;
+
+    case E_SHUFFLE:
+        return bed_shuffle_frames(x, b, e, undo);
+
+    case E_CUT:
+        if (undo) {
+            return bed_insert_frames(b, e->start, e->samples, e->frames);
+        } else {
+            return bed_remove_frames(b, e->start, e->frames);
+        }
+    }
+
+    return 0;
+}
+
+/* Check that the buffer still has the size the edit was made on */
+int bed_check_edit(t_bed* x, t_buffer* b, t_bed_edit* e, int undo)
+{
+    int valid = e->channels == b->b_nchans;
+
+    switch (e->type) {
+    case E_SAMPLES:
+        valid = valid && e->start + e->frames <= b->b_frames;
+        break;
+    case E_REVERSE:
+    case E_SHUFFLE:
+        valid = valid && e->frames == b->b_frames;
+        break;
+    case E_CUT:
+        if (undo) {
+            valid = valid && e->start <= b->b_frames;
+        } else {
+            valid = valid && e->start + e->frames <= b->b_frames;
+        }
+        break;
+    }
+
+    if (!valid) {
+        post("bed • \"%s\" has changed size, the undo history was cleared",
+             x->b_name->s_name);
+        bed_clear_history(x, 0);
+    }
+    return valid;
+}
+
+/******************************************************************************/
+void bed_normalize(t_bed* x, t_symbol* msg, short argc, t_atom* argv)
+{
+    if (bed_busy(x)) {
+        return;
+    }
+
+    if (argc > 1) {
+        error("bed • The message must have at most two members");
+        return;
+    }
+
+    float newmax = 1.0;
+    if (argc == 1) {
+        newmax = atom_getfloat(argv);
+    }
+
+    if (!bed_attach_buffer(x)) {
+        return;
+    }
+
+    t_buffer* b;
+    b = x->buffer;
+
+    ATOMIC_INCREMENT(&b->b_inuse);
+
+    if (!b->b_valid) {
+        ATOMIC_DECREMENT(&b->b_inuse);
+        post("bed • Not a valid buffer!");
+        return;
+    }
+
+    /* Find the peak, then rescale, each pass split among the workers */
+    t_bed_job* j = bed_prepare_job(x, J_PEAK, 1, b->b_frames * b->b_nchans,
+                                   2);
+    j->newmax = newmax;
+
+    if (x->async) {
+        bed_start_async(x, b, gensym("normalize"), E_SAMPLES, 0, b->b_frames);
+        ATOMIC_DECREMENT(&b->b_inuse);
+        return;
+    }
+
+    j->samples = b->b_samples;
+    bed_run_job(x, j);
+
+    if (!bed_next_pass(j)) {
+        ATOMIC_DECREMENT(&b->b_inuse);
+        return;
+    }
+
+    if (!bed_push_edit(x, b, E_SAMPLES, 0, b->b_frames, 1)) {
+        ATOMIC_DECREMENT(&b->b_inuse);
+        return;
+    }
+
+    bed_run_job(x, j);
+
+    object_method(&b->b_obj, gensym("dirty"));
+    ATOMIC_DECREMENT(&b->b_inuse);
+}
+
+void bed_fadein(t_bed* x, double fadetime)
+{
+    if (bed_busy(x)) {
+        return;
+    }
+
+    if (!bed_attach_buffer(x)) {
+        return;
+    }
+
+    t_buffer* b;
+    b = x->buffer;
+
+    ATOMIC_INCREMENT(&b->b_inuse);
+
+    if (!b->b_valid) {
+        ATOMIC_DECREMENT(&b->b_inuse);
+        post("bed • Not a valid buffer!");
+        return;
+    }
+
+    long fadeframes = fadetime * 0.001 * b->b_sr;
+    if (fadetime <= 0 || fadeframes > b->b_frames) {
+        post("bed • %.0fms is not a valid fade-in time", fadetime);
+        ATOMIC_DECREMENT(&b->b_inuse);
+        return;
+    }
+
+    t_bed_job* j = bed_prepare_job(x, J_FADEIN, b->b_nchans, fadeframes, 1);
+    j->length = fadeframes;
+
+    if (x->async) {
+        bed_start_async(x, b, gensym("fadein"), E_SAMPLES, 0, fadeframes);
+        ATOMIC_DECREMENT(&b->b_inuse);
+        return;
+    }
+
+    if (!bed_push_edit(x, b, E_SAMPLES, 0, fadeframes, 1)) {
+        ATOMIC_DECREMENT(&b->b_inuse);
+        return;
+    }
+
+    j->samples = b->b_samples;
+    bed_run_job(x, j);
+
+    object_method(&b->b_obj, gensym("dirty"));
+    ATOMIC_DECREMENT(&b->b_inuse);
+}
+
+void bed_fadeout(t_bed* x, double fadetime)
+{
+    if (bed_busy(x)) {
+        return;
+    }
+
+    if (!bed_attach_buffer(x)) {
+        return;
+    }
+
+    t_buffer* b;
+    b = x->buffer;
+
+    ATOMIC_INCREMENT(&b->b_inuse);
+
+    if (!b->b_valid) {
+        ATOMIC_DECREMENT(&b->b_inuse);
+        post("bed • Not a valid buffer!");
+        return;
+    }
+
+    long fadeframes = fadetime * 0.001 * b->b_sr;
+    if (fadetime <= 0 || fadeframes > b->b_frames) {
+        post("bed • %.0fms is not a valid fade-out time", fadetime);
+        ATOMIC_DECREMENT(&b->b_inuse);
+        return;
+    }
+
+    long fadestart = b->b_frames - fadeframes;
+
+    t_bed_job* j = bed_prepare_job(x, J_FADEOUT, b->b_nchans, fadeframes, 1);
+    j->length = fadeframes;
+
+    if (x->async) {
+        bed_start_async(x, b, gensym("fadeout"), E_SAMPLES, fadestart,
+                        fadeframes);
+        ATOMIC_DECREMENT(&b->b_inuse);
+        return;
+    }
+
+    if (!bed_push_edit(x, b, E_SAMPLES, fadestart, fadeframes, 1)) {
+        ATOMIC_DECREMENT(&b->b_inuse);
+        return;
+    }
+
+    j->samples = b->b_samples + (fadestart * b->b_nchans);
+    bed_run_job(x, j);
+
+    object_method(&b->b_obj, gensym("dirty"));
+    ATOMIC_DECREMENT(&b->b_inuse);
+}
+
+void bed_cut(t_bed* x, double start, double end)
+{
+    if (bed_busy(x)) {
+        return;
+    }
+
+    if (!bed_attach_buffer(x)) {
+        return;
+    }
+
+    t_buffer* b;
+    b = x->buffer;
+
+    ATOMIC_INCREMENT(&b->b_inuse);
+
+    if (!b->b_valid) {
+        ATOMIC_DECREMENT(&b->b_inuse);
+        post("bed • Not a valid buffer!");
+        return;
+    }
+
+    long startframe = start * 0.001 * b->b_sr;
+    long endframe = end * 0.001 * b->b_sr;
+    long cutframes = endframe - startframe;
+
+    if (startframe < 0 || endframe > b->b_frames || startframe > endframe) {
+        post("bed • %.0fms and %.0fms are not valid cut times", start, end);
+        ATOMIC_DECREMENT(&b->b_inuse);
+        return;
+    }
+
+    t_bed_edit* e = bed_push_edit(x, b, E_CUT, startframe, cutframes, 1);
+    if (e == NULL) {
+        ATOMIC_DECREMENT(&b->b_inuse);
+        return;
+    }
+
+    if (!bed_apply_edit(x, b, e, 0)) {
+        bed_pop_edit(x);
+        ATOMIC_DECREMENT(&b->b_inuse);
+        return;
+    }
+
+    object_method(&b->b_obj, gensym("dirty"));
+    ATOMIC_DECREMENT(&b->b_inuse);
+}
+
+void bed_paste(t_bed* x, t_symbol* destname)
+{
+    t_bed_edit* e = NULL;
+    if (x->next_edit > 0) {
+        e = &x->history[x->next_edit - 1];
+    }
+
+    if (e != NULL && e->type == E_CUT) {
+        if (!bed_attach_buffer(x)) {
+            return;
+        }
+
+        t_buffer* destbuf = NULL;
+        if (bed_attach_any_buffer(&destbuf, destname)) {
+            if (e->channels != destbuf->b_nchans) {
+                post("bed • Different number of channels of origin (%d) "
+                     "and number of channel of destination (%d)",
+                     e->channels, destbuf->b_nchans);
+                return;
+            }
+
+            t_atom rv;
+            object_method_long(&destbuf->b_obj, gensym("sizeinsamps"),
+                               e->frames, &rv);
+            ATOMIC_INCREMENT(&destbuf->b_inuse);
+            long chunksize = e->frames * destbuf->b_nchans * sizeof(float);
+            sysmem_copyptr(e->samples, destbuf->b_samples, chunksize);
+            ATOMIC_DECREMENT(&destbuf->b_inuse);
+
+        } else {
+            post("bed • \"%s\" is not a valid buffer", destname->s_name);
+            return;
+        }
+    } else {
+        post("bed • Nothing to paste");
+        return;
+    }
+}
+
+void bed_reverse(t_bed* x)
+{
+    if (bed_busy(x)) {
+        return;
+    }
+
+    if (!bed_attach_buffer(x)) {
+        return;
+    }
+
+    t_buffer* b;
+    b = x->buffer;
+
+    ATOMIC_INCREMENT(&b->b_inuse);
+
+    if (!b->b_valid) {
+        ATOMIC_DECREMENT(&b->b_inuse);
+        post("bed • Not a valid buffer!");
+        return;
+    }
+
+    if (x->async) {
+        t_bed_job* j = bed_prepare_job(x, J_REVERSE, b->b_nchans,
+                                       b->b_frames / 2, 1);
+        j->length = b->b_frames;
+        bed_start_async(x, b, gensym("reverse"), E_REVERSE, 0, b->b_frames);
+        ATOMIC_DECREMENT(&b->b_inuse);
+        return;
+    }
+
+    /* Reversing is its own inverse, so no frames need to be saved */
+    t_bed_edit* e = bed_push_edit(x, b, E_REVERSE, 0, b->b_frames, 0);
+    if (e == NULL) {
+        ATOMIC_DECREMENT(&b->b_inuse);
+        return;
+    }
+
+    bed_apply_edit(x, b, e, 0);
+
+    object_method(&b->b_obj, gensym("dirty"));
+    ATOMIC_DECREMENT(&b->b_inuse);
+}
+
+void bed_ring_modulation(t_bed* x, double frequency, t_symbol* waveform)
+{
+    if (bed_busy(x)) {
+        return;
+    }
+
+    if (!bed_attach_buffer(x)) {
+        return;
+    }
+
+    t_buffer* b;
+    b = x->buffer;
+
+    ATOMIC_INCREMENT(&b->b_inuse);
+
+    if (!b->b_valid) {
+        ATOMIC_DECREMENT(&b->b_inuse);
+        post("bed • Not a valid buffer!");
+        return;
+    }
+
+    t_bed_job* j = bed_prepare_job(x, J_RING, b->b_nchans, b->b_frames, 1);
+    if (!bed_setup_ring(b->b_sr, &j->steps[0], frequency, waveform)) {
+        ATOMIC_DECREMENT(&b->b_inuse);
+        return;
+    }
+    j->num_steps = 1;
+
+    if (x->async) {
+        bed_start_async(x, b, gensym("ring"), E_SAMPLES, 0, b->b_frames);
+        ATOMIC_DECREMENT(&b->b_inuse);
+        return;
+    }
+
+    if (!bed_push_edit(x, b, E_SAMPLES, 0, b->b_frames, 1)) {
+        bed_free_job(j);
+        ATOMIC_DECREMENT(&b->b_inuse);
+        return;
+    }
+
+    j->samples = b->b_samples;
+    bed_run_job(x, j);
+    bed_free_job(j);
+
+    object_method(&b->b_obj, gensym("dirty"));
+    ATOMIC_DECREMENT(&b->b_inuse);
+}
+
+/* Parse a list of pointwise operations into the steps of a job, for a
+ * number of frames at a sample rate */
+int bed_parse_steps(t_bed_job* j, long frames, double sr, short argc,
+                    t_atom* argv)
+{
+    long ii = 0;
+    while (ii < argc) {
+        if (atom_gettype(argv + ii) != A_SYM) {
+            error("bed • The batch must name each operation");
+            bed_free_job(j);
+            return 0;
+        }
+        if (j->num_steps == MAXIMUM_STEPS) {
+            error("bed • The batch can have at most %d operations",
+                  MAXIMUM_STEPS);
+            bed_free_job(j);
+            return 0;
+        }
+
+        t_symbol* op = atom_getsym(argv + ii++);
+        int has_value = ii < argc
+            && (atom_gettype(argv + ii) == A_FLOAT
+                || atom_gettype(argv + ii) == A_LONG);
+        double value = has_value ? atom_getfloat(argv + ii++) : 0.0;
+
+        t_bed_step* s = &j->steps[j->num_steps];
+        s->start = 0;
+        s->length = frames;
+
+        if (op == gensym("normalize")) {
+            s->type = J_PEAK;
+            s->newmax = has_value ? value : 1.0;
+        } else if (op == gensym("fadein")) {
+            long fadeframes = value * 0.001 * sr;
+            if (value <= 0 || fadeframes > frames) {
+                post("bed • %.0fms is not a valid fade-in time", value);
+                bed_free_job(j);
+                return 0;
+            }
+            s->type = J_FADEIN;
+            s->length = fadeframes;
+        } else if (op == gensym("fadeout")) {
+            long fadeframes = value * 0.001 * sr;
+            if (value <= 0 || fadeframes > frames) {
+                post("bed • %.0fms is not a valid fade-out time", value);
+                bed_free_job(j);
+                return 0;
+            }
+            s->type = J_FADEOUT;
+            s->start = frames - fadeframes;
+            s->length = fadeframes;
+        } else if (op == gensym("ring")) {
+            /* A name that follows the frequency is the waveform, unless it
+             * is the next operation */
+            t_symbol* waveform = gensym("");
+            if (ii < argc && atom_gettype(argv + ii) == A_SYM) {
+                t_symbol* next = atom_getsym(argv + ii);
+                if (next != gensym("normalize") && next != gensym("fadein")
+                    && next != gensym("fadeout") && next != gensym("ring")) {
+                    waveform = next;
+                    ii++;
+                }
+            }
+            if (!bed_setup_ring(sr, s, value, waveform)) {
+                bed_free_job(j);
+                return 0;
+            }
+        } else {
+            post("bed • %s cannot be part of a batch", op->s_name);
+            bed_free_job(j);
+            return 0;
+        }
+        j->num_steps++;
+    }
+
+    if (j->num_steps == 0) {
+        post("bed • Nothing to do");
+        return 0;
+    }
+    return 1;
+}
+
+/* Each normalize needs a pass that measures the peak before it. Returns the
+ * number of measuring passes */
+long bed_plan_batch(t_bed_job* j)
+{
+    long num_passes = 0;
+    for (long kk = j->num_steps - 1; kk >= 0; kk--) {
+        if (j->steps[kk].type == J_PEAK) {
+            j->type = J_BATCH_PEAK;
+            j->peak_steps = kk;
+            num_passes++;
+        }
+    }
+    return num_passes;
+}
+
+/* Apply a list of pointwise operations in one pass over the frames, with one
+ * undo step and one redraw */
+void bed_batch(t_bed* x, t_symbol* msg, short argc, t_atom* argv)
+{
+    if (bed_busy(x)) {
+        return;
+    }
+
+    if (!bed_attach_buffer(x)) {
+        return;
+    }
+
+    t_buffer* b;
+    b = x->buffer;
+
+    ATOMIC_INCREMENT(&b->b_inuse);
+
+    if (!b->b_valid) {
+        ATOMIC_DECREMENT(&b->b_inuse);
+        post("bed • Not a valid buffer!");
+        return;
+    }
+
+    t_bed_job* j = bed_prepare_job(x, J_BATCH, b->b_nchans, 0, 1);
+    if (!bed_parse_steps(j, b->b_frames, b->b_sr, argc, argv)) {
+        ATOMIC_DECREMENT(&b->b_inuse);
+        return;
+    }
+    j->num_passes += bed_plan_batch(j);
+
+    /* Only the frames some step changes are processed and saved */
+    long start = b->b_frames;
+    long end = 0;
+    for (long ii = 0; ii < j->num_steps; ii++) {
+        t_bed_step* s = &j->steps[ii];
+        if (start > s->start) {
+            start = s->start;
+        }
+        if (end < s->start + s->length) {
+            end = s->start + s->length;
+        }
+    }
+    j->offset = start;
+    j->count = end - start;
+
+    if (x->async) {
+        bed_start_async(x, b, gensym("batch"), E_SAMPLES, start, end - start);
+        ATOMIC_DECREMENT(&b->b_inuse);
+        return;
+    }
+
+    j->samples = b->b_samples + (start * b->b_nchans);
+    while (bed_measuring(j)) {
+        bed_run_job(x, j);
+        if (!bed_next_pass(j)) {
+            bed_free_job(j);
+            ATOMIC_DECREMENT(&b->b_inuse);
+            return;
+        }
+    }
+
+    if (!bed_push_edit(x, b, E_SAMPLES, start, end - start, 1)) {
+        bed_free_job(j);
+        ATOMIC_DECREMENT(&b->b_inuse);
+        return;
+    }
+
+    bed_run_job(x, j);
+    bed_free_job(j);
+
+    object_method(&b->b_obj, gensym("dirty"));
+    ATOMIC_DECREMENT(&b->b_inuse);
+}
+
+/* The buffers that "each" applies an operation to
+ * ****************************/
+void bed_targets(t_bed* x, t_symbol* msg, short argc, t_atom* argv)
+{
+    for (long ii = 0; ii < argc; ii++) {
+        if (atom_gettype(argv + ii) != A_SYM) {
+            error("bed • The targets must be a list of buffer names");
+            return;
+        }
+    }
+
+    if (x->targets != NULL) {
+        sysmem_freeptr(x->targets);
+        x->targets = NULL;
+        x->num_targets = 0;
+    }
+    if (argc == 0) {
+        return;
+    }
+
+    x->targets = (t_symbol**)sysmem_newptr(argc * sizeof(t_symbol*));
+    if (x->targets == NULL) {
+        error("bed • Cannot allocate memory for the targets");
+        return;
+    }
+    /* Keep each name once, or two workers would edit the same buffer */
+    long num_targets = 0;
+    for (long ii = 0; ii < argc; ii++) {
+        t_symbol* name = atom_getsym(argv + ii);
+        long jj = 0;
+        while (jj < num_targets && x->targets[jj] != name) {
+            jj++;
+        }
+        if (jj == num_targets) {
+            x->targets[num_targets++] = name;
+        }
+    }
+    x->num_targets = num_targets;
+}
+
+/* Apply reverse, or a batch of pointwise operations, to every target, the
+ * workers taking whole buffers. The targets stay in use until the end and
+ * their edits are not kept for undo, so editing the attached buffer clears
+ * the history */
+void bed_each(t_bed* x, t_symbol* msg, short argc, t_atom* argv)
+{
+    if (bed_busy(x)) {
+        return;
+    }
+
+    if (x->num_targets == 0) {
+        post("bed • No targets");
+        return;
+    }
+
+    t_bed_target* targets = (t_bed_target*)sysmem_newptrclear(
+        x->num_targets * sizeof(t_bed_target));
+    if (targets == NULL) {
+        error("bed • Cannot allocate memory for the targets");
+        return;
+    }
+
+    /* Look up every buffer once, on the main thread. Times are converted at
+     * the sample rate of the longest */
+    t_buffer* longest = NULL;
+    for (long ii = 0; ii < x->num_targets; ii++) {
+        t_bed_target* t = &targets[ii];
+        t->name = x->targets[ii];
+        t->status = T_SKIPPED;
+        if (!bed_attach_any_buffer(&t->buffer, t->name)) {
+            post("bed • \"%s\" is not a valid buffer", t->name->s_name);
+            t->buffer = NULL;
+            continue;
+        }
+
+        t_buffer* b = t->buffer;
+        ATOMIC_INCREMENT(&b->b_inuse);
+        if (!b->b_valid) {
+            post("bed • \"%s\" is not a valid buffer", t->name->s_name);
+            continue;
+        }
+        t->samples = b->b_samples;
+        t->nchans = b->b_nchans;
+        t->frames = b->b_frames;
+        t->status = T_DONE;
+        if (longest == NULL || longest->b_frames < b->b_frames) {
+            longest = b;
+        }
+    }
+
+    t_bed_job* j = bed_prepare_job(x, J_TARGETS, 1, x->num_targets, 1);
+    j->targets = targets;
+    j->target_type = J_REVERSE;
+
+    int ok = longest != NULL && longest->b_frames > 0;
+    if (!ok) {
+        post("bed • None of the targets is a valid buffer");
+    } else if (argc != 1 || atom_getsym(argv) != gensym("reverse")) {
+        /* Steps are parsed for the longest target and fitted to each */
+        j->type = J_BATCH;
+        ok = bed_parse_steps(j, longest->b_frames, longest->b_sr, argc,
+                             argv);
+        if (ok) {
+            bed_plan_batch(j);
+            j->target_type = j->type;
+            j->type = J_TARGETS;
+        }
+    }
 
-    chunksize = startframe * b->b_nchans * sizeof(float);
-    sysmem_copyptr(local_buffer, b->b_samples, chunksize);
-    chunksize = (bufferframes - endframe) * b->b_nchans * sizeof(float);
-    sysmem_copyptr(local_buffer + (endframe * b->b_nchans),
-                   b->b_samples + (startframe * b->b_nchans), chunksize);
+    if (ok) {
+        bed_run_job(x, j);
+        bed_free_job(j);
+    }
 
-    sysmem_freeptr(local_buffer);
+    long counts[3] = {0, 0, 0};
+    int attached = 0;
+    for (long ii = 0; ii < x->num_targets; ii++) {
+        t_bed_target* t = &targets[ii];
+        if (ok) {
+            counts[t->status]++;
+            if (t->status == T_DONE) {
+                object_method(&t->buffer->b_obj, gensym("dirty"));
+                attached = attached || t->name == x->b_name;
+            } else if (t->status == T_FAILED) {
+                post("bed • \"%s\" is too quiet to rescale",
+                     t->name->s_name);
+            } else if (t->frames > 0) {
+                post("bed • \"%s\" is too short, it was skipped",
+                     t->name->s_name);
+            }
+        }
+        if (t->buffer != NULL) {
+            ATOMIC_DECREMENT(&t->buffer->b_inuse);
+        }
+    }
+    sysmem_freeptr(targets);
 
-    object_method(&b->b_obj, gensym("dirty"));
-    ATOMIC_DECREMENT(&b->b_inuse);
+    if (attached && x->num_edits > 0) {
+        post("bed • \"%s\" was edited, the undo history was cleared",
+             x->b_name->s_name);
+        bed_clear_history(x, 0);
+    }
+
+    if (ok) {
+        t_atom summary[3];
+        atom_setlong(&summary[0], counts[T_DONE]);
+        atom_setlong(&summary[1], counts[T_SKIPPED]);
+        atom_setlong(&summary[2], counts[T_FAILED]);
+        outlet_anything(x->status_outlet, gensym("each"), 3, summary);
+    }
 }
 
-void bed_paste(t_bed* x, t_symbol* destname)
+/* A draw from [0, range), from a SplitMix64 generator local to the object:
+ * rand() can be as narrow as 15 bits and is shared with the whole program.
+ * Draws from the top of the range that would favour some results are
+ * rejected */
+uint64_t bed_random(t_bed* x, uint64_t range)
 {
-    if (x->can_undo && x->undo_cut) {
-        if (!bed_attach_buffer(x)) {
-            return;
-        }
+    uint64_t limit = UINT64_MAX - UINT64_MAX % range;
+    uint64_t value;
 
-        t_buffer* destbuf = NULL;
-        if (bed_attach_any_buffer(&destbuf, destname)) {
-            if (x->buffer->b_nchans != destbuf->b_nchans) {
-                post("bed • Different number of channels of origin (%d) "
-                     "and number of channel of destination (%d)",
-                     x->buffer->b_nchans, destbuf->b_nchans);
-                return;
-            }
+    do {
+        value = x->seed += 0x9e3779b97f4a7c15;
+        value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9;
+        value = (value ^ (value >> 27)) * 0x94d049bb133111eb;
+        value ^= value >> 31;
+    } while (value >= limit);
 
-            t_atom rv;
-            object_method_long(&destbuf->b_obj, gensym("sizeinsamps"),
-                               x->undo_frames, &rv);
-            ATOMIC_INCREMENT(&destbuf->b_inuse);
-            long chunksize = x->undo_frames * destbuf->b_nchans
-                * sizeof(float);
-            sysmem_copyptr(x->undo_samples, destbuf->b_samples, chunksize);
-            ATOMIC_DECREMENT(&destbuf->b_inuse);
+    return value % range;
+}
 
-        } else {
-            post("bed • \"%s\" is not a valid buffer", destname->s_name);
-            return;
-        }
-    } else {
-        post("bed • Nothing to paste");
-        return;
+/* Shuffle the segment indexes (Fisher-Yates) */
+void bed_shuffle_order(t_bed* x, long* order, long numsegments)
+{
+    for (long ii = 0; ii < numsegments; ii++) {
+        order[ii] = ii;
+    }
+    for (long ii = numsegments - 1; ii > 0; ii--) {
+        long jj = bed_random(x, ii + 1);
+        long temp = order[ii];
+        order[ii] = order[jj];
+        order[jj] = temp;
     }
 }
 
-void bed_reverse(t_bed* x)
+void bed_shuffle_n_segments(t_bed* x, long segments)
 {
+    if (bed_busy(x)) {
+        return;
+    }
+
     if (!bed_attach_buffer(x)) {
         return;
     }
@@ -496,187 +2130,585 @@ void bed_reverse(t_bed* x)
         return;
     }
 
-    long chunksize = b->b_frames * b->b_nchans * sizeof(float);
-    if (x->undo_samples == NULL) {
-        x->undo_samples = (float*)sysmem_newptr(chunksize);
-    } else {
-        x->undo_samples = (float*)sysmem_resizeptr(x->undo_samples, chunksize);
+    long totallength = b->b_frames;
+    long numsegments = segments;
+    if (numsegments < 1 || numsegments > totallength) {
+        ATOMIC_DECREMENT(&b->b_inuse);
+        post("bed • %ld is not a valid number of segments", segments);
+        return;
     }
 
-    if (x->undo_samples == NULL) {
-        error("bed • Cannot allocate memory for undo");
-        x->can_undo = 0;
+    /* The last segment is shorter when the frames do not divide evenly */
+    long segmentlength = ceil((double)totallength / numsegments);
+    numsegments = (totallength + segmentlength - 1) / segmentlength;
+
+    long* order = (long*)sysmem_newptr(numsegments * sizeof(long));
+    if (order == NULL) {
+        error("bed • Cannot allocate memory for shuffle");
         ATOMIC_DECREMENT(&b->b_inuse);
         return;
-    } else {
-        x->can_undo = 1;
-        x->undo_start = 0;
-        x->undo_frames = b->b_frames;
-        x->undo_resize = 0;
-        x->undo_cut = 0;
-        sysmem_copyptr(b->b_samples, x->undo_samples, chunksize);
     }
+    bed_shuffle_order(x, order, numsegments);
 
-    float temp;
-    for (int ii = 0; ii < ceil(b->b_frames / 2); ii++) {
-        for (int jj = 0; jj < b->b_nchans; jj++) {
-            temp = b->b_samples[(ii * b->b_nchans) + jj];
-            b->b_samples[(ii * b->b_nchans) + jj] = b->b_samples
-                                                        [(b->b_frames - 1
-                                                          - ii * b->b_nchans)
-                                                         + jj];
-            b->b_samples[(b->b_frames - 1 - ii * b->b_nchans) + jj] = temp;
-        }
+    /* Only the permutation is kept, the frames are scattered back on undo */
+    t_bed_edit* e = bed_push_edit(x, b, E_SHUFFLE, 0, totallength, 0);
+    if (e == NULL) {
+        sysmem_freeptr(order);
+        ATOMIC_DECREMENT(&b->b_inuse);
+        return;
+    }
+
+    e->order = order;
+    e->segments = numsegments;
+    e->segment_frames = segmentlength;
+    e->bytes = numsegments * sizeof(long);
+    x->history_bytes += e->bytes;
+
+    if (!bed_apply_edit(x, b, e, 0)) {
+        bed_pop_edit(x);
+        ATOMIC_DECREMENT(&b->b_inuse);
+        return;
     }
 
+    bed_trim_history(x);
+
     object_method(&b->b_obj, gensym("dirty"));
     ATOMIC_DECREMENT(&b->b_inuse);
 }
 
-void bed_ring_modulation(t_bed* x, double frequency)
+/* The file streaming
+ * *********************************************************/
+unsigned long bed_little(const unsigned char* p, long bytes)
 {
-    if (!bed_attach_buffer(x)) {
-        return;
+    unsigned long value = 0;
+    for (long ii = bytes - 1; ii >= 0; ii--) {
+        value = (value << 8) | p[ii];
     }
+    return value;
+}
 
-    t_buffer* b;
-    b = x->buffer;
+unsigned long bed_big(const unsigned char* p, long bytes)
+{
+    unsigned long value = 0;
+    for (long ii = 0; ii < bytes; ii++) {
+        value = (value << 8) | p[ii];
+    }
+    return value;
+}
 
-    ATOMIC_INCREMENT(&b->b_inuse);
+/* The 80-bit extended float that AIFF gives the sample rate in */
+double bed_extended(const unsigned char* p)
+{
+    long exponent = bed_big(p, 2) & 0x7FFF;
+    double mantissa = bed_big(p + 2, 4) * 4294967296.0 + bed_big(p + 6, 4);
+    return ldexp(mantissa, exponent - 16383 - 63);
+}
 
-    if (!b->b_valid) {
-        ATOMIC_DECREMENT(&b->b_inuse);
-        post("bed • Not a valid buffer!");
-        return;
+/* Find the format and the audio data of a WAV or AIFF file. Returns what is
+ * wrong with it, or NULL */
+const char* bed_parse_header(t_bed_stream* s)
+{
+    unsigned char* p = s->source;
+    size_t size = s->source_size;
+    int aiff = 0;
+    int aifc = 0;
+
+    if (size >= 12 && !memcmp(p, "RIFF", 4) && !memcmp(p + 8, "WAVE", 4)) {
+        s->big_endian = 0;
+    } else if (size >= 12 && !memcmp(p, "FORM", 4)
+               && (!memcmp(p + 8, "AIFF", 4)
+                   || (aifc = !memcmp(p + 8, "AIFC", 4)))) {
+        aiff = 1;
+        s->big_endian = 1;
+    } else {
+        return "not a WAV or AIFF file";
     }
 
-    long chunksize = b->b_frames * b->b_nchans * sizeof(float);
-    if (x->undo_samples == NULL) {
-        x->undo_samples = (float*)sysmem_newptr(chunksize);
-    } else {
-        x->undo_samples = (float*)sysmem_resizeptr(x->undo_samples, chunksize);
+    long format = 1;
+    long bits = 0;
+    size_t data_size = 0;
+    s->data_offset = 0;
+    s->nchans = 0;
+    s->is_float = 0;
+    s->sr = 0;
+
+    /* A recorder that did not finish may leave a chunk longer than the
+     * file */
+    size_t position = 12;
+    while (position + 8 <= size) {
+        unsigned char* chunk = p + position;
+        unsigned char* body = chunk + 8;
+        size_t length = aiff ? bed_big(chunk + 4, 4) : bed_little(chunk + 4, 4);
+        if (length > size - position - 8) {
+            length = size - position - 8;
+        }
+
+        if (!aiff && !memcmp(chunk, "fmt ", 4) && length >= 16) {
+            format = bed_little(body, 2);
+            s->nchans = bed_little(body + 2, 2);
+            s->sr = bed_little(body + 4, 4);
+            bits = bed_little(body + 14, 2);
+            if (format == 0xFFFE && length >= 26) {
+                format = bed_little(body + 24, 2);
+            }
+        } else if (!aiff && !memcmp(chunk, "data", 4)) {
+            s->data_offset = position + 8;
+            data_size = length;
+        } else if (aiff && !memcmp(chunk, "COMM", 4) && length >= 18) {
+            s->nchans = bed_big(body, 2);
+            bits = bed_big(body + 6, 2);
+            s->sr = bed_extended(body + 8);
+            if (aifc && length >= 22) {
+                if (!memcmp(body + 18, "sowt", 4)) {
+                    s->big_endian = 0;
+                } else if (!memcmp(body + 18, "fl32", 4)
+                           || !memcmp(body + 18, "FL32", 4)) {
+                    format = 3;
+                } else if (memcmp(body + 18, "NONE", 4)) {
+                    return "compressed";
+                }
+            }
+        } else if (aiff && !memcmp(chunk, "SSND", 4) && length >= 8) {
+            size_t skip = bed_big(body, 4);
+            if (skip > length - 8) {
+                return "truncated";
+            }
+            s->data_offset = position + 16 + skip;
+            data_size = length - 8 - skip;
+        }
+        position += 8 + length + (length & 1);
     }
 
-    if (x->undo_samples == NULL) {
-        error("bed • Cannot allocate memory for undo");
-        x->can_undo = 0;
-        ATOMIC_DECREMENT(&b->b_inuse);
-        return;
+    s->is_float = format == 3;
+    if (format != 1 && format != 3) {
+        return "compressed";
+    }
+    if (s->is_float ? bits != 32 : (bits < 16 || bits > 32 || bits % 8)) {
+        return "unsupported sample format";
+    }
+    if (s->nchans < 1 || s->data_offset == 0) {
+        return "no audio data";
+    }
+    if (s->sr <= 0) {
+        return "no sample rate";
+    }
+
+    s->bytes = bits / 8;
+    s->scale = ldexp(1.0, bits - 1);
+    s->frames = data_size / (s->bytes * s->nchans);
+    if (s->frames < 1) {
+        return "no audio data";
+    }
+    return NULL;
+}
+
+void bed_unmap(void* mapping, size_t size)
+{
+#ifdef WIN32
+    UnmapViewOfFile(mapping);
+#else
+    munmap(mapping, size);
+#endif
+}
+
+/* Map the source read-only, so the system pages it in as the workers reach
+ * it */
+int bed_map_source(t_bed* x, t_bed_stream* s, const char* path)
+{
+    void* mapping;
+    size_t size;
+
+#ifdef WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    LARGE_INTEGER file_size;
+    if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &file_size)) {
+        error("bed • Cannot open %s", path);
+        if (file != INVALID_HANDLE_VALUE) {
+            CloseHandle(file);
+        }
+        return 0;
+    }
+
+    size = (size_t)file_size.QuadPart;
+    HANDLE map = size ? CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0,
+                                           NULL)
+                      : NULL;
+    CloseHandle(file);
+
+    mapping = map ? MapViewOfFile(map, FILE_MAP_READ, 0, 0, 0) : NULL;
+    if (map) {
+        CloseHandle(map);
+    }
+    if (mapping == NULL) {
+        error("bed • Cannot map %s", path);
+        return 0;
+    }
+#else
+    struct stat info;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &info) != 0) {
+        error("bed • Cannot open %s", path);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return 0;
+    }
+
+    size = info.st_size;
+    mapping = size ? mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0)
+                   : MAP_FAILED;
+    close(fd);
+
+    if (mapping == MAP_FAILED) {
+        error("bed • Cannot map %s", path);
+        return 0;
+    }
+#endif
+
+    s->source = mapping;
+    s->source_size = size;
+
+    const char* problem = bed_parse_header(s);
+    if (problem != NULL) {
+        error("bed • %s: %s", path, problem);
+        bed_close_stream(s, 0);
+        return 0;
+    }
+    return 1;
+}
+
+/* Create the destination at the size of the source and map it for writing.
+ * Whatever surrounds the audio data is copied as it is */
+int bed_map_dest(t_bed* x, t_bed_stream* s, const char* source_path,
+                 const char* path)
+{
+    void* mapping;
+    size_t size = s->source_size;
+
+#ifdef WIN32
+    if (!_stricmp(source_path, path)) {
+        error("bed • Cannot write over %s while reading it", path);
+        return 0;
+    }
+
+    HANDLE file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, NULL,
+                              CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        error("bed • Cannot write %s", path);
+        return 0;
+    }
+
+    HANDLE map = CreateFileMappingA(file, NULL, PAGE_READWRITE,
+                                    (DWORD)((uint64_t)size >> 32),
+                                    (DWORD)size, NULL);
+    CloseHandle(file);
+
+    mapping = map ? MapViewOfFile(map, FILE_MAP_WRITE, 0, 0, 0) : NULL;
+    if (map) {
+        CloseHandle(map);
+    }
+#else
+    struct stat source_info;
+    struct stat info;
+    if (stat(source_path, &source_info) == 0 && stat(path, &info) == 0
+        && source_info.st_dev == info.st_dev
+        && source_info.st_ino == info.st_ino) {
+        error("bed • Cannot write over %s while reading it", path);
+        return 0;
+    }
+
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) {
+        error("bed • Cannot write %s", path);
+        return 0;
+    }
+
+    mapping = ftruncate(fd, size) == 0
+        ? mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)
+        : MAP_FAILED;
+    close(fd);
+
+    if (mapping == MAP_FAILED) {
+        mapping = NULL;
+    }
+#endif
+
+    snprintf(s->dest_path, MAX_PATH_CHARS, "%s", path);
+    if (mapping == NULL) {
+        error("bed • Cannot map %s", path);
+        remove(path);
+        return 0;
+    }
+
+    s->dest = mapping;
+    s->dest_size = size;
+
+    size_t data_end = s->data_offset
+                      + (size_t)s->frames * s->nchans * s->bytes;
+    memcpy(s->dest, s->source, s->data_offset);
+    memcpy(s->dest + data_end, s->source + data_end, size - data_end);
+    return 1;
+}
+
+/* Unmap both files, and remove the destination unless it is kept */
+void bed_close_stream(t_bed_stream* s, int keep)
+{
+    if (s->source != NULL) {
+        bed_unmap(s->source, s->source_size);
+        s->source = NULL;
+    }
+    if (s->dest != NULL) {
+        bed_unmap(s->dest, s->dest_size);
+        s->dest = NULL;
+        if (!keep) {
+            remove(s->dest_path);
+        }
+    }
+    if (s->order != NULL) {
+        sysmem_freeptr(s->order);
+        s->order = NULL;
+    }
+}
+
+void bed_end_stream(t_bed* x, int done)
+{
+    t_bed_stream* s = &x->stream;
+    if (done) {
+        post("bed • Wrote %ld frames to %s", s->frames, s->dest_path);
+    }
+    bed_close_stream(s, done);
+}
+
+/* The frame of the source that a frame of the destination comes from */
+long bed_stream_source(t_bed_stream* s, long frame)
+{
+    if (s->reverse) {
+        return s->frames - 1 - frame;
+    }
+    if (s->order == NULL) {
+        return frame;
+    }
+
+    /* Only the last segment of the source may be shorter, which moves the
+     * segments after it in the destination */
+    long length = s->segment_frames;
+    long last = s->frames - (s->segments - 1) * length;
+    long shorter = s->short_segment * length;
+    long segment;
+    long position;
+
+    if (frame < shorter) {
+        segment = frame / length;
+        position = frame % length;
+    } else if (frame < shorter + last) {
+        segment = s->short_segment;
+        position = frame - shorter;
     } else {
-        x->can_undo = 1;
-        x->undo_start = 0;
-        x->undo_frames = b->b_frames;
-        x->undo_resize = 0;
-        x->undo_cut = 0;
-        sysmem_copyptr(b->b_samples, x->undo_samples, chunksize);
+        segment = (frame - last) / length + 1;
+        position = (frame - last) % length;
+    }
+    return s->order[segment] * length + position;
+}
+
+/* Samples of every width are scaled as floats between -1 and 1 */
+static inline float bed_decode(t_bed_stream* s, const unsigned char* p)
+{
+    uint32_t word = s->big_endian ? bed_big(p, s->bytes)
+                                  : bed_little(p, s->bytes);
+    if (s->is_float) {
+        float value;
+        memcpy(&value, &word, sizeof(float));
+        return value;
     }
+    return (int32_t)(word << (32 - 8 * s->bytes)) / 2147483648.0f;
+}
 
-    float twopi = 8.0 * atan(1.0);
-    float oneoversr = 1.0 / b->b_sr;
-    for (int ii = 0; ii < b->b_frames; ii++) {
-        for (int jj = 0; jj < b->b_nchans; jj++) {
-            b->b_samples[(ii * b->b_nchans) + jj] *= sin(twopi * frequency * ii
-                                                         * oneoversr);
+static inline void bed_encode(t_bed_stream* s, unsigned char* p, float value)
+{
+    uint32_t word;
+    if (s->is_float) {
+        memcpy(&word, &value, sizeof(float));
+    } else {
+        double scaled = floor(value * s->scale + 0.5);
+        if (scaled > s->scale - 1) {
+            scaled = s->scale - 1;
+        } else if (scaled < -s->scale) {
+            scaled = -s->scale;
         }
+        word = (uint32_t)(int32_t)scaled;
     }
 
-    object_method(&b->b_obj, gensym("dirty"));
-    ATOMIC_DECREMENT(&b->b_inuse);
+    for (long ii = 0; ii < s->bytes; ii++) {
+        p[s->big_endian ? s->bytes - 1 - ii : ii] = word & 0xFF;
+        word >>= 8;
+    }
 }
 
-void bed_shuffle_n_segments(t_bed* x, long segments)
+/* Decode one channel of the frames [first, first + frames) of the
+ * destination from the source */
+void bed_stream_read(t_bed_stream* s, long channel, long first, long frames,
+                     float* block)
 {
-    if (!bed_attach_buffer(x)) {
-        return;
+    size_t stride = (size_t)s->nchans * s->bytes;
+    unsigned char* data = s->source + s->data_offset + channel * s->bytes;
+    for (long ii = 0; ii < frames; ii++) {
+        long frame = bed_stream_source(s, first + ii);
+        block[ii] = bed_decode(s, data + (size_t)frame * stride);
     }
+}
 
-    t_buffer* b;
-    b = x->buffer;
+void bed_stream_write(t_bed_stream* s, long channel, long first, long frames,
+                      float* block)
+{
+    size_t stride = (size_t)s->nchans * s->bytes;
+    unsigned char* data = s->dest + s->data_offset + channel * s->bytes;
+    for (long ii = 0; ii < frames; ii++) {
+        bed_encode(s, data + (size_t)(first + ii) * stride, block[ii]);
+    }
+}
 
-    ATOMIC_INCREMENT(&b->b_inuse);
+/* Process a sound file from disk to disk without loading it into a buffer.
+ * A reverse or a shuffle may come first and reorders the frames as they are
+ * read, then the pointwise operations of a batch apply on the way out */
+void bed_stream(t_bed* x, t_symbol* msg, short argc, t_atom* argv)
+{
+    defer(x, (method)bed_dostream, msg, argc, argv);
+}
 
-    if (!b->b_valid) {
-        ATOMIC_DECREMENT(&b->b_inuse);
-        post("bed • Not a valid buffer!");
+void bed_dostream(t_bed* x, t_symbol* msg, short argc, t_atom* argv)
+{
+    if (bed_busy(x)) {
         return;
     }
 
-    long chunksize = b->b_frames * b->b_nchans * sizeof(float);
-    if (x->undo_samples == NULL) {
-        x->undo_samples = (float*)sysmem_newptr(chunksize);
-    } else {
-        x->undo_samples = (float*)sysmem_resizeptr(x->undo_samples, chunksize);
+    if (argc < 2 || atom_gettype(argv) != A_SYM
+        || atom_gettype(argv + 1) != A_SYM) {
+        error("bed • stream needs a source and a destination file");
+        return;
     }
 
-    if (x->undo_samples == NULL) {
-        error("bed • Cannot allocate memory for undo");
-        x->can_undo = 0;
-        ATOMIC_DECREMENT(&b->b_inuse);
+    t_symbol* source = atom_getsym(argv);
+    t_symbol* dest = atom_getsym(argv + 1);
+    argc -= 2;
+    argv += 2;
+
+    char name[MAX_PATH_CHARS];
+    char source_path[MAX_PATH_CHARS];
+    char dest_path[MAX_PATH_CHARS];
+    short folder;
+    t_fourcc type;
+
+    strncpy_zero(name, source->s_name, MAX_PATH_CHARS);
+    if (locatefile_extended(name, &folder, &type, NULL, 0)
+        || path_toabsolutesystempath(folder, name, source_path)) {
+        error("bed • Cannot find %s", source->s_name);
         return;
-    } else {
-        x->can_undo = 1;
-        x->undo_start = 0;
-        x->undo_frames = b->b_frames;
-        x->undo_resize = 0;
-        x->undo_cut = 0;
-        sysmem_copyptr(b->b_samples, x->undo_samples, chunksize);
     }
 
-    long totallength = b->b_frames;
-    long basesegmentlength = ceil(totallength / segments);
+    /* Overwrite the destination where it is found, or else create it next
+     * to the patcher */
+    strncpy_zero(name, dest->s_name, MAX_PATH_CHARS);
+    if (locatefile_extended(name, &folder, &type, NULL, 0)) {
+        folder = path_getdefault();
+    }
+    if (path_toabsolutesystempath(folder, name, dest_path)) {
+        error("bed • Cannot write %s", dest->s_name);
+        return;
+    }
 
-    long randomsegment;
-    long start;
-    long end;
-    long bufferlength;
-    long buffersize;
-    float* local_buffer = NULL;
+    t_bed_stream* s = &x->stream;
+    s->reverse = 0;
+    if (!bed_map_source(x, s, source_path)) {
+        return;
+    }
+
+    long segments = 0;
+    if (argc > 0 && atom_getsym(argv) == gensym("reverse")) {
+        s->reverse = 1;
+        argc--;
+        argv++;
+    } else if (argc > 0 && atom_getsym(argv) == gensym("shuffle_n")) {
+        segments = argc > 1 ? atom_getlong(argv + 1) : 0;
+        if (segments < 1 || segments > s->frames) {
+            post("bed • %ld is not a valid number of segments", segments);
+            bed_close_stream(s, 0);
+            return;
+        }
+        argc -= 2;
+        argv += 2;
+    }
 
-    while (segments > 0) {
-        randomsegment = rand() % segments;
-        start = randomsegment * basesegmentlength;
-        end = start + basesegmentlength;
+    t_bed_job* j = bed_prepare_job(x, J_BATCH, s->nchans, s->frames, 1);
+    j->stream = s;
 
-        if (end > totallength) {
-            end = totallength;
+    /* Times are in the sample rate of the file */
+    if (argc > 0 || (!s->reverse && segments == 0)) {
+        if (!bed_parse_steps(j, s->frames, s->sr, argc, argv)) {
+            bed_close_stream(s, 0);
+            return;
         }
+        j->num_passes += bed_plan_batch(j);
+    }
 
-        bufferlength = (end - start);
-        buffersize = bufferlength * b->b_nchans * sizeof(float);
-        if (local_buffer == NULL) {
-            local_buffer = (float*)sysmem_newptr(buffersize);
-        } else {
-            local_buffer = (float*)sysmem_resizeptr(local_buffer, buffersize);
+    if (segments > 0) {
+        long segmentlength = ceil((double)s->frames / segments);
+        segments = (s->frames + segmentlength - 1) / segmentlength;
+
+        s->order = (long*)sysmem_newptr(segments * sizeof(long));
+        if (s->order == NULL) {
+            error("bed • Cannot allocate memory for shuffle");
+            bed_free_job(j);
+            bed_close_stream(s, 0);
+            return;
         }
-        sysmem_copyptr(b->b_samples + (start * b->b_nchans), local_buffer,
-                       buffersize);
+        bed_shuffle_order(x, s->order, segments);
 
-        for (long ii = end; ii < totallength; ii++) {
-            for (int jj = 0; jj < b->b_nchans; jj++) {
-                b->b_samples[((ii - bufferlength) * b->b_nchans) + jj]
-                    = b->b_samples[(ii * b->b_nchans) + jj];
+        s->segments = segments;
+        s->segment_frames = segmentlength;
+        for (long ii = 0; ii < segments; ii++) {
+            if (s->order[ii] == segments - 1) {
+                s->short_segment = ii;
             }
         }
-        sysmem_copyptr(local_buffer,
-                       b->b_samples
-                           + (totallength - bufferlength) * b->b_nchans,
-                       buffersize);
+    }
 
-        totallength -= bufferlength;
-        segments--;
+    if (!bed_map_dest(x, s, source_path, dest_path)) {
+        bed_free_job(j);
+        bed_close_stream(s, 0);
+        return;
     }
 
-    sysmem_freeptr(local_buffer);
+    if (x->async) {
+        x->async_op = gensym("stream");
+        x->async_samples = NULL;
+        bed_continue_async(x);
+        return;
+    }
 
-    object_method(&b->b_obj, gensym("dirty"));
-    ATOMIC_DECREMENT(&b->b_inuse);
+    while (bed_measuring(j)) {
+        bed_run_job(x, j);
+        if (!bed_next_pass(j)) {
+            bed_free_job(j);
+            bed_end_stream(x, 0);
+            return;
+        }
+    }
+
+    bed_run_job(x, j);
+    bed_free_job(j);
+    bed_end_stream(x, 1);
 }
 
 /******************************************************************************/
 
 void bed_undo(t_bed* x)
 {
-    if (!x->can_undo) {
+    if (bed_busy(x)) {
+        return;
+    }
+
+    if (x->next_edit == 0) {
         post("bed • Nothing to undo");
         return;
     }
@@ -696,59 +2728,49 @@ void bed_undo(t_bed* x)
         return;
     }
 
-    if (x->undo_cut) {
-        long bufferframes = b->b_frames;
-        long buffersize = bufferframes * b->b_nchans * sizeof(float);
-        float* local_buffer = (float*)sysmem_newptr(buffersize);
-        if (local_buffer == NULL) {
-            error("bed • Cannot allocate memory for undo");
-            x->can_undo = 0;
-            ATOMIC_DECREMENT(&b->b_inuse);
-            return;
-        } else {
-            sysmem_copyptr(b->b_samples, local_buffer, buffersize);
-        }
-
+    t_bed_edit* e = &x->history[x->next_edit - 1];
+    if (!bed_check_edit(x, b, e, 1) || !bed_apply_edit(x, b, e, 1)) {
         ATOMIC_DECREMENT(&b->b_inuse);
-        t_atom rv;
-        object_method_long(&b->b_obj, gensym("sizeinsamps"),
-                           (bufferframes + x->undo_frames), &rv);
-        ATOMIC_INCREMENT(&b->b_inuse);
+        return;
+    }
+    x->next_edit--;
 
-        long chunksize = x->undo_start * b->b_nchans * sizeof(float);
-        sysmem_copyptr(local_buffer, b->b_samples, chunksize);
+    object_method(&b->b_obj, gensym("dirty"));
+    ATOMIC_DECREMENT(&b->b_inuse);
+}
 
-        chunksize = x->undo_frames * b->b_nchans * sizeof(float);
-        sysmem_copyptr(x->undo_samples,
-                       b->b_samples + (x->undo_start * b->b_nchans),
-                       chunksize);
-        chunksize = (bufferframes - x->undo_start) * b->b_nchans
-            * sizeof(float);
-        sysmem_copyptr(local_buffer + (x->undo_start * b->b_nchans),
-                       b->b_samples
-                           + (x->undo_start + x->undo_frames) * b->b_nchans,
-                       chunksize);
+void bed_redo(t_bed* x)
+{
+    if (bed_busy(x)) {
+        return;
+    }
+
+    if (x->next_edit == x->num_edits) {
+        post("bed • Nothing to redo");
+        return;
+    }
+
+    if (!bed_attach_buffer(x)) {
+        return;
+    }
 
-        sysmem_freeptr(local_buffer);
+    t_buffer* b;
+    b = x->buffer;
 
-        x->undo_cut = 0;
+    ATOMIC_INCREMENT(&b->b_inuse);
 
-        object_method(&b->b_obj, gensym("dirty"));
+    if (!b->b_valid) {
         ATOMIC_DECREMENT(&b->b_inuse);
+        post("bed • Not a valid buffer!");
         return;
     }
 
-    if (x->undo_resize) {
+    t_bed_edit* e = &x->history[x->next_edit];
+    if (!bed_check_edit(x, b, e, 0) || !bed_apply_edit(x, b, e, 0)) {
         ATOMIC_DECREMENT(&b->b_inuse);
-        t_atom rv;
-        object_method_long(&b->b_obj, gensym("sizeinsamps"), x->undo_frames,
-                           &rv);
-        ATOMIC_INCREMENT(&b->b_inuse);
+        return;
     }
-
-    long chunksize = x->undo_frames * b->b_nchans * sizeof(float);
-    sysmem_copyptr(x->undo_samples, b->b_samples + x->undo_start, chunksize);
-    x->can_undo = 0;
+    x->next_edit++;
 
     object_method(&b->b_obj, gensym("dirty"));
     ATOMIC_DECREMENT(&b->b_inuse);
@@ -3,49 +3,256 @@
 #include "m_pd.h"
 #include "stdlib.h"
 #include <math.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <string.h>
 
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/* The global variables
+ * *******************************************************/
+#define MAXIMUM_CHANNELS 16
+#define MAXIMUM_UNDO_STEPS 64
+#define DEFAULT_UNDO_MEMORY 64.0
+
+#define MINIMUM_WORKERS 1
+#define DEFAULT_WORKERS 4
+#define MAXIMUM_WORKERS 16
+
+#define CHUNK_FRAMES 65536
+#define RING_BLOCK 256
+#define MAXIMUM_STEPS 16
+#define ASYNC_POLL_INTERVAL 10.0
+
 /* The class pointer
  * **********************************************************/
 static t_class* bed_class;
 
+/* The kinds of edits kept in the undo history
+ * ********************************/
+enum EDITS { E_SAMPLES, E_REVERSE, E_SHUFFLE, E_CUT };
+
+/* One step of the undo history
+ * ***********************************************/
+typedef struct _bed_edit {
+    long type;
+    long start;
+    long frames;
+    long channels;
+    long bytes;
+
+    float* samples;
+
+    long* order;
+    long segments;
+    long segment_frames;
+} t_bed_edit;
+
+/* The per-frame operations that can be split among workers
+ * ******************/
+enum JOBS {
+    J_PEAK,
+    J_SCALE,
+    J_FADEIN,
+    J_FADEOUT,
+    J_REVERSE,
+    J_RING,
+    J_BATCH_PEAK,
+    J_BATCH,
+    J_TARGETS
+};
+
+/* What became of each array an operation was applied to
+ * **********************/
+enum TARGETS { T_DONE, T_SKIPPED, T_FAILED };
+
+#ifdef _WIN32
+typedef HANDLE t_bed_thread;
+#else
+typedef pthread_t t_bed_thread;
+#endif
+
+/* One worker of a job and the range of iterations it processes
+ * ***************/
+typedef struct _bed_worker {
+    struct _bed_job* job;
+    long first;
+    long last;
+    volatile long done;
+    float peak;
+
+    t_bed_thread thread;
+    int running;
+} t_bed_worker;
+
+/* A pointwise operation, one step of a batch
+ * *********************************/
+typedef struct _bed_step {
+    long type;
+    long start;
+    long length;
+    float gain;
+    float newmax;
+
+    double increment;
+    double rotation_cos[RING_BLOCK];
+    double rotation_sin[RING_BLOCK];
+    float* table;
+    long table_size;
+} t_bed_step;
+
+/* One of the arrays an operation is applied to, besides the buffer
+ * ***********/
+typedef struct _bed_target {
+    t_symbol* name;
+    t_garray* buffer;
+    float* samples;
+    long frames;
+    long status;
+} t_bed_target;
+
+/* A sound file processed from disk to disk, both files mapped in memory.
+ * The frames may be read in another order than they are written
+ * *************/
+typedef struct _bed_stream {
+    unsigned char* source;
+    size_t source_size;
+    unsigned char* dest;
+    size_t dest_size;
+    char dest_path[MAXPDSTRING];
+
+    size_t data_offset;
+    long frames;
+    long nchans;
+    long bytes;
+    long is_float;
+    long big_endian;
+    double scale;
+    float sr;
+
+    long reverse;
+    long* order;
+    long segments;
+    long segment_frames;
+    long short_segment;
+} t_bed_stream;
+
+/* A per-frame operation on the buffer
+ * ****************************************/
+typedef struct _bed_job {
+    long type;
+    float* samples[MAXIMUM_CHANNELS];
+    long nchans;
+    long offset;
+    long length;
+    long count;
+
+    float gain;
+    float newmax;
+    float peak;
+
+    t_bed_step steps[MAXIMUM_STEPS];
+    long num_steps;
+    long peak_steps;
+
+    t_bed_target* targets;
+    long target_type;
+
+    t_bed_stream* stream;
+
+    long pass;
+    long num_passes;
+
+    float progress_from;
+    float progress_to;
+    float progress_sent;
+
+    long num_workers;
+    t_bed_worker workers[MAXIMUM_WORKERS];
+} t_bed_job;
+
 /* The object structure
  * *******************************************************/
 typedef struct _bed {
     t_object obj;
 
-    t_symbol* b_name;
-    t_garray* buffer;
+    t_symbol* b_names[MAXIMUM_CHANNELS];
+    t_garray* buffers[MAXIMUM_CHANNELS];
+    long b_nchans;
 
     long b_valid;
     long b_frames;
-    float* b_samples;
+    float* b_channels[MAXIMUM_CHANNELS];
     float b_sr;
 
-    float* undo_samples;
-    long undo_start;
-    long undo_frames;
-    long can_undo;
-    long undo_resize;
-    long undo_cut;
+    t_bed_edit history[MAXIMUM_UNDO_STEPS];
+    long num_edits;
+    long next_edit;
+    long history_bytes;
+    long history_budget;
+
+    t_bed_job job;
+    long num_workers;
+
+    long async;
+    t_symbol* async_op;
+    long async_edit;
+    long async_start;
+    long async_frames;
+    long async_total;
+    long async_nchans;
+    float* async_samples;
+    void* async_clock;
+
+    t_symbol** targets;
+    long num_targets;
+
+    uint64_t seed;
+
+    t_canvas* canvas;
+    t_bed_stream stream;
+
+    void* status_outlet;
 } t_bed;
 
 /* Function prototypes
  * ********************************************************/
-void* bed_new(t_symbol* s);
+void* bed_new(t_symbol* s, short argc, t_atom* argv);
 void bed_free(t_bed* x);
 
 void bed_info(t_bed* x);
-void bed_bufname(t_bed* x, t_symbol* name);
+void bed_bufname(t_bed* x, t_symbol* msg, short argc, t_atom* argv);
 void bed_normalize(t_bed* x, t_symbol* msg, short argc, t_atom* argv);
 void bed_fadein(t_bed* x, t_floatarg fadetime);
 void bed_fadeout(t_bed* x, t_floatarg fadetime);
 void bed_cut(t_bed* x, t_floatarg start, t_floatarg end);
-void bed_paste(t_bed* x, t_symbol* destname);
+void bed_paste(t_bed* x, t_symbol* msg, short argc, t_atom* argv);
 void bed_reverse(t_bed* x);
-void bed_ring_modulation(t_bed* x, t_floatarg frequency);
+void bed_ring_modulation(t_bed* x, t_floatarg frequency, t_symbol* waveform);
 void bed_shuffle_n_segments(t_bed* x, t_floatarg segments);
 void bed_undo(t_bed* x);
+void bed_redo(t_bed* x);
+void bed_undo_memory(t_bed* x, t_floatarg megabytes);
+void bed_workers(t_bed* x, t_floatarg workers);
+void bed_async(t_bed* x, t_floatarg async);
+void bed_batch(t_bed* x, t_symbol* msg, short argc, t_atom* argv);
+void bed_targets(t_bed* x, t_symbol* msg, short argc, t_atom* argv);
+void bed_each(t_bed* x, t_symbol* msg, short argc, t_atom* argv);
+void bed_stream(t_bed* x, t_symbol* msg, short argc, t_atom* argv);
+
+void bed_clear_history(t_bed* x, long first);
+void bed_join_job(t_bed_job* j);
+void bed_free_job(t_bed_job* j);
+void bed_async_tick(t_bed* x);
+void bed_close_stream(t_bed_stream* s, int keep);
 
 /* The initialization routine
  * *************************************************/
@@ -56,11 +263,11 @@ void bed_setup(void)
 {
     /* Initialize the class */
     bed_class = class_new(gensym("bed"), (t_newmethod)bed_new,
-                          (t_method)bed_free, sizeof(t_bed), 0, A_SYMBOL, 0);
+                          (t_method)bed_free, sizeof(t_bed), 0, A_GIMME, 0);
 
     /* Bind the object-specific methods */
     class_addmethod(bed_class, (t_method)bed_info, gensym("info"), 0);
-    class_addmethod(bed_class, (t_method)bed_bufname, gensym("name"), A_SYMBOL,
+    class_addmethod(bed_class, (t_method)bed_bufname, gensym("name"), A_GIMME,
                     0);
     class_addmethod(bed_class, (t_method)bed_normalize, gensym("normalize"),
                     A_GIMME, 0);
@@ -70,14 +277,29 @@ void bed_setup(void)
                     A_FLOAT, 0);
     class_addmethod(bed_class, (t_method)bed_cut, gensym("cut"), A_FLOAT,
                     A_FLOAT, 0);
-    class_addmethod(bed_class, (t_method)bed_paste, gensym("paste"), A_SYMBOL,
+    class_addmethod(bed_class, (t_method)bed_paste, gensym("paste"), A_GIMME,
                     0);
     class_addmethod(bed_class, (t_method)bed_reverse, gensym("reverse"), 0);
     class_addmethod(bed_class, (t_method)bed_ring_modulation, gensym("ring"),
-                    A_FLOAT, 0);
+                    A_FLOAT, A_DEFSYM, 0);
     class_addmethod(bed_class, (t_method)bed_shuffle_n_segments,
                     gensym("shuffle_n"), A_FLOAT, 0);
     class_addmethod(bed_class, (t_method)bed_undo, gensym("undo"), 0);
+    class_addmethod(bed_class, (t_method)bed_redo, gensym("redo"), 0);
+    class_addmethod(bed_class, (t_method)bed_undo_memory,
+                    gensym("undo_memory"), A_FLOAT, 0);
+    class_addmethod(bed_class, (t_method)bed_workers, gensym("workers"),
+                    A_FLOAT, 0);
+    class_addmethod(bed_class, (t_method)bed_async, gensym("async"), A_FLOAT,
+                    0);
+    class_addmethod(bed_class, (t_method)bed_batch, gensym("batch"), A_GIMME,
+                    0);
+    class_addmethod(bed_class, (t_method)bed_targets, gensym("targets"),
+                    A_GIMME, 0);
+    class_addmethod(bed_class, (t_method)bed_each, gensym("each"), A_GIMME,
+                    0);
+    class_addmethod(bed_class, (t_method)bed_stream, gensym("stream"),
+                    A_GIMME, 0);
 
     /* Print message to Max window */
     post("bed • External was loaded");
@@ -85,16 +307,42 @@ void bed_setup(void)
 
 /* The new and free instance routines
  * *****************************************/
-void* bed_new(t_symbol* s)
+int bed_set_names(t_bed* x, short argc, t_atom* argv);
+
+void* bed_new(t_symbol* s, short argc, t_atom* argv)
 {
     /* Instantiate a new object */
     t_bed* x = (t_bed*)pd_new(bed_class);
 
-    /* Parse passed argument */
-    x->b_name = s;
+    /* Parse passed arguments, one array per channel */
+    x->b_names[0] = &s_;
+    x->b_nchans = 1;
+    if (argc > 0) {
+        bed_set_names(x, argc, argv);
+    }
+
+    /* Create the status outlet */
+    x->status_outlet = outlet_new(&x->obj, gensym("anything"));
 
     /* Initialize some state variables */
-    x->undo_cut = 0;
+    x->num_edits = 0;
+    x->next_edit = 0;
+    x->history_bytes = 0;
+    x->history_budget = DEFAULT_UNDO_MEMORY * 1024 * 1024;
+    x->num_workers = DEFAULT_WORKERS;
+
+    x->async = 0;
+    x->async_op = NULL;
+    x->async_samples = NULL;
+    x->async_clock = clock_new(x, (t_method)bed_async_tick);
+    x->job.num_steps = 0;
+    x->targets = NULL;
+    x->num_targets = 0;
+    x->seed = ((uint64_t)rand() << 32) ^ rand() ^ (uintptr_t)x;
+    x->canvas = canvas_getcurrent();
+    x->stream.source = NULL;
+    x->stream.dest = NULL;
+    x->stream.order = NULL;
 
     /* Print message to Max window */
     post("bed • Object was created");
@@ -105,8 +353,23 @@ void* bed_new(t_symbol* s)
 
 void bed_free(t_bed* x)
 {
+    /* Wait for a pending asynchronous edit and discard it */
+    if (x->async_op != NULL) {
+        bed_join_job(&x->job);
+        bed_free_job(&x->job);
+        if (x->async_samples != NULL) {
+            freebytes(x->async_samples,
+                      x->async_frames * x->async_nchans * sizeof(float));
+        }
+        bed_close_stream(&x->stream, 0);
+    }
+    clock_free(x->async_clock);
+
     /* Free allocated dynamic memory */
-    freebytes(x->undo_samples, x->undo_frames);
+    bed_clear_history(x, 0);
+    if (x->targets != NULL) {
+        freebytes(x->targets, x->num_targets * sizeof(t_symbol*));
+    }
 
     /* Print message to Max window */
     post("bed • Object was deleted");
@@ -114,38 +377,57 @@ void bed_free(t_bed* x)
 
 /* The object-specific methods
  * ************************************************/
-int bed_attach_buffer(t_bed* x)
+float bed_sample_rate(void)
 {
-    t_symbol* b_name;
-    float* b_samples;
-    int b_frames;
+    float sr = sys_getsr();
+    return sr > 0 ? sr : 44100.0;
+}
 
-    b_name = x->b_name;
+/* Attach the arrays of the group, which must all have the same length */
+int bed_attach_buffer(t_bed* x)
+{
     x->b_valid = 0;
 
-    if (!(x->buffer = (t_garray*)pd_findbyclass(b_name, garray_class))) {
-        if (b_name->s_name) {
-            post("bed • \"%s\" is not a valid buffer", x->b_name->s_name);
+    for (long ii = 0; ii < x->b_nchans; ii++) {
+        t_symbol* b_name = x->b_names[ii];
+        float* b_samples;
+        int b_frames;
+
+        x->buffers[ii] = (t_garray*)pd_findbyclass(b_name, garray_class);
+        if (x->buffers[ii] == NULL) {
+            if (b_name->s_name) {
+                post("bed • \"%s\" is not a valid buffer", b_name->s_name);
+            }
+            return (int)x->b_valid;
         }
-        return (int)x->b_valid;
-    }
 
-    if (!garray_getfloatarray(x->buffer, &b_frames, &b_samples)) {
-        post("bed • \"%s\" is not a valid buffer", x->b_name->s_name);
-        return (int)x->b_valid;
-    } else {
-        x->b_valid = 1;
-        x->b_frames = (long)b_frames;
-        x->b_samples = b_samples;
-        x->b_sr = sys_getsr();
+        if (!garray_getfloatarray(x->buffers[ii], &b_frames, &b_samples)) {
+            post("bed • \"%s\" is not a valid buffer", b_name->s_name);
+            return (int)x->b_valid;
+        }
 
-        if (x->b_sr <= 0) {
-            x->b_sr = 44100.0;
+        if (ii > 0 && b_frames != x->b_frames) {
+            post("bed • \"%s\" and \"%s\" do not have the same length",
+                 x->b_names[0]->s_name, b_name->s_name);
+            return (int)x->b_valid;
         }
+
+        x->b_frames = (long)b_frames;
+        x->b_channels[ii] = b_samples;
     }
+
+    x->b_valid = 1;
+    x->b_sr = bed_sample_rate();
     return (int)x->b_valid;
 }
 
+void bed_redraw(t_bed* x)
+{
+    for (long ii = 0; ii < x->b_nchans; ii++) {
+        garray_redraw(x->buffers[ii]);
+    }
+}
+
 int bed_attach_any_buffer(t_garray** destbuf, t_symbol* b_name)
 {
     if (!(*destbuf = (t_garray*)pd_findbyclass(b_name, garray_class))) {
@@ -157,444 +439,1705 @@ int bed_attach_any_buffer(t_garray** destbuf, t_symbol* b_name)
     return 1;
 }
 
-/******************************************************************************/
-void bed_info(t_bed* x)
+/* The undo history
+ * ***********************************************************/
+void bed_free_edit(t_bed_edit* e)
 {
-    if (!bed_attach_buffer(x)) {
-        return;
+    if (e->samples != NULL) {
+        freebytes(e->samples, e->frames * e->channels * sizeof(float));
+        e->samples = NULL;
+    }
+    if (e->order != NULL) {
+        freebytes(e->order, e->segments * sizeof(long));
+        e->order = NULL;
     }
-
-    post("bed • Information:");
-    post("    buffer name: %s", x->b_name->s_name);
-    post("    frame count: %d", x->b_frames);
-    post("    validity: %d", x->b_valid);
 }
 
-void bed_bufname(t_bed* x, t_symbol* name) { x->b_name = name; }
-
-/******************************************************************************/
-void bed_normalize(t_bed* x, t_symbol* msg, short argc, t_atom* argv)
+/* Forget every edit from 'first' onwards */
+void bed_clear_history(t_bed* x, long first)
 {
-    if (argc > 1) {
-        pd_error(x, "bed • The message must have at most two members");
-        return;
+    for (long ii = first; ii < x->num_edits; ii++) {
+        x->history_bytes -= x->history[ii].bytes;
+        bed_free_edit(&x->history[ii]);
     }
 
-    float newmax = 1.0;
-    if (argc == 1) {
-        newmax = atom_getfloat(argv);
+    x->num_edits = first;
+    if (x->next_edit > first) {
+        x->next_edit = first;
     }
+}
 
-    if (!bed_attach_buffer(x)) {
-        return;
-    }
+void bed_drop_oldest_edit(t_bed* x)
+{
+    x->history_bytes -= x->history[0].bytes;
+    bed_free_edit(&x->history[0]);
 
-    if (!x->b_valid) {
-        post("bed • Not a valid buffer!");
-        return;
-    }
+    memmove(x->history, x->history + 1,
+            (x->num_edits - 1) * sizeof(t_bed_edit));
+    x->num_edits--;
+    x->next_edit--;
+}
 
-    long chunksize = x->b_frames * sizeof(float);
-    if (x->undo_samples == NULL) {
-        x->undo_samples = getbytes(chunksize);
-    } else {
-        long oldsize = x->undo_frames * sizeof(float);
-        x->undo_samples = resizebytes(x->undo_samples, oldsize, chunksize);
+/* Drop the oldest edits, then the furthest edits to redo, while the
+ * history is over budget. The last edit is always kept. */
+void bed_trim_history(t_bed* x)
+{
+    while (x->num_edits > 1 && x->history_bytes > x->history_budget) {
+        if (x->next_edit > 0) {
+            bed_drop_oldest_edit(x);
+        } else {
+            bed_clear_history(x, x->num_edits - 1);
+        }
     }
+}
 
-    if (x->undo_samples == NULL) {
-        pd_error(x, "bed • Cannot allocate memory for undo");
-        x->can_undo = 0;
-        return;
-    } else {
-        x->can_undo = 1;
-        x->undo_start = 0;
-        x->undo_frames = x->b_frames;
-        x->undo_resize = 0;
-        x->undo_cut = 0;
-        memcpy(x->undo_samples, x->b_samples, chunksize);
-    }
+/* Record a new edit, saving the frames it is about to change if asked to */
+t_bed_edit* bed_push_edit(t_bed* x, long type, long start, long frames,
+                          int save_samples)
+{
+    float* samples = NULL;
+    long chunksize = frames * sizeof(float);
 
-    float maxamp = 0.0;
-    for (int ii = 0; ii < x->b_frames; ii++) {
-        if (maxamp < fabs(x->b_samples[ii])) {
-            maxamp = fabs(x->b_samples[ii]);
+    /* The channels are saved one after the other */
+    if (save_samples) {
+        samples = getbytes(chunksize * x->b_nchans);
+        if (samples == NULL) {
+            pd_error(x, "bed • Cannot allocate memory for undo");
+            return NULL;
+        }
+        for (long ii = 0; ii < x->b_nchans; ii++) {
+            memcpy(samples + (ii * frames), x->b_channels[ii] + start,
+                   chunksize);
         }
     }
 
-    float rescale;
-    if (maxamp > 1e-6) {
-        rescale = newmax / maxamp;
-    } else {
-        post("bed • Amplitude is too low to rescale: %.2f", maxamp);
-        return;
-    }
+    /* A new edit discards the edits that could have been redone */
+    bed_clear_history(x, x->next_edit);
 
-    for (int ii = 0; ii < x->b_frames; ii++) {
-        x->b_samples[ii] *= rescale;
+    if (x->num_edits == MAXIMUM_UNDO_STEPS) {
+        bed_drop_oldest_edit(x);
     }
 
-    garray_redraw(x->buffer);
-}
+    t_bed_edit* e = &x->history[x->num_edits];
+    e->type = type;
+    e->start = start;
+    e->frames = frames;
+    e->channels = x->b_nchans;
+    e->bytes = save_samples ? chunksize * x->b_nchans : 0;
+    e->samples = samples;
+    e->order = NULL;
+    e->segments = 0;
+    e->segment_frames = 0;
 
-void bed_fadein(t_bed* x, t_floatarg fadetime)
-{
-    if (!bed_attach_buffer(x)) {
-        return;
-    }
+    x->num_edits++;
+    x->next_edit = x->num_edits;
+    x->history_bytes += e->bytes;
 
-    if (!x->b_valid) {
-        post("bed • Not a valid buffer!");
-        return;
-    }
+    bed_trim_history(x);
 
-    long fadeframes = fadetime * 0.001 * x->b_sr;
-    if (fadetime <= 0 || fadeframes > x->b_frames) {
-        post("bed • %.0fms is not a valid fade-in time", fadetime);
-        return;
-    }
+    return &x->history[x->next_edit - 1];
+}
 
-    long chunksize = fadeframes * sizeof(float);
-    if (x->undo_samples == NULL) {
-        x->undo_samples = getbytes(chunksize);
-    } else {
-        long oldsize = x->undo_frames * sizeof(float);
-        x->undo_samples = resizebytes(x->undo_samples, oldsize, chunksize);
-    }
+/* Give up an edit whose operation could not be carried out */
+void bed_pop_edit(t_bed* x) { bed_clear_history(x, x->next_edit - 1); }
 
-    if (x->undo_samples == NULL) {
-        pd_error(x, "bed • Cannot allocate memory for undo");
-        x->can_undo = 0;
+void bed_undo_memory(t_bed* x, t_floatarg megabytes)
+{
+    if (megabytes < 0) {
+        post("bed • %.2f MB is not a valid undo memory size", megabytes);
         return;
-    } else {
-        x->can_undo = 1;
-        x->undo_start = 0;
-        x->undo_frames = fadeframes;
-        x->undo_resize = 0;
-        x->undo_cut = 0;
-        memcpy(x->undo_samples, x->b_samples, chunksize);
-    }
-
-    for (int ii = 0; ii < fadeframes; ii++) {
-        x->b_samples[ii] *= (float)ii / (float)fadeframes;
     }
 
-    garray_redraw(x->buffer);
+    x->history_budget = megabytes * 1024 * 1024;
+    bed_trim_history(x);
 }
 
-void bed_fadeout(t_bed* x, t_floatarg fadetime)
+/* The workers
+ * ****************************************************************/
+void bed_workers(t_bed* x, t_floatarg workers)
 {
-    if (!bed_attach_buffer(x)) {
-        return;
+    long num_workers = workers;
+    if (num_workers < MINIMUM_WORKERS) {
+        num_workers = MINIMUM_WORKERS;
+        post("bed • Invalid argument: Minimum number of workers set to %d",
+             num_workers);
+    } else if (num_workers > MAXIMUM_WORKERS) {
+        num_workers = MAXIMUM_WORKERS;
+        post("bed • Invalid argument: Maximum number of workers set to %d",
+             num_workers);
     }
 
-    if (!x->b_valid) {
-        post("bed • Not a valid buffer!");
-        return;
-    }
-
-    long fadeframes = fadetime * 0.001 * x->b_sr;
-    if (fadetime <= 0 || fadeframes > x->b_frames) {
-        post("bed • %.0fms is not a valid fade-out time", fadetime);
-        return;
-    }
+    x->num_workers = num_workers;
+}
 
-    long chunksize = fadeframes * sizeof(float);
-    if (x->undo_samples == NULL) {
-        x->undo_samples = getbytes(chunksize);
-    } else {
-        long oldsize = x->undo_frames * sizeof(float);
-        x->undo_samples = resizebytes(x->undo_samples, oldsize, chunksize);
-    }
+/* The end of the block that holds frame ii. Blocks are aligned on the frames
+ * of the array, so they do not depend on how a job is split */
+long bed_block_end(t_bed_job* j, long ii, long last)
+{
+    long end = ii + RING_BLOCK - ((j->offset + ii) % RING_BLOCK);
+    return end < last ? end : last;
+}
 
-    if (x->undo_samples == NULL) {
-        pd_error(x, "bed • Cannot allocate memory for undo");
-        x->can_undo = 0;
-        return;
+/* The modulator of the frames [first, first + frames) of one block. Each
+ * block starts from the exact phase of its first frame and rotates it by a
+ * table of angles, so the phase does not drift on long buffers and the frames
+ * of a block do not depend on each other */
+void bed_ring_block(t_bed_step* s, long first, long frames, float* modulator)
+{
+    long offset = first % RING_BLOCK;
+    double twopi = 8.0 * atan(1.0);
+    double phase = s->increment * (first - offset);
+    phase -= floor(phase);
+
+    if (s->table == NULL) {
+        double re = cos(twopi * phase);
+        double im = sin(twopi * phase);
+        for (long ii = 0; ii < frames; ii++) {
+            modulator[ii] = im * s->rotation_cos[offset + ii]
+                + re * s->rotation_sin[offset + ii];
+        }
     } else {
-        x->can_undo = 1;
-        x->undo_start = x->b_frames - fadeframes;
-        x->undo_frames = fadeframes;
-        x->undo_resize = 0;
-        x->undo_cut = 0;
-        memcpy(x->undo_samples, x->b_samples + x->undo_start, chunksize);
-    }
+        /* One cycle of the waveform, read with linear interpolation */
+        for (long ii = 0; ii < frames; ii++) {
+            double position = phase + s->increment * (offset + ii);
+            position = (position - floor(position)) * s->table_size;
+
+            long index = (long)position;
+            if (index >= s->table_size) {
+                index = s->table_size - 1;
+            }
+            long next = index + 1 < s->table_size ? index + 1 : 0;
+            double fraction = position - index;
 
-    for (int ii = (int)x->undo_start; ii < x->undo_start + fadeframes; ii++) {
-        x->b_samples[ii] *= 1
-            - (float)(ii - x->undo_start) / (float)fadeframes;
+            modulator[ii] = s->table[index]
+                + fraction * (s->table[next] - s->table[index]);
+        }
     }
-
-    garray_redraw(x->buffer);
 }
 
-void bed_cut(t_bed* x, t_floatarg start, t_floatarg end)
+/* The factor of one step for the frames [first, first + frames) of one
+ * block, computed as the operation on its own would compute it */
+void bed_step_factors(t_bed_step* s, long first, long frames, float* factors)
 {
-    if (!bed_attach_buffer(x)) {
-        return;
-    }
-
-    if (!x->b_valid) {
-        post("bed • Not a valid buffer!");
-        return;
-    }
-
-    long startframe = start * 0.001 * x->b_sr;
-    long endframe = end * 0.001 * x->b_sr;
-    long cutframes = endframe - startframe;
-
-    if (startframe < 0 || endframe > x->b_frames || startframe > endframe) {
-        post("bed • %.0fms and %.0fms are not valid cut times", start, end);
-        return;
-    }
+    switch (s->type) {
+    case J_PEAK:
+    case J_SCALE:
+        for (long ii = 0; ii < frames; ii++) {
+            factors[ii] = s->gain;
+        }
+        break;
 
-    long chunksize = cutframes * sizeof(float);
-    if (x->undo_samples == NULL) {
-        x->undo_samples = getbytes(chunksize);
-    } else {
-        long oldsize = x->undo_frames * sizeof(float);
-        x->undo_samples = resizebytes(x->undo_samples, oldsize, chunksize);
-    }
+    case J_FADEIN:
+        for (long ii = 0; ii < frames; ii++) {
+            long kk = first + ii - s->start;
+            factors[ii] = kk < s->length ? (float)kk / (float)s->length : 1.0;
+        }
+        break;
 
-    if (x->undo_samples == NULL) {
-        pd_error(x, "bed • Cannot allocate memory for undo");
-        x->can_undo = 0;
-        return;
-    } else {
-        x->can_undo = 1;
-        x->undo_start = startframe;
-        x->undo_frames = cutframes;
-        x->undo_resize = 1;
-        x->undo_cut = 1;
-        memcpy(x->undo_samples, x->b_samples + startframe, chunksize);
-    }
+    case J_FADEOUT:
+        for (long ii = 0; ii < frames; ii++) {
+            long kk = first + ii - s->start;
+            factors[ii] = kk >= 0 ? 1 - (float)kk / (float)s->length : 1.0;
+        }
+        break;
 
-    long bufferframes = x->b_frames;
-    long buffersize = bufferframes * sizeof(float);
-    float* local_buffer = getbytes(buffersize);
-    if (local_buffer == NULL) {
-        pd_error(x, "bed • Cannot allocate memory for undo");
-        x->can_undo = 0;
-        return;
-    } else {
-        memcpy(local_buffer, x->b_samples, buffersize);
+    case J_RING:
+        bed_ring_block(s, first, frames, factors);
+        break;
     }
+}
 
-    garray_resize(x->buffer, x->b_frames - cutframes);
-
-    chunksize = startframe * sizeof(float);
-    memcpy(x->b_samples, local_buffer, chunksize);
-    chunksize = (bufferframes - endframe) * sizeof(float);
-    memcpy(x->b_samples + startframe, local_buffer + endframe, chunksize);
+void bed_process_target(t_bed_job* j, t_bed_target* t);
+void bed_stream_read(t_bed_stream* s, long channel, long first, long frames,
+                     float* block);
+void bed_stream_write(t_bed_stream* s, long channel, long first, long frames,
+                      float* block);
 
-    freebytes(local_buffer, buffersize);
+/* Run iterations [first, last) of a job, one frame, pair or target each, on
+ * every channel */
+void bed_process_frames(t_bed_job* j, long first, long last, float* peak)
+{
+    long nchans = j->nchans;
+    float factors[MAXIMUM_STEPS][RING_BLOCK];
+    float block[RING_BLOCK];
+
+    switch (j->type) {
+    case J_PEAK:
+        for (long cc = 0; cc < nchans; cc++) {
+            float* samples = j->samples[cc];
+            for (long ii = first; ii < last; ii++) {
+                if (*peak < fabs(samples[ii])) {
+                    *peak = fabs(samples[ii]);
+                }
+            }
+        }
+        break;
 
-    garray_redraw(x->buffer);
-}
+    case J_SCALE:
+        for (long cc = 0; cc < nchans; cc++) {
+            float* samples = j->samples[cc];
+            for (long ii = first; ii < last; ii++) {
+                samples[ii] *= j->gain;
+            }
+        }
+        break;
 
-void bed_paste(t_bed* x, t_symbol* destname)
-{
-    if (x->can_undo && x->undo_cut) {
-        if (!bed_attach_buffer(x)) {
-            return;
+    case J_FADEIN:
+        for (long cc = 0; cc < nchans; cc++) {
+            float* samples = j->samples[cc];
+            for (long ii = first; ii < last; ii++) {
+                samples[ii] *= (float)ii / (float)j->length;
+            }
         }
+        break;
 
-        t_garray* destbuf = NULL;
-        int destbuf_b_frames;
-        float* destbuf_b_samples;
-        if (bed_attach_any_buffer(&destbuf, destname)) {
-            if (!garray_getfloatarray(destbuf, &destbuf_b_frames,
-                                      &destbuf_b_samples)) {
-                post("bed • \"%s\" is not a valid buffer", destname->s_name);
-                return;
+    case J_FADEOUT:
+        for (long cc = 0; cc < nchans; cc++) {
+            float* samples = j->samples[cc];
+            for (long ii = first; ii < last; ii++) {
+                samples[ii] *= 1 - (float)ii / (float)j->length;
+            }
+        }
+        break;
+
+    case J_REVERSE:
+        for (long cc = 0; cc < nchans; cc++) {
+            float* samples = j->samples[cc];
+            for (long ii = first; ii < last; ii++) {
+                float temp = samples[ii];
+                samples[ii] = samples[j->length - 1 - ii];
+                samples[j->length - 1 - ii] = temp;
+            }
+        }
+        break;
+
+    case J_RING:
+        for (long ii = first; ii < last; ii = bed_block_end(j, ii, last)) {
+            long frames = bed_block_end(j, ii, last) - ii;
+            bed_ring_block(&j->steps[0], j->offset + ii, frames, factors[0]);
+            for (long cc = 0; cc < nchans; cc++) {
+                float* samples = j->samples[cc] + ii;
+                for (long kk = 0; kk < frames; kk++) {
+                    samples[kk] *= factors[0][kk];
+                }
             }
-            garray_resize(destbuf, x->undo_frames);
-            if (!garray_getfloatarray(destbuf, &destbuf_b_frames,
-                                      &destbuf_b_samples)) {
-                post("bed • \"%s\" is not a valid buffer", destname->s_name);
-                return;
+        }
+        break;
+
+    /* Apply the steps one after the other to each block while it is in the
+     * cache, in the order and with the rounding of separate operations. The
+     * factors of a block are shared by its channels. A measuring pass applies
+     * the steps before a normalize to a copy of the block and keeps its
+     * peak */
+    case J_BATCH_PEAK:
+    case J_BATCH:
+        for (long ii = first; ii < last; ii = bed_block_end(j, ii, last)) {
+            long frames = bed_block_end(j, ii, last) - ii;
+            long num_steps = j->num_steps;
+            if (j->type == J_BATCH_PEAK) {
+                num_steps = j->peak_steps;
             }
 
-            long chunksize = x->undo_frames * sizeof(float);
-            memcpy(destbuf_b_samples, x->undo_samples, chunksize);
+            int active[MAXIMUM_STEPS];
+            for (long jj = 0; jj < num_steps; jj++) {
+                t_bed_step* s = &j->steps[jj];
+                active[jj] = j->offset + ii < s->start + s->length
+                    && j->offset + ii + frames > s->start;
+                if (active[jj]) {
+                    bed_step_factors(s, j->offset + ii, frames, factors[jj]);
+                }
+            }
 
-            garray_redraw(destbuf);
+            for (long cc = 0; cc < nchans; cc++) {
+                float* frame = block;
+                if (j->stream != NULL) {
+                    bed_stream_read(j->stream, cc, j->offset + ii, frames,
+                                    block);
+                } else if (j->type == J_BATCH_PEAK) {
+                    memcpy(block, j->samples[cc] + ii, frames * sizeof(float));
+                } else {
+                    frame = j->samples[cc] + ii;
+                }
+
+                for (long jj = 0; jj < num_steps; jj++) {
+                    if (!active[jj]) {
+                        continue;
+                    }
+                    for (long kk = 0; kk < frames; kk++) {
+                        frame[kk] *= factors[jj][kk];
+                    }
+                }
+
+                if (j->type == J_BATCH_PEAK) {
+                    for (long kk = 0; kk < frames; kk++) {
+                        if (*peak < fabs(frame[kk])) {
+                            *peak = fabs(frame[kk]);
+                        }
+                    }
+                } else if (j->stream != NULL) {
+                    bed_stream_write(j->stream, cc, j->offset + ii, frames,
+                                     block);
+                }
+            }
+        }
+        break;
 
-        } else {
-            post("bed • \"%s\" is not a valid buffer", destname->s_name);
-            return;
+    case J_TARGETS:
+        for (long ii = first; ii < last; ii++) {
+            bed_process_target(j, &j->targets[ii]);
         }
-    } else {
-        post("bed • Nothing to paste");
-        return;
+        break;
     }
 }
 
-void bed_reverse(t_bed* x)
+/* The iterations processed between two progress reports, frames or whole
+ * arrays */
+long bed_chunk_size(t_bed_job* j)
 {
-    if (!bed_attach_buffer(x)) {
-        return;
-    }
+    return j->type == J_TARGETS ? 1 : CHUNK_FRAMES;
+}
 
-    if (!x->b_valid) {
-        post("bed • Not a valid buffer!");
-        return;
+void bed_report_progress(t_bed* x, t_bed_job* j, int finished)
+{
+    long done = 0;
+    for (long ii = 0; ii < j->num_workers; ii++) {
+        done += j->workers[ii].done;
     }
 
-    long chunksize = x->b_frames * sizeof(float);
-    if (x->undo_samples == NULL) {
-        x->undo_samples = getbytes(chunksize);
-    } else {
-        long oldsize = x->undo_frames * sizeof(float);
-        x->undo_samples = resizebytes(x->undo_samples, oldsize, chunksize);
+    float progress = j->progress_to;
+    if (!finished && j->count > 0) {
+        progress = j->progress_from
+            + (j->progress_to - j->progress_from) * done / j->count;
     }
 
-    if (x->undo_samples == NULL) {
-        pd_error(x, "bed • Cannot allocate memory for undo");
-        x->can_undo = 0;
-        return;
-    } else {
-        x->can_undo = 1;
-        x->undo_start = 0;
-        x->undo_frames = x->b_frames;
-        x->undo_resize = 0;
-        x->undo_cut = 0;
-        memcpy(x->undo_samples, x->b_samples, chunksize);
+    /* Report every percent, and always the end of the job */
+    if (finished || progress - j->progress_sent >= 0.01) {
+        t_atom value;
+        SETFLOAT(&value, progress);
+        outlet_anything(x->status_outlet, gensym("progress"), 1, &value);
+        j->progress_sent = progress;
     }
+}
 
-    float temp;
-    for (int ii = 0; ii < ceil(x->b_frames / 2); ii++) {
-        temp = x->b_samples[ii];
-        x->b_samples[ii] = x->b_samples[x->b_frames - 1 - ii];
-        x->b_samples[x->b_frames - 1 - ii] = temp;
-    }
+/* Process the range of a worker chunk by chunk, reporting progress when
+ * running on the main thread */
+void bed_work(t_bed_worker* w, t_bed* x)
+{
+    long chunk = bed_chunk_size(w->job);
+    for (long ii = w->first; ii < w->last; ii += chunk) {
+        long last = ii + chunk < w->last ? ii + chunk : w->last;
+
+        bed_process_frames(w->job, ii, last, &w->peak);
+        w->done = last - w->first;
 
-    garray_redraw(x->buffer);
+        if (x != NULL) {
+            bed_report_progress(x, w->job, 0);
+        }
+    }
 }
 
-void bed_ring_modulation(t_bed* x, t_floatarg frequency)
+#ifdef _WIN32
+DWORD WINAPI bed_thread_main(LPVOID w)
 {
-    if (!bed_attach_buffer(x)) {
-        return;
-    }
+    bed_work((t_bed_worker*)w, NULL);
+    return 0;
+}
 
-    if (!x->b_valid) {
-        post("bed • Not a valid buffer!");
-        return;
-    }
+int bed_thread_start(t_bed_worker* w)
+{
+    w->thread = CreateThread(NULL, 0, bed_thread_main, w, 0, NULL);
+    return w->thread != NULL;
+}
 
-    long chunksize = x->b_frames * sizeof(float);
-    if (x->undo_samples == NULL) {
-        x->undo_samples = getbytes(chunksize);
-    } else {
-        long oldsize = x->undo_frames * sizeof(float);
-        x->undo_samples = resizebytes(x->undo_samples, oldsize, chunksize);
-    }
+void bed_thread_join(t_bed_worker* w)
+{
+    WaitForSingleObject(w->thread, INFINITE);
+    CloseHandle(w->thread);
+}
+#else
+void* bed_thread_main(void* w)
+{
+    bed_work((t_bed_worker*)w, NULL);
+    return NULL;
+}
 
-    if (x->undo_samples == NULL) {
-        pd_error(x, "bed • Cannot allocate memory for undo");
-        x->can_undo = 0;
-        return;
-    } else {
-        x->can_undo = 1;
-        x->undo_start = 0;
-        x->undo_frames = x->b_frames;
-        x->undo_resize = 0;
-        x->undo_cut = 0;
-        memcpy(x->undo_samples, x->b_samples, chunksize);
-    }
+int bed_thread_start(t_bed_worker* w)
+{
+    return pthread_create(&w->thread, NULL, bed_thread_main, w) == 0;
+}
 
-    float twopi = 8.0 * atan(1.0);
-    float oneoversr = 1.0 / x->b_sr;
-    for (int ii = 0; ii < x->b_frames; ii++) {
-        x->b_samples[ii] *= sin(twopi * frequency * ii * oneoversr);
-    }
+void bed_thread_join(t_bed_worker* w) { pthread_join(w->thread, NULL); }
+#endif
 
-    garray_redraw(x->buffer);
+/* Prepare the job of an operation that takes a number of passes over the
+ * frames */
+t_bed_job* bed_prepare_job(t_bed* x, long type, long count, long num_passes)
+{
+    t_bed_job* j = &x->job;
+    j->type = type;
+    j->nchans = x->b_nchans;
+    j->offset = 0;
+    j->count = count;
+    j->num_steps = 0;
+    j->stream = NULL;
+    j->pass = 0;
+    j->num_passes = num_passes;
+    return j;
 }
 
-void bed_shuffle_n_segments(t_bed* x, t_floatarg segments)
+/* Point the job at the frames of every channel from 'start' on */
+void bed_set_job_frames(t_bed* x, t_bed_job* j, long start)
 {
-    if (!bed_attach_buffer(x)) {
-        return;
+    for (long ii = 0; ii < x->b_nchans; ii++) {
+        j->samples[ii] = x->b_channels[ii] + start;
     }
+}
 
-    if (!x->b_valid) {
-        post("bed • Not a valid buffer!");
-        return;
+/* Split the current pass of a job among the workers and start the threads of
+ * all workers from the first one on */
+void bed_start_job(t_bed* x, t_bed_job* j, long first_thread)
+{
+    /* Give every worker at least one chunk */
+    long chunk = bed_chunk_size(j);
+    long num_workers = (j->count + chunk - 1) / chunk;
+    if (num_workers > x->num_workers) {
+        num_workers = x->num_workers;
     }
-
-    long chunksize = x->b_frames * sizeof(float);
-    if (x->undo_samples == NULL) {
-        x->undo_samples = getbytes(chunksize);
-    } else {
-        long oldsize = x->undo_frames * sizeof(float);
-        x->undo_samples = resizebytes(x->undo_samples, oldsize, chunksize);
+    if (num_workers < 1) {
+        num_workers = 1;
     }
 
-    if (x->undo_samples == NULL) {
-        pd_error(x, "bed • Cannot allocate memory for undo");
-        x->can_undo = 0;
-        return;
-    } else {
-        x->can_undo = 1;
-        x->undo_start = 0;
-        x->undo_frames = x->b_frames;
-        x->undo_resize = 0;
-        x->undo_cut = 0;
-        memcpy(x->undo_samples, x->b_samples, chunksize);
+    j->num_workers = num_workers;
+    j->peak = 0.0;
+    j->progress_from = (float)j->pass / j->num_passes;
+    j->progress_to = (float)(j->pass + 1) / j->num_passes;
+    j->progress_sent = j->progress_from;
+
+    long share = (j->count + num_workers - 1) / num_workers;
+    for (long ii = 0; ii < num_workers; ii++) {
+        t_bed_worker* w = &j->workers[ii];
+        w->job = j;
+        w->first = ii * share < j->count ? ii * share : j->count;
+        w->last = w->first + share < j->count ? w->first + share : j->count;
+        w->done = 0;
+        w->peak = 0.0;
+        w->running = 0;
     }
 
-    long totallength = x->b_frames;
-    long basesegmentlength = ceil(totallength / segments);
+    for (long ii = first_thread; ii < num_workers; ii++) {
+        j->workers[ii].running = bed_thread_start(&j->workers[ii]);
+    }
+}
+
+int bed_job_finished(t_bed_job* j)
+{
+    for (long ii = 0; ii < j->num_workers; ii++) {
+        t_bed_worker* w = &j->workers[ii];
+        if (w->done < w->last - w->first) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Wait for the threads and combine the results of the workers */
+void bed_join_job(t_bed_job* j)
+{
+    for (long ii = 0; ii < j->num_workers; ii++) {
+        t_bed_worker* w = &j->workers[ii];
+        if (w->running) {
+            bed_thread_join(w);
+            w->running = 0;
+        }
+        if (j->peak < w->peak) {
+            j->peak = w->peak;
+        }
+    }
+}
+
+/* Process the first share on the main thread and wait for the others */
+void bed_run_job(t_bed* x, t_bed_job* j)
+{
+    bed_start_job(x, j, 1);
+
+    /* The main thread also takes over any worker that failed to start */
+    for (long ii = 0; ii < j->num_workers; ii++) {
+        if (!j->workers[ii].running) {
+            bed_work(&j->workers[ii], x);
+        }
+    }
+
+    bed_join_job(j);
+    bed_report_progress(x, j, 1);
+}
+
+/* Release what a job holds beyond the frames it processes */
+void bed_free_job(t_bed_job* j)
+{
+    for (long ii = 0; ii < j->num_steps; ii++) {
+        t_bed_step* s = &j->steps[ii];
+        if (s->type == J_RING && s->table != NULL) {
+            freebytes(s->table, s->table_size * sizeof(float));
+            s->table = NULL;
+        }
+    }
+    j->num_steps = 0;
+}
+
+/* The gain that brings the peak found by a job to the new maximum */
+int bed_normalize_gain(t_bed_job* j, float newmax)
+{
+    if (j->peak > 1e-6) {
+        j->gain = newmax / j->peak;
+        return 1;
+    } else {
+        post("bed • Amplitude is too low to rescale: %.2f", j->peak);
+        return 0;
+    }
+}
+
+int bed_measuring(t_bed_job* j)
+{
+    return j->type == J_PEAK || j->type == J_BATCH_PEAK;
+}
+
+/* Set up the pass that follows a measuring pass, once its peak is known */
+int bed_next_pass(t_bed_job* j)
+{
+    if (j->type == J_PEAK) {
+        if (!bed_normalize_gain(j, j->newmax)) {
+            return 0;
+        }
+        j->type = J_SCALE;
+    } else {
+        t_bed_step* s = &j->steps[j->peak_steps];
+        if (!bed_normalize_gain(j, s->newmax)) {
+            return 0;
+        }
+        s->gain = j->gain;
+
+        /* Measure again before the next normalize, if there is one */
+        j->type = J_BATCH;
+        for (long ii = j->peak_steps + 1; ii < j->num_steps; ii++) {
+            if (j->steps[ii].type == J_PEAK) {
+                j->type = J_BATCH_PEAK;
+                j->peak_steps = ii;
+                break;
+            }
+        }
+    }
+
+    j->pass++;
+    return 1;
+}
+
+/* Fit the steps of a job to an array of the given length. Fades keep their
+ * length and the other steps cover the whole array */
+int bed_fit_steps(t_bed_job* j, long frames)
+{
+    for (long ii = 0; ii < j->num_steps; ii++) {
+        t_bed_step* s = &j->steps[ii];
+        switch (s->type) {
+        case J_FADEIN:
+            s->start = 0;
+            break;
+        case J_FADEOUT:
+            s->start = frames - s->length;
+            break;
+        default:
+            s->start = 0;
+            s->length = frames;
+            break;
+        }
+        if (s->start < 0 || s->length > frames) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Run the operation of a job over the whole of one target, on its own copy
+ * of the steps. The peak is checked before each pass that needs it, so that
+ * no message is posted from a worker */
+void bed_process_target(t_bed_job* j, t_bed_target* t)
+{
+    t_bed_job k;
+    k.type = j->target_type;
+    k.samples[0] = t->samples;
+    k.nchans = 1;
+    k.offset = 0;
+    k.length = t->frames;
+    k.count = k.type == J_REVERSE ? t->frames / 2 : t->frames;
+    k.num_steps = j->num_steps;
+    k.peak_steps = j->peak_steps;
+    k.stream = NULL;
+    k.pass = 0;
+    memcpy(k.steps, j->steps, j->num_steps * sizeof(t_bed_step));
+
+    if (t->status != T_DONE) {
+        return;
+    }
+    if (!bed_fit_steps(&k, t->frames)) {
+        t->status = T_SKIPPED;
+        return;
+    }
+
+    while (bed_measuring(&k)) {
+        k.peak = 0.0;
+        bed_process_frames(&k, 0, k.count, &k.peak);
+        if (k.peak <= 1e-6) {
+            t->status = T_FAILED;
+            return;
+        }
+        bed_next_pass(&k);
+    }
+
+    bed_process_frames(&k, 0, k.count, &k.peak);
+}
+
+/* Set up a ring modulator step, copying the waveform so it may change while
+ * the job runs */
+int bed_setup_ring(t_bed* x, t_bed_step* s, float frequency,
+                   t_symbol* waveform)
+{
+    s->type = J_RING;
+    s->increment = frequency / (double)x->b_sr;
+    s->table = NULL;
+
+    double twopi = 8.0 * atan(1.0);
+    for (long ii = 0; ii < RING_BLOCK; ii++) {
+        s->rotation_cos[ii] = cos(twopi * s->increment * ii);
+        s->rotation_sin[ii] = sin(twopi * s->increment * ii);
+    }
+
+    if (waveform->s_name[0] != '\0') {
+        t_garray* wavebuf = NULL;
+        int wavebuf_b_frames;
+        float* wavebuf_b_samples;
+        if (!bed_attach_any_buffer(&wavebuf, waveform)) {
+            return 0;
+        }
+        if (!garray_getfloatarray(wavebuf, &wavebuf_b_frames,
+                                  &wavebuf_b_samples)
+            || wavebuf_b_frames < 1) {
+            post("bed • \"%s\" is not a valid buffer", waveform->s_name);
+            return 0;
+        }
+
+        s->table = getbytes(wavebuf_b_frames * sizeof(float));
+        if (s->table == NULL) {
+            pd_error(x, "bed • Cannot allocate memory for the waveform");
+            return 0;
+        }
+        s->table_size = wavebuf_b_frames;
+        memcpy(s->table, wavebuf_b_samples, s->table_size * sizeof(float));
+    }
+    return 1;
+}
+
+/* The asynchronous mode
+ * ******************************************************/
+void bed_async(t_bed* x, t_floatarg async) { x->async = async != 0; }
+
+/* Refuse to touch the array while an asynchronous edit is pending */
+int bed_busy(t_bed* x)
+{
+    if (x->async_op != NULL) {
+        pd_error(x, "bed • Busy with %s, wait until it is done",
+                 x->async_op->s_name);
+        return 1;
+    }
+    return 0;
+}
+
+/* Start the current pass of the job on the workers and poll them */
+void bed_continue_async(t_bed* x)
+{
+    t_bed_job* j = &x->job;
+    bed_start_job(x, j, 0);
+
+    /* Without threads the work is done right away */
+    for (long ii = 0; ii < j->num_workers; ii++) {
+        if (!j->workers[ii].running) {
+            bed_work(&j->workers[ii], NULL);
+        }
+    }
+
+    clock_delay(x->async_clock, ASYNC_POLL_INTERVAL);
+}
+
+/* Run the job on a copy of the frames it changes, off the main thread */
+void bed_start_async(t_bed* x, t_symbol* op, long edit, long start,
+                     long frames)
+{
+    float* samples = getbytes(frames * x->b_nchans * sizeof(float));
+    if (samples == NULL) {
+        pd_error(x, "bed • Cannot allocate memory for %s", op->s_name);
+        bed_free_job(&x->job);
+        return;
+    }
+    for (long ii = 0; ii < x->b_nchans; ii++) {
+        memcpy(samples + (ii * frames), x->b_channels[ii] + start,
+               frames * sizeof(float));
+        x->job.samples[ii] = samples + (ii * frames);
+    }
+
+    x->async_op = op;
+    x->async_edit = edit;
+    x->async_start = start;
+    x->async_frames = frames;
+    x->async_total = x->b_frames;
+    x->async_nchans = x->b_nchans;
+    x->async_samples = samples;
+
+    bed_continue_async(x);
+}
+
+void bed_end_stream(t_bed* x, int done);
+
+void bed_end_async(t_bed* x, t_symbol* status)
+{
+    t_atom op;
+    SETSYMBOL(&op, x->async_op);
+
+    bed_free_job(&x->job);
+    if (x->async_samples != NULL) {
+        freebytes(x->async_samples,
+                  x->async_frames * x->async_nchans * sizeof(float));
+        x->async_samples = NULL;
+    }
+    if (x->stream.source != NULL) {
+        bed_end_stream(x, status == gensym("done"));
+    }
+    x->async_op = NULL;
+
+    outlet_anything(x->status_outlet, status, 1, &op);
+}
+
+/* Poll the workers and, once they are done, swap the result into the array
+ * from the scheduler, between two DSP ticks */
+void bed_async_tick(t_bed* x)
+{
+    t_bed_job* j = &x->job;
+    if (!bed_job_finished(j)) {
+        bed_report_progress(x, j, 0);
+        clock_delay(x->async_clock, ASYNC_POLL_INTERVAL);
+        return;
+    }
+
+    bed_join_job(j);
+    bed_report_progress(x, j, 1);
+
+    /* Normalizing needs another pass once the peak is known */
+    if (bed_measuring(j)) {
+        if (!bed_next_pass(j)) {
+            bed_end_async(x, gensym("failed"));
+            return;
+        }
+        bed_continue_async(x);
+        return;
+    }
+
+    /* A file is written in place by the workers */
+    if (x->stream.source != NULL) {
+        bed_end_async(x, gensym("done"));
+        return;
+    }
+
+    if (!bed_attach_buffer(x)) {
+        bed_end_async(x, gensym("failed"));
+        return;
+    }
+
+    if (x->b_frames != x->async_total) {
+        post("bed • \"%s\" has changed size, %s was discarded",
+             x->b_names[0]->s_name, x->async_op->s_name);
+        bed_end_async(x, gensym("failed"));
+        return;
+    }
+
+    /* Only sample edits need the frames they replace for undo */
+    if (!bed_push_edit(x, x->async_edit, x->async_start, x->async_frames,
+                       x->async_edit == E_SAMPLES)) {
+        bed_end_async(x, gensym("failed"));
+        return;
+    }
+
+    for (long ii = 0; ii < x->b_nchans; ii++) {
+        memcpy(x->b_channels[ii] + x->async_start,
+               x->async_samples + (ii * x->async_frames),
+               x->async_frames * sizeof(float));
+    }
+
+    bed_redraw(x);
+    bed_end_async(x, gensym("done"));
+}
+
+/******************************************************************************/
+void bed_info(t_bed* x)
+{
+    if (!bed_attach_buffer(x)) {
+        return;
+    }
+
+    post("bed • Information:");
+    for (long ii = 0; ii < x->b_nchans; ii++) {
+        post("    buffer name: %s", x->b_names[ii]->s_name);
+    }
+    post("    frame count: %d", x->b_frames);
+    post("    channel count: %d", x->b_nchans);
+    post("    validity: %d", x->b_valid);
+    post("    undo steps: %d", x->next_edit);
+    post("    redo steps: %d", x->num_edits - x->next_edit);
+    post("    undo memory: %.2f MB", x->history_bytes / (1024.0 * 1024.0));
+    post("    workers: %d", x->num_workers);
+    post("    asynchronous: %d", x->async);
+    post("    targets: %d", x->num_targets);
+}
+
+/* Set the arrays of the group, one channel each */
+int bed_set_names(t_bed* x, short argc, t_atom* argv)
+{
+    if (argc < 1 || argc > MAXIMUM_CHANNELS) {
+        pd_error(x, "bed • The group must have between 1 and %d arrays",
+                 MAXIMUM_CHANNELS);
+        return 0;
+    }
+    for (long ii = 0; ii < argc; ii++) {
+        if (argv[ii].a_type != A_SYMBOL) {
+            pd_error(x, "bed • The group must be a list of array names");
+            return 0;
+        }
+    }
+
+    /* The history refers to the frames of the previous arrays */
+    int changed = argc != x->b_nchans;
+    for (long ii = 0; ii < argc; ii++) {
+        t_symbol* name = atom_getsymbol(argv + ii);
+        if (ii >= x->b_nchans || name != x->b_names[ii]) {
+            changed = 1;
+        }
+        x->b_names[ii] = name;
+    }
+    x->b_nchans = argc;
+
+    if (changed) {
+        bed_clear_history(x, 0);
+    }
+    return 1;
+}
+
+void bed_bufname(t_bed* x, t_symbol* msg, short argc, t_atom* argv)
+{
+    if (bed_busy(x)) {
+        return;
+    }
+
+    bed_set_names(x, argc, argv);
+}
+
+/******************************************************************************/
+void bed_reverse_frames(t_bed* x, long frames)
+{
+    t_bed_job* j = bed_prepare_job(x, J_REVERSE, frames / 2, 1);
+    bed_set_job_frames(x, j, 0);
+    j->length = frames;
+    bed_run_job(x, j);
+}
+
+/* Gather the segments in their shuffled order, or scatter them back */
+int bed_shuffle_frames(t_bed* x, t_bed_edit* e, int inverse)
+{
+    long buffersize = e->frames * sizeof(float);
+    float* local_buffer = getbytes(buffersize);
+    if (local_buffer == NULL) {
+        pd_error(x, "bed • Cannot allocate memory for shuffle");
+        return 0;
+    }
+
+    /* Every channel follows the same permutation */
+    for (long cc = 0; cc < x->b_nchans; cc++) {
+        float* samples = x->b_channels[cc];
+        memcpy(local_buffer, samples, buffersize);
+
+        long position = 0;
+        for (long ii = 0; ii < e->segments; ii++) {
+            long start = e->order[ii] * e->segment_frames;
+            long length = e->segment_frames;
+
+            if (start + length > e->frames) {
+                length = e->frames - start;
+            }
+
+            if (inverse) {
+                memcpy(samples + start, local_buffer + position,
+                       length * sizeof(float));
+            } else {
+                memcpy(samples + position, local_buffer + start,
+                       length * sizeof(float));
+            }
+            position += length;
+        }
+    }
+
+    freebytes(local_buffer, buffersize);
+
+    return 1;
+}
+
+/* Close the gap over the removed frames before the arrays shrink, since
+ * resizing keeps the frames that still fit */
+int bed_remove_frames(t_bed* x, long start, long frames)
+{
+    long bufferframes = x->b_frames;
+
+    for (long ii = 0; ii < x->b_nchans; ii++) {
+        memmove(x->b_channels[ii] + start, x->b_channels[ii] + start + frames,
+                (bufferframes - start - frames) * sizeof(float));
+        garray_resize_long(x->buffers[ii], bufferframes - frames);
+    }
+    bed_attach_buffer(x);
+
+    return 1;
+}
+
+/* Open a gap for the inserted frames, the channels of 'samples' following
+ * each other, once the arrays have grown */
+int bed_insert_frames(t_bed* x, long start, float* samples, long frames)
+{
+    long bufferframes = x->b_frames;
+
+    /* Grow every channel before moving any frames, and shrink the ones
+     * already grown back if another cannot grow */
+    for (long ii = 0; ii < x->b_nchans; ii++) {
+        int resized_frames;
+        float* resized_samples;
+        garray_resize_long(x->buffers[ii], bufferframes + frames);
+        if (!garray_getfloatarray(x->buffers[ii], &resized_frames,
+                                  &resized_samples)
+            || resized_frames != bufferframes + frames) {
+            for (long jj = 0; jj <= ii; jj++) {
+                garray_resize_long(x->buffers[jj], bufferframes);
+            }
+            bed_attach_buffer(x);
+            pd_error(x, "bed • Cannot resize \"%s\"",
+                     x->b_names[ii]->s_name);
+            return 0;
+        }
+    }
+    if (!bed_attach_buffer(x) || x->b_frames != bufferframes + frames) {
+        pd_error(x, "bed • Cannot resize \"%s\"", x->b_names[0]->s_name);
+        return 0;
+    }
+
+    for (long ii = 0; ii < x->b_nchans; ii++) {
+        memmove(x->b_channels[ii] + start + frames, x->b_channels[ii] + start,
+                (bufferframes - start) * sizeof(float));
+        memcpy(x->b_channels[ii] + start, samples + (ii * frames),
+               frames * sizeof(float));
+    }
+
+    return 1;
+}
+
+/* Undo or redo an edit on the attached buffer */
+int bed_apply_edit(t_bed* x, t_bed_edit* e, int undo)
+{
+    switch (e->type) {
+    case E_SAMPLES:
+        /* Swapping toggles between the edited and the saved frames */
+        for (long cc = 0; cc < x->b_nchans; cc++) {
+            float* samples = x->b_channels[cc] + e->start;
+            float* saved = e->samples + (cc * e->frames);
+            for (long ii = 0; ii < e->frames; ii++) {
+                float temp = samples[ii];
+                samples[ii] = saved[ii];
+                saved[ii] = temp;
+            }
+        }
+        return 1;
+
+    case E_REVERSE:
+        bed_reverse_frames(x, e->frames);
+        return 1;
+
+    case E_SHUFFLE:
+        return bed_shuffle_frames(x, e, undo);
+
+    case E_CUT:
+        if (undo) {
+            return bed_insert_frames(x, e->start, e->samples, e->frames);
+        } else {
+            return bed_remove_frames(x, e->start, e->frames);
+        }
+    }
+
+    return 0;
+}
+
+/* Check that the buffer still has the size the edit was made on */
+int bed_check_edit(t_bed* x, t_bed_edit* e, int undo)
+{
+    int valid = 1;
+
+    switch (e->type) {
+    case E_SAMPLES:
+        valid = e->start + e->frames <= x->b_frames;
+        break;
+    case E_REVERSE:
+    case E_SHUFFLE:
+        valid = e->frames == x->b_frames;
+        break;
+    case E_CUT:
+        if (undo) {
+            valid = e->start <= x->b_frames;
+        } else {
+            valid = e->start + e->frames <= x->b_frames;
+        }
+        break;
+    }
+
+    if (!valid) {
+        post("bed • \"%s\" has changed size, the undo history was cleared",
+             x->b_names[0]->s_name);
+        bed_clear_history(x, 0);
+    }
+    return valid;
+}
+
+/******************************************************************************/
+void bed_normalize(t_bed* x, t_symbol* msg, short argc, t_atom* argv)
+{
+    if (bed_busy(x)) {
+        return;
+    }
+
+    if (argc > 1) {
+        pd_error(x, "bed • The message must have at most two members");
+        return;
+    }
+
+    float newmax = 1.0;
+    if (argc == 1) {
+        newmax = atom_getfloat(argv);
+    }
+
+    if (!bed_attach_buffer(x)) {
+        return;
+    }
+
+    if (!x->b_valid) {
+        post("bed • Not a valid buffer!");
+        return;
+    }
+
+    /* Find the peak, then rescale, each pass split among the workers */
+    t_bed_job* j = bed_prepare_job(x, J_PEAK, x->b_frames, 2);
+    j->newmax = newmax;
+
+    if (x->async) {
+        bed_start_async(x, gensym("normalize"), E_SAMPLES, 0, x->b_frames);
+        return;
+    }
+
+    bed_set_job_frames(x, j, 0);
+    bed_run_job(x, j);
+
+    if (!bed_next_pass(j)) {
+        return;
+    }
+
+    if (!bed_push_edit(x, E_SAMPLES, 0, x->b_frames, 1)) {
+        return;
+    }
+
+    bed_run_job(x, j);
+
+    bed_redraw(x);
+}
+
+void bed_fadein(t_bed* x, t_floatarg fadetime)
+{
+    if (bed_busy(x)) {
+        return;
+    }
+
+    if (!bed_attach_buffer(x)) {
+        return;
+    }
+
+    if (!x->b_valid) {
+        post("bed • Not a valid buffer!");
+        return;
+    }
+
+    long fadeframes = fadetime * 0.001 * x->b_sr;
+    if (fadetime <= 0 || fadeframes > x->b_frames) {
+        post("bed • %.0fms is not a valid fade-in time", fadetime);
+        return;
+    }
+
+    t_bed_job* j = bed_prepare_job(x, J_FADEIN, fadeframes, 1);
+    j->length = fadeframes;
+
+    if (x->async) {
+        bed_start_async(x, gensym("fadein"), E_SAMPLES, 0, fadeframes);
+        return;
+    }
+
+    if (!bed_push_edit(x, E_SAMPLES, 0, fadeframes, 1)) {
+        return;
+    }
+
+    bed_set_job_frames(x, j, 0);
+    bed_run_job(x, j);
+
+    bed_redraw(x);
+}
+
+void bed_fadeout(t_bed* x, t_floatarg fadetime)
+{
+    if (bed_busy(x)) {
+        return;
+    }
+
+    if (!bed_attach_buffer(x)) {
+        return;
+    }
+
+    if (!x->b_valid) {
+        post("bed • Not a valid buffer!");
+        return;
+    }
+
+    long fadeframes = fadetime * 0.001 * x->b_sr;
+    if (fadetime <= 0 || fadeframes > x->b_frames) {
+        post("bed • %.0fms is not a valid fade-out time", fadetime);
+        return;
+    }
+
+    long fadestart = x->b_frames - fadeframes;
+
+    t_bed_job* j = bed_prepare_job(x, J_FADEOUT, fadeframes, 1);
+    j->length = fadeframes;
+
+    if (x->async) {
+        bed_start_async(x, gensym("fadeout"), E_SAMPLES, fadestart,
+                        fadeframes);
+        return;
+    }
+
+    if (!bed_push_edit(x, E_SAMPLES, fadestart, fadeframes, 1)) {
+        return;
+    }
+
+    bed_set_job_frames(x, j, fadestart);
+    bed_run_job(x, j);
+
+    bed_redraw(x);
+}
+
+void bed_cut(t_bed* x, t_floatarg start, t_floatarg end)
+{
+    if (bed_busy(x)) {
+        return;
+    }
+
+    if (!bed_attach_buffer(x)) {
+        return;
+    }
+
+    if (!x->b_valid) {
+        post("bed • Not a valid buffer!");
+        return;
+    }
+
+    long startframe = start * 0.001 * x->b_sr;
+    long endframe = end * 0.001 * x->b_sr;
+    long cutframes = endframe - startframe;
+
+    if (startframe < 0 || endframe > x->b_frames || startframe > endframe) {
+        post("bed • %.0fms and %.0fms are not valid cut times", start, end);
+        return;
+    }
+
+    t_bed_edit* e = bed_push_edit(x, E_CUT, startframe, cutframes, 1);
+    if (e == NULL) {
+        return;
+    }
+
+    if (!bed_apply_edit(x, e, 0)) {
+        bed_pop_edit(x);
+        return;
+    }
+
+    bed_redraw(x);
+}
+
+/* Paste each channel of the last cut into the array named in the same
+ * position */
+void bed_paste(t_bed* x, t_symbol* msg, short argc, t_atom* argv)
+{
+    t_bed_edit* e = NULL;
+    if (x->next_edit > 0) {
+        e = &x->history[x->next_edit - 1];
+    }
+
+    if (e == NULL || e->type != E_CUT) {
+        post("bed • Nothing to paste");
+        return;
+    }
+
+    if (argc < 1 || argc > e->channels) {
+        pd_error(x, "bed • The cut can be pasted into 1 to %ld arrays",
+                 e->channels);
+        return;
+    }
+
+    for (long ii = 0; ii < argc; ii++) {
+        t_symbol* destname = atom_getsymbol(argv + ii);
+        t_garray* destbuf = NULL;
+        int destbuf_b_frames;
+        float* destbuf_b_samples;
+        if (argv[ii].a_type != A_SYMBOL
+            || !bed_attach_any_buffer(&destbuf, destname)) {
+            post("bed • \"%s\" is not a valid buffer", destname->s_name);
+            return;
+        }
+        if (!garray_getfloatarray(destbuf, &destbuf_b_frames,
+                                  &destbuf_b_samples)) {
+            post("bed • \"%s\" is not a valid buffer", destname->s_name);
+            return;
+        }
+        garray_resize_long(destbuf, e->frames);
+        if (!garray_getfloatarray(destbuf, &destbuf_b_frames,
+                                  &destbuf_b_samples)) {
+            post("bed • \"%s\" is not a valid buffer", destname->s_name);
+            return;
+        }
+        if (destbuf_b_frames != e->frames) {
+            pd_error(x, "bed • Cannot resize \"%s\"", destname->s_name);
+            return;
+        }
+
+        long chunksize = e->frames * sizeof(float);
+        memcpy(destbuf_b_samples, e->samples + (ii * e->frames), chunksize);
+
+        garray_redraw(destbuf);
+    }
+}
+
+void bed_reverse(t_bed* x)
+{
+    if (bed_busy(x)) {
+        return;
+    }
+
+    if (!bed_attach_buffer(x)) {
+        return;
+    }
+
+    if (!x->b_valid) {
+        post("bed • Not a valid buffer!");
+        return;
+    }
+
+    if (x->async) {
+        t_bed_job* j = bed_prepare_job(x, J_REVERSE, x->b_frames / 2, 1);
+        j->length = x->b_frames;
+        bed_start_async(x, gensym("reverse"), E_REVERSE, 0, x->b_frames);
+        return;
+    }
+
+    /* Reversing is its own inverse, so no frames need to be saved */
+    t_bed_edit* e = bed_push_edit(x, E_REVERSE, 0, x->b_frames, 0);
+    if (e == NULL) {
+        return;
+    }
+
+    bed_apply_edit(x, e, 0);
+
+    bed_redraw(x);
+}
+
+void bed_ring_modulation(t_bed* x, t_floatarg frequency, t_symbol* waveform)
+{
+    if (bed_busy(x)) {
+        return;
+    }
+
+    if (!bed_attach_buffer(x)) {
+        return;
+    }
+
+    if (!x->b_valid) {
+        post("bed • Not a valid buffer!");
+        return;
+    }
+
+    t_bed_job* j = bed_prepare_job(x, J_RING, x->b_frames, 1);
+    if (!bed_setup_ring(x, &j->steps[0], frequency, waveform)) {
+        return;
+    }
+    j->num_steps = 1;
+
+    if (x->async) {
+        bed_start_async(x, gensym("ring"), E_SAMPLES, 0, x->b_frames);
+        return;
+    }
+
+    if (!bed_push_edit(x, E_SAMPLES, 0, x->b_frames, 1)) {
+        bed_free_job(j);
+        return;
+    }
+
+    bed_set_job_frames(x, j, 0);
+    bed_run_job(x, j);
+    bed_free_job(j);
+
+    bed_redraw(x);
+}
+
+/* Parse a list of pointwise operations into the steps of a job, for arrays
+ * of the given length */
+int bed_parse_steps(t_bed* x, t_bed_job* j, short argc, t_atom* argv,
+                    long frames)
+{
+    int ii = 0;
+    while (ii < argc) {
+        if (argv[ii].a_type != A_SYMBOL) {
+            pd_error(x, "bed • The batch must name each operation");
+            bed_free_job(j);
+            return 0;
+        }
+        if (j->num_steps == MAXIMUM_STEPS) {
+            pd_error(x, "bed • The batch can have at most %d operations",
+                     MAXIMUM_STEPS);
+            bed_free_job(j);
+            return 0;
+        }
+
+        t_symbol* op = atom_getsymbol(argv + ii++);
+        int has_value = ii < argc && argv[ii].a_type == A_FLOAT;
+        float value = has_value ? atom_getfloat(argv + ii++) : 0.0;
+
+        t_bed_step* s = &j->steps[j->num_steps];
+        s->start = 0;
+        s->length = frames;
+
+        if (op == gensym("normalize")) {
+            s->type = J_PEAK;
+            s->newmax = has_value ? value : 1.0;
+        } else if (op == gensym("fadein")) {
+            long fadeframes = value * 0.001 * x->b_sr;
+            if (value <= 0 || fadeframes > frames) {
+                post("bed • %.0fms is not a valid fade-in time", value);
+                bed_free_job(j);
+                return 0;
+            }
+            s->type = J_FADEIN;
+            s->length = fadeframes;
+        } else if (op == gensym("fadeout")) {
+            long fadeframes = value * 0.001 * x->b_sr;
+            if (value <= 0 || fadeframes > frames) {
+                post("bed • %.0fms is not a valid fade-out time", value);
+                bed_free_job(j);
+                return 0;
+            }
+            s->type = J_FADEOUT;
+            s->start = frames - fadeframes;
+            s->length = fadeframes;
+        } else if (op == gensym("ring")) {
+            /* A name that follows the frequency is the waveform, unless it
+             * is the next operation */
+            t_symbol* waveform = &s_;
+            if (ii < argc && argv[ii].a_type == A_SYMBOL) {
+                t_symbol* next = atom_getsymbol(argv + ii);
+                if (next != gensym("normalize") && next != gensym("fadein")
+                    && next != gensym("fadeout") && next != gensym("ring")) {
+                    waveform = next;
+                    ii++;
+                }
+            }
+            if (!bed_setup_ring(x, s, value, waveform)) {
+                bed_free_job(j);
+                return 0;
+            }
+        } else {
+            post("bed • %s cannot be part of a batch", op->s_name);
+            bed_free_job(j);
+            return 0;
+        }
+        j->num_steps++;
+    }
+
+    if (j->num_steps == 0) {
+        post("bed • Nothing to do");
+        return 0;
+    }
+    return 1;
+}
+
+/* Each normalize needs a pass that measures the peak before it. Returns the
+ * number of measuring passes */
+long bed_plan_batch(t_bed_job* j)
+{
+    long num_passes = 0;
+    for (long kk = j->num_steps - 1; kk >= 0; kk--) {
+        if (j->steps[kk].type == J_PEAK) {
+            j->type = J_BATCH_PEAK;
+            j->peak_steps = kk;
+            num_passes++;
+        }
+    }
+    return num_passes;
+}
+
+/* Apply a list of pointwise operations in one pass over the frames, with one
+ * undo step and one redraw */
+void bed_batch(t_bed* x, t_symbol* msg, short argc, t_atom* argv)
+{
+    if (bed_busy(x)) {
+        return;
+    }
+
+    if (!bed_attach_buffer(x)) {
+        return;
+    }
+
+    if (!x->b_valid) {
+        post("bed • Not a valid buffer!");
+        return;
+    }
+
+    t_bed_job* j = bed_prepare_job(x, J_BATCH, 0, 1);
+    if (!bed_parse_steps(x, j, argc, argv, x->b_frames)) {
+        return;
+    }
+    j->num_passes += bed_plan_batch(j);
+
+    /* Only the frames some step changes are processed and saved */
+    long start = x->b_frames;
+    long end = 0;
+    for (long ii = 0; ii < j->num_steps; ii++) {
+        t_bed_step* s = &j->steps[ii];
+        if (start > s->start) {
+            start = s->start;
+        }
+        if (end < s->start + s->length) {
+            end = s->start + s->length;
+        }
+    }
+    j->offset = start;
+    j->count = end - start;
+
+    if (x->async) {
+        bed_start_async(x, gensym("batch"), E_SAMPLES, start, end - start);
+        return;
+    }
+
+    bed_set_job_frames(x, j, start);
+    while (bed_measuring(j)) {
+        bed_run_job(x, j);
+        if (!bed_next_pass(j)) {
+            bed_free_job(j);
+            return;
+        }
+    }
+
+    if (!bed_push_edit(x, E_SAMPLES, start, end - start, 1)) {
+        bed_free_job(j);
+        return;
+    }
+
+    bed_run_job(x, j);
+    bed_free_job(j);
+
+    bed_redraw(x);
+}
+
+/* The arrays that "each" applies an operation to
+ * *****************************/
+void bed_targets(t_bed* x, t_symbol* msg, short argc, t_atom* argv)
+{
+    for (long ii = 0; ii < argc; ii++) {
+        if (argv[ii].a_type != A_SYMBOL) {
+            pd_error(x, "bed • The targets must be a list of array names");
+            return;
+        }
+    }
+
+    if (x->targets != NULL) {
+        freebytes(x->targets, x->num_targets * sizeof(t_symbol*));
+        x->targets = NULL;
+        x->num_targets = 0;
+    }
+    if (argc == 0) {
+        return;
+    }
+
+    x->targets = getbytes(argc * sizeof(t_symbol*));
+    if (x->targets == NULL) {
+        pd_error(x, "bed • Cannot allocate memory for the targets");
+        return;
+    }
+    /* Keep each name once, or two workers would edit the same array */
+    long num_targets = 0;
+    for (long ii = 0; ii < argc; ii++) {
+        t_symbol* name = atom_getsymbol(argv + ii);
+        long jj = 0;
+        while (jj < num_targets && x->targets[jj] != name) {
+            jj++;
+        }
+        if (jj == num_targets) {
+            x->targets[num_targets++] = name;
+        }
+    }
+    if (num_targets < argc) {
+        x->targets = resizebytes(x->targets, argc * sizeof(t_symbol*),
+                                 num_targets * sizeof(t_symbol*));
+    }
+    x->num_targets = num_targets;
+}
 
-    long randomsegment;
-    long start;
-    long end;
-    long bufferlength;
-    long buffersize = 0;
-    float* local_buffer = NULL;
+/* Apply reverse, or a batch of pointwise operations, to every target, the
+ * workers taking whole arrays. The targets are redrawn once at the end and
+ * their edits are not kept for undo, so editing one of the attached arrays
+ * clears the history */
+void bed_each(t_bed* x, t_symbol* msg, short argc, t_atom* argv)
+{
+    if (bed_busy(x)) {
+        return;
+    }
+
+    if (x->num_targets == 0) {
+        post("bed • No targets");
+        return;
+    }
 
-    while (segments > 0) {
-        randomsegment = rand() % (long)segments;
-        start = randomsegment * basesegmentlength;
-        end = start + basesegmentlength;
+    long targetsize = x->num_targets * sizeof(t_bed_target);
+    t_bed_target* targets = getbytes(targetsize);
+    if (targets == NULL) {
+        pd_error(x, "bed • Cannot allocate memory for the targets");
+        return;
+    }
 
-        if (end > totallength) {
-            end = totallength;
+    /* Look up every array once, on the main thread */
+    long longest = 0;
+    for (long ii = 0; ii < x->num_targets; ii++) {
+        t_bed_target* t = &targets[ii];
+        int frames = 0;
+        t->name = x->targets[ii];
+        t->status = T_SKIPPED;
+        if (bed_attach_any_buffer(&t->buffer, t->name)) {
+            if (garray_getfloatarray(t->buffer, &frames, &t->samples)) {
+                t->frames = frames;
+                t->status = T_DONE;
+            } else {
+                post("bed • \"%s\" is not a valid buffer", t->name->s_name);
+            }
+        }
+        if (t->status == T_DONE && longest < t->frames) {
+            longest = t->frames;
         }
+    }
 
-        bufferlength = (end - start);
-        buffersize = bufferlength * sizeof(float);
-        if (local_buffer == NULL) {
-            local_buffer = getbytes(buffersize);
-        } else {
-            long oldsize = x->undo_frames * sizeof(float);
-            local_buffer = resizebytes(local_buffer, oldsize, chunksize);
+    if (longest == 0) {
+        post("bed • None of the targets is a valid buffer");
+        freebytes(targets, targetsize);
+        return;
+    }
+
+    x->b_sr = bed_sample_rate();
+    t_bed_job* j = bed_prepare_job(x, J_TARGETS, x->num_targets, 1);
+    j->targets = targets;
+    j->target_type = J_REVERSE;
+
+    /* Steps are parsed for the longest target and fitted to each */
+    if (argc != 1 || atom_getsymbol(argv) != gensym("reverse")) {
+        j->type = J_BATCH;
+        if (!bed_parse_steps(x, j, argc, argv, longest)) {
+            freebytes(targets, targetsize);
+            return;
         }
-        memcpy(local_buffer, x->b_samples + start, buffersize);
+        bed_plan_batch(j);
+        j->target_type = j->type;
+        j->type = J_TARGETS;
+    }
 
-        for (long ii = end; ii < totallength; ii++) {
-            x->b_samples[ii - bufferlength] = x->b_samples[ii];
+    bed_run_job(x, j);
+    bed_free_job(j);
+
+    long counts[3] = {0, 0, 0};
+    t_symbol* attached = NULL;
+    for (long ii = 0; ii < x->num_targets; ii++) {
+        t_bed_target* t = &targets[ii];
+        counts[t->status]++;
+        if (t->status == T_DONE) {
+            garray_redraw(t->buffer);
+            for (long jj = 0; jj < x->b_nchans; jj++) {
+                if (t->name == x->b_names[jj]) {
+                    attached = t->name;
+                }
+            }
+        } else if (t->status == T_FAILED) {
+            post("bed • \"%s\" is too quiet to rescale", t->name->s_name);
+        } else if (t->frames > 0) {
+            post("bed • \"%s\" is too short, it was skipped",
+                 t->name->s_name);
         }
-        memcpy(x->b_samples + (totallength - bufferlength), local_buffer,
-               buffersize);
+    }
+    freebytes(targets, targetsize);
 
-        totallength -= bufferlength;
-        segments--;
+    if (attached != NULL && x->num_edits > 0) {
+        post("bed • \"%s\" was edited, the undo history was cleared",
+             attached->s_name);
+        bed_clear_history(x, 0);
     }
 
-    freebytes(local_buffer, buffersize);
+    t_atom summary[3];
+    SETFLOAT(&summary[0], counts[T_DONE]);
+    SETFLOAT(&summary[1], counts[T_SKIPPED]);
+    SETFLOAT(&summary[2], counts[T_FAILED]);
+    outlet_anything(x->status_outlet, gensym("each"), 3, summary);
+}
 
-    garray_redraw(x->buffer);
+/* A draw from [0, range), from a SplitMix64 generator local to the object:
+ * rand() can be as narrow as 15 bits and is shared with the whole program.
+ * Draws from the top of the range that would favour some results are
+ * rejected */
+uint64_t bed_random(t_bed* x, uint64_t range)
+{
+    uint64_t limit = UINT64_MAX - UINT64_MAX % range;
+    uint64_t value;
+
+    do {
+        value = x->seed += 0x9e3779b97f4a7c15;
+        value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9;
+        value = (value ^ (value >> 27)) * 0x94d049bb133111eb;
+        value ^= value >> 31;
+    } while (value >= limit);
+
+    return value % range;
 }
 
-/******************************************************************************/
+/* Shuffle the segment indexes (Fisher-Yates) */
+void bed_shuffle_order(t_bed* x, long* order, long numsegments)
+{
+    for (long ii = 0; ii < numsegments; ii++) {
+        order[ii] = ii;
+    }
+    for (long ii = numsegments - 1; ii > 0; ii--) {
+        long jj = bed_random(x, ii + 1);
+        long temp = order[ii];
+        order[ii] = order[jj];
+        order[jj] = temp;
+    }
+}
 
-void bed_undo(t_bed* x)
+void bed_shuffle_n_segments(t_bed* x, t_floatarg segments)
 {
-    if (!x->can_undo) {
-        post("bed • Nothing to undo");
+    if (bed_busy(x)) {
         return;
     }
 
@@ -607,46 +2150,621 @@ void bed_undo(t_bed* x)
         return;
     }
 
-    if (x->undo_cut) {
-        long bufferframes = x->b_frames;
-        long buffersize = bufferframes * sizeof(float);
-        float* local_buffer = getbytes(buffersize);
-        if (local_buffer == NULL) {
-            pd_error(x, "bed • Cannot allocate memory for undo");
-            x->can_undo = 0;
+    long totallength = x->b_frames;
+    long numsegments = segments;
+    if (numsegments < 1 || numsegments > totallength) {
+        post("bed • %.0f is not a valid number of segments", segments);
+        return;
+    }
+
+    /* The last segment is shorter when the frames do not divide evenly */
+    long segmentlength = ceil((double)totallength / numsegments);
+    numsegments = (totallength + segmentlength - 1) / segmentlength;
+
+    long* order = getbytes(numsegments * sizeof(long));
+    if (order == NULL) {
+        pd_error(x, "bed • Cannot allocate memory for shuffle");
+        return;
+    }
+    bed_shuffle_order(x, order, numsegments);
+
+    /* Only the permutation is kept, the frames are scattered back on undo */
+    t_bed_edit* e = bed_push_edit(x, E_SHUFFLE, 0, totallength, 0);
+    if (e == NULL) {
+        freebytes(order, numsegments * sizeof(long));
+        return;
+    }
+
+    e->order = order;
+    e->segments = numsegments;
+    e->segment_frames = segmentlength;
+    e->bytes = numsegments * sizeof(long);
+    x->history_bytes += e->bytes;
+
+    if (!bed_apply_edit(x, e, 0)) {
+        bed_pop_edit(x);
+        return;
+    }
+
+    bed_trim_history(x);
+
+    bed_redraw(x);
+}
+
+/* The file streaming
+ * *********************************************************/
+unsigned long bed_little(const unsigned char* p, long bytes)
+{
+    unsigned long value = 0;
+    for (long ii = bytes - 1; ii >= 0; ii--) {
+        value = (value << 8) | p[ii];
+    }
+    return value;
+}
+
+unsigned long bed_big(const unsigned char* p, long bytes)
+{
+    unsigned long value = 0;
+    for (long ii = 0; ii < bytes; ii++) {
+        value = (value << 8) | p[ii];
+    }
+    return value;
+}
+
+/* The 80-bit extended float that AIFF gives the sample rate in */
+double bed_extended(const unsigned char* p)
+{
+    long exponent = bed_big(p, 2) & 0x7FFF;
+    double mantissa = bed_big(p + 2, 4) * 4294967296.0 + bed_big(p + 6, 4);
+    return ldexp(mantissa, exponent - 16383 - 63);
+}
+
+/* Find the format and the audio data of a WAV or AIFF file. Returns what is
+ * wrong with it, or NULL */
+const char* bed_parse_header(t_bed_stream* s)
+{
+    unsigned char* p = s->source;
+    size_t size = s->source_size;
+    int aiff = 0;
+    int aifc = 0;
+
+    if (size >= 12 && !memcmp(p, "RIFF", 4) && !memcmp(p + 8, "WAVE", 4)) {
+        s->big_endian = 0;
+    } else if (size >= 12 && !memcmp(p, "FORM", 4)
+               && (!memcmp(p + 8, "AIFF", 4)
+                   || (aifc = !memcmp(p + 8, "AIFC", 4)))) {
+        aiff = 1;
+        s->big_endian = 1;
+    } else {
+        return "not a WAV or AIFF file";
+    }
+
+    long format = 1;
+    long bits = 0;
+    size_t data_size = 0;
+    s->data_offset = 0;
+    s->nchans = 0;
+    s->is_float = 0;
+    s->sr = 0;
+
+    /* A recorder that did not finish may leave a chunk longer than the
+     * file */
+    size_t position = 12;
+    while (position + 8 <= size) {
+        unsigned char* chunk = p + position;
+        unsigned char* body = chunk + 8;
+        size_t length = aiff ? bed_big(chunk + 4, 4) : bed_little(chunk + 4, 4);
+        if (length > size - position - 8) {
+            length = size - position - 8;
+        }
+
+        if (!aiff && !memcmp(chunk, "fmt ", 4) && length >= 16) {
+            format = bed_little(body, 2);
+            s->nchans = bed_little(body + 2, 2);
+            s->sr = bed_little(body + 4, 4);
+            bits = bed_little(body + 14, 2);
+            if (format == 0xFFFE && length >= 26) {
+                format = bed_little(body + 24, 2);
+            }
+        } else if (!aiff && !memcmp(chunk, "data", 4)) {
+            s->data_offset = position + 8;
+            data_size = length;
+        } else if (aiff && !memcmp(chunk, "COMM", 4) && length >= 18) {
+            s->nchans = bed_big(body, 2);
+            bits = bed_big(body + 6, 2);
+            s->sr = bed_extended(body + 8);
+            if (aifc && length >= 22) {
+                if (!memcmp(body + 18, "sowt", 4)) {
+                    s->big_endian = 0;
+                } else if (!memcmp(body + 18, "fl32", 4)
+                           || !memcmp(body + 18, "FL32", 4)) {
+                    format = 3;
+                } else if (memcmp(body + 18, "NONE", 4)) {
+                    return "compressed";
+                }
+            }
+        } else if (aiff && !memcmp(chunk, "SSND", 4) && length >= 8) {
+            size_t skip = bed_big(body, 4);
+            if (skip > length - 8) {
+                return "truncated";
+            }
+            s->data_offset = position + 16 + skip;
+            data_size = length - 8 - skip;
+        }
+        position += 8 + length + (length & 1);
+    }
+
+    s->is_float = format == 3;
+    if (format != 1 && format != 3) {
+        return "compressed";
+    }
+    if (s->is_float ? bits != 32 : (bits < 16 || bits > 32 || bits % 8)) {
+        return "unsupported sample format";
+    }
+    if (s->nchans < 1 || s->data_offset == 0) {
+        return "no audio data";
+    }
+    if (s->sr <= 0) {
+        return "no sample rate";
+    }
+
+    s->bytes = bits / 8;
+    s->scale = ldexp(1.0, bits - 1);
+    s->frames = data_size / (s->bytes * s->nchans);
+    if (s->frames < 1) {
+        return "no audio data";
+    }
+    return NULL;
+}
+
+void bed_unmap(void* mapping, size_t size)
+{
+#ifdef _WIN32
+    UnmapViewOfFile(mapping);
+#else
+    munmap(mapping, size);
+#endif
+}
+
+/* Map the source read-only, so the system pages it in as the workers reach
+ * it */
+int bed_map_source(t_bed* x, t_bed_stream* s, const char* path)
+{
+    void* mapping;
+    size_t size;
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    LARGE_INTEGER file_size;
+    if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &file_size)) {
+        pd_error(x, "bed • Cannot open %s", path);
+        if (file != INVALID_HANDLE_VALUE) {
+            CloseHandle(file);
+        }
+        return 0;
+    }
+
+    size = (size_t)file_size.QuadPart;
+    HANDLE map = size ? CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0,
+                                           NULL)
+                      : NULL;
+    CloseHandle(file);
+
+    mapping = map ? MapViewOfFile(map, FILE_MAP_READ, 0, 0, 0) : NULL;
+    if (map) {
+        CloseHandle(map);
+    }
+    if (mapping == NULL) {
+        pd_error(x, "bed • Cannot map %s", path);
+        return 0;
+    }
+#else
+    struct stat info;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &info) != 0) {
+        pd_error(x, "bed • Cannot open %s", path);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return 0;
+    }
+
+    size = info.st_size;
+    mapping = size ? mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0)
+                   : MAP_FAILED;
+    close(fd);
+
+    if (mapping == MAP_FAILED) {
+        pd_error(x, "bed • Cannot map %s", path);
+        return 0;
+    }
+#endif
+
+    s->source = mapping;
+    s->source_size = size;
+
+    const char* problem = bed_parse_header(s);
+    if (problem != NULL) {
+        pd_error(x, "bed • %s: %s", path, problem);
+        bed_close_stream(s, 0);
+        return 0;
+    }
+    return 1;
+}
+
+/* Create the destination at the size of the source and map it for writing.
+ * Whatever surrounds the audio data is copied as it is */
+int bed_map_dest(t_bed* x, t_bed_stream* s, const char* source_path,
+                 const char* path)
+{
+    void* mapping;
+    size_t size = s->source_size;
+
+#ifdef _WIN32
+    if (!_stricmp(source_path, path)) {
+        pd_error(x, "bed • Cannot write over %s while reading it", path);
+        return 0;
+    }
+
+    HANDLE file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, NULL,
+                              CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        pd_error(x, "bed • Cannot write %s", path);
+        return 0;
+    }
+
+    HANDLE map = CreateFileMappingA(file, NULL, PAGE_READWRITE,
+                                    (DWORD)((uint64_t)size >> 32),
+                                    (DWORD)size, NULL);
+    CloseHandle(file);
+
+    mapping = map ? MapViewOfFile(map, FILE_MAP_WRITE, 0, 0, 0) : NULL;
+    if (map) {
+        CloseHandle(map);
+    }
+#else
+    struct stat source_info;
+    struct stat info;
+    if (stat(source_path, &source_info) == 0 && stat(path, &info) == 0
+        && source_info.st_dev == info.st_dev
+        && source_info.st_ino == info.st_ino) {
+        pd_error(x, "bed • Cannot write over %s while reading it", path);
+        return 0;
+    }
+
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) {
+        pd_error(x, "bed • Cannot write %s", path);
+        return 0;
+    }
+
+    mapping = ftruncate(fd, size) == 0
+        ? mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)
+        : MAP_FAILED;
+    close(fd);
+
+    if (mapping == MAP_FAILED) {
+        mapping = NULL;
+    }
+#endif
+
+    snprintf(s->dest_path, MAXPDSTRING, "%s", path);
+    if (mapping == NULL) {
+        pd_error(x, "bed • Cannot map %s", path);
+        remove(path);
+        return 0;
+    }
+
+    s->dest = mapping;
+    s->dest_size = size;
+
+    size_t data_end = s->data_offset
+                      + (size_t)s->frames * s->nchans * s->bytes;
+    memcpy(s->dest, s->source, s->data_offset);
+    memcpy(s->dest + data_end, s->source + data_end, size - data_end);
+    return 1;
+}
+
+/* Unmap both files, and remove the destination unless it is kept */
+void bed_close_stream(t_bed_stream* s, int keep)
+{
+    if (s->source != NULL) {
+        bed_unmap(s->source, s->source_size);
+        s->source = NULL;
+    }
+    if (s->dest != NULL) {
+        bed_unmap(s->dest, s->dest_size);
+        s->dest = NULL;
+        if (!keep) {
+            remove(s->dest_path);
+        }
+    }
+    if (s->order != NULL) {
+        freebytes(s->order, s->segments * sizeof(long));
+        s->order = NULL;
+    }
+}
+
+void bed_end_stream(t_bed* x, int done)
+{
+    t_bed_stream* s = &x->stream;
+    if (done) {
+        post("bed • Wrote %ld frames to %s", s->frames, s->dest_path);
+    }
+    bed_close_stream(s, done);
+}
+
+/* The frame of the source that a frame of the destination comes from */
+long bed_stream_source(t_bed_stream* s, long frame)
+{
+    if (s->reverse) {
+        return s->frames - 1 - frame;
+    }
+    if (s->order == NULL) {
+        return frame;
+    }
+
+    /* Only the last segment of the source may be shorter, which moves the
+     * segments after it in the destination */
+    long length = s->segment_frames;
+    long last = s->frames - (s->segments - 1) * length;
+    long shorter = s->short_segment * length;
+    long segment;
+    long position;
+
+    if (frame < shorter) {
+        segment = frame / length;
+        position = frame % length;
+    } else if (frame < shorter + last) {
+        segment = s->short_segment;
+        position = frame - shorter;
+    } else {
+        segment = (frame - last) / length + 1;
+        position = (frame - last) % length;
+    }
+    return s->order[segment] * length + position;
+}
+
+/* Samples of every width are scaled as floats between -1 and 1 */
+static inline float bed_decode(t_bed_stream* s, const unsigned char* p)
+{
+    uint32_t word = s->big_endian ? bed_big(p, s->bytes)
+                                  : bed_little(p, s->bytes);
+    if (s->is_float) {
+        float value;
+        memcpy(&value, &word, sizeof(float));
+        return value;
+    }
+    return (int32_t)(word << (32 - 8 * s->bytes)) / 2147483648.0f;
+}
+
+static inline void bed_encode(t_bed_stream* s, unsigned char* p, float value)
+{
+    uint32_t word;
+    if (s->is_float) {
+        memcpy(&word, &value, sizeof(float));
+    } else {
+        double scaled = floor(value * s->scale + 0.5);
+        if (scaled > s->scale - 1) {
+            scaled = s->scale - 1;
+        } else if (scaled < -s->scale) {
+            scaled = -s->scale;
+        }
+        word = (uint32_t)(int32_t)scaled;
+    }
+
+    for (long ii = 0; ii < s->bytes; ii++) {
+        p[s->big_endian ? s->bytes - 1 - ii : ii] = word & 0xFF;
+        word >>= 8;
+    }
+}
+
+/* Decode one channel of the frames [first, first + frames) of the
+ * destination from the source */
+void bed_stream_read(t_bed_stream* s, long channel, long first, long frames,
+                     float* block)
+{
+    size_t stride = (size_t)s->nchans * s->bytes;
+    unsigned char* data = s->source + s->data_offset + channel * s->bytes;
+    for (long ii = 0; ii < frames; ii++) {
+        long frame = bed_stream_source(s, first + ii);
+        block[ii] = bed_decode(s, data + (size_t)frame * stride);
+    }
+}
+
+void bed_stream_write(t_bed_stream* s, long channel, long first, long frames,
+                      float* block)
+{
+    size_t stride = (size_t)s->nchans * s->bytes;
+    unsigned char* data = s->dest + s->data_offset + channel * s->bytes;
+    for (long ii = 0; ii < frames; ii++) {
+        bed_encode(s, data + (size_t)(first + ii) * stride, block[ii]);
+    }
+}
+
+/* Process a sound file from disk to disk without loading it into an array.
+ * A reverse or a shuffle may come first and reorders the frames as they are
+ * read, then the pointwise operations of a batch apply on the way out */
+void bed_stream(t_bed* x, t_symbol* msg, short argc, t_atom* argv)
+{
+    if (bed_busy(x)) {
+        return;
+    }
+
+    if (argc < 2 || argv[0].a_type != A_SYMBOL
+        || argv[1].a_type != A_SYMBOL) {
+        pd_error(x, "bed • stream needs a source and a destination file");
+        return;
+    }
+
+    t_symbol* source = atom_getsymbol(argv);
+    t_symbol* dest = atom_getsymbol(argv + 1);
+    argc -= 2;
+    argv += 2;
+
+    char dir[MAXPDSTRING];
+    char* name;
+    char source_path[MAXPDSTRING];
+    char dest_path[MAXPDSTRING];
+
+    int fd = canvas_open(x->canvas, source->s_name, "", dir, &name,
+                         MAXPDSTRING, 1);
+    if (fd < 0) {
+        pd_error(x, "bed • Cannot find %s", source->s_name);
+        return;
+    }
+    sys_close(fd);
+    if (snprintf(source_path, MAXPDSTRING, "%s/%s", dir, name)
+        >= MAXPDSTRING) {
+        pd_error(x, "bed • Path to %s is too long", source->s_name);
+        return;
+    }
+    canvas_makefilename(x->canvas, dest->s_name, dest_path, MAXPDSTRING);
+
+    t_bed_stream* s = &x->stream;
+    s->reverse = 0;
+    if (!bed_map_source(x, s, source_path)) {
+        return;
+    }
+
+    long segments = 0;
+    if (argc > 0 && atom_getsymbol(argv) == gensym("reverse")) {
+        s->reverse = 1;
+        argc--;
+        argv++;
+    } else if (argc > 0 && atom_getsymbol(argv) == gensym("shuffle_n")) {
+        segments = argc > 1 ? atom_getfloat(argv + 1) : 0;
+        if (segments < 1 || segments > s->frames) {
+            post("bed • %ld is not a valid number of segments", segments);
+            bed_close_stream(s, 0);
+            return;
+        }
+        argc -= 2;
+        argv += 2;
+    }
+
+    /* Times are in the sample rate of the file */
+    x->b_sr = s->sr;
+    t_bed_job* j = bed_prepare_job(x, J_BATCH, s->frames, 1);
+    j->nchans = s->nchans;
+    j->stream = s;
+
+    if (argc > 0 || (!s->reverse && segments == 0)) {
+        if (!bed_parse_steps(x, j, argc, argv, s->frames)) {
+            bed_close_stream(s, 0);
+            return;
+        }
+        j->num_passes += bed_plan_batch(j);
+    }
+
+    if (segments > 0) {
+        long segmentlength = ceil((double)s->frames / segments);
+        segments = (s->frames + segmentlength - 1) / segmentlength;
+
+        s->order = getbytes(segments * sizeof(long));
+        if (s->order == NULL) {
+            pd_error(x, "bed • Cannot allocate memory for shuffle");
+            bed_free_job(j);
+            bed_close_stream(s, 0);
+            return;
+        }
+        bed_shuffle_order(x, s->order, segments);
+
+        s->segments = segments;
+        s->segment_frames = segmentlength;
+        for (long ii = 0; ii < segments; ii++) {
+            if (s->order[ii] == segments - 1) {
+                s->short_segment = ii;
+            }
+        }
+    }
+
+    if (!bed_map_dest(x, s, source_path, dest_path)) {
+        bed_free_job(j);
+        bed_close_stream(s, 0);
+        return;
+    }
+
+    if (x->async) {
+        x->async_op = gensym("stream");
+        x->async_samples = NULL;
+        bed_continue_async(x);
+        return;
+    }
+
+    while (bed_measuring(j)) {
+        bed_run_job(x, j);
+        if (!bed_next_pass(j)) {
+            bed_free_job(j);
+            bed_end_stream(x, 0);
             return;
-        } else {
-            memcpy(local_buffer, x->b_samples, buffersize);
         }
+    }
+
+    bed_run_job(x, j);
+    bed_free_job(j);
+    bed_end_stream(x, 1);
+}
+
+/******************************************************************************/
+
+void bed_undo(t_bed* x)
+{
+    if (bed_busy(x)) {
+        return;
+    }
+
+    if (x->next_edit == 0) {
+        post("bed • Nothing to undo");
+        return;
+    }
+
+    if (!bed_attach_buffer(x)) {
+        return;
+    }
 
-        garray_resize(x->buffer, bufferframes + x->undo_frames);
+    if (!x->b_valid) {
+        post("bed • Not a valid buffer!");
+        return;
+    }
 
-        long chunksize = x->undo_start * sizeof(float);
-        memcpy(x->b_samples, local_buffer, chunksize);
+    t_bed_edit* e = &x->history[x->next_edit - 1];
+    if (!bed_check_edit(x, e, 1) || !bed_apply_edit(x, e, 1)) {
+        return;
+    }
+    x->next_edit--;
 
-        chunksize = x->undo_frames * sizeof(float);
-        memcpy(x->b_samples + x->undo_start, x->undo_samples, chunksize);
-        chunksize = (bufferframes - x->undo_start) * sizeof(float);
-        memcpy(x->b_samples + x->undo_start + x->undo_frames,
-               local_buffer + x->undo_start, chunksize);
+    bed_redraw(x);
+}
 
-        freebytes(local_buffer, buffersize);
+void bed_redo(t_bed* x)
+{
+    if (bed_busy(x)) {
+        return;
+    }
 
-        x->undo_cut = 0;
+    if (x->next_edit == x->num_edits) {
+        post("bed • Nothing to redo");
+        return;
+    }
 
-        garray_redraw(x->buffer);
+    if (!bed_attach_buffer(x)) {
         return;
     }
 
-    if (x->undo_resize) {
-        garray_resize(x->buffer, x->undo_frames);
+    if (!x->b_valid) {
+        post("bed • Not a valid buffer!");
+        return;
     }
 
-    long chunksize = x->undo_frames * sizeof(float);
-    memcpy(x->b_samples + x->undo_start, x->undo_samples, chunksize);
-    x->can_undo = 0;
+    t_bed_edit* e = &x->history[x->next_edit];
+    if (!bed_check_edit(x, e, 0) || !bed_apply_edit(x, e, 0)) {
+        return;
+    }
+    x->next_edit++;
 
-    garray_redraw(x->buffer);
+    bed_redraw(x);
 }
 
 /******************************************************************************/
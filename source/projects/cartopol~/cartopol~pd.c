@@ -1,4 +1,5 @@
 #include "m_pd.h"
+#include "polar_kernels.h"
 
 #include <math.h>
 
@@ -7,6 +8,8 @@
 typedef struct _cartopol {
     t_object obj;
     t_float x_f;
+
+    short approximate;
 } t_cartopol;
 
 /* The arguments/inlets/outlets/vectors indexes
@@ -37,6 +40,11 @@ void cartopol_free(t_cartopol* x);
 void cartopol_dsp(t_cartopol* x, t_signal** sp, short* count);
 t_int* cartopol_perform(t_int* w);
 
+/* The object-specific prototypes
+ * *********************************************/
+void cartopol_approximate(t_cartopol* x, t_symbol* msg, short argc,
+                          t_atom* argv);
+
 
 /* Function prototypes
  * ********************************************************/
@@ -61,7 +69,8 @@ void cartopol_tilde_setup(void)
     class_addmethod(cartopol_class, (t_method)cartopol_dsp, gensym("dsp"), 0);
 
     /* Bind the object-specific methods */
-    // nothing
+    class_addmethod(cartopol_class, (t_method)cartopol_approximate,
+                    gensym("approximate"), A_GIMME, 0);
 
     /* Print message to Max window */
     post("cartopol~ • External was loaded");
@@ -89,6 +98,9 @@ void* cartopol_common_new(t_cartopol* x, short argc, t_atom* argv)
     outlet_new(&x->obj, gensym("signal"));
     outlet_new(&x->obj, gensym("signal"));
 
+    /* Initialize some state variables */
+    x->approximate = 0;
+
     /* Print message to Max window */
     post("cartopol~ • Object was created");
 
@@ -122,7 +134,7 @@ void cartopol_dsp(t_cartopol* x, t_signal** sp, short* count)
 t_int* cartopol_perform(t_int* w)
 {
     /* Copy the object pointer */
-    // t_cartopol *x = (t_cartopol *)w[OBJECT];
+    t_cartopol* x = (t_cartopol*)w[OBJECT];
 
     /* Copy signal pointers */
     t_float* input_real = (t_float*)w[INPUT_REAL];
@@ -140,12 +152,35 @@ t_int* cartopol_perform(t_int* w)
     float local_real;
     float local_imag;
 
-    for (int ii = 0; ii < framesize; ii++) {
-        local_real = input_real[ii];
-        local_imag = (ii == 0 || ii == framesize - 1) ? 0.0 : input_imag[ii];
-
-        output_magn[ii] = hypotf(local_real, local_imag);
-        output_phase[ii] = -atan2(local_imag, local_real);
+    if (x->approximate) {
+        // the edge bins carry no imaginary part and are done apart, which
+        // keeps the loop free of branches
+        for (int ii = 1; ii < framesize - 1; ii++) {
+            local_real = input_real[ii];
+            local_imag = input_imag[ii];
+
+            output_magn[ii] = sqrtf(local_real * local_real
+                                    + local_imag * local_imag);
+            output_phase[ii] = -polar_atan2(local_imag, local_real);
+        }
+
+        local_real = input_real[0];
+        output_magn[0] = fabsf(local_real);
+        output_phase[0] = -polar_atan2(0.0, local_real);
+
+        local_real = input_real[framesize - 1];
+        output_magn[framesize - 1] = fabsf(local_real);
+        output_phase[framesize - 1] = -polar_atan2(0.0, local_real);
+
+    } else {
+        for (int ii = 0; ii < framesize; ii++) {
+            local_real = input_real[ii];
+            local_imag = (ii == 0 || ii == framesize - 1) ? 0.0
+                                                          : input_imag[ii];
+
+            output_magn[ii] = hypotf(local_real, local_imag);
+            output_phase[ii] = -atan2(local_imag, local_real);
+        }
     }
 
     for (int ii = framesize; ii < n; ii++) {
@@ -157,3 +192,13 @@ t_int* cartopol_perform(t_int* w)
     /* Return the next address in the DSP chain */
     return w + NEXT;
 }
+
+/* The object-specific methods
+ * ************************************************/
+void cartopol_approximate(t_cartopol* x, t_symbol* msg, short argc,
+                          t_atom* argv)
+{
+    if (argc >= 1) {
+        x->approximate = (short)atom_getfloatarg(0, argc, argv);
+    }
+}
@@ -12,6 +12,8 @@
 #define DEFAULT_ATTENUATION 0.1
 #define MAXIMUM_ATTENUATION 1.0
 
+#define PEAK_LANES 8
+
 /* The object structure
  * *******************************************************/
 typedef struct _cleaner {
@@ -283,11 +285,22 @@ void cleaner_perform64(t_cleaner* x, t_object* dsp64, double** ins,
     t_double threshold_value;
     t_double attenuation_value;
 
-    for (int ii = 0; ii < n; ii++) {
-        if (maxamp < input[ii]) {
-            maxamp = input[ii];
+    /* Find the peak magnitude of the frame in independent lanes, which
+     * the compiler can overlap or vectorize without finite-math flags.
+     * A NaN never wins a comparison, so it is skipped in any lane */
+    t_double peak[PEAK_LANES] = {0.0};
+    int tail = n - n % PEAK_LANES;
+    for (int ii = 0; ii < tail; ii += PEAK_LANES) {
+        for (int jj = 0; jj < PEAK_LANES; jj++) {
+            peak[jj] = input[ii + jj] > peak[jj] ? input[ii + jj] : peak[jj];
         }
     }
+    for (int ii = tail; ii < n; ii++) {
+        maxamp = input[ii] > maxamp ? input[ii] : maxamp;
+    }
+    for (int jj = 0; jj < PEAK_LANES; jj++) {
+        maxamp = peak[jj] > maxamp ? peak[jj] : maxamp;
+    }
 
     if (x->threshold_connected) {
         threshold_value = (*threshold) * maxamp;
@@ -301,10 +314,10 @@ void cleaner_perform64(t_cleaner* x, t_object* dsp64, double** ins,
         attenuation_value = x->attenuation_value;
     }
 
+    /* Attenuate the bins below the threshold, leaving the input untouched */
     for (int ii = 0; ii < n; ii++) {
-        if (input[ii] < threshold_value) {
-            input[ii] *= attenuation_value;
-        }
-        output[ii] = input[ii];
+        output[ii] = input[ii] < threshold_value
+                         ? input[ii] * attenuation_value
+                         : input[ii];
     }
 }
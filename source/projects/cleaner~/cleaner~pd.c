@@ -10,6 +10,8 @@
 #define DEFAULT_ATTENUATION 0.1
 #define MAXIMUM_ATTENUATION 1.0
 
+#define PEAK_LANES 8
+
 /* The object structure
  * *******************************************************/
 typedef struct _cleaner {
@@ -204,16 +206,30 @@ t_int* cleaner_perform(t_int* w)
     /* Load state variables */
     // nothing
 
+    /* Only the first n/2+1 bins of a real FFT carry information */
+    int num_bins = n / 2 + 1;
+
     /* Perform the DSP loop */
     float maxamp = 0.0;
     float threshold_value;
     float attenuation_value;
 
-    for (int ii = 0; ii < n; ii++) {
-        if (maxamp < input[ii]) {
-            maxamp = input[ii];
+    /* Find the peak magnitude of the frame in independent lanes, which
+     * the compiler can overlap or vectorize without finite-math flags.
+     * A NaN never wins a comparison, so it is skipped in any lane */
+    float peak[PEAK_LANES] = {0.0};
+    int tail = num_bins - num_bins % PEAK_LANES;
+    for (int ii = 0; ii < tail; ii += PEAK_LANES) {
+        for (int jj = 0; jj < PEAK_LANES; jj++) {
+            peak[jj] = input[ii + jj] > peak[jj] ? input[ii + jj] : peak[jj];
         }
     }
+    for (int ii = tail; ii < num_bins; ii++) {
+        maxamp = input[ii] > maxamp ? input[ii] : maxamp;
+    }
+    for (int jj = 0; jj < PEAK_LANES; jj++) {
+        maxamp = peak[jj] > maxamp ? peak[jj] : maxamp;
+    }
 
     if (x->threshold_connected) {
         threshold_value = (*threshold) * maxamp;
@@ -227,11 +243,14 @@ t_int* cleaner_perform(t_int* w)
         attenuation_value = x->attenuation_value;
     }
 
-    for (int ii = 0; ii < n; ii++) {
-        if (input[ii] < threshold_value) {
-            input[ii] *= attenuation_value;
-        }
-        output[ii] = input[ii];
+    /* Attenuate the bins below the threshold, leaving the input untouched */
+    for (int ii = 0; ii < num_bins; ii++) {
+        output[ii] = input[ii] < threshold_value
+                         ? input[ii] * attenuation_value
+                         : input[ii];
+    }
+    for (int ii = num_bins; ii < n; ii++) {
+        output[ii] = 0.0;
     }
 
     /* Update state variables */
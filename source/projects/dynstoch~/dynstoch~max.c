@@ -8,7 +8,13 @@
 
 /* The global variables
  * *******************************************************/
-#define NUM_POINTS 12
+#define DEFAULT_POINTS 12
+#define MINIMUM_POINTS 2
+#define MAXIMUM_POINTS 4096
+
+#define DEFAULT_VOICES 1
+#define MINIMUM_VOICES 1
+#define MAXIMUM_VOICES 1024
 
 #define INITIAL_FREQ 440.0
 #define MINIMUM_FREQ 100.0
@@ -21,6 +27,41 @@
 #define MINIMUM_DUR_DEV 0.0
 #define DEFAULT_DUR_DEV 0.001
 
+/* Atomic exchange for handing voice states to the perform routine
+ * ************/
+#ifdef _MSC_VER
+#include <intrin.h>
+#define dynstoch_exchange(target, value)                                      \
+    _InterlockedExchangePointer((void* volatile*)(target), value)
+#else
+#define dynstoch_exchange(target, value)                                      \
+    __atomic_exchange_n(target, value, __ATOMIC_ACQ_REL)
+#endif
+
+/* The voice state structure
+ * **************************************************/
+typedef struct _dynstoch_state {
+    int num_voices;
+    int num_points;
+
+    /* Breakpoint storage, one row per voice: each voice owns
+     * (num_points + 1) amplitudes and num_points durations in each of the
+     * two buffers, the one being played and the precomputed next cycle */
+    float* amplitudes[2];
+    float* durations[2];
+
+    /* Per-voice state, one element per voice */
+    short* current_buffer;
+    short* next_ready;
+    int* current_segment;
+    float* remaining_samples;
+    int* total_length;
+    int* next_total_length;
+    float* frequencies;
+    float* corner_residuals;
+    double frequency_sum;
+} t_dynstoch_state;
+
 /* The object structure
  * *******************************************************/
 typedef struct _dynstoch {
@@ -29,10 +70,18 @@ typedef struct _dynstoch {
     float a_durdev;
     float a_freqrange[2];
     float a_newfreq;
-
-    int num_points;
-    float* amplitudes;
-    float* durations;
+    long a_points;
+    long a_voices;
+    long a_bandlimit;
+
+    /* The latest voice state, which the methods edit, and the one the
+     * perform routine plays. A new state waits in 'pending' until the
+     * perform routine takes it at the start of a vector; the state it
+     * played before is freed once a later one has been taken */
+    t_dynstoch_state* state;
+    t_dynstoch_state* playing;
+    t_dynstoch_state* volatile pending;
+    t_dynstoch_state* retired;
 
     float sr;
     float freq;
@@ -45,16 +94,14 @@ typedef struct _dynstoch {
     float amplitude_deviation;
     float duration_deviation;
 
-    int current_segment;
-    int remaining_samples;
-
-    int total_length;
+    unsigned int seed;
+    short bandlimited;
     short first_time;
 } t_dynstoch;
 
 /* The arguments/inlets/outlets/vectors indexes
  * *******************************/
-enum ARGUMENTS { NONE };
+enum ARGUMENTS { A_VOICES, A_POINTS };
 enum INLETS { I_INPUT, NUM_INLETS };
 enum OUTLETS { O_OUTPUT, O_FREQUENCY, NUM_OUTLETS };
 enum DSP { PERFORM, OBJECT, INPUT1, OUTPUT1, FREQUENCY, VECTOR_SIZE, NEXT };
@@ -80,10 +127,23 @@ void dynstoch_ampdev(t_dynstoch* x, float ampdev);
 void dynstoch_durdev(t_dynstoch* x, float durdev);
 void dynstoch_setfreq(t_dynstoch* x, float new_freq);
 void dynstoch_freqrange(t_dynstoch* x, float min_freq, float max_freq);
-
-float dynstoch_rand(float min, float max);
-void dynstoch_initwave(t_dynstoch* x);
-void dynstoch_recalculate(t_dynstoch* x);
+void dynstoch_points(t_dynstoch* x, float points);
+void dynstoch_voices(t_dynstoch* x, float voices);
+void dynstoch_bandlimit(t_dynstoch* x, float bandlimit);
+
+int dynstoch_init_memory(t_dynstoch* x, int num_voices, int num_points);
+void dynstoch_free_memory(t_dynstoch* x);
+t_dynstoch_state* dynstoch_new_state(int num_voices, int num_points);
+void dynstoch_free_state(t_dynstoch_state* state);
+
+float dynstoch_rand(t_dynstoch* x, float min, float max);
+void dynstoch_initwave(t_dynstoch* x, t_dynstoch_state* state, int voice);
+void dynstoch_recalculate(t_dynstoch* x, t_dynstoch_state* state, int voice);
+void dynstoch_swap(t_dynstoch* x, t_dynstoch_state* state, int voice);
+void dynstoch_ramp(t_double* out, long n, float start, float slope);
+void dynstoch_corner(t_dynstoch* x, t_dynstoch_state* state, int voice,
+                     int segment, float slope, float amplitude, float fraction,
+                     float gain, t_double* out);
 
 /* Function prototypes
  * ********************************************************/
@@ -93,6 +153,9 @@ t_max_err a_ampdev_set(t_dynstoch* x, void* attr, long ac, t_atom* av);
 t_max_err a_durdev_set(t_dynstoch* x, void* attr, long ac, t_atom* av);
 t_max_err a_setfreq_set(t_dynstoch* x, void* attr, long ac, t_atom* av);
 t_max_err a_freqrange_set(t_dynstoch* x, void* attr, long ac, t_atom* av);
+t_max_err a_points_set(t_dynstoch* x, void* attr, long ac, t_atom* av);
+t_max_err a_voices_set(t_dynstoch* x, void* attr, long ac, t_atom* av);
+t_max_err a_bandlimit_set(t_dynstoch* x, void* attr, long ac, t_atom* av);
 void dynstoch_float(t_dynstoch* x, double farg);
 void dynstoch_assist(t_dynstoch* x, void* b, long msg, long arg, char* dst);
 
@@ -146,6 +209,21 @@ int C74_EXPORT main()
     CLASS_ATTR_ORDER(dynstoch_class, "freqrange", 0, "4");
     CLASS_ATTR_ACCESSORS(dynstoch_class, "freqrange", NULL, a_freqrange_set);
 
+    CLASS_ATTR_LONG(dynstoch_class, "points", 0, t_dynstoch, a_points);
+    CLASS_ATTR_LABEL(dynstoch_class, "points", 0, "Number of points");
+    CLASS_ATTR_ORDER(dynstoch_class, "points", 0, "5");
+    CLASS_ATTR_ACCESSORS(dynstoch_class, "points", NULL, a_points_set);
+
+    CLASS_ATTR_LONG(dynstoch_class, "voices", 0, t_dynstoch, a_voices);
+    CLASS_ATTR_LABEL(dynstoch_class, "voices", 0, "Number of voices");
+    CLASS_ATTR_ORDER(dynstoch_class, "voices", 0, "6");
+    CLASS_ATTR_ACCESSORS(dynstoch_class, "voices", NULL, a_voices_set);
+
+    CLASS_ATTR_LONG(dynstoch_class, "bandlimit", 0, t_dynstoch, a_bandlimit);
+    CLASS_ATTR_LABEL(dynstoch_class, "bandlimit", 0, "Band-limited output");
+    CLASS_ATTR_ORDER(dynstoch_class, "bandlimit", 0, "7");
+    CLASS_ATTR_ACCESSORS(dynstoch_class, "bandlimit", NULL, a_bandlimit_set);
+
     /* Register the class with Max */
     class_register(CLASS_BOX, dynstoch_class);
 
@@ -211,6 +289,36 @@ t_max_err a_freqrange_set(t_dynstoch* x, void* attr, long ac, t_atom* av)
     return MAX_ERR_NONE;
 }
 
+t_max_err a_points_set(t_dynstoch* x, void* attr, long ac, t_atom* av)
+{
+    if (ac && av) {
+        dynstoch_points(x, atom_getlong(av));
+        x->a_points = x->state->num_points;
+    }
+
+    return MAX_ERR_NONE;
+}
+
+t_max_err a_voices_set(t_dynstoch* x, void* attr, long ac, t_atom* av)
+{
+    if (ac && av) {
+        dynstoch_voices(x, atom_getlong(av));
+        x->a_voices = x->state->num_voices;
+    }
+
+    return MAX_ERR_NONE;
+}
+
+t_max_err a_bandlimit_set(t_dynstoch* x, void* attr, long ac, t_atom* av)
+{
+    if (ac && av) {
+        x->a_bandlimit = atom_getlong(av) != 0;
+        dynstoch_bandlimit(x, x->a_bandlimit);
+    }
+
+    return MAX_ERR_NONE;
+}
+
 /* The 'float' method
  * *********************************************************/
 void dynstoch_float(t_dynstoch* x, double farg)
@@ -260,23 +368,30 @@ void* dynstoch_common_new(t_dynstoch* x, short argc, t_atom* argv)
     /* Avoid sharing memory among audio vectors */
     x->obj.z_misc |= Z_NO_INPLACE;
 
-    /* Initialize state variables */
-    x->num_points = NUM_POINTS;
-    x->amplitudes = (float*)malloc((x->num_points + 1) * sizeof(float));
-    x->durations = (float*)malloc(x->num_points * sizeof(float));
-
-    if (x->amplitudes == NULL || x->durations == NULL) {
-        error("dynstoch~ • Cannot allocate memory for this object");
-        return NULL;
+    /* Parse the arguments */
+    int num_voices = DEFAULT_VOICES;
+    int num_points = DEFAULT_POINTS;
+    if (argc > A_VOICES && atom_gettype(argv + A_VOICES) != A_SYM) {
+        num_voices = atom_getlong(argv + A_VOICES);
+    }
+    if (argc > A_POINTS && atom_gettype(argv + A_POINTS) != A_SYM) {
+        num_points = atom_getlong(argv + A_POINTS);
     }
 
+    /* Initialize state variables */
     x->freq = INITIAL_FREQ;
     x->min_freq = MINIMUM_FREQ;
     x->max_freq = MAXIMUM_FREQ;
     x->amplitude_deviation = DEFAULT_AMP_DEV;
     x->duration_deviation = DEFAULT_DUR_DEV;
+    x->seed = rand();
     x->first_time = 1;
 
+    if (!dynstoch_init_memory(x, num_voices, num_points)) {
+        error("dynstoch~ • Cannot allocate memory for this object");
+        return NULL;
+    }
+
     /* Process the attributes */
 #ifdef TARGET_IS_MAX
     x->a_ampdev = x->amplitude_deviation;
@@ -284,6 +399,9 @@ void* dynstoch_common_new(t_dynstoch* x, short argc, t_atom* argv)
     x->a_newfreq = x->freq;
     x->a_freqrange[0] = x->min_freq;
     x->a_freqrange[1] = x->max_freq;
+    x->a_points = x->state->num_points;
+    x->a_voices = x->state->num_voices;
+    x->a_bandlimit = x->bandlimited;
     attr_args_process(x, argc, argv);
 #endif
 
@@ -302,8 +420,7 @@ void dynstoch_free(t_dynstoch* x)
     dsp_free((t_pxobject*)x);
 
     /* Free allocated dynamic memory */
-    free(x->amplitudes);
-    free(x->durations);
+    dynstoch_free_memory(x);
 
     /* Print message to Max window */
     post("dynstoch~ • Memory was freed");
@@ -343,25 +460,42 @@ void dynstoch_setfreq(t_dynstoch* x, float new_freq)
         return;
     }
 
+    t_dynstoch_state* state = x->state;
+    int num_points = state->num_points;
     float total_length = x->sr / new_freq;
-    long segment_duration = total_length / (float)x->num_points;
-    long difference = total_length - (segment_duration * x->num_points);
-
-    for (int ii = 0; ii < x->num_points; ii++) {
-        x->durations[ii] = segment_duration;
+    long segment_duration = total_length / (float)num_points;
+    if (segment_duration < 1) {
+        segment_duration = 1;
     }
+    long difference = total_length - (segment_duration * num_points);
 
-    int jj = 0;
-    while (difference-- > 0) {
-        x->durations[jj++]++;
-        jj %= x->num_points;
-    }
+    state->frequency_sum = 0;
+    for (int voice = 0; voice < state->num_voices; voice++) {
+        float* durations = state->durations[state->current_buffer[voice]]
+                           + voice * num_points;
+
+        for (int ii = 0; ii < num_points; ii++) {
+            durations[ii] = segment_duration;
+        }
+
+        int jj = 0;
+        long remainder = difference;
+        while (remainder-- > 0) {
+            durations[jj++]++;
+            jj %= num_points;
+        }
+
+        state->total_length[voice] = 0;
+        for (int ii = 0; ii < num_points; ii++) {
+            state->total_length[voice] += durations[ii];
+        }
+        state->frequencies[voice] = x->sr / state->total_length[voice];
+        state->frequency_sum += state->frequencies[voice];
 
-    x->total_length = 0;
-    for (int ii = 0; ii < x->num_points; ii++) {
-        x->total_length += x->durations[ii];
+        /* The next cycle was derived from the old durations */
+        state->next_ready[voice] = 0;
     }
-    x->freq = x->sr / x->total_length;
+    x->freq = state->frequency_sum / state->num_voices;
 }
 
 void dynstoch_freqrange(t_dynstoch* x, float min_freq, float max_freq)
@@ -375,94 +509,368 @@ void dynstoch_freqrange(t_dynstoch* x, float min_freq, float max_freq)
 
     x->min_duration = x->sr / max_freq;
     x->max_duration = x->sr / min_freq;
+
+    /* The next cycles were limited to the old range */
+    for (int voice = 0; voice < x->state->num_voices; voice++) {
+        x->state->next_ready[voice] = 0;
+    }
 }
 
-float dynstoch_rand(float min, float max)
+void dynstoch_points(t_dynstoch* x, float points)
 {
-    return (rand() % 32768) / 32767.0 * (max - min) + min;
+    if (!dynstoch_init_memory(x, x->state->num_voices, points)) {
+        error("dynstoch~ • Cannot allocate memory for %d points",
+              (int)points);
+    }
 }
 
-void dynstoch_initwave(t_dynstoch* x)
+void dynstoch_voices(t_dynstoch* x, float voices)
 {
-    x->total_length = x->sr / x->freq;
+    if (!dynstoch_init_memory(x, voices, x->state->num_points)) {
+        error("dynstoch~ • Cannot allocate memory for %d voices",
+              (int)voices);
+    }
+}
 
-    for (int ii = 0; ii < x->num_points; ii++) {
-        x->amplitudes[ii] = dynstoch_rand(-1.0, 1.0);
-        x->durations[ii] = x->total_length / x->num_points;
+void dynstoch_bandlimit(t_dynstoch* x, float bandlimit)
+{
+    x->bandlimited = bandlimit != 0;
+
+    /* Drop corrections left over from the other mode */
+    for (int voice = 0; voice < x->state->num_voices; voice++) {
+        x->state->corner_residuals[voice] = 0;
+    }
+}
+
+/* The memory allocation routines
+ * *********************************************/
+int dynstoch_init_memory(t_dynstoch* x, int num_voices, int num_points)
+{
+    if (num_voices < MINIMUM_VOICES) {
+        num_voices = MINIMUM_VOICES;
+    } else if (num_voices > MAXIMUM_VOICES) {
+        num_voices = MAXIMUM_VOICES;
+        post("dynstoch~ • Number of voices limited to %d", MAXIMUM_VOICES);
+    }
+    if (num_points < MINIMUM_POINTS) {
+        num_points = MINIMUM_POINTS;
+    } else if (num_points > MAXIMUM_POINTS) {
+        num_points = MAXIMUM_POINTS;
+        post("dynstoch~ • Number of points limited to %d", MAXIMUM_POINTS);
+    }
+
+    /* Build the new state completely before handing it over, so a failed
+     * request leaves the object playing as it was */
+    t_dynstoch_state* state = dynstoch_new_state(num_voices, num_points);
+    if (state == NULL) {
+        return 0;
+    }
+
+    /* Without a sampling rate the waveforms are built by the DSP method */
+    if (x->sr > 0) {
+        for (int voice = 0; voice < num_voices; voice++) {
+            dynstoch_initwave(x, state, voice);
+            dynstoch_recalculate(x, state, voice);
+        }
+    } else {
+        x->first_time = 1;
     }
 
-    x->current_segment = 0;
-    x->amplitudes[x->num_points] = x->amplitudes[0];
-    x->remaining_samples = x->durations[0];
+    /* The first state is played right away */
+    if (x->state == NULL) {
+        x->state = state;
+        x->playing = state;
+        return 1;
+    }
+
+    /* Hand it over in one exchange. A state the perform routine has not
+     * taken yet is dropped; otherwise the perform routine has left every
+     * older state behind, and the one it plays now is retired */
+    t_dynstoch_state* dropped = dynstoch_exchange(&x->pending, state);
+    if (dropped) {
+        dynstoch_free_state(dropped);
+    } else {
+        dynstoch_free_state(x->retired);
+        x->retired = x->state;
+    }
+    x->state = state;
+
+    return 1;
+}
+
+void dynstoch_free_memory(t_dynstoch* x)
+{
+    /* The perform routine plays either the latest or the retired state */
+    if (x->retired != x->state) {
+        dynstoch_free_state(x->retired);
+    }
+    dynstoch_free_state(x->state);
+
+    x->state = NULL;
+    x->playing = NULL;
+    x->pending = NULL;
+    x->retired = NULL;
+}
+
+t_dynstoch_state* dynstoch_new_state(int num_voices, int num_points)
+{
+    t_dynstoch_state* state = (t_dynstoch_state*)calloc(
+        1, sizeof(t_dynstoch_state));
+    if (state == NULL) {
+        return NULL;
+    }
+
+    size_t amplitudes_size = num_voices * (num_points + 1) * sizeof(float);
+    size_t durations_size = num_voices * num_points * sizeof(float);
+
+    state->num_voices = num_voices;
+    state->num_points = num_points;
+    state->amplitudes[0] = (float*)malloc(amplitudes_size);
+    state->amplitudes[1] = (float*)malloc(amplitudes_size);
+    state->durations[0] = (float*)malloc(durations_size);
+    state->durations[1] = (float*)malloc(durations_size);
+    state->current_buffer = (short*)calloc(num_voices, sizeof(short));
+    state->next_ready = (short*)calloc(num_voices, sizeof(short));
+    state->current_segment = (int*)calloc(num_voices, sizeof(int));
+    state->remaining_samples = (float*)calloc(num_voices, sizeof(float));
+    state->total_length = (int*)calloc(num_voices, sizeof(int));
+    state->next_total_length = (int*)calloc(num_voices, sizeof(int));
+    state->frequencies = (float*)calloc(num_voices, sizeof(float));
+    state->corner_residuals = (float*)calloc(num_voices, sizeof(float));
+
+    if (state->amplitudes[0] == NULL || state->amplitudes[1] == NULL ||
+        state->durations[0] == NULL || state->durations[1] == NULL ||
+        state->current_buffer == NULL || state->next_ready == NULL ||
+        state->current_segment == NULL || state->remaining_samples == NULL ||
+        state->total_length == NULL || state->next_total_length == NULL ||
+        state->frequencies == NULL || state->corner_residuals == NULL) {
+        dynstoch_free_state(state);
+        return NULL;
+    }
+
+    return state;
+}
+
+void dynstoch_free_state(t_dynstoch_state* state)
+{
+    if (state == NULL) {
+        return;
+    }
+
+    free(state->amplitudes[0]);
+    free(state->amplitudes[1]);
+    free(state->durations[0]);
+    free(state->durations[1]);
+    free(state->current_buffer);
+    free(state->next_ready);
+    free(state->current_segment);
+    free(state->remaining_samples);
+    free(state->total_length);
+    free(state->next_total_length);
+    free(state->frequencies);
+    free(state->corner_residuals);
+    free(state);
+}
+
+/* The waveform routines
+ * ******************************************************/
+float dynstoch_rand(t_dynstoch* x, float min, float max)
+{
+    /* Linear congruential generator local to the object: cheaper than
+     * rand(), which may take a lock, and called twice per breakpoint */
+    x->seed = x->seed * 1664525 + 1013904223;
+    return (x->seed >> 8) * (1.0f / 16777215) * (max - min) + min;
+}
+
+void dynstoch_initwave(t_dynstoch* x, t_dynstoch_state* state, int voice)
+{
+    int num_points = state->num_points;
+    float* amplitudes = state->amplitudes[0] + voice * (num_points + 1);
+    float* durations = state->durations[0] + voice * num_points;
+
+    int segment_duration = (x->sr / x->freq) / num_points;
+    if (segment_duration < 1) {
+        segment_duration = 1;
+    }
+
+    for (int ii = 0; ii < num_points; ii++) {
+        amplitudes[ii] = dynstoch_rand(x, -1.0, 1.0);
+        durations[ii] = segment_duration;
+    }
+    amplitudes[num_points] = amplitudes[0];
+
+    state->total_length[voice] = segment_duration * num_points;
+    state->frequencies[voice] = x->sr / state->total_length[voice];
+    state->frequency_sum += state->frequencies[voice];
+
+    state->current_buffer[voice] = 0;
+    state->current_segment[voice] = 0;
+    state->remaining_samples[voice] = durations[0];
+    state->corner_residuals[voice] = 0;
+    state->next_ready[voice] = 0;
 }
 
-void dynstoch_recalculate(t_dynstoch* x)
+void dynstoch_recalculate(t_dynstoch* x, t_dynstoch_state* state, int voice)
 {
+    /* Derive the next cycle's breakpoints from the ones being played, so
+     * the perform routine only has to swap buffers at the end of a cycle */
+    int num_points = state->num_points;
+    int current = state->current_buffer[voice];
+    float* current_amplitudes = state->amplitudes[current]
+                                + voice * (num_points + 1);
+    float* current_durations = state->durations[current]
+                               + voice * num_points;
+    float* amplitudes = state->amplitudes[!current]
+                        + voice * (num_points + 1);
+    float* durations = state->durations[!current] + voice * num_points;
+
     float amplitude_adjustment;
     float duration_adjustment;
+    float max_segment_duration = x->sr * 50e-3 / num_points;
 
-    x->total_length = 0;
-    for (int ii = 0; ii < x->num_points; ii++) {
-        amplitude_adjustment = dynstoch_rand(-x->amplitude_deviation,
+    int total_length = 0;
+    for (int ii = 0; ii < num_points; ii++) {
+        amplitude_adjustment = dynstoch_rand(x, -x->amplitude_deviation,
                                              x->amplitude_deviation);
-        duration_adjustment = dynstoch_rand(-x->duration_deviation,
+        duration_adjustment = dynstoch_rand(x, -x->duration_deviation,
                                             x->duration_deviation);
 
         /* Adjust amplitudes and durations */
-        x->amplitudes[ii] += amplitude_adjustment;
-        x->durations[ii] += duration_adjustment;
+        amplitudes[ii] = current_amplitudes[ii] + amplitude_adjustment;
+        durations[ii] = current_durations[ii] + duration_adjustment;
 
         /* Mirror amplitudes */
-        while (x->amplitudes[ii] > 1.0) {
-            x->amplitudes[ii] = 2.0 - x->amplitudes[ii];
+        while (amplitudes[ii] > 1.0) {
+            amplitudes[ii] = 2.0 - amplitudes[ii];
         }
-        while (x->amplitudes[ii] < -1.0) {
-            x->amplitudes[ii] = -2.0 - x->amplitudes[ii];
+        while (amplitudes[ii] < -1.0) {
+            amplitudes[ii] = -2.0 - amplitudes[ii];
         }
 
         /* Limit durations */
-        if (x->durations[ii] < 1) {
-            x->durations[ii] = 1;
+        if (durations[ii] < 1) {
+            durations[ii] = 1;
         }
-        if (x->durations[ii] > x->sr * 50e-3 / x->num_points) {
-            x->durations[ii] = x->sr * 50e-3 / x->num_points;
+        if (durations[ii] > max_segment_duration) {
+            durations[ii] = max_segment_duration;
         }
 
-        x->total_length += x->durations[ii];
+        total_length += durations[ii];
     }
 
     /* Force waveform period within frequency boundaries */
     int difference;
-    if (x->total_length > x->max_duration) {
-        difference = x->total_length - x->max_duration;
-        x->total_length = x->max_duration;
+    if (total_length > x->max_duration) {
+        difference = total_length - x->max_duration;
         for (int ii = 0; ii < difference; ii++) {
-            if (x->durations[ii % x->num_points] > 1) {
-                x->durations[ii % x->num_points] -= 1;
+            if (durations[ii % num_points] > 1) {
+                durations[ii % num_points] -= 1;
             }
         }
-    } else if (x->total_length < x->min_duration) {
-        difference = x->min_duration - x->total_length;
-        x->total_length = x->min_duration;
+    } else if (total_length < x->min_duration) {
+        difference = x->min_duration - total_length;
         for (int ii = 0; ii < difference; ii++) {
-            x->durations[ii % x->num_points] += 1;
+            durations[ii % num_points] += 1;
         }
     }
 
-    /* Limit minimum durations and recalculate total length and frequency */
-    x->total_length = 0;
-    for (int ii = 0; ii < x->num_points; ii++) {
-        if (x->durations[ii] < 1) {
-            x->durations[ii] = 1;
+    /* Limit minimum durations and recalculate total length */
+    total_length = 0;
+    for (int ii = 0; ii < num_points; ii++) {
+        if (durations[ii] < 1) {
+            durations[ii] = 1;
         }
-        x->total_length += x->durations[ii];
+        total_length += durations[ii];
     }
 
-    x->freq = x->sr / x->total_length;
+    amplitudes[num_points] = amplitudes[0];
+
+    state->next_total_length[voice] = total_length;
+    state->next_ready[voice] = 1;
+}
+
+void dynstoch_swap(t_dynstoch* x, t_dynstoch_state* state, int voice)
+{
+    /* Make the precomputed cycle the current one */
+    state->current_buffer[voice] = !state->current_buffer[voice];
+
+    state->total_length[voice] = state->next_total_length[voice];
+
+    state->frequency_sum -= state->frequencies[voice];
+    state->frequencies[voice] = x->sr / state->total_length[voice];
+    state->frequency_sum += state->frequencies[voice];
+
+    state->current_segment[voice] = 0;
+    state->remaining_samples[voice] = state->durations[
+        state->current_buffer[voice]][voice * state->num_points];
+    state->next_ready[voice] = 0;
+}
+
+void dynstoch_ramp(t_double* out, long n, float start, float slope)
+{
+    /* Four independent lanes, each advancing by four slopes, so the
+     * compiler can map one iteration onto a single vector operation */
+    float slope4 = slope * 4;
+    float ramp0 = start;
+    float ramp1 = start + slope;
+    float ramp2 = start + slope * 2;
+    float ramp3 = start + slope * 3;
+
+    long ii = 0;
+    for (; ii + 4 <= n; ii += 4) {
+        out[ii + 0] += ramp0;
+        out[ii + 1] += ramp1;
+        out[ii + 2] += ramp2;
+        out[ii + 3] += ramp3;
+
+        ramp0 += slope4;
+        ramp1 += slope4;
+        ramp2 += slope4;
+        ramp3 += slope4;
+    }
+    for (; ii < n; ii++) {
+        out[ii] += ramp0;
+        ramp0 += slope;
+    }
+}
+
+void dynstoch_corner(t_dynstoch* x, t_dynstoch_state* state, int voice,
+                     int segment, float slope, float amplitude, float fraction,
+                     float gain, t_double* out)
+{
+    int num_points = state->num_points;
+    int buffer = state->current_buffer[voice];
+    int next_segment = segment + 1;
+
+    /* The segment after the last one is the first of the next cycle */
+    if (next_segment == num_points) {
+        if (!state->next_ready[voice]) {
+            dynstoch_recalculate(x, state, voice);
+        }
+        buffer = !buffer;
+        next_segment = 0;
+    }
 
-    x->current_segment = 0;
-    x->amplitudes[x->num_points] = x->amplitudes[0];
-    x->remaining_samples = x->durations[0];
+    float* amplitudes = state->amplitudes[buffer] + voice * (num_points + 1);
+    float* durations = state->durations[buffer] + voice * num_points;
+
+    /* Change of slope at the corner, and the step between the end of a
+     * cycle and the start of the next one */
+    float next_slope = (amplitudes[next_segment + 1] - amplitudes[next_segment])
+                       / durations[next_segment];
+    float slope_change = (next_slope - slope) * gain;
+    float step = (amplitudes[next_segment] - amplitude) * gain;
+
+    /* The corner lies 'fraction' of a sample after the last sample of the
+     * segment: add the two-point polyBLAMP and polyBLEP residuals to that
+     * sample and keep the ones for the sample after it */
+    float before = 1 - fraction;
+    float after = fraction;
+
+    *out += slope_change * before * before * before / 6
+            + step * before * before / 2;
+    state->corner_residuals[voice] = slope_change * after * after * after / 6
+                                 - step * after * after / 2;
 }
 
 /******************************************************************************/
@@ -478,12 +886,19 @@ void dynstoch_dsp64(t_dynstoch* x, t_object* dsp64, short* count,
     /* Initialize state variables */
     x->sr = samplerate;
 
-    /* Initialize waveform */
+    /* Initialize waveforms */
     dynstoch_freqrange(x, x->min_freq, x->max_freq);
+    t_dynstoch_state* state = x->state;
     if (x->first_time) {
-        dynstoch_initwave(x);
+        state->frequency_sum = 0;
+        for (int voice = 0; voice < state->num_voices; voice++) {
+            dynstoch_initwave(x, state, voice);
+        }
         x->first_time = 0;
     }
+    for (int voice = 0; voice < state->num_voices; voice++) {
+        dynstoch_recalculate(x, state, voice);
+    }
 
     object_method(dsp64, gensym("dsp_add64"), x, dynstoch_perform64, 0, NULL);
 }
@@ -495,47 +910,109 @@ void dynstoch_perform64(t_dynstoch* x, t_object* dsp64, double** ins,
     t_double* input = ins[0];
     t_double* output = outs[0];
     t_double* frequency = outs[1];
-    int n = sampleframes;
+    long n = sampleframes;
+
+    /* Take a new voice state at the start of the vector */
+    t_dynstoch_state* pending = dynstoch_exchange(&x->pending, NULL);
+    if (pending) {
+        x->playing = pending;
+    }
 
     /* Load state variables */
-    int num_points = x->num_points;
-    float* amplitudes = x->amplitudes;
-    float* durations = x->durations;
-
-    int current_segment = x->current_segment;
-    float remaining_samples = x->remaining_samples;
-
-    /* Perform the DSP loop */
-    float amplitude1 = amplitudes[current_segment + 0];
-    float amplitude2 = amplitudes[current_segment + 1];
-
-    float frac;
-    float sample;
-    while (n--) {
-        if (remaining_samples < 1) {
-            current_segment++;
-            if (current_segment == num_points) {
-                dynstoch_recalculate(x);
-                current_segment = 0;
+    t_dynstoch_state* state = x->playing;
+    int num_voices = state->num_voices;
+    int num_points = state->num_points;
+    short bandlimited = x->bandlimited;
+    double gain = 1.0 / num_voices;
+
+    /* Perform the DSP loop, one voice at a time */
+    for (long ii = 0; ii < n; ii++) {
+        output[ii] = 0.0;
+    }
+
+    for (int voice = 0; voice < num_voices; voice++) {
+        float* amplitudes = state->amplitudes[state->current_buffer[voice]]
+                            + voice * (num_points + 1);
+        float* durations = state->durations[state->current_buffer[voice]]
+                           + voice * num_points;
+
+        int current_segment = state->current_segment[voice];
+        float remaining_samples = state->remaining_samples[voice];
+
+        float amplitude1 = amplitudes[current_segment + 0];
+        float amplitude2 = amplitudes[current_segment + 1];
+
+        float slope;
+        float start;
+        long run;
+        long ii = 0;
+        while (ii < n) {
+            if (remaining_samples < 1) {
+                current_segment++;
+                if (current_segment == num_points) {
+                    /* Only a period shorter than the vector size gets here
+                     * before the next cycle has been precomputed */
+                    if (!state->next_ready[voice]) {
+                        dynstoch_recalculate(x, state, voice);
+                    }
+                    dynstoch_swap(x, state, voice);
+                    amplitudes = state->amplitudes[state->current_buffer[voice]]
+                                 + voice * (num_points + 1);
+                    durations = state->durations[state->current_buffer[voice]]
+                                + voice * num_points;
+                    current_segment = 0;
+                }
+
+                if (bandlimited) {
+                    /* Carry the fraction of a sample left over, so every
+                     * sample lies on the continuous breakpoint function */
+                    remaining_samples += durations[current_segment];
+                    output[ii] += state->corner_residuals[voice];
+                    state->corner_residuals[voice] = 0;
+                } else {
+                    remaining_samples = durations[current_segment];
+                }
+                amplitude1 = amplitudes[current_segment + 0];
+                amplitude2 = amplitudes[current_segment + 1];
             }
 
-            remaining_samples = x->durations[current_segment];
-            amplitude1 = x->amplitudes[current_segment + 0];
-            amplitude2 = x->amplitudes[current_segment + 1];
-        }
+            /* Render the rest of the segment, or of the vector, as one
+             * ramp with a single division per run */
+            run = remaining_samples;
+            if (run > n - ii) {
+                run = n - ii;
+            }
+
+            slope = (amplitude2 - amplitude1) / durations[current_segment];
+            start = amplitude2 - slope * (remaining_samples - 1);
+            dynstoch_ramp(output + ii, run, start * gain, slope * gain);
+
+            ii += run;
+            remaining_samples -= run;
 
-        frac = (remaining_samples - 1) / durations[current_segment];
-        sample = (amplitude1 - amplitude2) * frac + amplitude2;
+            if (bandlimited && remaining_samples < 1) {
+                dynstoch_corner(x, state, voice, current_segment, slope,
+                                amplitude2, remaining_samples, gain,
+                                output + ii - 1);
+            }
+        }
 
-        *output++ = sample;
-        *frequency++ = x->freq;
+        /* Update state variables */
+        state->current_segment[voice] = current_segment;
+        state->remaining_samples[voice] = remaining_samples;
 
-        remaining_samples--;
+        /* Precompute the next cycle outside the sample loop */
+        if (!state->next_ready[voice]) {
+            dynstoch_recalculate(x, state, voice);
+        }
     }
 
-    /* Update state variables */
-    x->current_segment = current_segment;
-    x->remaining_samples = remaining_samples;
+    /* Output the average frequency of the voices */
+    float freq = state->frequency_sum / num_voices;
+    for (long ii = 0; ii < n; ii++) {
+        frequency[ii] = freq;
+    }
+    x->freq = freq;
 }
 
 
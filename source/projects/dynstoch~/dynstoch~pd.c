@@ -1,4 +1,4 @@
-#include "m_pd.h"`
+#include "m_pd.h"
 
 #include <math.h>
 #include <stdlib.h>
@@ -6,7 +6,13 @@
 
 /* The global variables
  * *******************************************************/
-#define NUM_POINTS 12
+#define DEFAULT_POINTS 12
+#define MINIMUM_POINTS 2
+#define MAXIMUM_POINTS 4096
+
+#define DEFAULT_VOICES 1
+#define MINIMUM_VOICES 1
+#define MAXIMUM_VOICES 1024
 
 #define INITIAL_FREQ 440.0
 #define MINIMUM_FREQ 100.0
@@ -25,9 +31,25 @@ typedef struct _dynstoch {
     t_object obj;
     t_float x_f;
 
+    int num_voices;
     int num_points;
-    float* amplitudes;
-    float* durations;
+
+    /* Breakpoint storage, one row per voice: each voice owns
+     * (num_points + 1) amplitudes and num_points durations in each of the
+     * two buffers, the one being played and the precomputed next cycle */
+    float* amplitudes[2];
+    float* durations[2];
+
+    /* Per-voice state, one element per voice */
+    short* current_buffer;
+    short* next_ready;
+    int* current_segment;
+    float* remaining_samples;
+    int* total_length;
+    int* next_total_length;
+    float* frequencies;
+    float* corner_residuals;
+    double frequency_sum;
 
     float sr;
     float freq;
@@ -40,16 +62,14 @@ typedef struct _dynstoch {
     float amplitude_deviation;
     float duration_deviation;
 
-    int current_segment;
-    int remaining_samples;
-
-    int total_length;
+    unsigned int seed;
+    short bandlimited;
     short first_time;
 } t_dynstoch;
 
 /* The arguments/inlets/outlets/vectors indexes
  * *******************************/
-enum ARGUMENTS { NONE };
+enum ARGUMENTS { A_VOICES, A_POINTS };
 enum INLETS { I_INPUT, NUM_INLETS };
 enum OUTLETS { O_OUTPUT, O_FREQUENCY, NUM_OUTLETS };
 enum DSP { PERFORM, OBJECT, INPUT1, OUTPUT1, FREQUENCY, VECTOR_SIZE, NEXT };
@@ -72,10 +92,20 @@ void dynstoch_ampdev(t_dynstoch* x, float ampdev);
 void dynstoch_durdev(t_dynstoch* x, float durdev);
 void dynstoch_setfreq(t_dynstoch* x, float new_freq);
 void dynstoch_freqrange(t_dynstoch* x, float min_freq, float max_freq);
+void dynstoch_points(t_dynstoch* x, float points);
+void dynstoch_voices(t_dynstoch* x, float voices);
+void dynstoch_bandlimit(t_dynstoch* x, float bandlimit);
 
-float dynstoch_rand(float min, float max);
-void dynstoch_initwave(t_dynstoch* x);
-void dynstoch_recalculate(t_dynstoch* x);
+int dynstoch_init_memory(t_dynstoch* x, int num_voices, int num_points);
+void dynstoch_free_memory(t_dynstoch* x);
+
+float dynstoch_rand(t_dynstoch* x, float min, float max);
+void dynstoch_initwave(t_dynstoch* x, int voice);
+void dynstoch_recalculate(t_dynstoch* x, int voice);
+void dynstoch_swap(t_dynstoch* x, int voice);
+void dynstoch_ramp(t_float* out, t_int n, float start, float slope);
+void dynstoch_corner(t_dynstoch* x, int voice, int segment, float slope,
+                     float amplitude, float fraction, float gain, t_float* out);
 
 /******************************************************************************/
 
@@ -111,6 +141,12 @@ void dynstoch_tilde_setup(void)
                     gensym("setfreq"), A_FLOAT, 0);
     class_addmethod(dynstoch_class, (t_method)dynstoch_freqrange,
                     gensym("freqrange"), A_FLOAT, A_FLOAT, 0);
+    class_addmethod(dynstoch_class, (t_method)dynstoch_points,
+                    gensym("points"), A_FLOAT, 0);
+    class_addmethod(dynstoch_class, (t_method)dynstoch_voices,
+                    gensym("voices"), A_FLOAT, 0);
+    class_addmethod(dynstoch_class, (t_method)dynstoch_bandlimit,
+                    gensym("bandlimit"), A_FLOAT, 0);
 
     /* Print message to Max window */
     post("dynstoch~ • External was loaded");
@@ -137,23 +173,30 @@ void* dynstoch_common_new(t_dynstoch* x, short argc, t_atom* argv)
     outlet_new(&x->obj, gensym("signal"));
     outlet_new(&x->obj, gensym("signal"));
 
-    /* Initialize state variables */
-    x->num_points = NUM_POINTS;
-    x->amplitudes = (float*)malloc((x->num_points + 1) * sizeof(float));
-    x->durations = (float*)malloc(x->num_points * sizeof(float));
-
-    if (x->amplitudes == NULL || x->durations == NULL) {
-        pd_error(x, "dynstoch~ • Cannot allocate memory for this object");
-        return NULL;
+    /* Parse the arguments */
+    int num_voices = DEFAULT_VOICES;
+    int num_points = DEFAULT_POINTS;
+    if (argc > A_VOICES) {
+        num_voices = atom_getfloatarg(A_VOICES, argc, argv);
+    }
+    if (argc > A_POINTS) {
+        num_points = atom_getfloatarg(A_POINTS, argc, argv);
     }
 
+    /* Initialize state variables */
     x->freq = INITIAL_FREQ;
     x->min_freq = MINIMUM_FREQ;
     x->max_freq = MAXIMUM_FREQ;
     x->amplitude_deviation = DEFAULT_AMP_DEV;
     x->duration_deviation = DEFAULT_DUR_DEV;
+    x->seed = rand();
     x->first_time = 1;
 
+    if (!dynstoch_init_memory(x, num_voices, num_points)) {
+        pd_error(x, "dynstoch~ • Cannot allocate memory for this object");
+        return NULL;
+    }
+
     /* Print message to Max window */
     post("dynstoch~ • Object was created");
 
@@ -167,8 +210,7 @@ void dynstoch_free(t_dynstoch* x)
 {
 
     /* Free allocated dynamic memory */
-    free(x->amplitudes);
-    free(x->durations);
+    dynstoch_free_memory(x);
 
     /* Print message to Max window */
     post("dynstoch~ • Memory was freed");
@@ -214,25 +256,41 @@ void dynstoch_setfreq(t_dynstoch* x, float new_freq)
         return;
     }
 
+    int num_points = x->num_points;
     float total_length = x->sr / new_freq;
-    long segment_duration = total_length / (float)x->num_points;
-    long difference = total_length - (segment_duration * x->num_points);
-
-    for (int ii = 0; ii < x->num_points; ii++) {
-        x->durations[ii] = segment_duration;
+    long segment_duration = total_length / (float)num_points;
+    if (segment_duration < 1) {
+        segment_duration = 1;
     }
+    long difference = total_length - (segment_duration * num_points);
 
-    int jj = 0;
-    while (difference-- > 0) {
-        x->durations[jj++]++;
-        jj %= x->num_points;
-    }
+    x->frequency_sum = 0;
+    for (int voice = 0; voice < x->num_voices; voice++) {
+        float* durations = x->durations[x->current_buffer[voice]]
+                           + voice * num_points;
+
+        for (int ii = 0; ii < num_points; ii++) {
+            durations[ii] = segment_duration;
+        }
+
+        int jj = 0;
+        long remainder = difference;
+        while (remainder-- > 0) {
+            durations[jj++]++;
+            jj %= num_points;
+        }
+
+        x->total_length[voice] = 0;
+        for (int ii = 0; ii < num_points; ii++) {
+            x->total_length[voice] += durations[ii];
+        }
+        x->frequencies[voice] = x->sr / x->total_length[voice];
+        x->frequency_sum += x->frequencies[voice];
 
-    x->total_length = 0;
-    for (int ii = 0; ii < x->num_points; ii++) {
-        x->total_length += x->durations[ii];
+        /* The next cycle was derived from the old durations */
+        x->next_ready[voice] = 0;
     }
-    x->freq = x->sr / x->total_length;
+    x->freq = x->frequency_sum / x->num_voices;
 }
 
 void dynstoch_freqrange(t_dynstoch* x, float min_freq, float max_freq)
@@ -246,96 +304,329 @@ void dynstoch_freqrange(t_dynstoch* x, float min_freq, float max_freq)
 
     x->min_duration = x->sr / max_freq;
     x->max_duration = x->sr / min_freq;
+
+    /* The next cycles were limited to the old range */
+    for (int voice = 0; voice < x->num_voices; voice++) {
+        x->next_ready[voice] = 0;
+    }
+}
+
+void dynstoch_points(t_dynstoch* x, float points)
+{
+    if (!dynstoch_init_memory(x, x->num_voices, points)) {
+        pd_error(x, "dynstoch~ • Cannot allocate memory for %d points",
+                 (int)points);
+    }
+}
+
+void dynstoch_voices(t_dynstoch* x, float voices)
+{
+    if (!dynstoch_init_memory(x, voices, x->num_points)) {
+        pd_error(x, "dynstoch~ • Cannot allocate memory for %d voices",
+                 (int)voices);
+    }
+}
+
+void dynstoch_bandlimit(t_dynstoch* x, float bandlimit)
+{
+    x->bandlimited = bandlimit != 0;
+
+    /* Drop corrections left over from the other mode */
+    for (int voice = 0; voice < x->num_voices; voice++) {
+        x->corner_residuals[voice] = 0;
+    }
+}
+
+/* The memory allocation routines
+ * *********************************************/
+int dynstoch_init_memory(t_dynstoch* x, int num_voices, int num_points)
+{
+    if (num_voices < MINIMUM_VOICES) {
+        num_voices = MINIMUM_VOICES;
+    } else if (num_voices > MAXIMUM_VOICES) {
+        num_voices = MAXIMUM_VOICES;
+        post("dynstoch~ • Number of voices limited to %d", MAXIMUM_VOICES);
+    }
+    if (num_points < MINIMUM_POINTS) {
+        num_points = MINIMUM_POINTS;
+    } else if (num_points > MAXIMUM_POINTS) {
+        num_points = MAXIMUM_POINTS;
+        post("dynstoch~ • Number of points limited to %d", MAXIMUM_POINTS);
+    }
+
+    /* Allocate the new storage before releasing the old one, so a failed
+     * request leaves the object playing as it was */
+    t_dynstoch temp = *x;
+    size_t amplitudes_size = num_voices * (num_points + 1) * sizeof(float);
+    size_t durations_size = num_voices * num_points * sizeof(float);
+
+    temp.amplitudes[0] = (float*)malloc(amplitudes_size);
+    temp.amplitudes[1] = (float*)malloc(amplitudes_size);
+    temp.durations[0] = (float*)malloc(durations_size);
+    temp.durations[1] = (float*)malloc(durations_size);
+    temp.current_buffer = (short*)calloc(num_voices, sizeof(short));
+    temp.next_ready = (short*)calloc(num_voices, sizeof(short));
+    temp.current_segment = (int*)calloc(num_voices, sizeof(int));
+    temp.remaining_samples = (float*)calloc(num_voices, sizeof(float));
+    temp.total_length = (int*)calloc(num_voices, sizeof(int));
+    temp.next_total_length = (int*)calloc(num_voices, sizeof(int));
+    temp.frequencies = (float*)calloc(num_voices, sizeof(float));
+    temp.corner_residuals = (float*)calloc(num_voices, sizeof(float));
+
+    if (temp.amplitudes[0] == NULL || temp.amplitudes[1] == NULL ||
+        temp.durations[0] == NULL || temp.durations[1] == NULL ||
+        temp.current_buffer == NULL || temp.next_ready == NULL ||
+        temp.current_segment == NULL || temp.remaining_samples == NULL ||
+        temp.total_length == NULL || temp.next_total_length == NULL ||
+        temp.frequencies == NULL || temp.corner_residuals == NULL) {
+        dynstoch_free_memory(&temp);
+        return 0;
+    }
+
+    dynstoch_free_memory(x);
+
+    x->num_voices = num_voices;
+    x->num_points = num_points;
+    x->amplitudes[0] = temp.amplitudes[0];
+    x->amplitudes[1] = temp.amplitudes[1];
+    x->durations[0] = temp.durations[0];
+    x->durations[1] = temp.durations[1];
+    x->current_buffer = temp.current_buffer;
+    x->next_ready = temp.next_ready;
+    x->current_segment = temp.current_segment;
+    x->remaining_samples = temp.remaining_samples;
+    x->total_length = temp.total_length;
+    x->next_total_length = temp.next_total_length;
+    x->frequencies = temp.frequencies;
+    x->corner_residuals = temp.corner_residuals;
+
+    /* Without a sampling rate the waveforms are built by the DSP method */
+    if (x->sr > 0) {
+        x->frequency_sum = 0;
+        for (int voice = 0; voice < num_voices; voice++) {
+            dynstoch_initwave(x, voice);
+            dynstoch_recalculate(x, voice);
+        }
+    } else {
+        x->first_time = 1;
+    }
+
+    return 1;
+}
+
+void dynstoch_free_memory(t_dynstoch* x)
+{
+    free(x->amplitudes[0]);
+    free(x->amplitudes[1]);
+    free(x->durations[0]);
+    free(x->durations[1]);
+    free(x->current_buffer);
+    free(x->next_ready);
+    free(x->current_segment);
+    free(x->remaining_samples);
+    free(x->total_length);
+    free(x->next_total_length);
+    free(x->frequencies);
+    free(x->corner_residuals);
 }
 
-float dynstoch_rand(float min, float max)
+/* The waveform routines
+ * ******************************************************/
+float dynstoch_rand(t_dynstoch* x, float min, float max)
 {
-    return (rand() % 32768) / 32767.0 * (max - min) + min;
+    /* Linear congruential generator local to the object: cheaper than
+     * rand(), which may take a lock, and called twice per breakpoint */
+    x->seed = x->seed * 1664525 + 1013904223;
+    return (x->seed >> 8) * (1.0f / 16777215) * (max - min) + min;
 }
 
-void dynstoch_initwave(t_dynstoch* x)
+void dynstoch_initwave(t_dynstoch* x, int voice)
 {
-    x->total_length = x->sr / x->freq;
+    int num_points = x->num_points;
+    float* amplitudes = x->amplitudes[0] + voice * (num_points + 1);
+    float* durations = x->durations[0] + voice * num_points;
 
-    for (int ii = 0; ii < x->num_points; ii++) {
-        x->amplitudes[ii] = dynstoch_rand(-1.0, 1.0);
-        x->durations[ii] = x->total_length / x->num_points;
+    int segment_duration = (x->sr / x->freq) / num_points;
+    if (segment_duration < 1) {
+        segment_duration = 1;
     }
 
-    x->current_segment = 0;
-    x->amplitudes[x->num_points] = x->amplitudes[0];
-    x->remaining_samples = x->durations[0];
+    for (int ii = 0; ii < num_points; ii++) {
+        amplitudes[ii] = dynstoch_rand(x, -1.0, 1.0);
+        durations[ii] = segment_duration;
+    }
+    amplitudes[num_points] = amplitudes[0];
+
+    x->total_length[voice] = segment_duration * num_points;
+    x->frequencies[voice] = x->sr / x->total_length[voice];
+    x->frequency_sum += x->frequencies[voice];
+
+    x->current_buffer[voice] = 0;
+    x->current_segment[voice] = 0;
+    x->remaining_samples[voice] = durations[0];
+    x->corner_residuals[voice] = 0;
+    x->next_ready[voice] = 0;
 }
 
-void dynstoch_recalculate(t_dynstoch* x)
+void dynstoch_recalculate(t_dynstoch* x, int voice)
 {
+    /* Derive the next cycle's breakpoints from the ones being played, so
+     * the perform routine only has to swap buffers at the end of a cycle */
+    int num_points = x->num_points;
+    int current = x->current_buffer[voice];
+    float* current_amplitudes = x->amplitudes[current]
+                                + voice * (num_points + 1);
+    float* current_durations = x->durations[current] + voice * num_points;
+    float* amplitudes = x->amplitudes[!current] + voice * (num_points + 1);
+    float* durations = x->durations[!current] + voice * num_points;
+
     float amplitude_adjustment;
     float duration_adjustment;
+    float max_segment_duration = x->sr * 50e-3 / num_points;
 
-    x->total_length = 0;
-    for (int ii = 0; ii < x->num_points; ii++) {
-        amplitude_adjustment = dynstoch_rand(-x->amplitude_deviation,
+    int total_length = 0;
+    for (int ii = 0; ii < num_points; ii++) {
+        amplitude_adjustment = dynstoch_rand(x, -x->amplitude_deviation,
                                              x->amplitude_deviation);
-        duration_adjustment = dynstoch_rand(-x->duration_deviation,
+        duration_adjustment = dynstoch_rand(x, -x->duration_deviation,
                                             x->duration_deviation);
 
         /* Adjust amplitudes and durations */
-        x->amplitudes[ii] += amplitude_adjustment;
-        x->durations[ii] += duration_adjustment;
+        amplitudes[ii] = current_amplitudes[ii] + amplitude_adjustment;
+        durations[ii] = current_durations[ii] + duration_adjustment;
 
         /* Mirror amplitudes */
-        while (x->amplitudes[ii] > 1.0) {
-            x->amplitudes[ii] = 2.0 - x->amplitudes[ii];
+        while (amplitudes[ii] > 1.0) {
+            amplitudes[ii] = 2.0 - amplitudes[ii];
         }
-        while (x->amplitudes[ii] < -1.0) {
-            x->amplitudes[ii] = -2.0 - x->amplitudes[ii];
+        while (amplitudes[ii] < -1.0) {
+            amplitudes[ii] = -2.0 - amplitudes[ii];
         }
 
         /* Limit durations */
-        if (x->durations[ii] < 1) {
-            x->durations[ii] = 1;
+        if (durations[ii] < 1) {
+            durations[ii] = 1;
         }
-        if (x->durations[ii] > x->sr * 50e-3 / x->num_points) {
-            x->durations[ii] = x->sr * 50e-3 / x->num_points;
+        if (durations[ii] > max_segment_duration) {
+            durations[ii] = max_segment_duration;
         }
 
-        x->total_length += x->durations[ii];
+        total_length += durations[ii];
     }
 
     /* Force waveform period within frequency boundaries */
     int difference;
-    if (x->total_length > x->max_duration) {
-        difference = x->total_length - x->max_duration;
-        x->total_length = x->max_duration;
+    if (total_length > x->max_duration) {
+        difference = total_length - x->max_duration;
         for (int ii = 0; ii < difference; ii++) {
-            if (x->durations[ii % x->num_points] > 1) {
-                x->durations[ii % x->num_points] -= 1;
+            if (durations[ii % num_points] > 1) {
+                durations[ii % num_points] -= 1;
             }
         }
-    } else if (x->total_length < x->min_duration) {
-        difference = x->min_duration - x->total_length;
-        x->total_length = x->min_duration;
+    } else if (total_length < x->min_duration) {
+        difference = x->min_duration - total_length;
         for (int ii = 0; ii < difference; ii++) {
-            x->durations[ii % x->num_points] += 1;
+            durations[ii % num_points] += 1;
         }
     }
 
-    /* Limit minimum durations and recalculate total length and frequency */
-    x->total_length = 0;
-    for (int ii = 0; ii < x->num_points; ii++) {
-        if (x->durations[ii] < 1) {
-            x->durations[ii] = 1;
+    /* Limit minimum durations and recalculate total length */
+    total_length = 0;
+    for (int ii = 0; ii < num_points; ii++) {
+        if (durations[ii] < 1) {
+            durations[ii] = 1;
         }
-        x->total_length += x->durations[ii];
+        total_length += durations[ii];
     }
 
-    x->freq = x->sr / x->total_length;
+    amplitudes[num_points] = amplitudes[0];
 
-    x->current_segment = 0;
-    x->amplitudes[x->num_points] = x->amplitudes[0];
-    x->remaining_samples = x->durations[0];
+    x->next_total_length[voice] = total_length;
+    x->next_ready[voice] = 1;
 }
 
+void dynstoch_swap(t_dynstoch* x, int voice)
+{
+    /* Make the precomputed cycle the current one */
+    x->current_buffer[voice] = !x->current_buffer[voice];
+
+    x->total_length[voice] = x->next_total_length[voice];
+
+    x->frequency_sum -= x->frequencies[voice];
+    x->frequencies[voice] = x->sr / x->total_length[voice];
+    x->frequency_sum += x->frequencies[voice];
+
+    x->current_segment[voice] = 0;
+    x->remaining_samples[voice] =
+        x->durations[x->current_buffer[voice]][voice * x->num_points];
+    x->next_ready[voice] = 0;
+}
+
+void dynstoch_ramp(t_float* out, t_int n, float start, float slope)
+{
+    /* Four independent lanes, each advancing by four slopes, so the
+     * compiler can map one iteration onto a single vector operation */
+    float slope4 = slope * 4;
+    float ramp0 = start;
+    float ramp1 = start + slope;
+    float ramp2 = start + slope * 2;
+    float ramp3 = start + slope * 3;
+
+    t_int ii = 0;
+    for (; ii + 4 <= n; ii += 4) {
+        out[ii + 0] += ramp0;
+        out[ii + 1] += ramp1;
+        out[ii + 2] += ramp2;
+        out[ii + 3] += ramp3;
+
+        ramp0 += slope4;
+        ramp1 += slope4;
+        ramp2 += slope4;
+        ramp3 += slope4;
+    }
+    for (; ii < n; ii++) {
+        out[ii] += ramp0;
+        ramp0 += slope;
+    }
+}
+
+void dynstoch_corner(t_dynstoch* x, int voice, int segment, float slope,
+                     float amplitude, float fraction, float gain, t_float* out)
+{
+    int num_points = x->num_points;
+    int buffer = x->current_buffer[voice];
+    int next_segment = segment + 1;
+
+    /* The segment after the last one is the first of the next cycle */
+    if (next_segment == num_points) {
+        if (!x->next_ready[voice]) {
+            dynstoch_recalculate(x, voice);
+        }
+        buffer = !buffer;
+        next_segment = 0;
+    }
+
+    float* amplitudes = x->amplitudes[buffer] + voice * (num_points + 1);
+    float* durations = x->durations[buffer] + voice * num_points;
+
+    /* Change of slope at the corner, and the step between the end of a
+     * cycle and the start of the next one */
+    float next_slope = (amplitudes[next_segment + 1] - amplitudes[next_segment])
+                       / durations[next_segment];
+    float slope_change = (next_slope - slope) * gain;
+    float step = (amplitudes[next_segment] - amplitude) * gain;
+
+    /* The corner lies 'fraction' of a sample after the last sample of the
+     * segment: add the two-point polyBLAMP and polyBLEP residuals to that
+     * sample and keep the ones for the sample after it */
+    float before = 1 - fraction;
+    float after = fraction;
+
+    *out += slope_change * before * before * before / 6
+            + step * before * before / 2;
+    x->corner_residuals[voice] = slope_change * after * after * after / 6
+                                 - step * after * after / 2;
+}
 
 /* The 'DSP' method
  * ***********************************************************/
@@ -349,12 +640,18 @@ void dynstoch_dsp(t_dynstoch* x, t_signal** sp, short* count)
     /* Initialize state variables */
     x->sr = sp[0]->s_sr;
 
-    /* Initialize waveform */
+    /* Initialize waveforms */
     dynstoch_freqrange(x, x->min_freq, x->max_freq);
     if (x->first_time) {
-        dynstoch_initwave(x);
+        x->frequency_sum = 0;
+        for (int voice = 0; voice < x->num_voices; voice++) {
+            dynstoch_initwave(x, voice);
+        }
         x->first_time = 0;
     }
+    for (int voice = 0; voice < x->num_voices; voice++) {
+        dynstoch_recalculate(x, voice);
+    }
 
     /* Attach the object to the DSP chain */
     dsp_add(dynstoch_perform, NEXT - 1, x, sp[0]->s_vec, sp[1]->s_vec,
@@ -379,44 +676,98 @@ t_int* dynstoch_perform(t_int* w)
     t_int n = w[VECTOR_SIZE];
 
     /* Load state variables */
+    int num_voices = x->num_voices;
     int num_points = x->num_points;
-    float* amplitudes = x->amplitudes;
-    float* durations = x->durations;
-
-    int current_segment = x->current_segment;
-    float remaining_samples = x->remaining_samples;
-
-    /* Perform the DSP loop */
-    float amplitude1 = amplitudes[current_segment + 0];
-    float amplitude2 = amplitudes[current_segment + 1];
-
-    float frac;
-    float sample;
-    while (n--) {
-        if (remaining_samples < 1) {
-            current_segment++;
-            if (current_segment == num_points) {
-                dynstoch_recalculate(x);
-                current_segment = 0;
+    short bandlimited = x->bandlimited;
+    float gain = 1.0 / num_voices;
+
+    /* Perform the DSP loop, one voice at a time */
+    for (t_int ii = 0; ii < n; ii++) {
+        output[ii] = 0.0;
+    }
+
+    for (int voice = 0; voice < num_voices; voice++) {
+        float* amplitudes = x->amplitudes[x->current_buffer[voice]]
+                            + voice * (num_points + 1);
+        float* durations = x->durations[x->current_buffer[voice]]
+                           + voice * num_points;
+
+        int current_segment = x->current_segment[voice];
+        float remaining_samples = x->remaining_samples[voice];
+
+        float amplitude1 = amplitudes[current_segment + 0];
+        float amplitude2 = amplitudes[current_segment + 1];
+
+        float slope;
+        float start;
+        t_int run;
+        t_int ii = 0;
+        while (ii < n) {
+            if (remaining_samples < 1) {
+                current_segment++;
+                if (current_segment == num_points) {
+                    /* Only a period shorter than the vector size gets here
+                     * before the next cycle has been precomputed */
+                    if (!x->next_ready[voice]) {
+                        dynstoch_recalculate(x, voice);
+                    }
+                    dynstoch_swap(x, voice);
+                    amplitudes = x->amplitudes[x->current_buffer[voice]]
+                                 + voice * (num_points + 1);
+                    durations = x->durations[x->current_buffer[voice]]
+                                + voice * num_points;
+                    current_segment = 0;
+                }
+
+                if (bandlimited) {
+                    /* Carry the fraction of a sample left over, so every
+                     * sample lies on the continuous breakpoint function */
+                    remaining_samples += durations[current_segment];
+                    output[ii] += x->corner_residuals[voice];
+                    x->corner_residuals[voice] = 0;
+                } else {
+                    remaining_samples = durations[current_segment];
+                }
+                amplitude1 = amplitudes[current_segment + 0];
+                amplitude2 = amplitudes[current_segment + 1];
             }
 
-            remaining_samples = x->durations[current_segment];
-            amplitude1 = x->amplitudes[current_segment + 0];
-            amplitude2 = x->amplitudes[current_segment + 1];
-        }
+            /* Render the rest of the segment, or of the vector, as one
+             * ramp with a single division per run */
+            run = remaining_samples;
+            if (run > n - ii) {
+                run = n - ii;
+            }
 
-        frac = (remaining_samples - 1) / durations[current_segment];
-        sample = (amplitude1 - amplitude2) * frac + amplitude2;
+            slope = (amplitude2 - amplitude1) / durations[current_segment];
+            start = amplitude2 - slope * (remaining_samples - 1);
+            dynstoch_ramp(output + ii, run, start * gain, slope * gain);
 
-        *output++ = sample;
-        *frequency++ = x->freq;
+            ii += run;
+            remaining_samples -= run;
 
-        remaining_samples--;
+            if (bandlimited && remaining_samples < 1) {
+                dynstoch_corner(x, voice, current_segment, slope, amplitude2,
+                                remaining_samples, gain, output + ii - 1);
+            }
+        }
+
+        /* Update state variables */
+        x->current_segment[voice] = current_segment;
+        x->remaining_samples[voice] = remaining_samples;
+
+        /* Precompute the next cycle outside the sample loop */
+        if (!x->next_ready[voice]) {
+            dynstoch_recalculate(x, voice);
+        }
     }
 
-    /* Update state variables */
-    x->current_segment = current_segment;
-    x->remaining_samples = remaining_samples;
+    /* Output the average frequency of the voices */
+    float freq = x->frequency_sum / num_voices;
+    for (t_int ii = 0; ii < n; ii++) {
+        frequency[ii] = freq;
+    }
+    x->freq = freq;
 
     /* Return the next address in the DSP chain */
     return w + NEXT;
@@ -1,4 +1,5 @@
 #include "m_pd.h"
+#include "polar_kernels.h"
 
 #include <math.h>
 
@@ -7,6 +8,8 @@
 typedef struct _poltocar {
     t_object obj;
     t_float x_f;
+
+    short approximate;
 } t_poltocar;
 
 /* The arguments/inlets/outlets/vectors indexes
@@ -37,6 +40,11 @@ void poltocar_free(t_poltocar* x);
 void poltocar_dsp(t_poltocar* x, t_signal** sp, short* count);
 t_int* poltocar_perform(t_int* w);
 
+/* The object-specific prototypes
+ * *********************************************/
+void poltocar_approximate(t_poltocar* x, t_symbol* msg, short argc,
+                          t_atom* argv);
+
 /******************************************************************************/
 
 /* Function prototypes
@@ -62,7 +70,8 @@ void poltocar_tilde_setup(void)
     class_addmethod(poltocar_class, (t_method)poltocar_dsp, gensym("dsp"), 0);
 
     /* Bind the object-specific methods */
-    // nothing
+    class_addmethod(poltocar_class, (t_method)poltocar_approximate,
+                    gensym("approximate"), A_GIMME, 0);
 
     /* Print message to Max window */
     post("poltocar~ • External was loaded");
@@ -89,6 +98,9 @@ void* poltocar_common_new(t_poltocar* x, short argc, t_atom* argv)
     outlet_new(&x->obj, gensym("signal"));
     outlet_new(&x->obj, gensym("signal"));
 
+    /* Initialize some state variables */
+    x->approximate = 0;
+
     /* Print message to Max window */
     post("poltocar~ • Object was created");
 
@@ -121,7 +133,7 @@ void poltocar_dsp(t_poltocar* x, t_signal** sp, short* count)
 t_int* poltocar_perform(t_int* w)
 {
     /* Copy the object pointer */
-    // t_poltocar *x = (t_poltocar *)w[OBJECT];
+    t_poltocar* x = (t_poltocar*)w[OBJECT];
 
     /* Copy signal pointers */
     t_float* input_magn = (t_float*)w[INPUT_MAGN];
@@ -138,13 +150,33 @@ t_int* poltocar_perform(t_int* w)
 
     float local_real;
     float local_imag;
-
-    for (int ii = 0; ii < framesize; ii++) {
-        local_real = input_magn[ii] * cos(input_phase[ii]);
-        local_imag = -input_magn[ii] * sin(input_phase[ii]);
-
-        output_real[ii] = local_real;
-        output_imag[ii] = (ii == 0 || ii == framesize - 1) ? 0.0 : local_imag;
+    float sine;
+    float cosine;
+
+    if (x->approximate) {
+        // the edge bins are cleared after the loop to keep it free of
+        // branches
+        for (int ii = 0; ii < framesize; ii++) {
+            polar_sincos(input_phase[ii], &sine, &cosine);
+            local_real = input_magn[ii] * cosine;
+            local_imag = -input_magn[ii] * sine;
+
+            output_real[ii] = local_real;
+            output_imag[ii] = local_imag;
+        }
+
+        output_imag[0] = 0.0;
+        output_imag[framesize - 1] = 0.0;
+
+    } else {
+        for (int ii = 0; ii < framesize; ii++) {
+            local_real = input_magn[ii] * cos(input_phase[ii]);
+            local_imag = -input_magn[ii] * sin(input_phase[ii]);
+
+            output_real[ii] = local_real;
+            output_imag[ii] = (ii == 0 || ii == framesize - 1) ? 0.0
+                                                               : local_imag;
+        }
     }
     for (int ii = framesize; ii < n; ii++) {
         output_real[ii] = 0.0;
@@ -154,3 +186,13 @@ t_int* poltocar_perform(t_int* w)
     /* Return the next address in the DSP chain */
     return w + NEXT;
 }
+
+/* The object-specific methods
+ * ************************************************/
+void poltocar_approximate(t_poltocar* x, t_symbol* msg, short argc,
+                          t_atom* argv)
+{
+    if (argc >= 1) {
+        x->approximate = (short)atom_getfloatarg(0, argc, argv);
+    }
+}
@@ -1,6 +1,7 @@
 #include "m_pd.h"
 
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
 /* The global variables
@@ -24,6 +25,65 @@
 #define DEFAULT_SUSTAIN_DURATION 100
 #define DEFAULT_RELEASE_DURATION 50
 
+#define EVENT_QUEUE_SIZE 256
+
+#define NUM_SEQUENCE_SLOTS 3
+#define SEQUENCE_SLOT 3
+#define SEQUENCE_READY 4
+
+/* Atomic exchange for handing sequences to the perform routine
+ * ***************/
+#ifdef _MSC_VER
+#include <intrin.h>
+#define retroseq_exchange(target, value) _InterlockedExchange(target, value)
+#else
+#define retroseq_exchange(target, value)                                      \
+    __atomic_exchange_n(target, value, __ATOMIC_ACQ_REL)
+#endif
+
+/* The event structure
+ * ********************************************************/
+typedef struct _retroseq_event {
+    double time;
+    short type;
+    float duration;
+} t_retroseq_event;
+
+/* The sequence structure
+ * *****************************************************/
+typedef struct _retroseq_sequence {
+    float* notes;
+    int note_length;
+    float* durations;
+    int duration_length;
+    long serial;
+
+    float* note_storage;
+    float* duration_storage;
+} t_retroseq_sequence;
+
+/* The pattern bank structure
+ * *************************************************/
+typedef struct _retroseq_bank {
+    int num_patterns;
+    long num_steps;
+    long* offsets;
+    int* lengths;
+    float* notes;
+    float* durations;
+} t_retroseq_bank;
+
+/* The envelope structure
+ * *****************************************************/
+typedef struct _retroseq_envelope {
+    float targets[4];
+    int lengths[4];
+    int stage;
+    int remaining;
+    float value;
+    float increment;
+} t_retroseq_envelope;
+
 /* The object structure
  * *******************************************************/
 typedef struct _retroseq {
@@ -44,6 +104,21 @@ typedef struct _retroseq {
     float current_duration_value;
     int duration_counter;
 
+    t_retroseq_sequence sequences[NUM_SEQUENCE_SLOTS];
+    int sequence_front;
+    int sequence_back;
+    volatile long sequence_middle;
+    volatile long sequence_restart;
+    short swap_on_cycle;
+    short echo_sequences;
+
+    long sequence_serial;
+    volatile long sequence_taken;
+    t_retroseq_bank* bank;
+    t_retroseq_bank* retired_bank;
+    long retired_at;
+    t_canvas* canvas;
+
     void* shuffle_freqs_outlet;
     void* shuffle_durs_outlet;
     t_atom* shuffle_list;
@@ -53,14 +128,21 @@ typedef struct _retroseq {
     int sample_counter;
 
     void* bang_outlet;
-    void* bang_clock;
-
     void* adsr_outlet;
-    void* adsr_clock;
+
+    void* event_clock;
+    t_retroseq_event* event_queue;
+    int event_read;
+    int event_write;
+    double time_origin;
 
     short elastic_sustain;
     float sustain_amplitude;
 
+    short signal_envelope;
+    float envelope_shape[10];
+    t_retroseq_envelope envelope;
+
     int adsr_bytes;
     float* adsr;
     int adsr_out_bytes;
@@ -71,6 +153,7 @@ typedef struct _retroseq {
     short manual_override;
     short trigger_sent;
     short play_backwards;
+    int stride;
 } t_retroseq;
 
 /* The arguments/inlets/outlets/vectors indexes
@@ -83,9 +166,12 @@ enum OUTLETS {
     O_BANG,
     O_SHUFFLE_F,
     O_SHUFFLE_D,
+    O_TRIGGER,
+    O_ENVELOPE,
     NUM_OUTLETS
 };
-enum DSP { PERFORM, OBJECT, OUTPUT, VECTOR_SIZE, NEXT };
+enum DSP { PERFORM, OBJECT, OUTPUT, TRIGGER, ENVELOPE, VECTOR_SIZE, NEXT };
+enum EVENTS { E_ADSR, E_BANG };
 
 /* The class pointer
  * **********************************************************/
@@ -111,6 +197,21 @@ void retroseq_list(t_retroseq* x, t_symbol* msg, short argc, t_atom* argv);
 void retroseq_freqlist(t_retroseq* x, t_symbol* msg, short argc, t_atom* argv);
 void retroseq_durlist(t_retroseq* x, t_symbol* msg, short argc, t_atom* argv);
 
+void retroseq_publish(t_retroseq* x, short restart);
+void retroseq_hand_over(t_retroseq* x, short restart);
+void retroseq_take_sequence(t_retroseq* x, int* note_counter,
+                            int* duration_counter);
+void retroseq_swap_on_cycle(t_retroseq* x, t_symbol* msg, short argc,
+                            t_atom* argv);
+void retroseq_echo_sequences(t_retroseq* x, t_symbol* msg, short argc,
+                             t_atom* argv);
+
+void retroseq_read(t_retroseq* x, t_symbol* filename);
+void retroseq_load_bank(t_retroseq* x, long argc, t_atom* argv);
+void retroseq_detach_sequence(t_retroseq* x);
+void retroseq_free_bank(t_retroseq_bank* bank);
+void retroseq_pattern(t_retroseq* x, t_symbol* msg, short argc, t_atom* argv);
+
 void retroseq_shuffle_freqs(t_retroseq* x);
 void retroseq_shuffle_durs(t_retroseq* x);
 void retroseq_shuffle(t_retroseq* x);
@@ -123,14 +224,29 @@ void retroseq_set_sustain_amplitude(t_retroseq* x, t_symbol* msg, short argc,
                                     t_atom* argv);
 void retroseq_set_adsr(t_retroseq* x, t_symbol* msg, short argc, t_atom* argv);
 
-void retroseq_send_adsr(t_retroseq* x);
-void retroseq_send_bang(t_retroseq* x);
+void retroseq_set_signal_envelope(t_retroseq* x, t_symbol* msg, short argc,
+                                  t_atom* argv);
+
+void retroseq_shape_adsr(t_retroseq* x, float note_duration_ms,
+                         float* adsr_out);
+void retroseq_send_adsr(t_retroseq* x, float note_duration_ms);
+void retroseq_start_envelope(t_retroseq* x, t_retroseq_envelope* envelope,
+                             float note_duration_ms);
+float retroseq_envelope_tick(t_retroseq_envelope* envelope);
+
+double retroseq_logical_time(t_retroseq* x);
+void retroseq_push_event(t_retroseq* x, double time, short type,
+                         float duration);
+void retroseq_send_events(t_retroseq* x);
 
 void retroseq_manual_override(t_retroseq* x, t_symbol* msg, short argc,
                               t_atom* argv);
 void retroseq_trigger_sent(t_retroseq* x);
 void retroseq_play_backwards(t_retroseq* x, t_symbol* msg, short argc,
                              t_atom* argv);
+void retroseq_stride(t_retroseq* x, t_symbol* msg, short argc, t_atom* argv);
+short retroseq_wraps(int counter, int step, int length);
+int retroseq_advance(int counter, int step, int length);
 
 /******************************************************************************/
 
@@ -163,6 +279,14 @@ void retroseq_tilde_setup(void)
                     gensym("freqlist"), A_GIMME, 0);
     class_addmethod(retroseq_class, (t_method)retroseq_durlist,
                     gensym("durlist"), A_GIMME, 0);
+    class_addmethod(retroseq_class, (t_method)retroseq_swap_on_cycle,
+                    gensym("swap_on_cycle"), A_GIMME, 0);
+    class_addmethod(retroseq_class, (t_method)retroseq_echo_sequences,
+                    gensym("echo_sequences"), A_GIMME, 0);
+    class_addmethod(retroseq_class, (t_method)retroseq_read, gensym("read"),
+                    A_SYMBOL, 0);
+    class_addmethod(retroseq_class, (t_method)retroseq_pattern,
+                    gensym("pattern"), A_GIMME, 0);
 
     class_addmethod(retroseq_class, (t_method)retroseq_shuffle_freqs,
                     gensym("shuffle_freqs"), 0);
@@ -179,6 +303,8 @@ void retroseq_tilde_setup(void)
                     gensym("sustain_amplitude"), A_GIMME, 0);
     class_addmethod(retroseq_class, (t_method)retroseq_set_adsr,
                     gensym("adsr"), A_GIMME, 0);
+    class_addmethod(retroseq_class, (t_method)retroseq_set_signal_envelope,
+                    gensym("signal_envelope"), A_GIMME, 0);
 
     class_addmethod(retroseq_class, (t_method)retroseq_manual_override,
                     gensym("manual_override"), A_GIMME, 0);
@@ -186,6 +312,8 @@ void retroseq_tilde_setup(void)
                     gensym("bang"), 0);
     class_addmethod(retroseq_class, (t_method)retroseq_play_backwards,
                     gensym("play_backwards"), A_GIMME, 0);
+    class_addmethod(retroseq_class, (t_method)retroseq_stride,
+                    gensym("stride"), A_GIMME, 0);
 
     /* Print message to Max window */
     post("retroseq~ • External was loaded");
@@ -279,8 +407,12 @@ void* retroseq_common_new(t_retroseq* x, short argc, t_atom* argv)
     x->shuffle_freqs_outlet = outlet_new(&x->obj, gensym("list"));
     x->shuffle_durs_outlet = outlet_new(&x->obj, gensym("list"));
 
+    /* Create the sample-accurate trigger and envelope outlets */
+    outlet_new(&x->obj, gensym("signal"));
+    outlet_new(&x->obj, gensym("signal"));
+
     /* Initialize clocks */
-    x->bang_clock = clock_new(x, (t_method)retroseq_send_bang);
+    x->event_clock = clock_new(x, (t_method)retroseq_send_events);
 
     /* Parse passed arguments */
     // nothing
@@ -302,6 +434,29 @@ void* retroseq_common_new(t_retroseq* x, short argc, t_atom* argv)
     x->duration_sequence[1] = D1;
     x->duration_sequence[2] = D2;
 
+    for (int ii = 0; ii < NUM_SEQUENCE_SLOTS; ii++) {
+        x->sequences[ii].note_storage = (float*)new_memory(
+            x->max_sequence_bytes);
+        x->sequences[ii].duration_storage = (float*)new_memory(
+            x->max_sequence_bytes);
+    }
+    x->sequence_front = 0;
+    x->sequence_middle = 1;
+    x->sequence_back = 2;
+    x->sequence_restart = 0;
+    x->swap_on_cycle = 0;
+    x->echo_sequences = 1;
+
+    x->sequence_serial = 0;
+    x->sequence_taken = 0;
+    x->bank = NULL;
+    x->retired_bank = NULL;
+    x->retired_at = 0;
+    x->canvas = canvas_getcurrent();
+
+    /* The DSP method starts with the default sequence */
+    retroseq_publish(x, 1);
+
     srand((unsigned int)clock());
     x->shuffle_list = (t_atom*)new_memory(MAXIMUM_SEQUENCE_LENGTH
                                           * sizeof(t_atom));
@@ -310,6 +465,9 @@ void* retroseq_common_new(t_retroseq* x, short argc, t_atom* argv)
     x->elastic_sustain = 0;
     x->sustain_amplitude = DEFAULT_SUSTAIN_AMPLITUDE;
 
+    x->play_backwards = 0;
+    x->stride = 1;
+
     x->adsr_bytes = 4 * sizeof(float);
     x->adsr = (float*)new_memory(x->adsr_bytes);
     x->adsr[0] = DEFAULT_ATACK_DURATION;
@@ -322,6 +480,16 @@ void* retroseq_common_new(t_retroseq* x, short argc, t_atom* argv)
     x->adsr_list_bytes = 10 * sizeof(t_atom);
     x->adsr_list = (t_atom*)new_memory(x->adsr_list_bytes);
 
+    x->signal_envelope = 0;
+    x->envelope.remaining = 0;
+    x->envelope.value = 0.0;
+
+    x->event_queue = (t_retroseq_event*)new_memory(EVENT_QUEUE_SIZE
+                                                   * sizeof(t_retroseq_event));
+    x->event_read = 0;
+    x->event_write = 0;
+    x->time_origin = clock_getlogicaltime();
+
     /* Print message to Max window */
     post("retroseq~ • Object was created");
 
@@ -335,18 +503,27 @@ void retroseq_free(t_retroseq* x)
 {
 
     /* Free allocated dynamic memory */
-    clock_free(x->bang_clock);
-    clock_free(x->adsr_clock);
+    clock_free(x->event_clock);
 
     free_memory(x->note_sequence, x->max_sequence_bytes);
     free_memory(x->duration_sequence, x->max_sequence_bytes);
 
+    for (int ii = 0; ii < NUM_SEQUENCE_SLOTS; ii++) {
+        free_memory(x->sequences[ii].note_storage, x->max_sequence_bytes);
+        free_memory(x->sequences[ii].duration_storage, x->max_sequence_bytes);
+    }
+
+    retroseq_free_bank(x->bank);
+    retroseq_free_bank(x->retired_bank);
+
     free_memory(x->shuffle_list, MAXIMUM_SEQUENCE_LENGTH * sizeof(t_atom));
 
     free_memory(x->adsr, x->adsr_bytes);
     free_memory(x->adsr_out, x->adsr_out_bytes);
     free_memory(x->adsr_list, x->adsr_list_bytes);
 
+    free_memory(x->event_queue, EVENT_QUEUE_SIZE * sizeof(t_retroseq_event));
+
     /* Print message to Max window */
     post("retroseq~ • Memory was freed");
 }
@@ -384,15 +561,18 @@ void retroseq_list(t_retroseq* x, t_symbol* msg, short argc, t_atom* argv)
     }
 
     x->note_sequence_length = argc / 2;
-    x->note_counter = x->note_sequence_length - 1;
     x->duration_sequence_length = argc / 2;
-    x->duration_counter = x->duration_sequence_length - 1;
 
-    send_sequence_as_list(x->note_sequence_length, x->note_sequence,
-                          x->shuffle_list, x->shuffle_freqs_outlet);
+    retroseq_publish(x, 1);
 
-    send_sequence_as_list(x->duration_sequence_length, x->duration_sequence,
-                          x->shuffle_list, x->shuffle_durs_outlet);
+    if (x->echo_sequences) {
+        send_sequence_as_list(x->note_sequence_length, x->note_sequence,
+                              x->shuffle_list, x->shuffle_freqs_outlet);
+
+        send_sequence_as_list(x->duration_sequence_length,
+                              x->duration_sequence, x->shuffle_list,
+                              x->shuffle_durs_outlet);
+    }
 }
 
 void retroseq_freqlist(t_retroseq* x, t_symbol* msg, short argc, t_atom* argv)
@@ -411,10 +591,13 @@ void retroseq_freqlist(t_retroseq* x, t_symbol* msg, short argc, t_atom* argv)
     }
 
     x->note_sequence_length = argc;
-    x->note_counter = x->note_sequence_length - 1;
 
-    send_sequence_as_list(x->note_sequence_length, x->note_sequence,
-                          x->shuffle_list, x->shuffle_freqs_outlet);
+    retroseq_publish(x, 1);
+
+    if (x->echo_sequences) {
+        send_sequence_as_list(x->note_sequence_length, x->note_sequence,
+                              x->shuffle_list, x->shuffle_freqs_outlet);
+    }
 }
 
 void retroseq_durlist(t_retroseq* x, t_symbol* msg, short argc, t_atom* argv)
@@ -433,10 +616,298 @@ void retroseq_durlist(t_retroseq* x, t_symbol* msg, short argc, t_atom* argv)
     }
 
     x->duration_sequence_length = argc;
-    x->duration_counter = x->duration_sequence_length - 1;
 
-    send_sequence_as_list(x->duration_sequence_length, x->duration_sequence,
-                          x->shuffle_list, x->shuffle_durs_outlet);
+    retroseq_publish(x, 1);
+
+    if (x->echo_sequences) {
+        send_sequence_as_list(x->duration_sequence_length,
+                              x->duration_sequence, x->shuffle_list,
+                              x->shuffle_durs_outlet);
+    }
+}
+
+void retroseq_publish(t_retroseq* x, short restart)
+{
+    t_retroseq_sequence* sequence = x->sequences + x->sequence_back;
+
+    /* Fill the slot only the message methods write to */
+    sequence->notes = sequence->note_storage;
+    memcpy(sequence->notes, x->note_sequence,
+           x->note_sequence_length * sizeof(float));
+    sequence->note_length = x->note_sequence_length;
+    sequence->durations = sequence->duration_storage;
+    memcpy(sequence->durations, x->duration_sequence,
+           x->duration_sequence_length * sizeof(float));
+    sequence->duration_length = x->duration_sequence_length;
+
+    retroseq_hand_over(x, restart);
+}
+
+void retroseq_hand_over(t_retroseq* x, short restart)
+{
+    x->sequences[x->sequence_back].serial = ++x->sequence_serial;
+
+    if (restart) {
+        x->sequence_restart = 1;
+    }
+
+    /* Hand it over in one exchange, and take back the slot it replaces.
+     * A sequence the perform routine has not taken yet is dropped */
+    x->sequence_back = retroseq_exchange(&x->sequence_middle,
+                                         x->sequence_back | SEQUENCE_READY)
+                       & SEQUENCE_SLOT;
+}
+
+void retroseq_take_sequence(t_retroseq* x, int* note_counter,
+                            int* duration_counter)
+{
+    x->sequence_front = retroseq_exchange(&x->sequence_middle,
+                                          x->sequence_front)
+                        & SEQUENCE_SLOT;
+
+    t_retroseq_sequence* sequence = x->sequences + x->sequence_front;
+    x->sequence_taken = sequence->serial;
+
+    /* New lists start over, edits carry on from the same position */
+    if (retroseq_exchange(&x->sequence_restart, 0)) {
+        *note_counter = -1;
+        *duration_counter = -1;
+    } else {
+        if (*note_counter >= sequence->note_length) {
+            *note_counter = sequence->note_length - 1;
+        }
+        if (*duration_counter >= sequence->duration_length) {
+            *duration_counter = sequence->duration_length - 1;
+        }
+    }
+}
+
+void retroseq_swap_on_cycle(t_retroseq* x, t_symbol* msg, short argc,
+                            t_atom* argv)
+{
+    if (argc == 1) {
+        x->swap_on_cycle = (short)atom_getfloat(argv);
+    }
+}
+
+void retroseq_echo_sequences(t_retroseq* x, t_symbol* msg, short argc,
+                             t_atom* argv)
+{
+    if (argc == 1) {
+        x->echo_sequences = (short)atom_getfloat(argv);
+    }
+}
+
+void retroseq_read(t_retroseq* x, t_symbol* filename)
+{
+    t_binbuf* binbuf = binbuf_new();
+
+    /* Each line, or each message ending in a semicolon, is one pattern */
+    if (binbuf_read_via_canvas(binbuf, filename->s_name, x->canvas, 1)) {
+        pd_error(x, "retroseq~ • Cannot read %s", filename->s_name);
+    } else {
+        retroseq_load_bank(x, binbuf_getnatom(binbuf), binbuf_getvec(binbuf));
+    }
+
+    binbuf_free(binbuf);
+}
+
+void retroseq_load_bank(t_retroseq* x, long argc, t_atom* argv)
+{
+    /* Count the patterns and their steps */
+    int num_patterns = 0;
+    long num_steps = 0;
+    long members = 0;
+
+    for (long ii = 0; ii <= argc; ii++) {
+        if (ii == argc || argv[ii].a_type == A_SEMI) {
+            if (members % 2) {
+                pd_error(x,
+                         "retroseq~ • Pattern %d must have an even number "
+                         "of members",
+                         num_patterns);
+                return;
+            }
+            if (members) {
+                num_patterns++;
+                num_steps += members / 2;
+            }
+            members = 0;
+        } else {
+            members++;
+        }
+    }
+
+    if (num_patterns == 0) {
+        pd_error(x, "retroseq~ • The file has no patterns");
+        return;
+    }
+
+    /* With the DSP off nothing plays from a bank, so the sequence the
+     * next DSP start begins with gets its own copy */
+    short dsp_running = pd_getdspstate();
+    if (!dsp_running) {
+        retroseq_detach_sequence(x);
+    }
+
+    /* The perform routine may still play a pattern of the retired bank
+     * until it takes a sequence published after the bank was retired */
+    if (x->retired_bank) {
+        if (dsp_running && x->sequence_taken <= x->retired_at) {
+            pd_error(x, "retroseq~ • The previous bank is still playing");
+            return;
+        }
+        retroseq_free_bank(x->retired_bank);
+        x->retired_bank = NULL;
+    }
+
+    t_retroseq_bank* bank = (t_retroseq_bank*)new_memory(
+        sizeof(t_retroseq_bank));
+    if (bank == NULL) {
+        return;
+    }
+    bank->num_patterns = num_patterns;
+    bank->num_steps = num_steps;
+    bank->offsets = (long*)new_memory(num_patterns * sizeof(long));
+    bank->lengths = (int*)new_memory(num_patterns * sizeof(int));
+    bank->notes = (float*)new_memory(num_steps * sizeof(float));
+    bank->durations = (float*)new_memory(num_steps * sizeof(float));
+
+    /* Keep the current bank if the new one does not fit in memory */
+    if (bank->offsets == NULL || bank->lengths == NULL
+        || bank->notes == NULL || bank->durations == NULL) {
+        retroseq_free_bank(bank);
+        return;
+    }
+
+    /* Store all patterns back to back, as note and duration arrays */
+    int pattern = 0;
+    long step = 0;
+    members = 0;
+    bank->offsets[0] = 0;
+
+    for (long ii = 0; ii <= argc; ii++) {
+        if (ii == argc || argv[ii].a_type == A_SEMI) {
+            if (members) {
+                bank->lengths[pattern] = step - bank->offsets[pattern];
+                if (++pattern < num_patterns) {
+                    bank->offsets[pattern] = step;
+                }
+            }
+            members = 0;
+        } else {
+            if (members % 2) {
+                bank->durations[step++] = atom_getfloat(argv + ii);
+            } else {
+                bank->notes[step] = atom_getfloat(argv + ii);
+            }
+            members++;
+        }
+    }
+
+    if (dsp_running) {
+        x->retired_bank = x->bank;
+        x->retired_at = x->sequence_serial;
+    } else {
+        retroseq_free_bank(x->bank);
+    }
+    x->bank = bank;
+
+    post("retroseq~ • Read %d patterns with %ld steps", num_patterns,
+         num_steps);
+}
+
+void retroseq_detach_sequence(t_retroseq* x)
+{
+    /* Take a sequence published while the DSP was off */
+    if (x->sequence_middle & SEQUENCE_READY) {
+        retroseq_take_sequence(x, &x->note_counter, &x->duration_counter);
+    }
+    t_retroseq_sequence* sequence = x->sequences + x->sequence_front;
+
+    /* A pattern selected from a bank is cut to the storage length, as
+     * the message side copy already is */
+    if (sequence->notes != sequence->note_storage) {
+        if (sequence->note_length > MAXIMUM_SEQUENCE_LENGTH) {
+            sequence->note_length = MAXIMUM_SEQUENCE_LENGTH;
+        }
+        memcpy(sequence->note_storage, sequence->notes,
+               sequence->note_length * sizeof(float));
+        sequence->notes = sequence->note_storage;
+    }
+    if (sequence->durations != sequence->duration_storage) {
+        if (sequence->duration_length > MAXIMUM_SEQUENCE_LENGTH) {
+            sequence->duration_length = MAXIMUM_SEQUENCE_LENGTH;
+        }
+        memcpy(sequence->duration_storage, sequence->durations,
+               sequence->duration_length * sizeof(float));
+        sequence->durations = sequence->duration_storage;
+    }
+}
+
+void retroseq_free_bank(t_retroseq_bank* bank)
+{
+    if (bank == NULL) {
+        return;
+    }
+
+    /* A bank that failed to allocate may be missing arrays */
+    if (bank->offsets) {
+        free_memory(bank->offsets, bank->num_patterns * sizeof(long));
+    }
+    if (bank->lengths) {
+        free_memory(bank->lengths, bank->num_patterns * sizeof(int));
+    }
+    if (bank->notes) {
+        free_memory(bank->notes, bank->num_steps * sizeof(float));
+    }
+    if (bank->durations) {
+        free_memory(bank->durations, bank->num_steps * sizeof(float));
+    }
+    free_memory(bank, sizeof(t_retroseq_bank));
+}
+
+void retroseq_pattern(t_retroseq* x, t_symbol* msg, short argc, t_atom* argv)
+{
+    t_retroseq_bank* bank = x->bank;
+
+    if (argc != 1) {
+        return;
+    }
+    if (bank == NULL) {
+        pd_error(x, "retroseq~ • No pattern bank was read");
+        return;
+    }
+
+    int index = (int)atom_getfloat(argv);
+    if (index < 0 || index >= bank->num_patterns) {
+        pd_error(x, "retroseq~ • Pattern %d does not exist", index);
+        return;
+    }
+
+    /* Point the slot at the bank instead of copying the pattern, so
+     * switching takes the same time whatever its length */
+    t_retroseq_sequence* sequence = x->sequences + x->sequence_back;
+    sequence->notes = bank->notes + bank->offsets[index];
+    sequence->note_length = bank->lengths[index];
+    sequence->durations = bank->durations + bank->offsets[index];
+    sequence->duration_length = bank->lengths[index];
+
+    retroseq_hand_over(x, 1);
+
+    /* Keep a copy on the message side, so the shuffles and edits that
+     * follow start from the selected pattern */
+    int length = bank->lengths[index];
+    if (length > MAXIMUM_SEQUENCE_LENGTH) {
+        length = MAXIMUM_SEQUENCE_LENGTH;
+    }
+
+    memcpy(x->note_sequence, bank->notes + bank->offsets[index],
+           length * sizeof(float));
+    memcpy(x->duration_sequence, bank->durations + bank->offsets[index],
+           length * sizeof(float));
+    x->note_sequence_length = length;
+    x->duration_sequence_length = length;
 }
 
 void retroseq_permute(float* sequence, int length)
@@ -456,16 +927,25 @@ void retroseq_shuffle_freqs(t_retroseq* x)
 {
     retroseq_permute(x->note_sequence, x->note_sequence_length);
 
-    send_sequence_as_list(x->note_sequence_length, x->note_sequence,
-                          x->shuffle_list, x->shuffle_freqs_outlet);
+    retroseq_publish(x, 0);
+
+    if (x->echo_sequences) {
+        send_sequence_as_list(x->note_sequence_length, x->note_sequence,
+                              x->shuffle_list, x->shuffle_freqs_outlet);
+    }
 }
 
 void retroseq_shuffle_durs(t_retroseq* x)
 {
     retroseq_permute(x->duration_sequence, x->duration_sequence_length);
 
-    send_sequence_as_list(x->duration_sequence_length, x->duration_sequence,
-                          x->shuffle_list, x->shuffle_durs_outlet);
+    retroseq_publish(x, 0);
+
+    if (x->echo_sequences) {
+        send_sequence_as_list(x->duration_sequence_length,
+                              x->duration_sequence, x->shuffle_list,
+                              x->shuffle_durs_outlet);
+    }
 }
 
 void retroseq_shuffle(t_retroseq* x)
@@ -533,16 +1013,20 @@ void retroseq_set_adsr(t_retroseq* x, t_symbol* msg, short argc, t_atom* argv)
     }
 }
 
-void retroseq_send_adsr(t_retroseq* x)
+void retroseq_set_signal_envelope(t_retroseq* x, t_symbol* msg, short argc,
+                                  t_atom* argv)
+{
+    if (argc == 1) {
+        x->signal_envelope = (short)atom_getfloat(argv);
+    }
+}
+
+void retroseq_shape_adsr(t_retroseq* x, float note_duration_ms,
+                         float* adsr_out)
 {
     short elastic_sustain = x->elastic_sustain;
 
     float* adsr = x->adsr;
-    float* adsr_out = x->adsr_out;
-    t_atom* adsr_list = x->adsr_list;
-
-    float note_duration_ms = x->duration_sequence[x->duration_counter]
-        * (60.0 / x->tempo_bpm);
 
     adsr_out[0] = 0.0;
     adsr_out[1] = 0.0;
@@ -577,6 +1061,14 @@ void retroseq_send_adsr(t_retroseq* x)
             adsr_out[9] *= rescale;
         }
     }
+}
+
+void retroseq_send_adsr(t_retroseq* x, float note_duration_ms)
+{
+    float* adsr_out = x->adsr_out;
+    t_atom* adsr_list = x->adsr_list;
+
+    retroseq_shape_adsr(x, note_duration_ms, adsr_out);
 
     for (int ii = 0; ii < 10; ii++) {
         SETFLOAT(adsr_list + ii, adsr_out[ii]);
@@ -584,7 +1076,100 @@ void retroseq_send_adsr(t_retroseq* x)
     outlet_list(x->adsr_outlet, NULL, 10, adsr_list);
 }
 
-void retroseq_send_bang(t_retroseq* x) { outlet_bang(x->bang_outlet); }
+void retroseq_start_envelope(t_retroseq* x, t_retroseq_envelope* envelope,
+                             float note_duration_ms)
+{
+    float* shape = x->envelope_shape;
+    float samples_per_ms = x->fs / 1000.0;
+
+    retroseq_shape_adsr(x, note_duration_ms, shape);
+
+    /* The same (target, time) pairs as the list, after the jump to the
+     * first value */
+    for (int ii = 0; ii < 4; ii++) {
+        envelope->targets[ii] = shape[2 + 2 * ii];
+        envelope->lengths[ii] = shape[3 + 2 * ii] * samples_per_ms;
+        if (envelope->lengths[ii] < 1) {
+            envelope->lengths[ii] = 1;
+        }
+    }
+
+    envelope->stage = 0;
+    envelope->value = shape[0];
+    envelope->remaining = envelope->lengths[0];
+    envelope->increment = (envelope->targets[0] - envelope->value)
+                          / envelope->remaining;
+}
+
+float retroseq_envelope_tick(t_retroseq_envelope* envelope)
+{
+    float value = envelope->value;
+
+    if (envelope->remaining > 0) {
+        envelope->value += envelope->increment;
+
+        /* Land exactly on the target and start the next segment */
+        if (--envelope->remaining == 0) {
+            envelope->value = envelope->targets[envelope->stage];
+
+            if (++envelope->stage < 4) {
+                envelope->remaining = envelope->lengths[envelope->stage];
+                envelope->increment = (envelope->targets[envelope->stage]
+                                       - envelope->value)
+                                      / envelope->remaining;
+            }
+        }
+    }
+
+    return value;
+}
+
+double retroseq_logical_time(t_retroseq* x)
+{
+    return clock_gettimesince(x->time_origin);
+}
+
+void retroseq_push_event(t_retroseq* x, double time, short type,
+                         float duration)
+{
+    int next_write = (x->event_write + 1) % EVENT_QUEUE_SIZE;
+
+    /* Drop the event if the queue is full, the trigger outlet still has it */
+    if (next_write == x->event_read) {
+        return;
+    }
+
+    t_retroseq_event* event = x->event_queue + x->event_write;
+    event->time = time;
+    event->type = type;
+    event->duration = duration;
+
+    x->event_write = next_write;
+}
+
+void retroseq_send_events(t_retroseq* x)
+{
+    double now = retroseq_logical_time(x);
+
+    /* Output the events that are due, in order, then wait for the next one.
+     * The tolerance absorbs rounding in the scheduler time */
+    while (x->event_read != x->event_write) {
+        t_retroseq_event event = x->event_queue[x->event_read];
+
+        if (event.time > now + 1e-6) {
+            clock_delay(x->event_clock, event.time - now);
+            return;
+        }
+
+        x->event_read = (x->event_read + 1) % EVENT_QUEUE_SIZE;
+
+        if (event.type == E_BANG) {
+            outlet_bang(x->bang_outlet);
+        } else {
+            retroseq_send_adsr(x, event.duration);
+        }
+    }
+}
 
 void retroseq_manual_override(t_retroseq* x, t_symbol* msg, short argc,
                               t_atom* argv)
@@ -600,46 +1185,45 @@ void retroseq_trigger_sent(t_retroseq* x) { x->trigger_sent = 1; }
 void retroseq_play_backwards(t_retroseq* x, t_symbol* msg, short argc,
                              t_atom* argv)
 {
+    /* The read cursor changes direction, the sequences stay as they are */
     if (argc == 1) {
-        short state = (short)atom_getfloat(argv);
+        x->play_backwards = (short)atom_getfloat(argv) != 0;
+    }
+}
 
-        if (x->play_backwards != state) {
-            x->play_backwards = (short)state;
+void retroseq_stride(t_retroseq* x, t_symbol* msg, short argc, t_atom* argv)
+{
+    if (argc == 1) {
+        int stride = (int)atom_getfloat(argv);
 
-            float* sequence;
-            int length;
-            int position;
+        if (stride == 0) {
+            pd_error(x, "retroseq~ • The stride must not be zero");
+            return;
+        }
 
-            sequence = x->note_sequence;
-            length = x->note_sequence_length;
-            position = 0;
-            while (position < length) {
-                float temp = sequence[position];
-                sequence[position] = sequence[length - 1];
-                sequence[length - 1] = temp;
+        x->stride = stride;
+    }
+}
 
-                position++;
-                length--;
-            }
-            send_sequence_as_list(x->note_sequence_length, x->note_sequence,
-                                  x->shuffle_list, x->shuffle_freqs_outlet);
-
-            sequence = x->duration_sequence;
-            length = x->duration_sequence_length;
-            position = 0;
-            while (position < length) {
-                float temp = sequence[position];
-                sequence[position] = sequence[length - 1];
-                sequence[length - 1] = temp;
-
-                position++;
-                length--;
-            }
-            send_sequence_as_list(x->duration_sequence_length,
-                                  x->duration_sequence, x->shuffle_list,
-                                  x->shuffle_durs_outlet);
-        }
+short retroseq_wraps(int counter, int step, int length)
+{
+    return counter < 0 || counter + step >= length || counter + step < 0;
+}
+
+int retroseq_advance(int counter, int step, int length)
+{
+    /* A negative counter starts from the first step in the direction of
+     * play */
+    if (counter < 0) {
+        return step > 0 ? 0 : length - 1;
+    }
+
+    counter = (counter + step) % length;
+    if (counter < 0) {
+        counter += length;
     }
+
+    return counter;
 }
 
 /******************************************************************************/
@@ -653,14 +1237,19 @@ void retroseq_dsp(t_retroseq* x, t_signal** sp, short* count)
     x->duration_factor = (60.0 / x->tempo_bpm) * (x->fs / 1000.0);
     x->sample_counter = 0;
 
-    x->current_note_value = x->note_sequence[0];
-    x->note_counter = x->note_sequence_length - 1;
+    /* Take a sequence published while the DSP was off */
+    if (x->sequence_middle & SEQUENCE_READY) {
+        retroseq_take_sequence(x, &x->note_counter, &x->duration_counter);
+    }
+    t_retroseq_sequence* sequence = x->sequences + x->sequence_front;
+
+    x->current_note_value = sequence->notes[0];
+    x->note_counter = -1;
 
-    x->current_duration_value = x->duration_sequence[0];
-    x->duration_counter = x->duration_sequence_length - 1;
+    x->current_duration_value = sequence->durations[0];
+    x->duration_counter = -1;
 
     x->manual_override = 0;
-    x->play_backwards = 0;
 
     /* Adjust to changes in the sampling rate */
     if (x->fs != sp[0]->s_sr) {
@@ -671,7 +1260,8 @@ void retroseq_dsp(t_retroseq* x, t_signal** sp, short* count)
     }
 
     /* Attach the object to the DSP chain */
-    dsp_add(retroseq_perform, NEXT - 1, x, sp[0]->s_vec, sp[0]->s_n);
+    dsp_add(retroseq_perform, NEXT - 1, x, sp[1]->s_vec, sp[2]->s_vec,
+            sp[3]->s_vec, sp[0]->s_n);
 
     /* Print message to Max window */
     post("retroseq~ • Executing 32-bit perform routine");
@@ -686,18 +1276,20 @@ t_int* retroseq_perform(t_int* w)
 
     /* Copy signal pointers */
     t_float* output = (t_float*)w[OUTPUT];
+    t_float* trigger = (t_float*)w[TRIGGER];
+    t_float* envelope = (t_float*)w[ENVELOPE];
 
     /* Copy the signal vector size */
     t_int n = w[VECTOR_SIZE];
 
     /* Load state variables */
-    float* note_sequence = x->note_sequence;
-    int note_sequence_length = x->note_sequence_length;
+    t_retroseq_sequence* sequence = x->sequences + x->sequence_front;
+    short swap_on_cycle = x->swap_on_cycle;
+    int step = x->play_backwards ? -x->stride : x->stride;
+
     float current_note_value = x->current_note_value;
     int note_counter = x->note_counter;
 
-    float* duration_sequence = x->duration_sequence;
-    int duration_sequence_length = x->duration_sequence_length;
     float current_duration_value = x->current_duration_value;
     int duration_counter = x->duration_counter;
 
@@ -707,48 +1299,121 @@ t_int* retroseq_perform(t_int* w)
     short manual_override = x->manual_override;
     short trigger_sent = x->trigger_sent;
 
+    /* Events are stamped with the logical time of their sample */
+    double block_time = retroseq_logical_time(x);
+    double sample_ms = 1000.0 / x->fs;
+    double event_time;
+    float tempo_factor = 60.0 / x->tempo_bpm;
+    int event_write = x->event_write;
+
+    short signal_envelope = x->signal_envelope;
+    t_retroseq_envelope envelope_state = x->envelope;
+    float note_duration_ms;
+
     /* Perform the DSP loop */
     if (manual_override) {
-        while (n--) {
+        for (t_int ii = 0; ii < n; ii++) {
+            trigger[ii] = 0.0;
+
             if (trigger_sent) {
                 trigger_sent = 0;
-
-                if (++note_counter >= note_sequence_length) {
-                    note_counter = 0;
-                    clock_delay(x->bang_clock, 0);
+                event_time = block_time + ii * sample_ms;
+
+                /* Take a newly published sequence at this note, or only
+                 * when the current one starts over */
+                if ((x->sequence_middle & SEQUENCE_READY)
+                    && (!swap_on_cycle
+                        || retroseq_wraps(note_counter, step,
+                                          sequence->note_length))) {
+                    retroseq_take_sequence(x, &note_counter,
+                                           &duration_counter);
+                    sequence = x->sequences + x->sequence_front;
                 }
 
-                current_note_value = note_sequence[note_counter];
-                clock_delay(x->adsr_clock, 0);
+                if (retroseq_wraps(note_counter, step,
+                                   sequence->note_length)) {
+                    retroseq_push_event(x, event_time, E_BANG, 0);
+                }
+                note_counter = retroseq_advance(note_counter, step,
+                                                sequence->note_length);
+
+                current_note_value = sequence->notes[note_counter];
+                trigger[ii] = 1.0;
+
+                /* Manual notes keep the duration the sequence stopped at */
+                note_duration_ms = duration_counter < 0
+                                       ? sequence->durations[0]
+                                       : sequence->durations[duration_counter];
+                note_duration_ms *= tempo_factor;
+                if (signal_envelope) {
+                    retroseq_start_envelope(x, &envelope_state,
+                                            note_duration_ms);
+                } else {
+                    retroseq_push_event(x, event_time, E_ADSR,
+                                        note_duration_ms);
+                }
             }
 
-            *output++ = current_note_value;
+            output[ii] = current_note_value;
+            envelope[ii] = retroseq_envelope_tick(&envelope_state);
         }
     }
 
     else {
-        while (n--) {
+        for (t_int ii = 0; ii < n; ii++) {
+            trigger[ii] = 0.0;
+
             if (sample_counter-- <= 0) {
-                if (++note_counter >= note_sequence_length) {
-                    note_counter = 0;
-                    clock_delay(x->bang_clock, 0);
+                event_time = block_time + ii * sample_ms;
+
+                /* Take a newly published sequence at this note, or only
+                 * when the current one starts over */
+                if ((x->sequence_middle & SEQUENCE_READY)
+                    && (!swap_on_cycle
+                        || retroseq_wraps(note_counter, step,
+                                          sequence->note_length))) {
+                    retroseq_take_sequence(x, &note_counter,
+                                           &duration_counter);
+                    sequence = x->sequences + x->sequence_front;
                 }
 
-                if (++duration_counter >= duration_sequence_length) {
-                    duration_counter = 0;
+                if (retroseq_wraps(note_counter, step,
+                                   sequence->note_length)) {
+                    retroseq_push_event(x, event_time, E_BANG, 0);
                 }
+                note_counter = retroseq_advance(note_counter, step,
+                                                sequence->note_length);
 
-                current_duration_value = duration_sequence[duration_counter];
+                duration_counter = retroseq_advance(
+                    duration_counter, step, sequence->duration_length);
+
+                current_duration_value = sequence->durations[duration_counter];
                 sample_counter = current_duration_value * duration_factor;
 
-                current_note_value = note_sequence[note_counter];
-                clock_delay(x->adsr_clock, 0);
+                current_note_value = sequence->notes[note_counter];
+                trigger[ii] = 1.0;
+
+                note_duration_ms = current_duration_value * tempo_factor;
+                if (signal_envelope) {
+                    retroseq_start_envelope(x, &envelope_state,
+                                            note_duration_ms);
+                } else {
+                    retroseq_push_event(x, event_time, E_ADSR,
+                                        note_duration_ms);
+                }
             }
 
-            *output++ = current_note_value;
+            output[ii] = current_note_value;
+            envelope[ii] = retroseq_envelope_tick(&envelope_state);
         }
     }
 
+    /* Wake the clock at the first queued event */
+    if (x->event_write != event_write) {
+        double delay = x->event_queue[x->event_read].time - block_time;
+        clock_delay(x->event_clock, delay > 0 ? delay : 0);
+    }
+
     /* Update state variables */
     x->current_note_value = current_note_value;
     x->note_counter = note_counter;
@@ -758,6 +1423,7 @@ t_int* retroseq_perform(t_int* w)
 
     x->sample_counter = sample_counter;
     x->trigger_sent = trigger_sent;
+    x->envelope = envelope_state;
 
     /* Return the next address in the DSP chain */
     return w + NEXT;
@@ -1,24 +1,123 @@
 #include "ext.h"
 #include "ext_obex.h"
 #include "z_dsp.h"
+#include "polar_kernels.h"
 
 #include <math.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 /* The global variables
  * *******************************************************/
 #define MINIMUM_DURATION 000.0
 #define DEFAULT_DURATION 5000.0
 #define MAXIMUM_DURATION 10000.0
 
+#define MINIMUM_HEADS 1
+#define DEFAULT_HEADS 1
+#define MAXIMUM_HEADS 16
+
 #define SCRUBBER_EMPTY 0
 #define SCRUBBER_FULL 1
 
+#define FRAME_ALIGNMENT 64
+
+#define MINIMUM_STFT_SIZE 16
+#define MAXIMUM_STFT_SIZE 65536
+
+#define SCRUBBER_FILE_MAGIC "SCRUBBER"
+#define SCRUBBER_FILE_VERSION 1
+
+/* Atomic exchange for handing memory and mapped files to the perform
+ * routine */
+#ifdef WIN32
+#define scrubber_exchange(target, value)                                      \
+    InterlockedExchangePointer((void* volatile*)(target), value)
+#else
+#define scrubber_exchange(target, value)                                      \
+    __atomic_exchange_n(target, value, __ATOMIC_ACQ_REL)
+#endif
+
 // already defined by c74support/msp-includes/z_dsp.h
 // #define PI 3.1415926535898
 // #define TWOPI 6.2831853071796
 
+/* The analysis file header
+ * **************************************************/
+/* An analysis file is this header followed by the frames exactly as they
+ * are laid out in memory, so it can be mapped and played in place */
+typedef struct _scrubber_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t framesize;
+    uint64_t framecount;
+    uint32_t fftsize;
+    float fs;
+    float overlap;
+    char reserved[28];
+} t_scrubber_header;
+
+/* The mapped file structure
+ * **************************************************/
+/* The frames of a mapped analysis file, handed to the perform routine as
+ * one unit so it never pairs them with another frame count */
+typedef struct _scrubber_file {
+    void* mapping;
+    size_t mapping_size;
+    float* frames;
+    long framesize;
+    long framecount;
+} t_scrubber_file;
+
+/* The frame store structure
+ * **************************************************/
+/* The frames, the per-bin state and the built-in STFT the perform routine
+ * works on. A change of size builds a new one on the side and hands it over
+ * as one unit, so the perform routine never reads a block that is being
+ * reallocated. A new one takes over the frames block of the previous one
+ * when it is large enough */
+typedef struct _scrubber_memory {
+    long fftsize;
+    long framecount;
+    long recording_frame;
+    short buffer_status;
+
+    float* frames;
+    void* frames_memory;
+    long frames_capacity;
+    float* last_phase_in;
+    float* last_phase_out;
+    float* magnitudes;
+
+    long stft_size;
+    long stft_hop;
+    long stft_cursor;
+    long stft_countdown;
+    double stft_gain;
+    double* stft_syncs;
+    double* stft_memory;
+    double* stft_window;
+    double* stft_input;
+    double* stft_output;
+    double* stft_real;
+    double* stft_imag;
+    double* stft_packed;
+    double* stft_cos;
+    double* stft_sin;
+    long* stft_bitrev;
+} t_scrubber_memory;
+
 /* The object structure
  * *******************************************************/
 typedef struct _scrubber {
@@ -26,30 +125,52 @@ typedef struct _scrubber {
 
     float fs;
 
-    float** amplitudes;
-    float** phasediffs;
-    float* last_phase_in;
-    float* last_phase_out;
-
+    /* The frame store, handed over like the files below: 'memory' is the
+     * latest one, 'playing' the one the perform routine works on */
+    t_scrubber_memory* memory;
+    t_scrubber_memory* playing;
+    t_scrubber_memory* volatile pending_memory;
+    t_scrubber_memory* retired_memory;
+
+    /* The file played in place of the frame store. The latest one waits
+     * in 'pending_file' until the perform routine takes it at the start
+     * of a vector, and 'frame_store' stands for going back to the frame
+     * store. The file it played before is unmapped once a later handover
+     * has been taken */
+    t_scrubber_file* file;
+    t_scrubber_file* playing_file;
+    t_scrubber_file* volatile pending_file;
+    t_scrubber_file* retired_file;
+    t_scrubber_file frame_store;
+
+    /* The size the next frame store is built for, 'stft_size' is 0 while
+     * the FFT size follows the signal vector size */
     float duration_ms;
     float overlap;
     long fftsize;
     long framecount;
-    long old_framecount;
+    long stft_size;
 
-    long recording_frame;
-    float playback_frame;
-    float last_position;
+    /* Per-head state, one element per read head */
+    int num_heads;
+    float* playback_frames;
+    float* last_positions;
+    float* head_controls;
 
     short acquire_sample;
-    short buffer_status;
+    short approximate;
+    short interpolate;
+    short phase_lock;
 } t_scrubber;
 
 /* The arguments/inlets/outlets/vectors indexes
  * *******************************/
-enum ARGUMENTS { A_DURATION };
+/* Every read head has its own speed and position inlets and its own set of
+ * outlets, so these repeat for each head after the first */
+enum ARGUMENTS { A_DURATION, A_HEADS };
 enum INLETS { I_REAL, I_IMAG, I_SPEED, I_POSITION, NUM_INLETS };
-enum OUTLETS { O_REAL, O_IMAG, NUM_OUTLETS };
+enum OUTLETS { O_REAL, O_IMAG, O_PHASE, NUM_OUTLETS };
+#define HEAD_INLETS (NUM_INLETS - I_SPEED)
 enum DSP {
     PERFORM,
     OBJECT,
@@ -80,9 +201,30 @@ void scrubber_perform64(t_scrubber* x, t_object* dsp64, double** ins,
 /* The object-specific prototypes
  * *********************************************/
 void scrubber_init_memory(t_scrubber* x);
+void scrubber_hand_over_memory(t_scrubber* x, t_scrubber_memory* memory);
+void scrubber_free_memory(t_scrubber* x, t_scrubber_memory* memory);
 void scrubber_sample(t_scrubber* x);
 void scrubber_overlap(t_scrubber* x, t_symbol* msg, short argc, t_atom* argv);
 void scrubber_resize(t_scrubber* x, t_symbol* msg, short argc, t_atom* argv);
+void scrubber_approximate(t_scrubber* x, t_symbol* msg, short argc,
+                          t_atom* argv);
+void scrubber_interpolate(t_scrubber* x, t_symbol* msg, short argc,
+                          t_atom* argv);
+void scrubber_phase_lock(t_scrubber* x, t_symbol* msg, short argc,
+                         t_atom* argv);
+void scrubber_stft(t_scrubber* x, t_symbol* msg, short argc, t_atom* argv);
+short scrubber_init_stft(t_scrubber* x, t_scrubber_memory* memory);
+void scrubber_write(t_scrubber* x, t_symbol* filename);
+void scrubber_dowrite(t_scrubber* x, t_symbol* filename, short argc,
+                      t_atom* argv);
+void scrubber_read(t_scrubber* x, t_symbol* filename);
+void scrubber_doread(t_scrubber* x, t_symbol* filename, short argc,
+                     t_atom* argv);
+short scrubber_write_file(t_scrubber* x, const char* path);
+short scrubber_map_file(t_scrubber* x, const char* path);
+void scrubber_unmap_file(t_scrubber* x);
+void scrubber_hand_over(t_scrubber* x, t_scrubber_file* file);
+void scrubber_free_file(t_scrubber_file* file);
 
 /* Function prototypes
  * ********************************************************/
@@ -119,6 +261,15 @@ int C74_EXPORT main()
                     A_FLOAT, 0);
     class_addmethod(scrubber_class, (method)scrubber_resize, "resize", A_FLOAT,
                     0);
+    class_addmethod(scrubber_class, (method)scrubber_approximate,
+                    "approximate", A_GIMME, 0);
+    class_addmethod(scrubber_class, (method)scrubber_interpolate,
+                    "interpolate", A_GIMME, 0);
+    class_addmethod(scrubber_class, (method)scrubber_phase_lock, "phase_lock",
+                    A_GIMME, 0);
+    class_addmethod(scrubber_class, (method)scrubber_stft, "stft", A_GIMME, 0);
+    class_addmethod(scrubber_class, (method)scrubber_write, "write", A_SYM, 0);
+    class_addmethod(scrubber_class, (method)scrubber_read, "read", A_SYM, 0);
 
     /* Add standard Max methods to the class */
     class_dspinit(scrubber_class);
@@ -158,7 +309,9 @@ void scrubber_assist(t_scrubber* x, void* b, long msg, long arg, char* dst)
 {
     /* Document inlet functions */
     if (msg == ASSIST_INLET) {
-        switch (arg) {
+        long head = arg < I_SPEED ? 0 : (arg - I_SPEED) / HEAD_INLETS;
+
+        switch (arg - head * HEAD_INLETS) {
         case I_REAL:
             snprintf_zero(dst, ASSIST_MAX_STRING_LEN, "(signal) Real part");
             break;
@@ -167,23 +320,34 @@ void scrubber_assist(t_scrubber* x, void* b, long msg, long arg, char* dst)
                           "(signal) Imaginary part");
             break;
         case I_SPEED:
-            snprintf_zero(dst, ASSIST_MAX_STRING_LEN, "(signal) Speed");
+            snprintf_zero(dst, ASSIST_MAX_STRING_LEN,
+                          "(signal) Speed of read head %ld", head + 1);
             break;
         case I_POSITION:
-            snprintf_zero(dst, ASSIST_MAX_STRING_LEN, "(signal) Position");
+            snprintf_zero(dst, ASSIST_MAX_STRING_LEN,
+                          "(signal) Position of read head %ld", head + 1);
             break;
         }
     }
 
     /* Document outlet functions */
     else if (msg == ASSIST_OUTLET) {
-        switch (arg) {
+        long head = arg / NUM_OUTLETS;
+
+        switch (arg % NUM_OUTLETS) {
         case O_REAL:
-            snprintf_zero(dst, ASSIST_MAX_STRING_LEN, "(signal) Real part");
+            snprintf_zero(dst, ASSIST_MAX_STRING_LEN,
+                          "(signal) Real part of read head %ld", head + 1);
             break;
         case O_IMAG:
             snprintf_zero(dst, ASSIST_MAX_STRING_LEN,
-                          "(signal) Imaginary part");
+                          "(signal) Imaginary part of read head %ld",
+                          head + 1);
+            break;
+        case O_PHASE:
+            snprintf_zero(dst, ASSIST_MAX_STRING_LEN,
+                          "(signal) Playback phase of read head %ld",
+                          head + 1);
             break;
         }
     }
@@ -194,24 +358,17 @@ void scrubber_assist(t_scrubber* x, void* b, long msg, long arg, char* dst)
  * ******************************************/
 void* scrubber_common_new(t_scrubber* x, short argc, t_atom* argv)
 {
-    /* Create inlets */
-    dsp_setup((t_pxobject*)x, NUM_INLETS);
-
-    /* Create signal outlets */
-    outlet_new((t_object*)x, "signal");
-    outlet_new((t_object*)x, "signal");
-    outlet_new((t_object*)x, "signal");
-
-    /* Avoid sharing memory among audio vectors */
-    x->obj.z_misc |= Z_NO_INPLACE;
-
     /* Initialize input arguments */
     float duration_ms = DEFAULT_DURATION;
+    int num_heads = DEFAULT_HEADS;
 
     /* Parse passed arguments */
     if (argc > A_DURATION) {
         duration_ms = atom_getfloatarg(A_DURATION, argc, argv);
     }
+    if (argc > A_HEADS) {
+        num_heads = atom_getfloatarg(A_HEADS, argc, argv);
+    }
 
     /* Check validity of passed arguments */
     if (duration_ms < MINIMUM_DURATION) {
@@ -224,29 +381,65 @@ void* scrubber_common_new(t_scrubber* x, short argc, t_atom* argv)
              duration_ms);
     }
 
+    if (num_heads < MINIMUM_HEADS) {
+        num_heads = MINIMUM_HEADS;
+        post("scrubber~ • Invalid argument: Minimum read heads set to %d",
+             num_heads);
+    } else if (num_heads > MAXIMUM_HEADS) {
+        num_heads = MAXIMUM_HEADS;
+        post("scrubber~ • Invalid argument: Maximum read heads set to %d",
+             num_heads);
+    }
+
+    /* Create inlets */
+    dsp_setup((t_pxobject*)x, I_SPEED + num_heads * HEAD_INLETS);
+
+    /* Create signal outlets */
+    for (int ii = 0; ii < num_heads * NUM_OUTLETS; ii++) {
+        outlet_new((t_object*)x, "signal");
+    }
+
+    /* Avoid sharing memory among audio vectors */
+    x->obj.z_misc |= Z_NO_INPLACE;
+
     /* Initialize some state variables */
     x->fs = sys_getsr();
 
-    x->amplitudes = NULL;
-    x->phasediffs = NULL;
-    x->last_phase_in = NULL;
-    x->last_phase_out = NULL;
+    x->memory = NULL;
+    x->playing = NULL;
+    x->pending_memory = NULL;
+    x->retired_memory = NULL;
+    x->file = NULL;
+    x->playing_file = NULL;
+    x->pending_file = NULL;
+    x->retired_file = NULL;
 
     x->duration_ms = duration_ms;
     x->overlap = 8;
     x->fftsize = 1024;
     x->framecount = 1;
-    x->old_framecount = 0;
 
-    x->recording_frame = 0;
-    x->playback_frame = 0;
-    x->last_position = 0;
+    x->num_heads = num_heads;
+    x->playback_frames = (float*)calloc(num_heads, sizeof(float));
+    x->last_positions = (float*)calloc(num_heads, sizeof(float));
+    x->head_controls = (float*)calloc(num_heads * HEAD_INLETS, sizeof(float));
 
     x->acquire_sample = 0;
-    x->buffer_status = SCRUBBER_EMPTY;
+    x->approximate = 0;
+    x->interpolate = 0;
+    x->phase_lock = 0;
+
+    x->stft_size = 0;
 
     scrubber_init_memory(x);
 
+    if (x->playback_frames == NULL || x->last_positions == NULL
+        || x->head_controls == NULL) {
+        error("scrubber~ • Cannot allocate memory for %d read heads",
+              num_heads);
+        return NULL;
+    }
+
     /* Print message to Max window */
     post("scrubber~ • Object was created");
 
@@ -261,17 +454,16 @@ void scrubber_free(t_scrubber* x)
     /* Remove the object from the DSP chain */
     dsp_free((t_pxobject*)x);
 
-    /* Free allocated dynamic memory */
-    if (x->amplitudes != NULL) {
-        for (int ii = 0; ii < x->framecount; ii++) {
-            free(x->amplitudes[ii]);
-            free(x->phasediffs[ii]);
-        }
-        free(x->amplitudes);
-        free(x->phasediffs);
-        free(x->last_phase_in);
-        free(x->last_phase_out);
-    }
+    /* Free allocated dynamic memory, the perform routine is gone so the
+     * files and the frame store can go right away */
+    scrubber_free_file(x->file);
+    scrubber_free_file(x->retired_file);
+    scrubber_free_memory(x, x->retired_memory);
+    x->retired_memory = NULL;
+    scrubber_free_memory(x, x->memory);
+    free(x->playback_frames);
+    free(x->last_positions);
+    free(x->head_controls);
 
     /* Print message to Max window */
     post("scrubber~ • Memory was freed");
@@ -294,56 +486,145 @@ void scrubber_init_memory(t_scrubber* x)
         return;
     }
 
-    x->buffer_status = SCRUBBER_EMPTY;
+    scrubber_unmap_file(x);
 
-    long bytesize;
+    t_scrubber_memory* memory = (t_scrubber_memory*)calloc(
+        1, sizeof(t_scrubber_memory));
+    if (memory == NULL) {
+        post("scrubber~ • cannot allocate %ld frames", framecount);
+        return;
+    }
 
-    if (x->amplitudes == NULL) {
-        bytesize = framecount * sizeof(float*);
-        x->amplitudes = (float**)malloc(bytesize);
-        x->phasediffs = (float**)malloc(bytesize);
+    memory->fftsize = x->fftsize;
+    memory->framecount = framecount;
+    memory->recording_frame = 0;
+    memory->buffer_status = SCRUBBER_EMPTY;
+
+    /* All frames live in one block of interleaved magnitude and phase
+     * difference pairs. It has room for the maximum duration, so a resize
+     * only allocates when the overlap, FFT size or sampling rate grow */
+    t_scrubber_memory* previous = x->memory;
+    long capacity = framecount * framesize * 2;
+
+    if (previous != NULL && capacity <= previous->frames_capacity) {
+        memory->frames_memory = previous->frames_memory;
+        memory->frames = previous->frames;
+        memory->frames_capacity = previous->frames_capacity;
+    } else {
+        long max_framecount = (MAXIMUM_DURATION * 0.001 * x->fs)
+            * (x->overlap / x->fftsize);
+        if (capacity < max_framecount * framesize * 2) {
+            capacity = max_framecount * framesize * 2;
+        }
 
-        bytesize = framesize * sizeof(float);
-        x->last_phase_in = (float*)malloc(bytesize);
-        x->last_phase_out = (float*)malloc(bytesize);
+        memory->frames_memory = malloc(capacity * sizeof(float)
+                                       + FRAME_ALIGNMENT - 1);
+        if (memory->frames_memory != NULL) {
+            memory->frames = (float*)(((uintptr_t)memory->frames_memory
+                                       + FRAME_ALIGNMENT - 1)
+                                      & ~(uintptr_t)(FRAME_ALIGNMENT - 1));
+            memory->frames_capacity = capacity;
+        }
+    }
 
-    } else {
-        for (int ii = 0; ii < x->old_framecount; ii++) {
-            free(x->amplitudes[ii]);
-            free(x->phasediffs[ii]);
+    memory->last_phase_in = (float*)calloc(framesize, sizeof(float));
+    memory->last_phase_out = (float*)calloc(framesize * x->num_heads,
+                                            sizeof(float));
+    memory->magnitudes = (float*)calloc(framesize, sizeof(float));
+
+    /* Without frames there is nothing to sample into or play, and the
+     * perform routine only leaves the previous frames behind */
+    if (memory->frames == NULL || memory->last_phase_in == NULL
+        || memory->last_phase_out == NULL || memory->magnitudes == NULL) {
+        if (previous == NULL
+            || memory->frames_memory != previous->frames_memory) {
+            free(memory->frames_memory);
         }
+        free(memory->last_phase_in);
+        free(memory->last_phase_out);
+        free(memory->magnitudes);
+        memory->frames = NULL;
+        memory->frames_memory = NULL;
+        memory->frames_capacity = 0;
+        memory->last_phase_in = NULL;
+        memory->last_phase_out = NULL;
+        memory->magnitudes = NULL;
+
+        x->acquire_sample = 0;
+        post("scrubber~ • cannot allocate %ld frames", framecount);
+    }
 
-        bytesize = framecount * sizeof(float*);
-        x->amplitudes = (float**)realloc(x->amplitudes, bytesize);
-        x->phasediffs = (float**)realloc(x->phasediffs, bytesize);
+    if (x->stft_size > 0 && scrubber_init_stft(x, memory)) {
+        x->stft_size = 0;
+        post("scrubber~ • cannot allocate a %ld point STFT", memory->fftsize);
+    }
+
+    scrubber_hand_over_memory(x, memory);
+}
 
-        bytesize = framesize * sizeof(float);
-        x->last_phase_in = (float*)realloc(x->last_phase_in, bytesize);
-        x->last_phase_out = (float*)realloc(x->last_phase_out, bytesize);
+void scrubber_hand_over_memory(t_scrubber* x, t_scrubber_memory* memory)
+{
+    /* Hand it over in one exchange. A frame store the perform routine has
+     * not taken yet is dropped; otherwise the perform routine has left
+     * every older one behind, and the one it works on now is retired */
+    t_scrubber_memory* unused = scrubber_exchange(&x->pending_memory,
+                                                  memory);
+    if (unused == NULL) {
+        unused = x->retired_memory;
+        x->retired_memory = x->memory;
     }
 
-    bytesize = framesize * sizeof(float);
-    for (int ii = 0; ii < framecount; ii++) {
-        x->amplitudes[ii] = (float*)malloc(bytesize);
-        x->phasediffs[ii] = (float*)malloc(bytesize);
+    x->memory = memory;
+    scrubber_free_memory(x, unused);
+}
 
-        memset(x->amplitudes[ii], 0, bytesize);
-        memset(x->phasediffs[ii], 0, bytesize);
+void scrubber_free_memory(t_scrubber* x, t_scrubber_memory* memory)
+{
+    if (memory == NULL) {
+        return;
     }
 
-    memset(x->last_phase_in, 0, bytesize);
-    memset(x->last_phase_out, 0, bytesize);
+    /* The frames block stays while a frame store still in use shares it */
+    short shared = 0;
+    t_scrubber_memory* in_use[2] = {x->memory, x->retired_memory};
+    for (int ii = 0; ii < 2; ii++) {
+        if (in_use[ii] != NULL && in_use[ii] != memory
+            && in_use[ii]->frames_memory == memory->frames_memory) {
+            shared = 1;
+        }
+    }
 
-    x->old_framecount = framecount;
+    if (!shared) {
+        free(memory->frames_memory);
+    }
+    free(memory->last_phase_in);
+    free(memory->last_phase_out);
+    free(memory->magnitudes);
+    free(memory->stft_memory);
+    free(memory->stft_bitrev);
+    free(memory);
 }
 
 void scrubber_sample(t_scrubber* x)
 {
-    x->recording_frame = 0;
-    x->playback_frame = 0;
+    /* A mapped file is read-only, so go back to the frame store */
+    if (x->file != NULL) {
+        x->framecount = (x->duration_ms * 0.001 * x->fs)
+            * (x->overlap / x->fftsize);
+        scrubber_init_memory(x);
+    }
+
+    t_scrubber_memory* memory = x->memory;
+    if (memory == NULL || memory->frames == NULL) {
+        post("scrubber~ • no memory to sample into");
+        return;
+    }
+
+    memory->recording_frame = 0;
+    memset(x->playback_frames, 0, x->num_heads * sizeof(float));
 
     x->acquire_sample = 1;
-    x->buffer_status = SCRUBBER_EMPTY;
+    memory->buffer_status = SCRUBBER_EMPTY;
 }
 
 void scrubber_overlap(t_scrubber* x, t_symbol* msg, short argc, t_atom* argv)
@@ -373,7 +654,6 @@ void scrubber_resize(t_scrubber* x, t_symbol* msg, short argc, t_atom* argv)
 
         if (x->duration_ms != new_duration) {
             x->duration_ms = new_duration;
-            x->old_framecount = x->framecount;
             x->framecount = (x->duration_ms * 0.001 * x->fs)
                 * (x->overlap / (x->fftsize * 2));
 
@@ -382,6 +662,445 @@ void scrubber_resize(t_scrubber* x, t_symbol* msg, short argc, t_atom* argv)
     }
 }
 
+void scrubber_approximate(t_scrubber* x, t_symbol* msg, short argc,
+                          t_atom* argv)
+{
+    if (argc >= 1) {
+        x->approximate = (short)atom_getfloatarg(0, argc, argv);
+    }
+}
+
+void scrubber_interpolate(t_scrubber* x, t_symbol* msg, short argc,
+                          t_atom* argv)
+{
+    if (argc >= 1) {
+        x->interpolate = (short)atom_getfloatarg(0, argc, argv);
+    }
+}
+
+void scrubber_phase_lock(t_scrubber* x, t_symbol* msg, short argc,
+                         t_atom* argv)
+{
+    if (argc >= 1) {
+        x->phase_lock = (short)atom_getfloatarg(0, argc, argv);
+    }
+}
+
+void scrubber_stft(t_scrubber* x, t_symbol* msg, short argc, t_atom* argv)
+{
+    if (argc >= 1) {
+        long new_size = (long)atom_getfloatarg(0, argc, argv);
+        if (new_size != 0
+            && (new_size < MINIMUM_STFT_SIZE || new_size > MAXIMUM_STFT_SIZE
+                || (new_size & (new_size - 1)) != 0)) {
+            post("scrubber~ • bad STFT size: %ld", new_size);
+            return;
+        }
+
+        if (argc >= 2) {
+            float new_overlap = atom_getfloatarg(1, argc, argv);
+            if (new_overlap <= 0) {
+                post("scrubber~ • bad overlap: %f", new_overlap);
+                return;
+            }
+            x->overlap = new_overlap;
+        }
+
+        x->stft_size = new_size;
+
+        // the FFT size no longer follows the signal vector size, so the
+        // frames can be resized right away. Going back to it waits for the
+        // next DSP method call, and the outputs stay silent until then
+        if (x->stft_size > 0) {
+            x->fftsize = x->stft_size;
+            x->framecount = (x->duration_ms * 0.001 * x->fs)
+                * (x->overlap / x->fftsize);
+        } else {
+            post("scrubber~ • restart the DSP to leave the built-in STFT");
+        }
+        scrubber_init_memory(x);
+    }
+}
+
+/* Sets up the built-in STFT of 'memory' for its FFT size, and returns 1
+ * when it cannot be allocated. One block holds the window, the input ring,
+ * the spectrum, the twiddles and an output ring and sync value for every
+ * read head */
+short scrubber_init_stft(t_scrubber* x, t_scrubber_memory* memory)
+{
+    long size = memory->fftsize;
+    long half = size / 2;
+
+    memory->stft_memory = (double*)calloc(
+        (5 + x->num_heads) * size + 2 * (half + 1) + x->num_heads,
+        sizeof(double));
+    memory->stft_bitrev = (long*)malloc(half * sizeof(long));
+
+    if (memory->stft_memory == NULL || memory->stft_bitrev == NULL) {
+        free(memory->stft_memory);
+        free(memory->stft_bitrev);
+        memory->stft_memory = NULL;
+        memory->stft_bitrev = NULL;
+        return 1;
+    }
+
+    memory->stft_size = size;
+    memory->stft_window = memory->stft_memory;
+    memory->stft_input = memory->stft_window + size;
+    memory->stft_real = memory->stft_input + size;
+    memory->stft_imag = memory->stft_real + size;
+    memory->stft_packed = memory->stft_imag + size;
+    memory->stft_cos = memory->stft_packed + size;
+    memory->stft_sin = memory->stft_cos + half + 1;
+    memory->stft_output = memory->stft_sin + half + 1;
+    memory->stft_syncs = memory->stft_output + x->num_heads * size;
+
+    // periodic Hann window, used for both analysis and resynthesis
+    double energy = 0.0;
+    for (long ii = 0; ii < size; ii++) {
+        memory->stft_window[ii] = 0.5 - 0.5 * cos(TWOPI * ii / size);
+        energy += memory->stft_window[ii] * memory->stft_window[ii];
+    }
+
+    for (long ii = 0; ii <= half; ii++) {
+        memory->stft_cos[ii] = cos(TWOPI * ii / size);
+        memory->stft_sin[ii] = sin(TWOPI * ii / size);
+    }
+
+    // bit reversed order for the complex FFT of half the size
+    for (long ii = 0; ii < half; ii++) {
+        long reversed = 0;
+        for (long bit = 1; bit < half; bit <<= 1) {
+            reversed = (reversed << 1) | ((ii & bit) != 0);
+        }
+        memory->stft_bitrev[ii] = reversed;
+    }
+
+    memory->stft_hop = size / x->overlap;
+    if (memory->stft_hop < 1) {
+        memory->stft_hop = 1;
+    }
+
+    // the squared windows overlap-add to this gain on average
+    memory->stft_gain = memory->stft_hop / energy;
+
+    memory->stft_cursor = 0;
+    memory->stft_countdown = memory->stft_hop;
+
+    return 0;
+}
+
+void scrubber_write(t_scrubber* x, t_symbol* filename)
+{
+    defer(x, (method)scrubber_dowrite, filename, 0, NULL);
+}
+
+void scrubber_dowrite(t_scrubber* x, t_symbol* filename, short argc,
+                      t_atom* argv)
+{
+    char name[MAX_PATH_CHARS];
+    char path[MAX_PATH_CHARS];
+    short folder;
+    t_fourcc type;
+
+    /* Overwrite the file where it is found, or else create it next to the
+     * patcher */
+    strncpy_zero(name, filename->s_name, MAX_PATH_CHARS);
+    if (locatefile_extended(name, &folder, &type, NULL, 0)) {
+        folder = path_getdefault();
+    }
+
+    if (path_toabsolutesystempath(folder, name, path)) {
+        error("scrubber~ • Cannot write %s", filename->s_name);
+        return;
+    }
+
+    if (scrubber_write_file(x, path) == 0) {
+        post("scrubber~ • Wrote %ld frames to %s", x->memory->framecount,
+             filename->s_name);
+    }
+}
+
+void scrubber_read(t_scrubber* x, t_symbol* filename)
+{
+    defer(x, (method)scrubber_doread, filename, 0, NULL);
+}
+
+void scrubber_doread(t_scrubber* x, t_symbol* filename, short argc,
+                     t_atom* argv)
+{
+    char name[MAX_PATH_CHARS];
+    char path[MAX_PATH_CHARS];
+    short folder;
+    t_fourcc type;
+
+    strncpy_zero(name, filename->s_name, MAX_PATH_CHARS);
+    if (locatefile_extended(name, &folder, &type, NULL, 0)
+        || path_toabsolutesystempath(folder, name, path)) {
+        error("scrubber~ • Cannot find %s", filename->s_name);
+        return;
+    }
+
+    if (scrubber_map_file(x, path) == 0) {
+        post("scrubber~ • Mapped %ld frames from %s", x->file->framecount,
+             filename->s_name);
+    }
+}
+
+short scrubber_write_file(t_scrubber* x, const char* path)
+{
+    if (x->file != NULL) {
+        error("scrubber~ • Already playing from a file");
+        return 1;
+    }
+    t_scrubber_memory* memory = x->memory;
+    if (memory == NULL || memory->buffer_status != SCRUBBER_FULL) {
+        error("scrubber~ • Nothing sampled to write");
+        return 1;
+    }
+
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) {
+        error("scrubber~ • Cannot write %s", path);
+        return 1;
+    }
+
+    t_scrubber_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SCRUBBER_FILE_MAGIC, sizeof(header.magic));
+    header.version = SCRUBBER_FILE_VERSION;
+    header.framesize = memory->fftsize / 2;
+    header.framecount = memory->framecount;
+    header.fftsize = memory->fftsize;
+    header.fs = x->fs;
+    header.overlap = x->overlap;
+
+    size_t count = (size_t)memory->framecount * header.framesize * 2;
+    short failed = fwrite(&header, sizeof(header), 1, file) != 1
+        || fwrite(memory->frames, sizeof(float), count, file) != count;
+    failed |= fclose(file) != 0;
+
+    if (failed) {
+        error("scrubber~ • Failed writing %s", path);
+    }
+    return failed;
+}
+
+/* Plays an analysis file in place of the frame store. The file is mapped
+ * read-only and shared, so the system pages it in on demand and instances
+ * reading the same file share its memory */
+short scrubber_map_file(t_scrubber* x, const char* path)
+{
+    void* mapping;
+    size_t size;
+
+    /* The file is played through the per-bin state of the frame store */
+    t_scrubber_memory* memory = x->memory;
+    if (memory == NULL || memory->frames == NULL) {
+        error("scrubber~ • No memory to play %s", path);
+        return 1;
+    }
+
+#ifdef WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    LARGE_INTEGER file_size;
+    if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &file_size)) {
+        error("scrubber~ • Cannot open %s", path);
+        if (file != INVALID_HANDLE_VALUE) {
+            CloseHandle(file);
+        }
+        return 1;
+    }
+
+    size = (size_t)file_size.QuadPart;
+    HANDLE map = size ? CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0,
+                                           NULL)
+                      : NULL;
+    CloseHandle(file);
+
+    mapping = map ? MapViewOfFile(map, FILE_MAP_READ, 0, 0, 0) : NULL;
+    if (map) {
+        CloseHandle(map);
+    }
+    if (mapping == NULL) {
+        error("scrubber~ • Cannot map %s", path);
+        return 1;
+    }
+#else
+    struct stat info;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &info) != 0) {
+        error("scrubber~ • Cannot open %s", path);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return 1;
+    }
+
+    size = info.st_size;
+    mapping = size ? mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0)
+                   : MAP_FAILED;
+    close(fd);
+
+    if (mapping == MAP_FAILED) {
+        error("scrubber~ • Cannot map %s", path);
+        return 1;
+    }
+#endif
+
+    /* Check that the file holds whole frames of our size */
+    t_scrubber_header* header = (t_scrubber_header*)mapping;
+    long framesize = memory->fftsize / 2;
+    const char* problem = NULL;
+
+    if (size < sizeof(t_scrubber_header)
+        || memcmp(header->magic, SCRUBBER_FILE_MAGIC, sizeof(header->magic))) {
+        problem = "not an analysis file";
+    } else if (header->version != SCRUBBER_FILE_VERSION) {
+        problem = "unsupported version";
+    } else if (header->framesize != framesize) {
+        problem = "different FFT size";
+    } else if (header->framecount == 0
+               || (size - sizeof(t_scrubber_header)) / sizeof(float) / 2
+                       / framesize
+                   < header->framecount) {
+        problem = "truncated";
+    }
+
+    if (problem != NULL) {
+        error("scrubber~ • %s: %s", path, problem);
+#ifdef WIN32
+        UnmapViewOfFile(mapping);
+#else
+        munmap(mapping, size);
+#endif
+        return 1;
+    }
+
+    if (header->fs != x->fs) {
+        post("scrubber~ • %s was analyzed at %.0f[Hz]", path, header->fs);
+    }
+
+    t_scrubber_file* file = (t_scrubber_file*)malloc(
+        sizeof(t_scrubber_file));
+    if (file == NULL) {
+        error("scrubber~ • Cannot map %s", path);
+#ifdef WIN32
+        UnmapViewOfFile(mapping);
+#else
+        munmap(mapping, size);
+#endif
+        return 1;
+    }
+
+    file->mapping = mapping;
+    file->mapping_size = size;
+    file->frames = (float*)(header + 1);
+    file->framesize = framesize;
+    file->framecount = header->framecount;
+
+    /* Swap the file in for the frame store. The perform routine takes it
+     * with its frame count and starts the read heads over */
+    scrubber_hand_over(x, file);
+
+    x->acquire_sample = 0;
+    memory->buffer_status = SCRUBBER_FULL;
+
+    return 0;
+}
+
+void scrubber_unmap_file(t_scrubber* x)
+{
+    if (x->file == NULL) {
+        return;
+    }
+
+    scrubber_hand_over(x, &x->frame_store);
+}
+
+void scrubber_hand_over(t_scrubber* x, t_scrubber_file* file)
+{
+    /* Hand it over in one exchange. A file the perform routine has not
+     * taken yet is dropped; otherwise the perform routine has left every
+     * older file behind, and the one it plays now is retired */
+    t_scrubber_file* dropped = scrubber_exchange(&x->pending_file, file);
+    if (dropped) {
+        if (dropped != &x->frame_store) {
+            scrubber_free_file(dropped);
+        }
+    } else {
+        scrubber_free_file(x->retired_file);
+        x->retired_file = x->file;
+    }
+
+    x->file = file != &x->frame_store ? file : NULL;
+}
+
+void scrubber_free_file(t_scrubber_file* file)
+{
+    if (file == NULL) {
+        return;
+    }
+
+#ifdef WIN32
+    UnmapViewOfFile(file->mapping);
+#else
+    munmap(file->mapping, file->mapping_size);
+#endif
+
+    free(file);
+}
+
+/* The fast polar kernels
+ * ****************************************************/
+/* One bin of the analysis with the shared kernels: cartopol~, framedelta~ and
+ * a phasewrap~ that relies on both phases lying within [-pi, pi] */
+static inline void scrubber_analyze_bin(float real, float imag,
+                                        float* last_phase, float* frame)
+{
+    float phase = -polar_atan2(imag, real);
+    float phasediff = phase - *last_phase;
+    *last_phase = phase;
+
+    phasediff += phasediff > (float)PI ? (float)-TWOPI : 0.0f;
+    phasediff += phasediff < (float)-PI ? (float)TWOPI : 0.0f;
+
+    frame[0] = sqrtf(real * real + imag * imag);
+    frame[1] = phasediff;
+}
+
+/* Identity phase locking: every bin from one magnitude trough to the next
+ * takes its phase from the peak in between. Within the main lobe of a Hann
+ * window the bins of a sinusoid alternate by pi, so odd distances from the
+ * peak keep that offset */
+static void scrubber_lock_phases(float* magnitudes, float* phases,
+                                 int framesize)
+{
+    int ii = 0;
+
+    while (ii < framesize) {
+        int start = ii;
+
+        while (ii + 1 < framesize && magnitudes[ii + 1] >= magnitudes[ii]) {
+            ii++;
+        }
+        int peak = ii;
+
+        while (ii + 1 < framesize && magnitudes[ii + 1] < magnitudes[ii]) {
+            ii++;
+        }
+
+        float peak_phase = phases[peak];
+        float odd_phase = peak_phase > 0.0 ? peak_phase - PI : peak_phase + PI;
+        for (int jj = start; jj <= ii; jj++) {
+            phases[jj] = (jj - peak) & 1 ? odd_phase : peak_phase;
+        }
+
+        ii++;
+    }
+}
+
 /* The 'DSP' method
  * ***********************************************************/
 
@@ -394,13 +1113,13 @@ void scrubber_dsp64(t_scrubber* x, t_object* dsp64, short* count,
     long new_fftsize;
 
     new_fs = samplerate;
-    new_fftsize = maxvectorsize * 2;
+    new_fftsize = x->stft_size > 0 ? x->stft_size : maxvectorsize * 2;
 
     long new_framecount = (x->duration_ms * 0.001 * new_fs)
         * (x->overlap / new_fftsize);
 
     if (x->fs != new_fs || x->fftsize != new_fftsize
-        || x->framecount != new_framecount) {
+        || (x->file == NULL && x->framecount != new_framecount)) {
 
         x->fs = new_fs;
         x->fftsize = new_fftsize;
@@ -416,36 +1135,21 @@ void scrubber_dsp64(t_scrubber* x, t_object* dsp64, short* count,
     post("scrubber~ • Executing 64-bit perform routine");
 }
 
-void scrubber_perform64(t_scrubber* x, t_object* dsp64, double** ins,
-                        long numins, double** outs, long numouts,
-                        long sampleframes, long flags, void* userparam)
+/* The spectral processing
+ * ***************************************************/
+/* Records one frame of 'n' bins and returns the sync value for it */
+static double scrubber_analyze(t_scrubber* x, t_double* input_real,
+                               t_double* input_imag, int n)
 {
-    /* Copy signal pointers */
-    t_double* input_real = ins[0];
-    t_double* input_imag = ins[1];
-    t_double* speed = ins[2];
-    t_double* position = ins[3];
-
-    t_double* output_real = outs[0];
-    t_double* output_imag = outs[1];
-    t_double* sync = outs[2];
-    int n = sampleframes;
-
     /* Load state variables */
-    float** amplitudes = x->amplitudes;
-    float** phasediffs = x->phasediffs;
-
-    float* last_phase_in = x->last_phase_in;
-    float* last_phase_out = x->last_phase_out;
-
-    long framecount = x->framecount;
+    t_scrubber_memory* memory = x->playing;
+    float* frame;
+    float* last_phase_in = memory->last_phase_in;
 
-    long recording_frame = x->recording_frame;
-    double playback_frame = x->playback_frame;
-    double last_position = x->last_position;
+    long framecount = memory->framecount;
+    long recording_frame = memory->recording_frame;
 
-    short acquire_samples = x->acquire_sample;
-    short buffer_status = x->buffer_status;
+    short approximate = x->approximate;
 
     /* Perform the DSP loop */
     double local_real;
@@ -458,14 +1162,27 @@ void scrubber_perform64(t_scrubber* x, t_object* dsp64, double** ins,
     int framesize;
     framesize = (int)n;
 
-    // mode: analysis
-    if (acquire_samples) {
-        sync_val = (double)recording_frame / (double)framecount;
+    sync_val = (double)recording_frame / (double)framecount;
+    frame = memory->frames + recording_frame * framesize * 2;
+
+    if (approximate) {
+        // the edge bins carry no imaginary part and are done apart,
+        // which keeps the loop free of branches
+        for (int ii = 1; ii < framesize - 1; ii++) {
+            scrubber_analyze_bin(input_real[ii], input_imag[ii],
+                                 last_phase_in + ii, frame + 2 * ii);
+        }
+        scrubber_analyze_bin(input_real[0], 0.0, last_phase_in, frame);
+        scrubber_analyze_bin(input_real[framesize - 1], 0.0,
+                             last_phase_in + framesize - 1,
+                             frame + 2 * (framesize - 1));
 
+    } else {
         for (int ii = 0; ii < framesize; ii++) {
             local_real = input_real[ii];
-            local_imag = (ii == 0 || ii == framesize - 1) ? 0.0
-                                                          : input_imag[ii];
+            local_imag = (ii == 0 || ii == framesize - 1)
+                ? 0.0
+                : input_imag[ii];
 
             // functionality of cartopol~
             local_magnitude = hypotf(local_real, local_imag);
@@ -484,73 +1201,472 @@ void scrubber_perform64(t_scrubber* x, t_object* dsp64, double** ins,
             }
 
             // record magnitudes and phases
-            amplitudes[recording_frame][ii] = local_magnitude;
-            phasediffs[recording_frame][ii] = phasediff;
+            frame[2 * ii] = local_magnitude;
+            frame[2 * ii + 1] = phasediff;
+        }
+    }
+
+
+    recording_frame++;
+    if (recording_frame >= framecount) {
+        x->acquire_sample = 0;
+        memory->buffer_status = SCRUBBER_FULL;
+    }
+
+    /* Update state variables */
+    memory->recording_frame = recording_frame;
+
+    return sync_val;
+}
+
+/* Plays one frame of 'n' bins from read head 'head' and returns the sync
+ * value for it */
+static double scrubber_synthesize(t_scrubber* x, int head, t_double speed,
+                                  t_double position, t_double* output_real,
+                                  t_double* output_imag, int n)
+{
+    /* Load state variables */
+    t_scrubber_memory* memory = x->playing;
+    float* frames = memory->frames;
+    float* frame;
+    float* next_frame;
+
+    float* last_phase_out;
+    float* magnitudes = memory->magnitudes;
+
+    long framecount = memory->framecount;
+
+    if (x->playing_file != NULL) {
+        frames = x->playing_file->frames;
+        framecount = x->playing_file->framecount;
+    }
+
+    double playback_frame = x->playback_frames[head];
+    double last_position = x->last_positions[head];
+
+    short approximate = x->approximate;
+    short interpolate = x->interpolate;
+    short phase_lock = x->phase_lock;
+
+    /* Perform the DSP loop */
+    double local_real;
+    double local_imag;
+    double local_magnitude;
+    double local_phase;
+    double phasediff;
+    double sync_val;
+    double fraction;
+    float sine;
+    float cosine;
+
+    int framesize;
+    framesize = (int)n;
+    last_phase_out = memory->last_phase_out + head * framesize;
+
+    sync_val = playback_frame / (double)framecount;
+
+    if (position != last_position && position >= 0.0 && position <= 1.0) {
+
+        last_position = position;
+        playback_frame = last_position * (double)(framecount - 1);
+    }
+
+    playback_frame += speed;
+    while (playback_frame < 0.0) {
+        playback_frame += framecount;
+    }
+    while (playback_frame >= framecount) {
+        playback_frame -= framecount;
+    }
+
+    int int_playback_frame = floor(playback_frame);
+    frame = frames + int_playback_frame * framesize * 2;
+    next_frame = frames
+        + ((int_playback_frame + 1) % framecount) * framesize * 2;
+    fraction = interpolate ? playback_frame - int_playback_frame : 0.0;
+
+    for (int ii = 0; ii < framesize; ii++) {
+        // read in between the two frames, taking the phase differences
+        // the short way around the circle
+        local_magnitude = frame[2 * ii];
+        local_magnitude += fraction
+            * (next_frame[2 * ii] - local_magnitude);
+
+        local_phase = frame[2 * ii + 1];
+        phasediff = next_frame[2 * ii + 1] - local_phase;
+        phasediff += phasediff > PI ? -TWOPI : 0.0;
+        phasediff += phasediff < -PI ? TWOPI : 0.0;
+        local_phase += fraction * phasediff;
+
+        // functionality of frameaccum~, kept wrapped to [-pi, pi]
+        local_phase += last_phase_out[ii];
+        local_phase += local_phase > PI ? -TWOPI : 0.0;
+        local_phase += local_phase < -PI ? TWOPI : 0.0;
+
+        magnitudes[ii] = local_magnitude;
+        last_phase_out[ii] = local_phase;
+    }
+
+    if (phase_lock) {
+        scrubber_lock_phases(magnitudes, last_phase_out, framesize);
+    }
+
+    if (approximate) {
+        // the edge bins are cleared after the loop to keep it free of
+        // branches
+        for (int ii = 0; ii < framesize; ii++) {
+            polar_sincos(last_phase_out[ii], &sine, &cosine);
+
+            output_real[ii] = magnitudes[ii] * cosine;
+            output_imag[ii] = -magnitudes[ii] * sine;
+        }
+
+        output_imag[0] = 0.0;
+        output_imag[framesize - 1] = 0.0;
+
+    } else {
+        for (int ii = 0; ii < framesize; ii++) {
+            // functionality of poltocar~
+            local_real = magnitudes[ii] * cos(last_phase_out[ii]);
+            local_imag = -magnitudes[ii] * sin(last_phase_out[ii]);
+
+            // playback real and imaginary part
+            output_real[ii] = local_real;
+            output_imag[ii] = (ii == 0 || ii == framesize - 1)
+                ? 0.0
+                : local_imag;
         }
+    }
+
+
+    /* Update state variables */
+    x->playback_frames[head] = playback_frame;
+    x->last_positions[head] = last_position;
+
+    return sync_val;
+}
+
+/* Silences the outputs of every read head */
+static void scrubber_silence(t_scrubber* x, t_double** outputs, double sync_val,
+                             int n)
+{
+    for (int head = 0; head < x->num_heads; head++) {
+        t_double* output_real = outputs[head * NUM_OUTLETS + O_REAL];
+        t_double* output_imag = outputs[head * NUM_OUTLETS + O_IMAG];
+        t_double* sync = outputs[head * NUM_OUTLETS + O_PHASE];
 
-        // playback silence
         for (int ii = 0; ii < n; ii++) {
             output_real[ii] = 0.0;
             output_imag[ii] = 0.0;
             sync[ii] = sync_val;
         }
+    }
+}
+
+/* The built-in STFT
+ * **********************************************************/
+/* Radix-2 FFT of half the STFT size, in place over separate real and
+ * imaginary arrays. It shares the twiddles of the full size real FFT */
+static void scrubber_fft_complex(t_scrubber_memory* memory, double* real,
+                                 double* imag)
+{
+    long size = memory->stft_size / 2;
+    long* bitrev = memory->stft_bitrev;
+    double* cosines = memory->stft_cos;
+    double* sines = memory->stft_sin;
+    double swap;
+
+    for (long ii = 0; ii < size; ii++) {
+        long jj = bitrev[ii];
+        if (jj > ii) {
+            swap = real[ii];
+            real[ii] = real[jj];
+            real[jj] = swap;
+            swap = imag[ii];
+            imag[ii] = imag[jj];
+            imag[jj] = swap;
+        }
+    }
 
-        recording_frame++;
-        if (recording_frame >= framecount) {
-            x->acquire_sample = 0;
-            x->buffer_status = SCRUBBER_FULL;
+    for (long span = 2; span <= size; span <<= 1) {
+        long half = span / 2;
+        long step = memory->stft_size / span;
+
+        for (long start = 0; start < size; start += span) {
+            for (long ii = 0; ii < half; ii++) {
+                double twiddle_real = cosines[ii * step];
+                double twiddle_imag = -sines[ii * step];
+                long top = start + ii;
+                long bottom = top + half;
+
+                double product_real = real[bottom] * twiddle_real
+                    - imag[bottom] * twiddle_imag;
+                double product_imag = real[bottom] * twiddle_imag
+                    + imag[bottom] * twiddle_real;
+
+                real[bottom] = real[top] - product_real;
+                imag[bottom] = imag[top] - product_imag;
+                real[top] += product_real;
+                imag[top] += product_imag;
+            }
         }
+    }
+}
 
-        // mode: synthesis
-    } else if (buffer_status == SCRUBBER_FULL) {
-        sync_val = playback_frame / (double)framecount;
+/* Real FFT of the 'stft_size' samples in 'real'. The even and odd samples
+ * go through one complex FFT of half the size and are untangled after, which
+ * leaves bins 0 to stft_size/2 in 'real' and 'imag' */
+static void scrubber_fft(t_scrubber_memory* memory, double* real,
+                         double* imag)
+{
+    long half = memory->stft_size / 2;
+    double* packed_real = memory->stft_packed;
+    double* packed_imag = memory->stft_packed + half;
+
+    for (long ii = 0; ii < half; ii++) {
+        packed_real[ii] = real[2 * ii];
+        packed_imag[ii] = real[2 * ii + 1];
+    }
+
+    scrubber_fft_complex(memory, packed_real, packed_imag);
+
+    for (long kk = 0; kk <= half; kk++) {
+        long top = kk & (half - 1);
+        long mirror = (half - kk) & (half - 1);
+
+        // the even part is the conjugate symmetric half, the odd part the
+        // antisymmetric one turned by a quarter circle
+        double even_real = 0.5 * (packed_real[top] + packed_real[mirror]);
+        double even_imag = 0.5 * (packed_imag[top] - packed_imag[mirror]);
+        double odd_real = 0.5 * (packed_imag[top] + packed_imag[mirror]);
+        double odd_imag = -0.5 * (packed_real[top] - packed_real[mirror]);
+
+        real[kk] = even_real + memory->stft_cos[kk] * odd_real
+            + memory->stft_sin[kk] * odd_imag;
+        imag[kk] = even_imag + memory->stft_cos[kk] * odd_imag
+            - memory->stft_sin[kk] * odd_real;
+    }
+}
+
+/* Inverse of the above, scaled so that a round trip gives back the input */
+static void scrubber_ifft(t_scrubber_memory* memory, double* real,
+                          double* imag)
+{
+    long half = memory->stft_size / 2;
+    double* packed_real = memory->stft_packed;
+    double* packed_imag = memory->stft_packed + half;
+
+    for (long kk = 0; kk < half; kk++) {
+        double even_real = 0.5 * (real[kk] + real[half - kk]);
+        double even_imag = 0.5 * (imag[kk] - imag[half - kk]);
+        double diff_real = 0.5 * (real[kk] - real[half - kk]);
+        double diff_imag = 0.5 * (imag[kk] + imag[half - kk]);
+
+        double odd_real = diff_real * memory->stft_cos[kk]
+            - diff_imag * memory->stft_sin[kk];
+        double odd_imag = diff_real * memory->stft_sin[kk]
+            + diff_imag * memory->stft_cos[kk];
+
+        packed_real[kk] = even_real - odd_imag;
+        packed_imag[kk] = even_imag + odd_real;
+    }
 
-        if (*position != last_position && *position >= 0.0
-            && *position <= 1.0) {
+    // swapping the parts turns the forward FFT into the inverse one
+    scrubber_fft_complex(memory, packed_imag, packed_real);
 
-            last_position = *position;
-            playback_frame = last_position * (double)(framecount - 1);
+    double scale = 1.0 / half;
+    for (long ii = 0; ii < half; ii++) {
+        real[2 * ii] = packed_real[ii] * scale;
+        real[2 * ii + 1] = packed_imag[ii] * scale;
+    }
+}
+
+/* Analyzes the latest 'stft_size' input samples while sampling, otherwise
+ * resynthesizes every read head and overlap-adds it into the head's output
+ * ring */
+static void scrubber_stft_frame(t_scrubber* x)
+{
+    t_scrubber_memory* memory = x->playing;
+    long size = memory->stft_size;
+    long mask = size - 1;
+    long cursor = memory->stft_cursor;
+
+    double* window = memory->stft_window;
+    double* input = memory->stft_input;
+    double* real = memory->stft_real;
+    double* imag = memory->stft_imag;
+    double* syncs = memory->stft_syncs;
+    double gain = memory->stft_gain;
+    float* controls = x->head_controls;
+
+    // mode: analysis
+    if (x->acquire_sample) {
+        // the ring holds its oldest sample at the cursor
+        for (long ii = 0; ii < size; ii++) {
+            real[ii] = input[(cursor + ii) & mask] * window[ii];
         }
 
-        playback_frame += *speed;
-        while (playback_frame < 0.0) {
-            playback_frame += framecount;
+        scrubber_fft(memory, real, imag);
+        syncs[0] = scrubber_analyze(x, real, imag, size / 2);
+
+        for (int head = 1; head < x->num_heads; head++) {
+            syncs[head] = syncs[0];
         }
-        while (playback_frame >= framecount) {
-            playback_frame -= framecount;
+
+        // mode: synthesis
+    } else if (memory->buffer_status == SCRUBBER_FULL) {
+        for (int head = 0; head < x->num_heads; head++) {
+            double* output = memory->stft_output + head * size;
+
+            syncs[head] = scrubber_synthesize(
+                x, head, controls[head * HEAD_INLETS],
+                controls[head * HEAD_INLETS + 1], real, imag, size / 2);
+            // the frames hold bins 0 to size/2 - 1, so Nyquist stays empty
+            real[size / 2] = 0.0;
+            imag[size / 2] = 0.0;
+            scrubber_ifft(memory, real, imag);
+
+            for (long ii = 0; ii < size; ii++) {
+                output[(cursor + ii) & mask] += real[ii] * window[ii] * gain;
+            }
         }
 
-        int int_playback_frame = floor(playback_frame);
-        for (int ii = 0; ii < framesize; ii++) {
-            local_magnitude = amplitudes[int_playback_frame][ii];
-            local_phase = phasediffs[int_playback_frame][ii];
+        // mode: stand by - waiting to start sampling
+    } else {
+        for (int head = 0; head < x->num_heads; head++) {
+            syncs[head] = 0.0;
+        }
+    }
+}
 
-            // functionality of frameaccum~
-            last_phase_out[ii] += local_phase;
-            local_phase = last_phase_out[ii];
+/* The 'perform' routine
+ * ******************************************************/
+void scrubber_perform64(t_scrubber* x, t_object* dsp64, double** ins,
+                        long numins, double** outs, long numouts,
+                        long sampleframes, long flags, void* userparam)
+{
+    /* Copy signal pointers, which follow the order of inlets and outlets */
+    t_double* input_real = ins[I_REAL];
+    t_double* input_imag = ins[I_IMAG];
+    t_double** controls = ins + I_SPEED;
+    t_double** outputs = outs;
+    int n = sampleframes;
 
-            // functionality of poltocar~
-            local_real = local_magnitude * cos(local_phase);
-            local_imag = -local_magnitude * sin(local_phase);
+    /* Take a new frame store at the start of the vector. The one it
+     * replaces is freed by the next hand-over */
+    t_scrubber_memory* memory = scrubber_exchange(&x->pending_memory, NULL);
+    if (memory != NULL) {
+        x->playing = memory;
+    }
 
-            // playback real and imaginary part
-            output_real[ii] = local_real;
-            output_imag[ii] = (ii == 0 || ii == framesize - 1) ? 0.0
-                                                               : local_imag;
-            sync[ii] = sync_val;
+    memory = x->playing;
+    if (memory == NULL) {
+        scrubber_silence(x, outs, 0.0, n);
+        return;
+    }
+
+    /* Take a new file, or the way back to the frame store, at the start
+     * of the vector */
+    t_scrubber_file* file = scrubber_exchange(&x->pending_file, NULL);
+    if (file == &x->frame_store) {
+        x->playing_file = NULL;
+    } else if (file != NULL) {
+        x->playing_file = file;
+
+        memory->recording_frame = 0;
+        memset(x->playback_frames, 0, x->num_heads * sizeof(float));
+        if (memory->last_phase_out != NULL) {
+            memset(memory->last_phase_out, 0,
+                   memory->fftsize / 2 * x->num_heads * sizeof(float));
         }
+    }
+
+    /* Load state variables */
+    int num_heads = x->num_heads;
+    float* head_controls = x->head_controls;
+
+    /* A file only plays through a frame store of its own frame size */
+    short playable = memory->magnitudes != NULL
+        && (x->playing_file == NULL
+            || x->playing_file->framesize * 2 == memory->fftsize);
+
+    /* Perform the DSP loop */
+    double sync_val;
+
+    // mode: waiting for a frame store the file or the sample fits in
+    if (!playable) {
+        scrubber_silence(x, outputs, 0.0, n);
+
+        // mode: built-in STFT - signals in and out, one FFT size of latency
+    } else if (memory->stft_size > 0) {
+        long mask = memory->stft_size - 1;
+        long cursor = memory->stft_cursor;
 
-        // mode: stand by - waiting to start sampling
-    } else {
         for (int ii = 0; ii < n; ii++) {
-            output_real[ii] = 0.0;
-            output_imag[ii] = 0.0;
-            sync[ii] = 0.0;
+            short frame_due = --memory->stft_countdown <= 0;
+            memory->stft_input[cursor] = input_real[ii];
+
+            // take the controls before the outputs can overwrite them
+            if (frame_due) {
+                for (int jj = 0; jj < num_heads * HEAD_INLETS; jj++) {
+                    head_controls[jj] = controls[jj][ii];
+                }
+            }
+
+            for (int head = 0; head < num_heads; head++) {
+                double* output = memory->stft_output
+                    + head * memory->stft_size;
+
+                outputs[head * NUM_OUTLETS + O_REAL][ii] = output[cursor];
+                outputs[head * NUM_OUTLETS + O_IMAG][ii] = 0.0;
+                outputs[head * NUM_OUTLETS + O_PHASE][ii] =
+                    memory->stft_syncs[head];
+                output[cursor] = 0.0;
+            }
+
+            memory->stft_cursor = cursor = (cursor + 1) & mask;
+
+            if (frame_due) {
+                memory->stft_countdown = memory->stft_hop;
+                scrubber_stft_frame(x);
+            }
         }
-    }
 
-    /* Update state variables */
-    x->recording_frame = recording_frame;
-    x->playback_frame = playback_frame;
-    x->last_position = last_position;
+        // mode: spectral - one frame per signal vector
+    } else if (n * 2 == memory->fftsize) {
+        // take the controls before the outputs can overwrite them
+        for (int jj = 0; jj < num_heads * HEAD_INLETS; jj++) {
+            head_controls[jj] = *controls[jj];
+        }
+
+        // mode: analysis
+        if (x->acquire_sample) {
+            sync_val = scrubber_analyze(x, input_real, input_imag, n);
+            scrubber_silence(x, outputs, sync_val, n);
+
+            // mode: synthesis
+        } else if (memory->buffer_status == SCRUBBER_FULL) {
+            for (int head = 0; head < num_heads; head++) {
+                t_double* sync = outputs[head * NUM_OUTLETS + O_PHASE];
+
+                sync_val = scrubber_synthesize(
+                    x, head, head_controls[head * HEAD_INLETS],
+                    head_controls[head * HEAD_INLETS + 1],
+                    outputs[head * NUM_OUTLETS + O_REAL],
+                    outputs[head * NUM_OUTLETS + O_IMAG], n);
+
+                for (int ii = 0; ii < n; ii++) {
+                    sync[ii] = sync_val;
+                }
+            }
+
+            // mode: stand by - waiting to start sampling
+        } else {
+            scrubber_silence(x, outputs, 0.0, n);
+        }
+
+        // mode: waiting for the DSP chain to catch up with the FFT size
+    } else {
+        scrubber_silence(x, outputs, 0.0, n);
+    }
 }
@@ -1,21 +1,60 @@
 #include "m_pd.h"
+#include "polar_kernels.h"
 
 #include <math.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 /* The global variables
  * *******************************************************/
 #define MINIMUM_DURATION 000.0
 #define DEFAULT_DURATION 5000.0
 #define MAXIMUM_DURATION 10000.0
 
+#define MINIMUM_HEADS 1
+#define DEFAULT_HEADS 1
+#define MAXIMUM_HEADS 16
+
 #define SCRUBBER_EMPTY 0
 #define SCRUBBER_FULL 1
 
+#define FRAME_ALIGNMENT 64
+
+#define MINIMUM_STFT_SIZE 16
+#define MAXIMUM_STFT_SIZE 65536
+
+#define SCRUBBER_FILE_MAGIC "SCRUBBER"
+#define SCRUBBER_FILE_VERSION 1
+
 #define PI 3.1415926535898
 #define TWOPI 6.2831853071796
 
+/* The analysis file header
+ * **************************************************/
+/* An analysis file is this header followed by the frames exactly as they
+ * are laid out in memory, so it can be mapped and played in place */
+typedef struct _scrubber_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t framesize;
+    uint64_t framecount;
+    uint32_t fftsize;
+    float fs;
+    float overlap;
+    char reserved[28];
+} t_scrubber_header;
+
 /* The object structure
  * *******************************************************/
 typedef struct _scrubber {
@@ -24,43 +63,65 @@ typedef struct _scrubber {
 
     float fs;
 
-    float** amplitudes;
-    float** phasediffs;
+    float* frames;
+    float* frames_block;
+    void* frames_memory;
+    long frames_capacity;
+    void* mapping;
+    size_t mapping_size;
     float* last_phase_in;
     float* last_phase_out;
+    float* magnitudes;
 
     float duration_ms;
     float overlap;
     long fftsize;
     long framecount;
-    long old_framecount;
 
     long recording_frame;
-    float playback_frame;
-    float last_position;
+
+    /* Per-head state, one element per read head */
+    int num_heads;
+    float* playback_frames;
+    float* last_positions;
+    float* head_controls;
 
     short acquire_sample;
     short buffer_status;
+    short approximate;
+    short interpolate;
+    short phase_lock;
+
+    long stft_size;
+    long stft_hop;
+    long stft_cursor;
+    long stft_countdown;
+    float stft_gain;
+    float* stft_syncs;
+    float* stft_memory;
+    float* stft_window;
+    float* stft_input;
+    float* stft_output;
+    float* stft_real;
+    float* stft_imag;
+    float* stft_packed;
+    float* stft_cos;
+    float* stft_sin;
+    long* stft_bitrev;
+
+    t_canvas* canvas;
+    t_float** signals;
 } t_scrubber;
 
 /* The arguments/inlets/outlets/vectors indexes
  * *******************************/
-enum ARGUMENTS { A_DURATION };
+/* Every read head has its own speed and position inlets and its own set of
+ * outlets, so these repeat for each head after the first */
+enum ARGUMENTS { A_DURATION, A_HEADS };
 enum INLETS { I_REAL, I_IMAG, I_SPEED, I_POSITION, NUM_INLETS };
-enum OUTLETS { O_REAL, O_IMAG, NUM_OUTLETS };
-enum DSP {
-    PERFORM,
-    OBJECT,
-    INPUT_REAL,
-    INPUT_IMAG,
-    SPEED,
-    POSITION,
-    OUTPUT_REAL,
-    OUTPUT_IMAG,
-    SYNC,
-    VECTOR_SIZE,
-    NEXT
-};
+enum OUTLETS { O_REAL, O_IMAG, O_PHASE, NUM_OUTLETS };
+#define HEAD_INLETS (NUM_INLETS - I_SPEED)
+enum DSP { PERFORM, OBJECT, VECTOR_SIZE, NEXT };
 
 /* The class pointer
  * **********************************************************/
@@ -79,6 +140,19 @@ void scrubber_init_memory(t_scrubber* x);
 void scrubber_sample(t_scrubber* x);
 void scrubber_overlap(t_scrubber* x, t_symbol* msg, short argc, t_atom* argv);
 void scrubber_resize(t_scrubber* x, t_symbol* msg, short argc, t_atom* argv);
+void scrubber_approximate(t_scrubber* x, t_symbol* msg, short argc,
+                          t_atom* argv);
+void scrubber_interpolate(t_scrubber* x, t_symbol* msg, short argc,
+                          t_atom* argv);
+void scrubber_phase_lock(t_scrubber* x, t_symbol* msg, short argc,
+                         t_atom* argv);
+void scrubber_stft(t_scrubber* x, t_symbol* msg, short argc, t_atom* argv);
+void scrubber_init_stft(t_scrubber* x);
+void scrubber_write(t_scrubber* x, t_symbol* filename);
+void scrubber_read(t_scrubber* x, t_symbol* filename);
+short scrubber_write_file(t_scrubber* x, const char* path);
+short scrubber_map_file(t_scrubber* x, const char* path);
+void scrubber_unmap_file(t_scrubber* x);
 
 /******************************************************************************/
 
@@ -112,6 +186,18 @@ void scrubber_tilde_setup(void)
                     gensym("overlap"), A_GIMME, 0);
     class_addmethod(scrubber_class, (t_method)scrubber_resize,
                     gensym("resize"), A_GIMME, 0);
+    class_addmethod(scrubber_class, (t_method)scrubber_approximate,
+                    gensym("approximate"), A_GIMME, 0);
+    class_addmethod(scrubber_class, (t_method)scrubber_interpolate,
+                    gensym("interpolate"), A_GIMME, 0);
+    class_addmethod(scrubber_class, (t_method)scrubber_phase_lock,
+                    gensym("phase_lock"), A_GIMME, 0);
+    class_addmethod(scrubber_class, (t_method)scrubber_stft, gensym("stft"),
+                    A_GIMME, 0);
+    class_addmethod(scrubber_class, (t_method)scrubber_write,
+                    gensym("write"), A_SYMBOL, 0);
+    class_addmethod(scrubber_class, (t_method)scrubber_read, gensym("read"),
+                    A_SYMBOL, 0);
 
     /* Print message to Max window */
     post("scrubber~ • External was loaded");
@@ -131,24 +217,17 @@ void* scrubber_new(t_symbol* s, short argc, t_atom* argv)
  * ******************************************/
 void* scrubber_common_new(t_scrubber* x, short argc, t_atom* argv)
 {
-    /* Create inlets */
-    inlet_new(&x->obj, &x->obj.ob_pd, gensym("signal"), gensym("signal"));
-    inlet_new(&x->obj, &x->obj.ob_pd, gensym("signal"), gensym("signal"));
-    inlet_new(&x->obj, &x->obj.ob_pd, gensym("signal"), gensym("signal"));
-
-    /* Create signal outlets */
-    outlet_new(&x->obj, gensym("signal"));
-    outlet_new(&x->obj, gensym("signal"));
-    outlet_new(&x->obj, gensym("signal"));
-
-
     /* Initialize input arguments */
     float duration_ms = DEFAULT_DURATION;
+    int num_heads = DEFAULT_HEADS;
 
     /* Parse passed arguments */
     if (argc > A_DURATION) {
         duration_ms = atom_getfloatarg(A_DURATION, argc, argv);
     }
+    if (argc > A_HEADS) {
+        num_heads = atom_getfloatarg(A_HEADS, argc, argv);
+    }
 
     /* Check validity of passed arguments */
     if (duration_ms < MINIMUM_DURATION) {
@@ -161,29 +240,75 @@ void* scrubber_common_new(t_scrubber* x, short argc, t_atom* argv)
              duration_ms);
     }
 
+    if (num_heads < MINIMUM_HEADS) {
+        num_heads = MINIMUM_HEADS;
+        post("scrubber~ • Invalid argument: Minimum read heads set to %d",
+             num_heads);
+    } else if (num_heads > MAXIMUM_HEADS) {
+        num_heads = MAXIMUM_HEADS;
+        post("scrubber~ • Invalid argument: Maximum read heads set to %d",
+             num_heads);
+    }
+
+    /* Create inlets */
+    for (int ii = I_IMAG; ii < I_SPEED + num_heads * HEAD_INLETS; ii++) {
+        inlet_new(&x->obj, &x->obj.ob_pd, gensym("signal"), gensym("signal"));
+    }
+
+    /* Create signal outlets */
+    for (int ii = 0; ii < num_heads * NUM_OUTLETS; ii++) {
+        outlet_new(&x->obj, gensym("signal"));
+    }
+
     /* Initialize some state variables */
     x->fs = sys_getsr();
 
-    x->amplitudes = NULL;
-    x->phasediffs = NULL;
+    x->frames = NULL;
+    x->frames_block = NULL;
+    x->frames_memory = NULL;
+    x->frames_capacity = 0;
+    x->mapping = NULL;
+    x->mapping_size = 0;
     x->last_phase_in = NULL;
     x->last_phase_out = NULL;
+    x->magnitudes = NULL;
 
     x->duration_ms = duration_ms;
     x->overlap = 8;
     x->fftsize = 1024;
     x->framecount = 1;
-    x->old_framecount = 0;
 
     x->recording_frame = 0;
-    x->playback_frame = 0;
-    x->last_position = 0;
+
+    x->num_heads = num_heads;
+    x->playback_frames = (float*)calloc(num_heads, sizeof(float));
+    x->last_positions = (float*)calloc(num_heads, sizeof(float));
+    x->head_controls = (float*)calloc(num_heads * HEAD_INLETS, sizeof(float));
+    x->signals = (t_float**)calloc(I_SPEED + num_heads
+                                   * (HEAD_INLETS + NUM_OUTLETS),
+                                   sizeof(t_float*));
 
     x->acquire_sample = 0;
     x->buffer_status = SCRUBBER_EMPTY;
+    x->approximate = 0;
+    x->interpolate = 0;
+    x->phase_lock = 0;
+
+    x->stft_size = 0;
+    x->stft_memory = NULL;
+    x->stft_bitrev = NULL;
+
+    x->canvas = canvas_getcurrent();
 
     scrubber_init_memory(x);
 
+    if (x->playback_frames == NULL || x->last_positions == NULL
+        || x->head_controls == NULL || x->signals == NULL) {
+        pd_error(x, "scrubber~ • Cannot allocate memory for %d read heads",
+                 num_heads);
+        return NULL;
+    }
+
     /* Print message to Max window */
     post("scrubber~ • Object was created");
 
@@ -196,16 +321,17 @@ void* scrubber_common_new(t_scrubber* x, short argc, t_atom* argv)
 void scrubber_free(t_scrubber* x)
 {
     /* Free allocated dynamic memory */
-    if (x->amplitudes != NULL) {
-        for (int ii = 0; ii < x->framecount; ii++) {
-            free(x->amplitudes[ii]);
-            free(x->phasediffs[ii]);
-        }
-        free(x->amplitudes);
-        free(x->phasediffs);
-        free(x->last_phase_in);
-        free(x->last_phase_out);
-    }
+    scrubber_unmap_file(x);
+    free(x->frames_memory);
+    free(x->last_phase_in);
+    free(x->last_phase_out);
+    free(x->magnitudes);
+    free(x->playback_frames);
+    free(x->last_positions);
+    free(x->head_controls);
+    free(x->signals);
+    free(x->stft_memory);
+    free(x->stft_bitrev);
 
     /* Print message to Max window */
     post("scrubber~ • Memory was freed");
@@ -229,53 +355,95 @@ void scrubber_init_memory(t_scrubber* x)
         return;
     }
 
+    scrubber_unmap_file(x);
     x->buffer_status = SCRUBBER_EMPTY;
 
     long bytesize;
 
-    if (x->amplitudes == NULL) {
-        bytesize = framecount * sizeof(float*);
-        x->amplitudes = (float**)malloc(bytesize);
-        x->phasediffs = (float**)malloc(bytesize);
-
-        bytesize = framesize * sizeof(float);
-        x->last_phase_in = (float*)malloc(bytesize);
-        x->last_phase_out = (float*)malloc(bytesize);
+    /* All frames live in one block of interleaved magnitude and phase
+     * difference pairs. It has room for the maximum duration, so a resize
+     * only reallocates when the overlap, FFT size or sampling rate grow */
+    long capacity = framecount * framesize * 2;
 
-    } else {
-        for (int ii = 0; ii < x->old_framecount; ii++) {
-            free(x->amplitudes[ii]);
-            free(x->phasediffs[ii]);
+    if (capacity > x->frames_capacity) {
+        long max_framecount = (MAXIMUM_DURATION * 0.001 * x->fs)
+            * (x->overlap / x->fftsize);
+        if (capacity < max_framecount * framesize * 2) {
+            capacity = max_framecount * framesize * 2;
         }
 
-        bytesize = framecount * sizeof(float*);
-        x->amplitudes = (float**)realloc(x->amplitudes, bytesize);
-        x->phasediffs = (float**)realloc(x->phasediffs, bytesize);
+        free(x->frames_memory);
+        x->frames_memory = malloc(capacity * sizeof(float) + FRAME_ALIGNMENT
+                                  - 1);
+
+        if (x->frames_memory == NULL) {
+            x->frames = NULL;
+            x->frames_block = NULL;
+            x->frames_capacity = 0;
+            x->acquire_sample = 0;
+            post("scrubber~ • cannot allocate %ld frames", framecount);
+            return;
+        }
 
-        bytesize = framesize * sizeof(float);
-        x->last_phase_in = (float*)realloc(x->last_phase_in, bytesize);
-        x->last_phase_out = (float*)realloc(x->last_phase_out, bytesize);
+        x->frames_block = (float*)(((uintptr_t)x->frames_memory
+                                    + FRAME_ALIGNMENT - 1)
+                                   & ~(uintptr_t)(FRAME_ALIGNMENT - 1));
+        x->frames_capacity = capacity;
     }
 
     bytesize = framesize * sizeof(float);
-    for (int ii = 0; ii < framecount; ii++) {
-        x->amplitudes[ii] = (float*)malloc(bytesize);
-        x->phasediffs[ii] = (float*)malloc(bytesize);
+    float* last_phase_in = (float*)realloc(x->last_phase_in, bytesize);
+    if (last_phase_in != NULL) {
+        x->last_phase_in = last_phase_in;
+    }
+    float* last_phase_out = (float*)realloc(x->last_phase_out,
+                                            bytesize * x->num_heads);
+    if (last_phase_out != NULL) {
+        x->last_phase_out = last_phase_out;
+    }
+    float* magnitudes = (float*)realloc(x->magnitudes, bytesize);
+    if (magnitudes != NULL) {
+        x->magnitudes = magnitudes;
+    }
 
-        memset(x->amplitudes[ii], 0, bytesize);
-        memset(x->phasediffs[ii], 0, bytesize);
+    /* The per-bin state no longer fits the frames, so leave nothing to
+     * sample into or play */
+    if (last_phase_in == NULL || last_phase_out == NULL
+        || magnitudes == NULL) {
+        free(x->last_phase_in);
+        free(x->last_phase_out);
+        free(x->magnitudes);
+        x->last_phase_in = NULL;
+        x->last_phase_out = NULL;
+        x->magnitudes = NULL;
+        x->frames = NULL;
+        x->acquire_sample = 0;
+        post("scrubber~ • cannot allocate %ld frames", framecount);
+        return;
     }
 
-    memset(x->last_phase_in, 0, bytesize);
-    memset(x->last_phase_out, 0, bytesize);
+    x->frames = x->frames_block;
 
-    x->old_framecount = framecount;
+    memset(x->last_phase_in, 0, bytesize);
+    memset(x->last_phase_out, 0, bytesize * x->num_heads);
 }
 
 void scrubber_sample(t_scrubber* x)
 {
+    /* A mapped file is read-only, so go back to the frame store */
+    if (x->mapping != NULL) {
+        x->framecount = (x->duration_ms * 0.001 * x->fs)
+            * (x->overlap / x->fftsize);
+        scrubber_init_memory(x);
+    }
+
+    if (x->frames == NULL) {
+        post("scrubber~ • no memory to sample into");
+        return;
+    }
+
     x->recording_frame = 0;
-    x->playback_frame = 0;
+    memset(x->playback_frames, 0, x->num_heads * sizeof(float));
 
     x->acquire_sample = 1;
     x->buffer_status = SCRUBBER_EMPTY;
@@ -293,6 +461,10 @@ void scrubber_overlap(t_scrubber* x, t_symbol* msg, short argc, t_atom* argv)
         if (x->overlap != new_overlap) {
             x->overlap = new_overlap;
             scrubber_init_memory(x);
+
+            if (x->stft_size > 0) {
+                scrubber_init_stft(x);
+            }
         }
     }
 }
@@ -308,7 +480,6 @@ void scrubber_resize(t_scrubber* x, t_symbol* msg, short argc, t_atom* argv)
 
         if (x->duration_ms != new_duration) {
             x->duration_ms = new_duration;
-            x->old_framecount = x->framecount;
             x->framecount = (x->duration_ms * 0.001 * x->fs)
                 * (x->overlap / (x->fftsize * 2));
 
@@ -317,6 +488,332 @@ void scrubber_resize(t_scrubber* x, t_symbol* msg, short argc, t_atom* argv)
     }
 }
 
+void scrubber_approximate(t_scrubber* x, t_symbol* msg, short argc,
+                          t_atom* argv)
+{
+    if (argc >= 1) {
+        x->approximate = (short)atom_getfloatarg(0, argc, argv);
+    }
+}
+
+void scrubber_interpolate(t_scrubber* x, t_symbol* msg, short argc,
+                          t_atom* argv)
+{
+    if (argc >= 1) {
+        x->interpolate = (short)atom_getfloatarg(0, argc, argv);
+    }
+}
+
+void scrubber_phase_lock(t_scrubber* x, t_symbol* msg, short argc,
+                         t_atom* argv)
+{
+    if (argc >= 1) {
+        x->phase_lock = (short)atom_getfloatarg(0, argc, argv);
+    }
+}
+
+void scrubber_stft(t_scrubber* x, t_symbol* msg, short argc, t_atom* argv)
+{
+    if (argc >= 1) {
+        long new_size = (long)atom_getfloatarg(0, argc, argv);
+        if (new_size != 0
+            && (new_size < MINIMUM_STFT_SIZE || new_size > MAXIMUM_STFT_SIZE
+                || (new_size & (new_size - 1)) != 0)) {
+            post("scrubber~ • bad STFT size: %ld", new_size);
+            return;
+        }
+
+        if (argc >= 2) {
+            float new_overlap = atom_getfloatarg(1, argc, argv);
+            if (new_overlap <= 0) {
+                post("scrubber~ • bad overlap: %f", new_overlap);
+                return;
+            }
+            x->overlap = new_overlap;
+        }
+
+        x->stft_size = new_size;
+        scrubber_init_stft(x);
+
+        // the DSP method picks up the new FFT size
+        canvas_update_dsp();
+    }
+}
+
+/* Sets up the built-in STFT for 'stft_size' points. One block holds the
+ * window, the input ring, the spectrum, the twiddles and an output ring and
+ * sync value for every read head */
+void scrubber_init_stft(t_scrubber* x)
+{
+    long size = x->stft_size;
+    long half = size / 2;
+
+    free(x->stft_memory);
+    x->stft_memory = NULL;
+
+    if (size == 0) {
+        return;
+    }
+
+    x->stft_memory = (float*)calloc(
+        (5 + x->num_heads) * size + 2 * (half + 1) + x->num_heads,
+        sizeof(float));
+    x->stft_bitrev = (long*)realloc(x->stft_bitrev, half * sizeof(long));
+
+    if (x->stft_memory == NULL || x->stft_bitrev == NULL) {
+        free(x->stft_memory);
+        x->stft_memory = NULL;
+        x->stft_size = 0;
+        post("scrubber~ • cannot allocate a %ld point STFT", size);
+        return;
+    }
+
+    x->stft_window = x->stft_memory;
+    x->stft_input = x->stft_window + size;
+    x->stft_real = x->stft_input + size;
+    x->stft_imag = x->stft_real + size;
+    x->stft_packed = x->stft_imag + size;
+    x->stft_cos = x->stft_packed + size;
+    x->stft_sin = x->stft_cos + half + 1;
+    x->stft_output = x->stft_sin + half + 1;
+    x->stft_syncs = x->stft_output + x->num_heads * size;
+
+    // periodic Hann window, used for both analysis and resynthesis
+    double energy = 0.0;
+    for (long ii = 0; ii < size; ii++) {
+        x->stft_window[ii] = 0.5 - 0.5 * cos(TWOPI * ii / size);
+        energy += x->stft_window[ii] * x->stft_window[ii];
+    }
+
+    for (long ii = 0; ii <= half; ii++) {
+        x->stft_cos[ii] = cos(TWOPI * ii / size);
+        x->stft_sin[ii] = sin(TWOPI * ii / size);
+    }
+
+    // bit reversed order for the complex FFT of half the size
+    for (long ii = 0; ii < half; ii++) {
+        long reversed = 0;
+        for (long bit = 1; bit < half; bit <<= 1) {
+            reversed = (reversed << 1) | ((ii & bit) != 0);
+        }
+        x->stft_bitrev[ii] = reversed;
+    }
+
+    x->stft_hop = size / x->overlap;
+    if (x->stft_hop < 1) {
+        x->stft_hop = 1;
+    }
+
+    // the squared windows overlap-add to this gain on average
+    x->stft_gain = x->stft_hop / energy;
+
+    x->stft_cursor = 0;
+    x->stft_countdown = x->stft_hop;
+}
+
+void scrubber_write(t_scrubber* x, t_symbol* filename)
+{
+    char path[MAXPDSTRING];
+
+    canvas_makefilename(x->canvas, filename->s_name, path, MAXPDSTRING);
+    if (scrubber_write_file(x, path) == 0) {
+        post("scrubber~ • Wrote %ld frames to %s", x->framecount,
+             filename->s_name);
+    }
+}
+
+void scrubber_read(t_scrubber* x, t_symbol* filename)
+{
+    char dir[MAXPDSTRING];
+    char* name;
+    char path[MAXPDSTRING];
+
+    int fd = canvas_open(x->canvas, filename->s_name, "", dir, &name,
+                         MAXPDSTRING, 1);
+    if (fd < 0) {
+        pd_error(x, "scrubber~ • Cannot find %s", filename->s_name);
+        return;
+    }
+    sys_close(fd);
+
+    if (snprintf(path, MAXPDSTRING, "%s/%s", dir, name) >= MAXPDSTRING) {
+        pd_error(x, "scrubber~ • Path to %s is too long", filename->s_name);
+        return;
+    }
+    if (scrubber_map_file(x, path) == 0) {
+        post("scrubber~ • Mapped %ld frames from %s", x->framecount,
+             filename->s_name);
+    }
+}
+
+short scrubber_write_file(t_scrubber* x, const char* path)
+{
+    if (x->mapping != NULL) {
+        pd_error(x, "scrubber~ • Already playing from a file");
+        return 1;
+    }
+    if (x->buffer_status != SCRUBBER_FULL) {
+        pd_error(x, "scrubber~ • Nothing sampled to write");
+        return 1;
+    }
+
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) {
+        pd_error(x, "scrubber~ • Cannot write %s", path);
+        return 1;
+    }
+
+    t_scrubber_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SCRUBBER_FILE_MAGIC, sizeof(header.magic));
+    header.version = SCRUBBER_FILE_VERSION;
+    header.framesize = x->fftsize / 2 + 1;
+    header.framecount = x->framecount;
+    header.fftsize = x->fftsize;
+    header.fs = x->fs;
+    header.overlap = x->overlap;
+
+    size_t count = (size_t)x->framecount * header.framesize * 2;
+    short failed = fwrite(&header, sizeof(header), 1, file) != 1
+        || fwrite(x->frames, sizeof(float), count, file) != count;
+    failed |= fclose(file) != 0;
+
+    if (failed) {
+        pd_error(x, "scrubber~ • Failed writing %s", path);
+    }
+    return failed;
+}
+
+/* Plays an analysis file in place of the frame store. The file is mapped
+ * read-only and shared, so the system pages it in on demand and instances
+ * reading the same file share its memory */
+short scrubber_map_file(t_scrubber* x, const char* path)
+{
+    void* mapping;
+    size_t size;
+
+    /* The file is played through the per-bin state of the frame store */
+    if (x->magnitudes == NULL) {
+        pd_error(x, "scrubber~ • No memory to play %s", path);
+        return 1;
+    }
+
+#ifdef WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    LARGE_INTEGER file_size;
+    if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &file_size)) {
+        pd_error(x, "scrubber~ • Cannot open %s", path);
+        if (file != INVALID_HANDLE_VALUE) {
+            CloseHandle(file);
+        }
+        return 1;
+    }
+
+    size = (size_t)file_size.QuadPart;
+    HANDLE map = size ? CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0,
+                                           NULL)
+                      : NULL;
+    CloseHandle(file);
+
+    mapping = map ? MapViewOfFile(map, FILE_MAP_READ, 0, 0, 0) : NULL;
+    if (map) {
+        CloseHandle(map);
+    }
+    if (mapping == NULL) {
+        pd_error(x, "scrubber~ • Cannot map %s", path);
+        return 1;
+    }
+#else
+    struct stat info;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &info) != 0) {
+        pd_error(x, "scrubber~ • Cannot open %s", path);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return 1;
+    }
+
+    size = info.st_size;
+    mapping = size ? mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0)
+                   : MAP_FAILED;
+    close(fd);
+
+    if (mapping == MAP_FAILED) {
+        pd_error(x, "scrubber~ • Cannot map %s", path);
+        return 1;
+    }
+#endif
+
+    /* Check that the file holds whole frames of our size */
+    t_scrubber_header* header = (t_scrubber_header*)mapping;
+    long framesize = x->fftsize / 2 + 1;
+    const char* problem = NULL;
+
+    if (size < sizeof(t_scrubber_header)
+        || memcmp(header->magic, SCRUBBER_FILE_MAGIC, sizeof(header->magic))) {
+        problem = "not an analysis file";
+    } else if (header->version != SCRUBBER_FILE_VERSION) {
+        problem = "unsupported version";
+    } else if (header->framesize != framesize) {
+        problem = "different FFT size";
+    } else if (header->framecount == 0
+               || (size - sizeof(t_scrubber_header)) / sizeof(float) / 2
+                       / framesize
+                   < header->framecount) {
+        problem = "truncated";
+    }
+
+    if (problem != NULL) {
+        pd_error(x, "scrubber~ • %s: %s", path, problem);
+#ifdef WIN32
+        UnmapViewOfFile(mapping);
+#else
+        munmap(mapping, size);
+#endif
+        return 1;
+    }
+
+    if (header->fs != x->fs) {
+        post("scrubber~ • %s was analyzed at %.0f[Hz]", path, header->fs);
+    }
+
+    /* Swap the file in for the frame store */
+    scrubber_unmap_file(x);
+    x->mapping = mapping;
+    x->mapping_size = size;
+
+    x->frames = (float*)(header + 1);
+    x->framecount = header->framecount;
+
+    x->recording_frame = 0;
+    memset(x->playback_frames, 0, x->num_heads * sizeof(float));
+    x->acquire_sample = 0;
+    x->buffer_status = SCRUBBER_FULL;
+
+    memset(x->last_phase_out, 0, framesize * x->num_heads * sizeof(float));
+
+    return 0;
+}
+
+void scrubber_unmap_file(t_scrubber* x)
+{
+    if (x->mapping == NULL) {
+        return;
+    }
+
+#ifdef WIN32
+    UnmapViewOfFile(x->mapping);
+#else
+    munmap(x->mapping, x->mapping_size);
+#endif
+
+    x->mapping = NULL;
+    x->mapping_size = 0;
+    x->frames = x->frames_block;
+}
+
 /* The 'DSP' method
  * ***********************************************************/
 
@@ -327,13 +824,13 @@ void scrubber_dsp(t_scrubber* x, t_signal** sp, short* count)
     long new_fftsize;
 
     new_fs = sys_getsr();
-    new_fftsize = sp[0]->s_n;
+    new_fftsize = x->stft_size > 0 ? x->stft_size : sp[0]->s_n;
 
     long new_framecount = (x->duration_ms * 0.001 * new_fs)
         * (x->overlap / new_fftsize);
 
     if (x->fs != new_fs || x->fftsize != new_fftsize
-        || x->framecount != new_framecount) {
+        || (x->mapping == NULL && x->framecount != new_framecount)) {
 
         x->fs = new_fs;
         x->fftsize = new_fftsize;
@@ -342,49 +839,83 @@ void scrubber_dsp(t_scrubber* x, t_signal** sp, short* count)
         scrubber_init_memory(x);
     }
 
+    /* Keep the signal vectors, as the number of them depends on the heads */
+    int num_signals = I_SPEED + x->num_heads * (HEAD_INLETS + NUM_OUTLETS);
+    for (int ii = 0; ii < num_signals; ii++) {
+        x->signals[ii] = sp[ii]->s_vec;
+    }
+
     /* Attach the object to the DSP chain */
-    dsp_add(scrubber_perform, NEXT - 1, x, sp[0]->s_vec, sp[1]->s_vec,
-            sp[2]->s_vec, sp[3]->s_vec, sp[4]->s_vec, sp[5]->s_vec,
-            sp[6]->s_vec, sp[0]->s_n);
+    dsp_add(scrubber_perform, NEXT - 1, x, sp[0]->s_n);
 
     /* Print message to Max window */
     post("scrubber~ • Executing 32-bit perform routine");
 }
 
-/* The 'perform' routine
- * ******************************************************/
-t_int* scrubber_perform(t_int* w)
+/* The fast polar kernels
+ * ****************************************************/
+/* One bin of the analysis with the shared kernels: cartopol~, framedelta~ and
+ * a phasewrap~ that relies on both phases lying within [-pi, pi] */
+static inline void scrubber_analyze_bin(float real, float imag,
+                                        float* last_phase, float* frame)
 {
-    /* Copy the object pointer */
-    t_scrubber* x = (t_scrubber*)w[OBJECT];
+    float phase = -polar_atan2(imag, real);
+    float phasediff = phase - *last_phase;
+    *last_phase = phase;
 
-    /* Copy signal pointers */
-    t_float* input_real = (t_float*)w[INPUT_REAL];
-    t_float* input_imag = (t_float*)w[INPUT_IMAG];
-    t_float* speed = (t_float*)w[SPEED];
-    t_float* position = (t_float*)w[POSITION];
-    t_float* output_real = (t_float*)w[OUTPUT_REAL];
-    t_float* output_imag = (t_float*)w[OUTPUT_IMAG];
-    t_float* sync = (t_float*)w[SYNC];
+    phasediff += phasediff > (float)PI ? (float)-TWOPI : 0.0f;
+    phasediff += phasediff < (float)-PI ? (float)TWOPI : 0.0f;
 
-    /* Copy the signal vector size */
-    t_int n = w[VECTOR_SIZE];
+    frame[0] = sqrtf(real * real + imag * imag);
+    frame[1] = phasediff;
+}
 
-    /* Load state variables */
-    float** amplitudes = x->amplitudes;
-    float** phasediffs = x->phasediffs;
+/* Identity phase locking: every bin from one magnitude trough to the next
+ * takes its phase from the peak in between. Within the main lobe of a Hann
+ * window the bins of a sinusoid alternate by pi, so odd distances from the
+ * peak keep that offset */
+static void scrubber_lock_phases(float* magnitudes, float* phases,
+                                 int framesize)
+{
+    int ii = 0;
+
+    while (ii < framesize) {
+        int start = ii;
+
+        while (ii + 1 < framesize && magnitudes[ii + 1] >= magnitudes[ii]) {
+            ii++;
+        }
+        int peak = ii;
+
+        while (ii + 1 < framesize && magnitudes[ii + 1] < magnitudes[ii]) {
+            ii++;
+        }
+
+        float peak_phase = phases[peak];
+        float odd_phase = peak_phase > 0.0 ? peak_phase - PI : peak_phase + PI;
+        for (int jj = start; jj <= ii; jj++) {
+            phases[jj] = (jj - peak) & 1 ? odd_phase : peak_phase;
+        }
+
+        ii++;
+    }
+}
 
+/* The spectral processing
+ * ***************************************************/
+/* Records one frame of 'n' points, of which bins 0 to n/2 are used, and
+ * returns the sync value for it */
+static float scrubber_analyze(t_scrubber* x, t_float* input_real,
+                              t_float* input_imag, int n)
+{
+    /* Load state variables */
+    float* frame;
     float* last_phase_in = x->last_phase_in;
-    float* last_phase_out = x->last_phase_out;
 
     long framecount = x->framecount;
-
     long recording_frame = x->recording_frame;
-    float playback_frame = x->playback_frame;
-    float last_position = x->last_position;
 
-    short acquire_samples = x->acquire_sample;
-    short buffer_status = x->buffer_status;
+    short approximate = x->approximate;
 
     /* Perform the DSP loop */
     float local_real;
@@ -397,14 +928,27 @@ t_int* scrubber_perform(t_int* w)
     int framesize;
     framesize = (int)(n / 2) + 1;
 
-    // mode: analysis
-    if (acquire_samples) {
-        sync_val = (float)recording_frame / (float)framecount;
+    sync_val = (float)recording_frame / (float)framecount;
+    frame = x->frames + recording_frame * framesize * 2;
+
+    if (approximate) {
+        // the edge bins carry no imaginary part and are done apart,
+        // which keeps the loop free of branches
+        for (int ii = 1; ii < framesize - 1; ii++) {
+            scrubber_analyze_bin(input_real[ii], input_imag[ii],
+                                 last_phase_in + ii, frame + 2 * ii);
+        }
+        scrubber_analyze_bin(input_real[0], 0.0, last_phase_in, frame);
+        scrubber_analyze_bin(input_real[framesize - 1], 0.0,
+                             last_phase_in + framesize - 1,
+                             frame + 2 * (framesize - 1));
 
+    } else {
         for (int ii = 0; ii < framesize; ii++) {
             local_real = input_real[ii];
-            local_imag = (ii == 0 || ii == framesize - 1) ? 0.0
-                                                          : input_imag[ii];
+            local_imag = (ii == 0 || ii == framesize - 1)
+                ? 0.0
+                : input_imag[ii];
 
             // functionality of cartopol~
             local_magnitude = hypotf(local_real, local_imag);
@@ -423,81 +967,427 @@ t_int* scrubber_perform(t_int* w)
             }
 
             // record magnitudes and phases
-            amplitudes[recording_frame][ii] = local_magnitude;
-            phasediffs[recording_frame][ii] = phasediff;
+            frame[2 * ii] = local_magnitude;
+            frame[2 * ii + 1] = phasediff;
         }
+    }
 
-        // playback silence
-        for (int ii = 0; ii < n; ii++) {
-            output_real[ii] = 0.0;
-            output_imag[ii] = 0.0;
-            sync[ii] = sync_val;
-        }
+    recording_frame++;
+    if (recording_frame >= framecount) {
+        x->acquire_sample = 0;
+        x->buffer_status = SCRUBBER_FULL;
+    }
 
-        recording_frame++;
-        if (recording_frame >= framecount) {
-            x->acquire_sample = 0;
-            x->buffer_status = SCRUBBER_FULL;
-        }
+    /* Update state variables */
+    x->recording_frame = recording_frame;
 
-        // mode: synthesis
-    } else if (buffer_status == SCRUBBER_FULL) {
-        sync_val = playback_frame / (float)framecount;
+    return sync_val;
+}
+
+/* Plays one frame of 'n' points from read head 'head' and returns the sync
+ * value for it */
+static float scrubber_synthesize(t_scrubber* x, int head, t_float speed,
+                                 t_float position, t_float* output_real,
+                                 t_float* output_imag, int n)
+{
+    /* Load state variables */
+    float* frames = x->frames;
+    float* frame;
+    float* next_frame;
 
-        if (*position != last_position && *position >= 0.0
-            && *position <= 1.0) {
+    float* last_phase_out;
+    float* magnitudes = x->magnitudes;
 
-            last_position = *position;
-            playback_frame = last_position * (float)(framecount - 1);
-        }
+    long framecount = x->framecount;
 
-        playback_frame += *speed;
-        while (playback_frame < 0.0) {
-            playback_frame += framecount;
-        }
-        while (playback_frame >= framecount) {
-            playback_frame -= framecount;
-        }
+    float playback_frame = x->playback_frames[head];
+    float last_position = x->last_positions[head];
+
+    short approximate = x->approximate;
+    short interpolate = x->interpolate;
+    short phase_lock = x->phase_lock;
+
+    /* Perform the DSP loop */
+    float local_real;
+    float local_imag;
+    float local_magnitude;
+    float local_phase;
+    float phasediff;
+    float sync_val;
+    float fraction;
+    float sine;
+    float cosine;
 
-        int int_playback_frame = floor(playback_frame);
+    int framesize;
+    framesize = (int)(n / 2) + 1;
+    last_phase_out = x->last_phase_out + head * framesize;
+
+    sync_val = playback_frame / (float)framecount;
+
+    if (position != last_position && position >= 0.0 && position <= 1.0) {
+
+        last_position = position;
+        playback_frame = last_position * (float)(framecount - 1);
+    }
+
+    playback_frame += speed;
+    while (playback_frame < 0.0) {
+        playback_frame += framecount;
+    }
+    while (playback_frame >= framecount) {
+        playback_frame -= framecount;
+    }
+
+    int int_playback_frame = floor(playback_frame);
+    frame = frames + int_playback_frame * framesize * 2;
+    next_frame = frames
+        + ((int_playback_frame + 1) % framecount) * framesize * 2;
+    fraction = interpolate ? playback_frame - int_playback_frame : 0.0;
+
+    for (int ii = 0; ii < framesize; ii++) {
+        // read in between the two frames, taking the phase differences
+        // the short way around the circle
+        local_magnitude = frame[2 * ii];
+        local_magnitude += fraction
+            * (next_frame[2 * ii] - local_magnitude);
+
+        local_phase = frame[2 * ii + 1];
+        phasediff = next_frame[2 * ii + 1] - local_phase;
+        phasediff += phasediff > PI ? -TWOPI : 0.0;
+        phasediff += phasediff < -PI ? TWOPI : 0.0;
+        local_phase += fraction * phasediff;
+
+        // functionality of frameaccum~, kept wrapped to [-pi, pi]
+        local_phase += last_phase_out[ii];
+        local_phase += local_phase > PI ? -TWOPI : 0.0;
+        local_phase += local_phase < -PI ? TWOPI : 0.0;
+
+        magnitudes[ii] = local_magnitude;
+        last_phase_out[ii] = local_phase;
+    }
+
+    if (phase_lock) {
+        scrubber_lock_phases(magnitudes, last_phase_out, framesize);
+    }
+
+    if (approximate) {
+        // the edge bins are cleared after the loop to keep it free of
+        // branches
         for (int ii = 0; ii < framesize; ii++) {
-            local_magnitude = amplitudes[int_playback_frame][ii];
-            local_phase = phasediffs[int_playback_frame][ii];
+            polar_sincos(last_phase_out[ii], &sine, &cosine);
 
-            // functionality of frameaccum~
-            last_phase_out[ii] += local_phase;
-            local_phase = last_phase_out[ii];
+            output_real[ii] = magnitudes[ii] * cosine;
+            output_imag[ii] = -magnitudes[ii] * sine;
+        }
 
+        output_imag[0] = 0.0;
+        output_imag[framesize - 1] = 0.0;
+
+    } else {
+        for (int ii = 0; ii < framesize; ii++) {
             // functionality of poltocar~
-            local_real = local_magnitude * cos(local_phase);
-            local_imag = -local_magnitude * sin(local_phase);
+            local_real = magnitudes[ii] * cos(last_phase_out[ii]);
+            local_imag = -magnitudes[ii] * sin(last_phase_out[ii]);
 
             // playback real and imaginary part
             output_real[ii] = local_real;
-            output_imag[ii] = (ii == 0 || ii == framesize - 1) ? 0.0
-                                                               : local_imag;
-            sync[ii] = sync_val;
+            output_imag[ii] = (ii == 0 || ii == framesize - 1)
+                ? 0.0
+                : local_imag;
         }
+    }
+
+    for (int ii = framesize; ii < n; ii++) {
+        output_real[ii] = 0.0;
+        output_imag[ii] = 0.0;
+    }
+
+    /* Update state variables */
+    x->playback_frames[head] = playback_frame;
+    x->last_positions[head] = last_position;
+
+    return sync_val;
+}
+
+/* Silences the outputs of every read head */
+static void scrubber_silence(t_scrubber* x, t_float** outputs, float sync_val,
+                             int n)
+{
+    for (int head = 0; head < x->num_heads; head++) {
+        t_float* output_real = outputs[head * NUM_OUTLETS + O_REAL];
+        t_float* output_imag = outputs[head * NUM_OUTLETS + O_IMAG];
+        t_float* sync = outputs[head * NUM_OUTLETS + O_PHASE];
 
-        for (int ii = framesize; ii < n; ii++) {
+        for (int ii = 0; ii < n; ii++) {
             output_real[ii] = 0.0;
             output_imag[ii] = 0.0;
             sync[ii] = sync_val;
         }
+    }
+}
+
+/* The built-in STFT
+ * **********************************************************/
+/* Radix-2 FFT of half the STFT size, in place over separate real and
+ * imaginary arrays. It shares the twiddles of the full size real FFT */
+static void scrubber_fft_complex(t_scrubber* x, float* real, float* imag)
+{
+    long size = x->stft_size / 2;
+    long* bitrev = x->stft_bitrev;
+    float* cosines = x->stft_cos;
+    float* sines = x->stft_sin;
+    float swap;
+
+    for (long ii = 0; ii < size; ii++) {
+        long jj = bitrev[ii];
+        if (jj > ii) {
+            swap = real[ii];
+            real[ii] = real[jj];
+            real[jj] = swap;
+            swap = imag[ii];
+            imag[ii] = imag[jj];
+            imag[jj] = swap;
+        }
+    }
+
+    for (long span = 2; span <= size; span <<= 1) {
+        long half = span / 2;
+        long step = x->stft_size / span;
+
+        for (long start = 0; start < size; start += span) {
+            for (long ii = 0; ii < half; ii++) {
+                float twiddle_real = cosines[ii * step];
+                float twiddle_imag = -sines[ii * step];
+                long top = start + ii;
+                long bottom = top + half;
+
+                float product_real = real[bottom] * twiddle_real
+                    - imag[bottom] * twiddle_imag;
+                float product_imag = real[bottom] * twiddle_imag
+                    + imag[bottom] * twiddle_real;
+
+                real[bottom] = real[top] - product_real;
+                imag[bottom] = imag[top] - product_imag;
+                real[top] += product_real;
+                imag[top] += product_imag;
+            }
+        }
+    }
+}
+
+/* Real FFT of the 'stft_size' samples in 'real'. The even and odd samples
+ * go through one complex FFT of half the size and are untangled after, which
+ * leaves bins 0 to stft_size/2 in 'real' and 'imag' */
+static void scrubber_fft(t_scrubber* x, float* real, float* imag)
+{
+    long half = x->stft_size / 2;
+    float* packed_real = x->stft_packed;
+    float* packed_imag = x->stft_packed + half;
+
+    for (long ii = 0; ii < half; ii++) {
+        packed_real[ii] = real[2 * ii];
+        packed_imag[ii] = real[2 * ii + 1];
+    }
+
+    scrubber_fft_complex(x, packed_real, packed_imag);
+
+    for (long kk = 0; kk <= half; kk++) {
+        long top = kk & (half - 1);
+        long mirror = (half - kk) & (half - 1);
+
+        // the even part is the conjugate symmetric half, the odd part the
+        // antisymmetric one turned by a quarter circle
+        float even_real = 0.5 * (packed_real[top] + packed_real[mirror]);
+        float even_imag = 0.5 * (packed_imag[top] - packed_imag[mirror]);
+        float odd_real = 0.5 * (packed_imag[top] + packed_imag[mirror]);
+        float odd_imag = -0.5 * (packed_real[top] - packed_real[mirror]);
+
+        real[kk] = even_real + x->stft_cos[kk] * odd_real
+            + x->stft_sin[kk] * odd_imag;
+        imag[kk] = even_imag + x->stft_cos[kk] * odd_imag
+            - x->stft_sin[kk] * odd_real;
+    }
+}
+
+/* Inverse of the above, scaled so that a round trip gives back the input */
+static void scrubber_ifft(t_scrubber* x, float* real, float* imag)
+{
+    long half = x->stft_size / 2;
+    float* packed_real = x->stft_packed;
+    float* packed_imag = x->stft_packed + half;
+
+    for (long kk = 0; kk < half; kk++) {
+        float even_real = 0.5 * (real[kk] + real[half - kk]);
+        float even_imag = 0.5 * (imag[kk] - imag[half - kk]);
+        float diff_real = 0.5 * (real[kk] - real[half - kk]);
+        float diff_imag = 0.5 * (imag[kk] + imag[half - kk]);
+
+        float odd_real = diff_real * x->stft_cos[kk]
+            - diff_imag * x->stft_sin[kk];
+        float odd_imag = diff_real * x->stft_sin[kk]
+            + diff_imag * x->stft_cos[kk];
+
+        packed_real[kk] = even_real - odd_imag;
+        packed_imag[kk] = even_imag + odd_real;
+    }
+
+    // swapping the parts turns the forward FFT into the inverse one
+    scrubber_fft_complex(x, packed_imag, packed_real);
+
+    float scale = 1.0 / half;
+    for (long ii = 0; ii < half; ii++) {
+        real[2 * ii] = packed_real[ii] * scale;
+        real[2 * ii + 1] = packed_imag[ii] * scale;
+    }
+}
+
+/* Analyzes the latest 'stft_size' input samples while sampling, otherwise
+ * resynthesizes every read head and overlap-adds it into the head's output
+ * ring */
+static void scrubber_stft_frame(t_scrubber* x)
+{
+    long size = x->stft_size;
+    long mask = size - 1;
+    long cursor = x->stft_cursor;
+
+    float* window = x->stft_window;
+    float* input = x->stft_input;
+    float* real = x->stft_real;
+    float* imag = x->stft_imag;
+    float* syncs = x->stft_syncs;
+    float gain = x->stft_gain;
+    float* controls = x->head_controls;
+
+    // mode: analysis
+    if (x->acquire_sample) {
+        // the ring holds its oldest sample at the cursor
+        for (long ii = 0; ii < size; ii++) {
+            real[ii] = input[(cursor + ii) & mask] * window[ii];
+        }
+
+        scrubber_fft(x, real, imag);
+        syncs[0] = scrubber_analyze(x, real, imag, size);
+
+        for (int head = 1; head < x->num_heads; head++) {
+            syncs[head] = syncs[0];
+        }
+
+        // mode: synthesis
+    } else if (x->buffer_status == SCRUBBER_FULL) {
+        for (int head = 0; head < x->num_heads; head++) {
+            float* output = x->stft_output + head * size;
+
+            syncs[head] = scrubber_synthesize(
+                x, head, controls[head * HEAD_INLETS],
+                controls[head * HEAD_INLETS + 1], real, imag, size);
+            scrubber_ifft(x, real, imag);
+
+            for (long ii = 0; ii < size; ii++) {
+                output[(cursor + ii) & mask] += real[ii] * window[ii] * gain;
+            }
+        }
 
         // mode: stand by - waiting to start sampling
     } else {
-        for (int ii = 0; ii < n; ii++) {
-            output_real[ii] = 0.0;
-            output_imag[ii] = 0.0;
-            sync[ii] = 0.0;
+        for (int head = 0; head < x->num_heads; head++) {
+            syncs[head] = 0.0;
         }
     }
+}
 
-    /* Update state variables */
-    x->recording_frame = recording_frame;
-    x->playback_frame = playback_frame;
-    x->last_position = last_position;
+/* The 'perform' routine
+ * ******************************************************/
+t_int* scrubber_perform(t_int* w)
+{
+    /* Copy the object pointer */
+    t_scrubber* x = (t_scrubber*)w[OBJECT];
+
+    /* Copy signal pointers, which follow the order of inlets and outlets */
+    t_float* input_real = x->signals[I_REAL];
+    t_float* input_imag = x->signals[I_IMAG];
+    t_float** controls = x->signals + I_SPEED;
+    t_float** outputs = controls + x->num_heads * HEAD_INLETS;
+
+    /* Copy the signal vector size */
+    t_int n = w[VECTOR_SIZE];
+
+    /* Load state variables */
+    int num_heads = x->num_heads;
+    float* head_controls = x->head_controls;
+
+    /* Perform the DSP loop */
+    float sync_val;
+
+    // mode: built-in STFT - signals in and out, one FFT size of latency
+    if (x->stft_size > 0 && x->stft_size == x->fftsize) {
+        long mask = x->stft_size - 1;
+        long cursor = x->stft_cursor;
+
+        for (int ii = 0; ii < n; ii++) {
+            short frame_due = --x->stft_countdown <= 0;
+            x->stft_input[cursor] = input_real[ii];
+
+            // take the controls before the outputs can overwrite them
+            if (frame_due) {
+                for (int jj = 0; jj < num_heads * HEAD_INLETS; jj++) {
+                    head_controls[jj] = controls[jj][ii];
+                }
+            }
+
+            for (int head = 0; head < num_heads; head++) {
+                float* output = x->stft_output + head * x->stft_size;
+
+                outputs[head * NUM_OUTLETS + O_REAL][ii] = output[cursor];
+                outputs[head * NUM_OUTLETS + O_IMAG][ii] = 0.0;
+                outputs[head * NUM_OUTLETS + O_PHASE][ii] = x->stft_syncs[head];
+                output[cursor] = 0.0;
+            }
+
+            x->stft_cursor = cursor = (cursor + 1) & mask;
+
+            if (frame_due) {
+                x->stft_countdown = x->stft_hop;
+                scrubber_stft_frame(x);
+            }
+        }
+
+        // mode: spectral - one frame per signal vector
+    } else if (x->stft_size == 0 && n == x->fftsize) {
+        // take the controls before the outputs can overwrite them
+        for (int jj = 0; jj < num_heads * HEAD_INLETS; jj++) {
+            head_controls[jj] = *controls[jj];
+        }
+
+        // mode: analysis
+        if (x->acquire_sample) {
+            sync_val = scrubber_analyze(x, input_real, input_imag, n);
+            scrubber_silence(x, outputs, sync_val, n);
+
+            // mode: synthesis
+        } else if (x->buffer_status == SCRUBBER_FULL) {
+            for (int head = 0; head < num_heads; head++) {
+                t_float* sync = outputs[head * NUM_OUTLETS + O_PHASE];
+
+                sync_val = scrubber_synthesize(
+                    x, head, head_controls[head * HEAD_INLETS],
+                    head_controls[head * HEAD_INLETS + 1],
+                    outputs[head * NUM_OUTLETS + O_REAL],
+                    outputs[head * NUM_OUTLETS + O_IMAG], n);
+
+                for (int ii = 0; ii < n; ii++) {
+                    sync[ii] = sync_val;
+                }
+            }
+
+            // mode: stand by - waiting to start sampling
+        } else {
+            scrubber_silence(x, outputs, 0.0, n);
+        }
+
+        // mode: waiting for the DSP chain to catch up with the FFT size
+    } else {
+        scrubber_silence(x, outputs, 0.0, n);
+    }
 
     /* Return the next address in the DSP chain */
     return w + NEXT;